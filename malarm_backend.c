@@ -0,0 +1,373 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "malarm_backend.h"
+#include "malarm_trace.h"
+#include "malarm_util.h"
+
+int backend_open(app_data *app)
+{
+	const char *name = g_getenv(MALARM_BACKEND_ENV);
+	char *dir;
+
+	if (name == NULL) name = "maemo";
+
+	if (strcmp(name, "maemo") == 0) {
+		app->backend = backend_maemo_new(app);
+	} else if (strcmp(name, "memory") == 0) {
+		app->backend = backend_memory_new();
+	} else if (strcmp(name, "file") == 0) {
+		dir = get_data_path(NULL);
+		app->backend = backend_file_new(dir);
+		g_free(dir);
+	} else {
+		malarm_print("error: unknown backend %s\n", name);
+		return -1;
+	}
+
+	if (app->backend == NULL) {
+		malarm_print("error: failed to open backend %s\n", name);
+		return -1;
+	}
+	malarm_debug("using %s backend\n", app->backend->name);
+	return 0;
+}
+
+void backend_close(app_data *app)
+{
+	if (app->backend == NULL) return;
+
+	app->backend->destroy(app->backend);
+	app->backend = NULL;
+}
+
+// true if key is directly in dir, for key_foreach
+int backend_key_in_dir(const char *key, const char *dir)
+{
+	gsize len = strlen(dir);
+
+	return (strncmp(key, dir, len) == 0) && (key[len] == '/') &&
+		(strchr(key + len + 1, '/') == NULL);
+}
+
+// true if key is in dir or below, for key_unset_dir
+int backend_key_under_dir(const char *key, const char *dir)
+{
+	gsize len = strlen(dir);
+
+	return (strncmp(key, dir, len) == 0) && (key[len] == '/');
+}
+
+cookie_t *backend_event_query(app_data *app, time_t first, time_t last, 
+		int32_t flag_mask, int32_t flags)
+{
+	gint64 start = trace_begin();
+	cookie_t *cookies;
+	int n = 0;
+
+	cookies = app->backend->event_query(app->backend, first, last, flag_mask, flags);
+	if (start) {
+		while (cookies && cookies[n]) n++;
+		trace_end(TRACE_ALARM_QUERY, -1, start, first, n, NULL);
+	}
+	return cookies;
+}
+
+alarm_event_t *backend_event_get(app_data *app, cookie_t cookie)
+{
+	gint64 start = trace_begin();
+	alarm_event_t *event;
+
+	event = app->backend->event_get(app->backend, cookie);
+	if (start) {
+		trace_end(TRACE_ALARM_GET, -1, start, cookie, event != NULL, 
+				event ? event->dbus_name : NULL);
+	}
+	return event;
+}
+
+void backend_event_free(app_data *app, alarm_event_t *event)
+{
+	if (event) app->backend->event_free(app->backend, event);
+}
+
+cookie_t backend_event_add(app_data *app, alarm_event_t *event)
+{
+	gint64 start = trace_begin();
+	cookie_t cookie;
+
+	cookie = app->backend->event_add(app->backend, event);
+	if (start) {
+		trace_end(TRACE_ALARM_ADD, -1, start, event->alarm_time, cookie, 
+				event->dbus_name);
+	}
+	return cookie;
+}
+
+int backend_event_del(app_data *app, cookie_t cookie)
+{
+	gint64 start = trace_begin();
+	int ret;
+
+	ret = app->backend->event_del(app->backend, cookie);
+	if (start) trace_end(TRACE_ALARM_DEL, -1, start, cookie, ret == 0, NULL);
+	return ret;
+}
+
+// the last queued change of key, NULL if none
+static backend_key_change *find_key_change(app_data *app, const char *key)
+{
+	GArray *changes = app->backend->key_changes;
+	backend_key_change *change;
+	int i;
+
+	for (i = changes ? changes->len - 1 : -1; i >= 0; i--) {
+		change = &g_array_index(changes, backend_key_change, i);
+		if (strcmp(change->key, key) == 0) {
+			return change;
+		}
+	}
+	return NULL;
+}
+
+static void queue_key_change(app_data *app, const char *key, gint val, int unset)
+{
+	backend_key_change change = { g_strdup(key), val, unset };
+
+	g_array_append_val(app->backend->key_changes, change);
+}
+
+gint backend_key_get(app_data *app, const char *key)
+{
+	backend_key_change *change;
+	gint64 start;
+	gint val;
+
+	if ((change = find_key_change(app, key)) != NULL) {
+		return change->unset ? 0 : change->val;
+	}
+
+	start = trace_begin();
+	val = app->backend->key_get(app->backend, key);
+	if (start) trace_end(TRACE_GCONF_GET_INT, -1, start, 0, val, key);
+	return val;
+}
+
+int backend_key_set(app_data *app, const char *key, gint val)
+{
+	gint64 start;
+	int ret;
+
+	if (app->backend->key_changes) {
+		queue_key_change(app, key, val, FALSE);
+		return 0;
+	}
+
+	start = trace_begin();
+	ret = app->backend->key_set(app->backend, key, val);
+	if (start) trace_end(TRACE_GCONF_SET_INT, -1, start, val, ret == 0, key);
+	return ret;
+}
+
+int backend_key_unset(app_data *app, const char *key)
+{
+	gint64 start;
+	int ret;
+
+	if (app->backend->key_changes) {
+		queue_key_change(app, key, 0, TRUE);
+		return 0;
+	}
+
+	start = trace_begin();
+	ret = app->backend->key_unset(app->backend, key);
+	if (start) trace_end(TRACE_GCONF_UNSET, -1, start, 0, ret == 0, key);
+	return ret;
+}
+
+typedef struct {
+	backend_key_func func;
+	gpointer data;
+	int n;
+} key_count;
+
+static void count_key(const char *key, gint val, gpointer data)
+{
+	key_count *count = (key_count*)data;
+
+	count->n++;
+	count->func(key, val, count->data);
+}
+
+void backend_key_foreach(app_data *app, const char *dir, backend_key_func func, 
+		gpointer data)
+{
+	gint64 start = trace_begin();
+	key_count count = { func, data, 0 };
+
+	app->backend->key_foreach(app->backend, dir, count_key, &count);
+	if (start) trace_end(TRACE_GCONF_ALL_ENTRIES, -1, start, 0, count.n, dir);
+}
+
+int backend_key_unset_dir(app_data *app, const char *dir)
+{
+	gint64 start = trace_begin();
+	int ret;
+
+	ret = app->backend->key_unset_dir(app->backend, dir);
+	if (start) trace_end(TRACE_GCONF_RECURSIVE_UNSET, -1, start, 0, ret == 0, dir);
+	return ret;
+}
+
+int backend_sound_play(app_data *app, const char *path)
+{
+	gint64 start = trace_begin();
+	int ret;
+
+	ret = app->backend->sound_play(app->backend, path);
+	trace_end(TRACE_SOUND_PLAY, TRACE_PHASE_SOUND, start, 0, ret, path);
+	return ret;
+}
+
+int backend_sound_stop(app_data *app)
+{
+	gint64 start = trace_begin();
+	int ret;
+
+	ret = app->backend->sound_stop(app->backend);
+	trace_end(TRACE_SOUND_STOP, TRACE_PHASE_SOUND, start, 0, ret, NULL);
+	return ret;
+}
+
+// true if fetching many events at once is cheaper than one at a time
+int backend_has_event_get_batch(app_data *app)
+{
+	return app->backend->event_get_batch != NULL;
+}
+
+void backend_event_get_batch(app_data *app, const cookie_t *cookies, int n, 
+		alarm_event_t **events)
+{
+	gint64 start;
+	int i;
+
+	if (app->backend->event_get_batch == NULL) {
+		for (i=0; i<n; i++) {
+			events[i] = backend_event_get(app, cookies[i]);
+		}
+		return;
+	}
+
+	start = trace_begin();
+	app->backend->event_get_batch(app->backend, cookies, n, events);
+	if (start) trace_end(TRACE_ALARM_GET_BATCH, -1, start, n, 0, NULL);
+}
+
+// cookies[i] is 0 if events[i] was not added
+void backend_event_add_batch(app_data *app, alarm_event_t **events, int n, 
+		cookie_t *cookies)
+{
+	gint64 start;
+	int i;
+
+	if (app->backend->event_add_batch == NULL) {
+		for (i=0; i<n; i++) {
+			cookies[i] = backend_event_add(app, events[i]);
+		}
+		return;
+	}
+
+	start = trace_begin();
+	app->backend->event_add_batch(app->backend, events, n, cookies);
+	if (start) trace_end(TRACE_ALARM_ADD_BATCH, -1, start, n, 0, NULL);
+}
+
+// sets all keys, on failure the keys set so far are unset
+int backend_key_set_batch(app_data *app, const char **keys, const gint *vals, 
+		int n)
+{
+	gint64 start;
+	int ret = 0;
+	int i;
+
+	if (app->backend->key_set_batch == NULL) {
+		for (i=0; (i<n) && (ret == 0); i++) {
+			ret = backend_key_set(app, keys[i], vals[i]);
+		}
+		// unset the keys that were set
+		while ((ret != 0) && (--i > 0)) {
+			backend_key_unset(app, keys[i-1]);
+		}
+		return ret;
+	}
+
+	start = trace_begin();
+	ret = app->backend->key_set_batch(app->backend, keys, vals, n);
+	if (start) trace_end(TRACE_KEY_SET_BATCH, -1, start, n, ret == 0, NULL);
+	return ret;
+}
+
+// worker thread: queue key sets and unsets until backend_key_commit()
+void backend_key_begin(app_data *app)
+{
+	g_assert(app->backend->key_changes == NULL);
+	app->backend->key_changes = g_array_new(FALSE, FALSE, 
+			sizeof(backend_key_change));
+}
+
+// make the queued changes, in order
+int backend_key_commit(app_data *app)
+{
+	GArray *changes = app->backend->key_changes;
+	backend_key_change *change;
+	gint64 start;
+	int ret = 0;
+	int i;
+
+	g_assert(changes != NULL);
+	app->backend->key_changes = NULL;
+
+	if (changes->len == 0) {
+		// nothing to commit
+	} else if (app->backend->key_commit == NULL) {
+		for (i=0; i<changes->len; i++) {
+			change = &g_array_index(changes, backend_key_change, i);
+			if ((change->unset ? backend_key_unset(app, change->key) : 
+						backend_key_set(app, change->key, change->val)) != 0) {
+				ret = -1;
+			}
+		}
+	} else {
+		start = trace_begin();
+		ret = app->backend->key_commit(app->backend, 
+				(backend_key_change*)changes->data, changes->len);
+		if (start) trace_end(TRACE_KEY_COMMIT, -1, start, changes->len, ret == 0, NULL);
+	}
+
+	if (ret != 0) {
+		malarm_print("error: failed to commit %u key changes\n", changes->len);
+	}
+
+	for (i=0; i<changes->len; i++) {
+		g_free(g_array_index(changes, backend_key_change, i).key);
+	}
+	g_array_free(changes, TRUE);
+	return ret;
+}
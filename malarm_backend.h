@@ -0,0 +1,132 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_BACKEND_H_
+#define _MALARM_BACKEND_H_
+
+#include "malarm_main.h"
+
+/* All alarm event, key-value and sound calls go through a backend:
+ * - maemo: alarmd, gconf and osso-multimedia (the default)
+ * - memory: in-process tables, for tests and benchmarks
+ * - file: mmap-ed files in ~/.malarm, for a desktop Linux build
+ * MALARM_BACKEND_ENV selects the backend by name at startup.
+ *
+ * Event and key calls are made by the worker thread, and event_get also
+ * by the fetch threads. Sound calls are made by the main loop.
+ * Events from event_get are freed with backend_event_free(), cookie
+ * arrays from event_query with free(). Keys are full gconf-style paths.
+ * int results are 0 on success, -1 on failure.
+ *
+ * The batch entries may be NULL, the backend_*_batch() fcns then make
+ * one call per item.
+ *
+ * Between backend_key_begin() and backend_key_commit(), key sets and
+ * unsets are queued (and seen by key gets), then made in one key_commit
+ * call: one gconf change set for a whole row operation.
+ */
+#define MALARM_BACKEND_ENV  "MALARM_BACKEND"
+
+typedef void (*backend_key_func)(const char *key, gint val, gpointer data);
+// returns TRUE to snooze the event
+typedef gboolean (*backend_fire_func)(cookie_t cookie, const alarm_event_t *event, 
+		gpointer data);
+
+typedef struct {
+	char *key;
+	gint val;
+	int unset;
+} backend_key_change;
+
+struct _backend {
+	const char *name;
+	gpointer priv;
+
+	cookie_t *(*event_query)(backend *be, time_t first, time_t last, 
+			int32_t flag_mask, int32_t flags);
+	alarm_event_t *(*event_get)(backend *be, cookie_t cookie);
+	void (*event_free)(backend *be, alarm_event_t *event);
+	cookie_t (*event_add)(backend *be, alarm_event_t *event);  // 0 on failure
+	int (*event_del)(backend *be, cookie_t cookie);
+
+	gint (*key_get)(backend *be, const char *key);  // 0 if not set
+	int (*key_set)(backend *be, const char *key, gint val);
+	int (*key_unset)(backend *be, const char *key);
+	void (*key_foreach)(backend *be, const char *dir, backend_key_func func, 
+			gpointer data);
+	int (*key_unset_dir)(backend *be, const char *dir);
+
+	int (*sound_play)(backend *be, const char *path);
+	int (*sound_stop)(backend *be);
+
+	// batch entries, may be NULL
+	void (*event_get_batch)(backend *be, const cookie_t *cookies, int n, 
+			alarm_event_t **events);
+	void (*event_add_batch)(backend *be, alarm_event_t **events, int n, 
+			cookie_t *cookies);
+	int (*key_set_batch)(backend *be, const char **keys, const gint *vals, int n);
+	int (*key_commit)(backend *be, const backend_key_change *changes, int n);
+
+	void (*destroy)(backend *be);
+
+	GArray *key_changes;  // queued backend_key_change, NULL if none
+};
+
+backend *backend_maemo_new(app_data *app);
+backend *backend_memory_new(void);
+time_t backend_memory_next_due(backend *be);
+int backend_memory_fire(backend *be, time_t now, backend_fire_func func, 
+		gpointer data);
+backend *backend_file_new(const char *dir);
+
+int backend_open(app_data *app);
+void backend_close(app_data *app);
+
+// for backends
+int backend_key_in_dir(const char *key, const char *dir);
+int backend_key_under_dir(const char *key, const char *dir);
+
+// traced calls to app->backend
+cookie_t *backend_event_query(app_data *app, time_t first, time_t last, 
+		int32_t flag_mask, int32_t flags);
+alarm_event_t *backend_event_get(app_data *app, cookie_t cookie);
+void backend_event_free(app_data *app, alarm_event_t *event);
+cookie_t backend_event_add(app_data *app, alarm_event_t *event);
+int backend_event_del(app_data *app, cookie_t cookie);
+
+gint backend_key_get(app_data *app, const char *key);
+int backend_key_set(app_data *app, const char *key, gint val);
+int backend_key_unset(app_data *app, const char *key);
+void backend_key_foreach(app_data *app, const char *dir, backend_key_func func, 
+		gpointer data);
+int backend_key_unset_dir(app_data *app, const char *dir);
+
+int backend_sound_play(app_data *app, const char *path);
+int backend_sound_stop(app_data *app);
+
+int backend_has_event_get_batch(app_data *app);
+void backend_event_get_batch(app_data *app, const cookie_t *cookies, int n, 
+		alarm_event_t **events);
+void backend_event_add_batch(app_data *app, alarm_event_t **events, int n, 
+		cookie_t *cookies);
+int backend_key_set_batch(app_data *app, const char **keys, const gint *vals, 
+		int n);
+void backend_key_begin(app_data *app);
+int backend_key_commit(app_data *app);
+
+#endif /* #define _MALARM_BACKEND_H_ */
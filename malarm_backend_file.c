@@ -0,0 +1,675 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "malarm_backend.h"
+#include "malarm_util.h"
+
+/* Events and keys are kept in two files of fixed-size slots, mapped into
+ * memory. A single call syncs the pages it changed, a batch call syncs
+ * once at the end. An index from cookie (or key) to slot is built when
+ * the files are opened. Files grow by doubling the number of slots.
+ * No alarm ever fires, this backend is for running malarm on a desktop.
+ */
+
+#define FILE_MAGIC    0x424c414d  /* "MALB" */
+#define FILE_VERSION  1
+#define FILE_HEADER_SIZE  32
+#define FILE_INITIAL_SLOTS  64
+
+#define EVENT_SLOT_SIZE  512
+#define EVENT_N_STRINGS  9
+#define EVENT_STRINGS_SIZE  (EVENT_SLOT_SIZE - 40)
+
+#define KEY_SLOT_SIZE  128
+#define KEY_MAX_LEN  (KEY_SLOT_SIZE - 8 - 1)
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 slot_size;
+	guint32 nslots;
+	gint32 next_cookie;  // events file only
+} file_header;
+
+typedef struct {
+	gint32 cookie;       // 0 if slot is free
+	gint32 flags;
+	gint64 alarm_time;
+	guint32 recurrence;
+	gint32 recurrence_count;
+	guint32 snooze;
+	guint32 snoozed;
+	guint16 strings_len;
+	guint16 strings_mask;  // bit i is set if string i is not NULL
+	guchar pad[4];
+	gchar strings[EVENT_STRINGS_SIZE];  // NUL terminated, in event order
+} file_event;
+
+typedef struct {
+	gint32 used;
+	gint32 val;
+	gchar key[KEY_MAX_LEN + 1];
+} file_key;
+
+typedef struct {
+	char *path;
+	int fd;
+	guchar *map;
+	gsize size;
+	guint slot_size;
+	GArray *free_slots;
+} slot_file;
+
+typedef struct {
+	slot_file events;
+	slot_file keys;
+	GHashTable *event_index;  // cookie -> slot + 1
+	GHashTable *key_index;    // key -> slot + 1
+	int batch;                // sync is done at the end of the batch
+} file_data;
+
+#define FILE_DATA(be)  ((file_data*)(be)->priv)
+#define FILE_HEADER(f)  ((file_header*)(f)->map)
+#define FILE_SLOT(f, i)  ((f)->map + FILE_HEADER_SIZE + (gsize)(i)*(f)->slot_size)
+
+static int file_map(slot_file *f, gsize size)
+{
+	f->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+	if (f->map == MAP_FAILED) {
+		malarm_print("error: failed to map %s: %s\n", f->path, g_strerror(errno));
+		f->map = NULL;
+		return -1;
+	}
+	f->size = size;
+	return 0;
+}
+
+static int file_open(slot_file *f, const char *path, guint slot_size)
+{
+	struct stat st;
+	file_header *header;
+	gsize size;
+
+	f->path = g_strdup(path);
+	f->slot_size = slot_size;
+	f->free_slots = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	f->fd = g_open(path, O_RDWR | O_CREAT, 0600);
+	if ((f->fd < 0) || (fstat(f->fd, &st) != 0)) {
+		malarm_print("error: failed to open %s: %s\n", path, g_strerror(errno));
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		size = FILE_HEADER_SIZE + FILE_INITIAL_SLOTS*slot_size;
+		if ((ftruncate(f->fd, size) != 0) || (file_map(f, size) != 0)) {
+			return -1;
+		}
+		header = FILE_HEADER(f);
+		header->magic = FILE_MAGIC;
+		header->version = FILE_VERSION;
+		header->slot_size = slot_size;
+		header->nslots = FILE_INITIAL_SLOTS;
+		return 0;
+	}
+
+	if ((st.st_size < FILE_HEADER_SIZE) || (file_map(f, st.st_size) != 0)) {
+		malarm_print("error: %s is truncated\n", path);
+		return -1;
+	}
+	header = FILE_HEADER(f);
+	if ((header->magic != FILE_MAGIC) || (header->version != FILE_VERSION) ||
+			(header->slot_size != slot_size) ||
+			(FILE_HEADER_SIZE + (gsize)header->nslots*slot_size > f->size)) {
+		malarm_print("error: %s is not a malarm backend file\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void file_close(slot_file *f)
+{
+	if (f->map) {
+		msync(f->map, f->size, MS_SYNC);
+		munmap(f->map, f->size);
+	}
+	if (f->fd >= 0) close(f->fd);
+	if (f->free_slots) g_array_free(f->free_slots, TRUE);
+	g_free(f->path);
+}
+
+// write changed pages of the slot to the file
+static void file_sync_slot(file_data *fd, slot_file *f, guint slot)
+{
+	gsize page = sysconf(_SC_PAGESIZE);
+	gsize start = (FILE_SLOT(f, slot) - f->map) & ~(page - 1);
+	gsize end = FILE_SLOT(f, slot) - f->map + f->slot_size;
+
+	if (fd->batch) return;
+
+	// the header may have changed too
+	msync(f->map, page, MS_SYNC);
+	msync(f->map + start, end - start, MS_SYNC);
+}
+
+// returns a free slot, growing the file if there is none
+static int file_alloc_slot(slot_file *f, guint *slot)
+{
+	file_header *header = FILE_HEADER(f);
+	guint nslots = header->nslots;
+	gsize size = FILE_HEADER_SIZE + (gsize)nslots*2*f->slot_size;
+	guint i;
+
+	if (f->free_slots->len == 0) {
+		msync(f->map, f->size, MS_SYNC);
+		munmap(f->map, f->size);
+		f->map = NULL;
+		if ((ftruncate(f->fd, size) != 0) || (file_map(f, size) != 0)) {
+			malarm_print("error: failed to grow %s: %s\n", f->path, 
+					g_strerror(errno));
+			// map again at the old size
+			if (f->map == NULL) file_map(f, f->size);
+			return -1;
+		}
+		FILE_HEADER(f)->nslots = nslots*2;
+		for (i = nslots*2; i > nslots; i--) {
+			guint free_slot = i - 1;
+			g_array_append_val(f->free_slots, free_slot);
+		}
+	}
+
+	*slot = g_array_index(f->free_slots, guint, f->free_slots->len - 1);
+	g_array_set_size(f->free_slots, f->free_slots->len - 1);
+	return 0;
+}
+
+static void file_free_slot(slot_file *f, guint slot)
+{
+	memset(FILE_SLOT(f, slot), 0, f->slot_size);
+	g_array_append_val(f->free_slots, slot);
+}
+
+static const char **event_strings(const alarm_event_t *event, const char **s)
+{
+	s[0] = event->title;
+	s[1] = event->message;
+	s[2] = event->sound;
+	s[3] = event->icon;
+	s[4] = event->dbus_interface;
+	s[5] = event->dbus_service;
+	s[6] = event->dbus_path;
+	s[7] = event->dbus_name;
+	s[8] = event->exec_name;
+	return s;
+}
+
+static int pack_event(file_event *slot, const alarm_event_t *event)
+{
+	const char *s[EVENT_N_STRINGS];
+	gsize len = 0, n;
+	int i;
+
+	slot->strings_mask = 0;
+	event_strings(event, s);
+	for (i=0; i<EVENT_N_STRINGS; i++) {
+		if (s[i] == NULL) continue;
+		n = strlen(s[i]) + 1;
+		if (len + n > EVENT_STRINGS_SIZE) {
+			malarm_print("error: alarm event is too large\n");
+			return -1;
+		}
+		memcpy(slot->strings + len, s[i], n);
+		len += n;
+		slot->strings_mask |= 1 << i;
+	}
+	slot->strings_len = len;
+
+	slot->flags = event->flags;
+	slot->alarm_time = event->alarm_time;
+	slot->recurrence = event->recurrence;
+	slot->recurrence_count = event->recurrence_count;
+	slot->snooze = event->snooze;
+	slot->snoozed = event->snoozed;
+	return 0;
+}
+
+static alarm_event_t *unpack_event(const file_event *slot)
+{
+	alarm_event_t *event;
+	char *s[EVENT_N_STRINGS];
+	const gchar *p = slot->strings;
+	int i;
+
+	for (i=0; i<EVENT_N_STRINGS; i++) {
+		s[i] = NULL;
+		if (slot->strings_mask & (1 << i)) {
+			s[i] = g_strdup(p);
+			p += strlen(p) + 1;
+		}
+	}
+
+	event = g_new0(alarm_event_t, 1);
+	event->alarm_time = slot->alarm_time;
+	event->recurrence = slot->recurrence;
+	event->recurrence_count = slot->recurrence_count;
+	event->snooze = slot->snooze;
+	event->snoozed = slot->snoozed;
+	event->flags = slot->flags;
+	event->title = s[0];
+	event->message = s[1];
+	event->sound = s[2];
+	event->icon = s[3];
+	event->dbus_interface = s[4];
+	event->dbus_service = s[5];
+	event->dbus_path = s[6];
+	event->dbus_name = s[7];
+	event->exec_name = s[8];
+	return event;
+}
+
+static int event_slot(file_data *fd, cookie_t cookie, guint *slot)
+{
+	guint i = GPOINTER_TO_UINT(g_hash_table_lookup(fd->event_index, 
+				GINT_TO_POINTER(cookie)));
+	if (i == 0) return -1;
+	*slot = i - 1;
+	return 0;
+}
+
+typedef struct {
+	file_data *fd;
+	time_t first, last;
+	int32_t flag_mask, flags;
+	GArray *cookies;
+} file_query;
+
+static void query_event(gpointer key, gpointer value, gpointer data)
+{
+	file_query *query = (file_query*)data;
+	file_event *slot = (file_event*)FILE_SLOT(&query->fd->events, 
+			GPOINTER_TO_UINT(value) - 1);
+	cookie_t cookie = GPOINTER_TO_INT(key);
+
+	if ((slot->alarm_time >= query->first) && (slot->alarm_time <= query->last) &&
+			((slot->flags & query->flag_mask) == query->flags)) {
+		g_array_append_val(query->cookies, cookie);
+	}
+}
+
+static gint compare_cookies(gconstpointer a, gconstpointer b)
+{
+	cookie_t ca = *(const cookie_t*)a;
+	cookie_t cb = *(const cookie_t*)b;
+
+	return (ca < cb) ? -1 : (ca > cb);
+}
+
+static cookie_t *file_event_query(backend *be, time_t first, time_t last, 
+		int32_t flag_mask, int32_t flags)
+{
+	file_query query = { FILE_DATA(be), first, last, flag_mask, flags, NULL };
+	cookie_t *cookies;
+
+	query.cookies = g_array_new(FALSE, FALSE, sizeof(cookie_t));
+	g_hash_table_foreach(FILE_DATA(be)->event_index, query_event, &query);
+	g_array_sort(query.cookies, compare_cookies);
+
+	// 0 terminated, freed with free() like alarm_event_query()
+	cookies = malloc((query.cookies->len + 1)*sizeof(cookie_t));
+	memcpy(cookies, query.cookies->data, query.cookies->len*sizeof(cookie_t));
+	cookies[query.cookies->len] = 0;
+	g_array_free(query.cookies, TRUE);
+	return cookies;
+}
+
+static alarm_event_t *file_event_get(backend *be, cookie_t cookie)
+{
+	file_data *fd = FILE_DATA(be);
+	guint slot;
+
+	if (event_slot(fd, cookie, &slot) != 0) return NULL;
+	return unpack_event((file_event*)FILE_SLOT(&fd->events, slot));
+}
+
+static void file_event_free(backend *be, alarm_event_t *event)
+{
+	free_alarm_event_copy(event);
+}
+
+static cookie_t file_event_add(backend *be, alarm_event_t *event)
+{
+	file_data *fd = FILE_DATA(be);
+	file_event *slot;
+	cookie_t cookie;
+	guint i;
+
+	if (file_alloc_slot(&fd->events, &i) != 0) return 0;
+
+	slot = (file_event*)FILE_SLOT(&fd->events, i);
+	if (pack_event(slot, event) != 0) {
+		file_free_slot(&fd->events, i);
+		return 0;
+	}
+	cookie = ++FILE_HEADER(&fd->events)->next_cookie;
+	slot->cookie = cookie;
+
+	g_hash_table_insert(fd->event_index, GINT_TO_POINTER(cookie), 
+			GUINT_TO_POINTER(i + 1));
+	file_sync_slot(fd, &fd->events, i);
+	return cookie;
+}
+
+static int file_event_del(backend *be, cookie_t cookie)
+{
+	file_data *fd = FILE_DATA(be);
+	guint slot;
+
+	if (event_slot(fd, cookie, &slot) != 0) return -1;
+
+	g_hash_table_remove(fd->event_index, GINT_TO_POINTER(cookie));
+	file_free_slot(&fd->events, slot);
+	file_sync_slot(fd, &fd->events, slot);
+	return 0;
+}
+
+// events are read straight from the mapping, no request per event
+static void file_event_get_batch(backend *be, const cookie_t *cookies, int n, 
+		alarm_event_t **events)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		events[i] = file_event_get(be, cookies[i]);
+	}
+}
+
+static void file_event_add_batch(backend *be, alarm_event_t **events, int n, 
+		cookie_t *cookies)
+{
+	file_data *fd = FILE_DATA(be);
+	int i;
+
+	fd->batch = 1;
+	for (i=0; i<n; i++) {
+		cookies[i] = file_event_add(be, events[i]);
+	}
+	fd->batch = 0;
+	msync(fd->events.map, fd->events.size, MS_SYNC);
+}
+
+static gint file_key_get(backend *be, const char *key)
+{
+	file_data *fd = FILE_DATA(be);
+	guint i = GPOINTER_TO_UINT(g_hash_table_lookup(fd->key_index, key));
+
+	if (i == 0) return 0;
+	return ((file_key*)FILE_SLOT(&fd->keys, i - 1))->val;
+}
+
+static int file_key_set(backend *be, const char *key, gint val)
+{
+	file_data *fd = FILE_DATA(be);
+	guint i = GPOINTER_TO_UINT(g_hash_table_lookup(fd->key_index, key));
+	file_key *slot;
+
+	if (strlen(key) > KEY_MAX_LEN) {
+		malarm_print("error: key %s is too long\n", key);
+		return -1;
+	}
+
+	if (i == 0) {
+		if (file_alloc_slot(&fd->keys, &i) != 0) return -1;
+		slot = (file_key*)FILE_SLOT(&fd->keys, i);
+		strcpy(slot->key, key);
+		slot->used = 1;
+		g_hash_table_insert(fd->key_index, g_strdup(key), GUINT_TO_POINTER(i + 1));
+	} else {
+		i--;
+		slot = (file_key*)FILE_SLOT(&fd->keys, i);
+	}
+	slot->val = val;
+
+	file_sync_slot(fd, &fd->keys, i);
+	return 0;
+}
+
+static int file_key_unset(backend *be, const char *key)
+{
+	file_data *fd = FILE_DATA(be);
+	guint i = GPOINTER_TO_UINT(g_hash_table_lookup(fd->key_index, key));
+
+	if (i == 0) return 0;
+
+	g_hash_table_remove(fd->key_index, key);
+	file_free_slot(&fd->keys, i - 1);
+	file_sync_slot(fd, &fd->keys, i - 1);
+	return 0;
+}
+
+typedef struct {
+	file_data *fd;
+	const char *dir;
+	backend_key_func func;
+	gpointer data;
+	GSList *keys;
+} file_dir;
+
+static void foreach_dir_key(gpointer key, gpointer value, gpointer data)
+{
+	file_dir *dir = (file_dir*)data;
+	file_key *slot = (file_key*)FILE_SLOT(&dir->fd->keys, 
+			GPOINTER_TO_UINT(value) - 1);
+
+	if (backend_key_in_dir(key, dir->dir)) {
+		dir->func(key, slot->val, dir->data);
+	}
+}
+
+static void file_key_foreach(backend *be, const char *dir, backend_key_func func, 
+		gpointer data)
+{
+	file_dir d = { FILE_DATA(be), dir, func, data, NULL };
+
+	g_hash_table_foreach(FILE_DATA(be)->key_index, foreach_dir_key, &d);
+}
+
+static void collect_dir_key(gpointer key, gpointer value, gpointer data)
+{
+	file_dir *dir = (file_dir*)data;
+
+	if (backend_key_under_dir(key, dir->dir)) {
+		dir->keys = g_slist_prepend(dir->keys, g_strdup(key));
+	}
+}
+
+static int file_key_unset_dir(backend *be, const char *dir)
+{
+	file_data *fd = FILE_DATA(be);
+	file_dir d = { fd, dir, NULL, NULL, NULL };
+	GSList *l;
+
+	g_hash_table_foreach(fd->key_index, collect_dir_key, &d);
+
+	fd->batch = 1;
+	for (l = d.keys; l; l = l->next) {
+		file_key_unset(be, l->data);
+		g_free(l->data);
+	}
+	fd->batch = 0;
+	g_slist_free(d.keys);
+
+	msync(fd->keys.map, fd->keys.size, MS_SYNC);
+	return 0;
+}
+
+static int file_key_set_batch(backend *be, const char **keys, const gint *vals, 
+		int n)
+{
+	file_data *fd = FILE_DATA(be);
+	int ret = 0;
+	int i;
+
+	fd->batch = 1;
+	for (i=0; (i<n) && (ret == 0); i++) {
+		ret = file_key_set(be, keys[i], vals[i]);
+	}
+	while ((ret != 0) && (--i > 0)) {
+		file_key_unset(be, keys[i-1]);
+	}
+	fd->batch = 0;
+
+	msync(fd->keys.map, fd->keys.size, MS_SYNC);
+	return ret;
+}
+
+static int file_key_commit(backend *be, const backend_key_change *changes, 
+		int n)
+{
+	file_data *fd = FILE_DATA(be);
+	int ret = 0;
+	int i;
+
+	fd->batch = 1;
+	for (i=0; i<n; i++) {
+		if ((changes[i].unset ? file_key_unset(be, changes[i].key) : 
+					file_key_set(be, changes[i].key, changes[i].val)) != 0) {
+			ret = -1;
+		}
+	}
+	fd->batch = 0;
+
+	msync(fd->keys.map, fd->keys.size, MS_SYNC);
+	return ret;
+}
+
+static int file_sound_play(backend *be, const char *path)
+{
+	// no sound service on a desktop
+	malarm_print("sound: %s\n", path);
+	return 0;
+}
+
+static int file_sound_stop(backend *be)
+{
+	return 0;
+}
+
+static void file_destroy(backend *be)
+{
+	file_data *fd = FILE_DATA(be);
+
+	file_close(&fd->events);
+	file_close(&fd->keys);
+	if (fd->event_index) g_hash_table_destroy(fd->event_index);
+	if (fd->key_index) g_hash_table_destroy(fd->key_index);
+	g_free(fd);
+	g_free(be);
+}
+
+// build the indexes and free slot lists
+static void file_scan(file_data *fd)
+{
+	guint n, i;
+
+	n = FILE_HEADER(&fd->events)->nslots;
+	for (i = n; i > 0; i--) {
+		file_event *slot = (file_event*)FILE_SLOT(&fd->events, i - 1);
+		guint free_slot = i - 1;
+
+		if (slot->cookie) {
+			g_hash_table_insert(fd->event_index, GINT_TO_POINTER(slot->cookie), 
+					GUINT_TO_POINTER(i));
+		} else {
+			g_array_append_val(fd->events.free_slots, free_slot);
+		}
+	}
+
+	n = FILE_HEADER(&fd->keys)->nslots;
+	for (i = n; i > 0; i--) {
+		file_key *slot = (file_key*)FILE_SLOT(&fd->keys, i - 1);
+		guint free_slot = i - 1;
+
+		if (slot->used) {
+			slot->key[KEY_MAX_LEN] = '\0';
+			g_hash_table_insert(fd->key_index, g_strdup(slot->key), 
+					GUINT_TO_POINTER(i));
+		} else {
+			g_array_append_val(fd->keys.free_slots, free_slot);
+		}
+	}
+}
+
+backend *backend_file_new(const char *dir)
+{
+	backend *be;
+	file_data *fd;
+	char *path;
+	int ret;
+
+	g_mkdir(dir, 0700);
+
+	be = g_new0(backend, 1);
+	fd = g_new0(file_data, 1);
+	be->priv = fd;
+	be->destroy = file_destroy;
+	fd->events.fd = fd->keys.fd = -1;
+
+	path = g_build_filename(dir, "backend_events", NULL);
+	ret = file_open(&fd->events, path, EVENT_SLOT_SIZE);
+	g_free(path);
+	if (ret == 0) {
+		path = g_build_filename(dir, "backend_keys", NULL);
+		ret = file_open(&fd->keys, path, KEY_SLOT_SIZE);
+		g_free(path);
+	}
+	if (ret != 0) {
+		file_destroy(be);
+		return NULL;
+	}
+
+	fd->event_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	fd->key_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	file_scan(fd);
+
+	be->name = "file";
+	be->event_query = file_event_query;
+	be->event_get = file_event_get;
+	be->event_free = file_event_free;
+	be->event_add = file_event_add;
+	be->event_del = file_event_del;
+	be->key_get = file_key_get;
+	be->key_set = file_key_set;
+	be->key_unset = file_key_unset;
+	be->key_foreach = file_key_foreach;
+	be->key_unset_dir = file_key_unset_dir;
+	be->sound_play = file_sound_play;
+	be->sound_stop = file_sound_stop;
+	be->event_get_batch = file_event_get_batch;
+	be->event_add_batch = file_event_add_batch;
+	be->key_set_batch = file_key_set_batch;
+	be->key_commit = file_key_commit;
+	return be;
+}
@@ -0,0 +1,243 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <osso-multimedia-interface.h>
+
+#include "malarm_backend.h"
+
+// alarmd, gconf and osso-multimedia-service
+typedef struct {
+	osso_context_t *ctx;
+	GConfClient *gconf;
+} maemo_data;
+
+#define MAEMO_DATA(be)  ((maemo_data*)(be)->priv)
+
+static cookie_t *maemo_event_query(backend *be, time_t first, time_t last, 
+		int32_t flag_mask, int32_t flags)
+{
+	return alarm_event_query(first, last, flag_mask, flags);
+}
+
+static alarm_event_t *maemo_event_get(backend *be, cookie_t cookie)
+{
+	return alarm_event_get(cookie);
+}
+
+static void maemo_event_free(backend *be, alarm_event_t *event)
+{
+	alarm_event_free(event);
+}
+
+static cookie_t maemo_event_add(backend *be, alarm_event_t *event)
+{
+	cookie_t cookie;
+
+	cookie = alarm_event_add(event);
+	if (cookie <= 0) {
+		malarm_print("error setting alarm event, error code: '%d'\n", 
+				alarmd_get_error());
+		return 0;
+	}
+	return cookie;
+}
+
+static int maemo_event_del(backend *be, cookie_t cookie)
+{
+	// alarm_event_del() returns 1 on success
+	return alarm_event_del(cookie) ? 0 : -1;
+}
+
+static gint maemo_key_get(backend *be, const char *key)
+{
+	return gconf_client_get_int(MAEMO_DATA(be)->gconf, key, NULL);
+}
+
+static int maemo_key_set(backend *be, const char *key, gint val)
+{
+	return gconf_client_set_int(MAEMO_DATA(be)->gconf, key, val, NULL) ? 0 : -1;
+}
+
+static int maemo_key_unset(backend *be, const char *key)
+{
+	return gconf_client_unset(MAEMO_DATA(be)->gconf, key, NULL) ? 0 : -1;
+}
+
+static void maemo_key_foreach(backend *be, const char *dir, backend_key_func func, 
+		gpointer data)
+{
+	GSList *entries, *l;
+	GError *error = NULL;
+
+	entries = gconf_client_all_entries(MAEMO_DATA(be)->gconf, dir, &error);
+	if (error) {
+		malarm_print("error: failed to read %s: %s\n", dir, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	for (l = entries; l; l = l->next) {
+		GConfEntry *entry = (GConfEntry*)l->data;
+		GConfValue *value = gconf_entry_get_value(entry);
+
+		if (value && (value->type == GCONF_VALUE_INT)) {
+			func(gconf_entry_get_key(entry), gconf_value_get_int(value), data);
+		}
+		gconf_entry_free(entry);
+	}
+	g_slist_free(entries);
+}
+
+static int maemo_key_unset_dir(backend *be, const char *dir)
+{
+	return gconf_client_recursive_unset(MAEMO_DATA(be)->gconf, dir, 0, NULL) ? 
+		0 : -1;
+}
+
+// one gconf request for all keys
+static int maemo_key_set_batch(backend *be, const char **keys, const gint *vals, 
+		int n)
+{
+	GConfChangeSet *cs;
+	GError *error = NULL;
+	int i;
+
+	cs = gconf_change_set_new();
+	for (i=0; i<n; i++) {
+		gconf_change_set_set_int(cs, keys[i], vals[i]);
+	}
+
+	if (!gconf_client_commit_change_set(MAEMO_DATA(be)->gconf, cs, TRUE, &error)) {
+		malarm_print("error: failed to set %d gconf keys: %s\n", n, 
+				error ? error->message : "");
+		if (error) g_error_free(error);
+		gconf_change_set_unref(cs);
+		return -1;
+	}
+
+	gconf_change_set_unref(cs);
+	return 0;
+}
+
+// one gconf request for a row operation, a later change of a key wins
+static int maemo_key_commit(backend *be, const backend_key_change *changes, 
+		int n)
+{
+	GConfChangeSet *cs;
+	GError *error = NULL;
+	int i;
+
+	cs = gconf_change_set_new();
+	for (i=0; i<n; i++) {
+		if (changes[i].unset) {
+			gconf_change_set_unset(cs, changes[i].key);
+		} else {
+			gconf_change_set_set_int(cs, changes[i].key, changes[i].val);
+		}
+	}
+
+	if (!gconf_client_commit_change_set(MAEMO_DATA(be)->gconf, cs, TRUE, &error)) {
+		malarm_print("error: failed to commit %d gconf changes: %s\n", n, 
+				error ? error->message : "");
+		if (error) g_error_free(error);
+		gconf_change_set_unref(cs);
+		return -1;
+	}
+
+	gconf_change_set_unref(cs);
+	return 0;
+}
+
+static int maemo_sound_play(backend *be, const char *path)
+{
+	osso_return_t ret;
+	osso_rpc_t retval;
+
+	/* malarm_debug("playing %s\n", path); */
+	ret = osso_rpc_run(MAEMO_DATA(be)->ctx, OSSO_MULTIMEDIA_SERVICE, 
+			OSSO_MULTIMEDIA_OBJECT_PATH, OSSO_MULTIMEDIA_SOUND_INTERFACE, 
+			OSSO_MULTIMEDIA_PLAY_SOUND_REQ, &retval,
+			DBUS_TYPE_STRING, path,
+			DBUS_TYPE_INT32, 1, // what are possible priority values?
+			DBUS_TYPE_INVALID);
+	if (ret != OSSO_OK) {
+		malarm_print("error sending play rpc to osso-multimedia-service: %d\n", ret);
+		malarm_print("osso retval: type %d, val %d\n", retval.type, retval.value.i);
+		return -1;
+	}
+	return 0;
+}
+
+static int maemo_sound_stop(backend *be)
+{
+	osso_return_t ret;
+	osso_rpc_t retval;
+
+	ret = osso_rpc_run(MAEMO_DATA(be)->ctx, OSSO_MULTIMEDIA_SERVICE, 
+			OSSO_MULTIMEDIA_OBJECT_PATH, OSSO_MULTIMEDIA_SOUND_INTERFACE, 
+			OSSO_MULTIMEDIA_STOP_SOUND_REQ, &retval,
+			DBUS_TYPE_INVALID);
+	if (ret != OSSO_OK) {
+		malarm_print("error sending stop rpc to osso-multimedia-service: %d\n", ret);
+		malarm_print("osso retval: type %d, val %d\n", retval.type, retval.value.i);
+		return -1;
+	}
+	return 0;
+}
+
+static void maemo_destroy(backend *be)
+{
+	g_free(be->priv);
+	g_free(be);
+}
+
+/* libalarm has no batch calls, event gets are pipelined by the fetch
+ * threads instead (see malarm_fetch.h)
+ */
+backend *backend_maemo_new(app_data *app)
+{
+	backend *be;
+	maemo_data *maemo;
+
+	g_assert(app->ctx != NULL);
+	g_assert(app->gconf != NULL);
+
+	maemo = g_new0(maemo_data, 1);
+	maemo->ctx = app->ctx;
+	maemo->gconf = app->gconf;
+
+	be = g_new0(backend, 1);
+	be->name = "maemo";
+	be->priv = maemo;
+	be->event_query = maemo_event_query;
+	be->event_get = maemo_event_get;
+	be->event_free = maemo_event_free;
+	be->event_add = maemo_event_add;
+	be->event_del = maemo_event_del;
+	be->key_get = maemo_key_get;
+	be->key_set = maemo_key_set;
+	be->key_unset = maemo_key_unset;
+	be->key_foreach = maemo_key_foreach;
+	be->key_unset_dir = maemo_key_unset_dir;
+	be->key_set_batch = maemo_key_set_batch;
+	be->key_commit = maemo_key_commit;
+	be->sound_play = maemo_sound_play;
+	be->sound_stop = maemo_sound_stop;
+	be->destroy = maemo_destroy;
+	return be;
+}
@@ -0,0 +1,361 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "malarm_backend.h"
+#include "malarm_util.h"
+
+/* in-process tables, nothing is kept after exit. Alarms only fire when
+ * a driver calls backend_memory_fire(), as alarmd would at their time.
+ */
+typedef struct {
+	GHashTable *events;  // cookie -> event copy
+	GTree *due;          // memory_due -> NULL, in the order events fire
+	GHashTable *keys;    // key -> value
+	cookie_t next_cookie;
+	char *sound;         // path of the playing sound
+} memory_data;
+
+#define MEMORY_DATA(be)  ((memory_data*)(be)->priv)
+
+// snooze of events that have none, minutes
+#define MEMORY_SNOOZE  10
+
+typedef struct {
+	time_t time;  // alarm_time + snoozed minutes, as alarmd shows it
+	cookie_t cookie;
+} memory_due;
+
+static gint compare_due(gconstpointer a, gconstpointer b)
+{
+	const memory_due *da = (const memory_due*)a;
+	const memory_due *db = (const memory_due*)b;
+
+	if (da->time != db->time) {
+		return (da->time < db->time) ? -1 : 1;
+	}
+	return (da->cookie < db->cookie) ? -1 : (da->cookie > db->cookie);
+}
+
+static void set_due(memory_due *due, cookie_t cookie, const alarm_event_t *event)
+{
+	due->time = event->alarm_time + (time_t)event->snoozed*60;
+	due->cookie = cookie;
+}
+
+static void insert_due(memory_data *mem, cookie_t cookie, const alarm_event_t *event)
+{
+	memory_due *due = g_new(memory_due, 1);
+
+	set_due(due, cookie, event);
+	g_tree_insert(mem->due, due, NULL);
+}
+
+static void remove_due(memory_data *mem, cookie_t cookie, const alarm_event_t *event)
+{
+	memory_due due;
+
+	set_due(&due, cookie, event);
+	g_tree_remove(mem->due, &due);
+}
+
+typedef struct {
+	time_t first, last;
+	int32_t flag_mask, flags;
+	GArray *cookies;
+} memory_query;
+
+static void query_event(gpointer key, gpointer value, gpointer data)
+{
+	memory_query *query = (memory_query*)data;
+	alarm_event_t *event = (alarm_event_t*)value;
+	cookie_t cookie = GPOINTER_TO_INT(key);
+
+	if ((event->alarm_time >= query->first) && (event->alarm_time <= query->last) &&
+			((event->flags & query->flag_mask) == query->flags)) {
+		g_array_append_val(query->cookies, cookie);
+	}
+}
+
+static gint compare_cookies(gconstpointer a, gconstpointer b)
+{
+	cookie_t ca = *(const cookie_t*)a;
+	cookie_t cb = *(const cookie_t*)b;
+
+	return (ca < cb) ? -1 : (ca > cb);
+}
+
+static cookie_t *memory_event_query(backend *be, time_t first, time_t last, 
+		int32_t flag_mask, int32_t flags)
+{
+	memory_query query = { first, last, flag_mask, flags, NULL };
+	cookie_t *cookies;
+
+	query.cookies = g_array_new(FALSE, FALSE, sizeof(cookie_t));
+	g_hash_table_foreach(MEMORY_DATA(be)->events, query_event, &query);
+	g_array_sort(query.cookies, compare_cookies);
+
+	// 0 terminated, freed with free() like alarm_event_query()
+	cookies = malloc((query.cookies->len + 1)*sizeof(cookie_t));
+	memcpy(cookies, query.cookies->data, query.cookies->len*sizeof(cookie_t));
+	cookies[query.cookies->len] = 0;
+	g_array_free(query.cookies, TRUE);
+	return cookies;
+}
+
+static alarm_event_t *memory_event_get(backend *be, cookie_t cookie)
+{
+	alarm_event_t *event;
+
+	event = g_hash_table_lookup(MEMORY_DATA(be)->events, GINT_TO_POINTER(cookie));
+	return event ? copy_alarm_event(event) : NULL;
+}
+
+static void memory_event_free(backend *be, alarm_event_t *event)
+{
+	free_alarm_event_copy(event);
+}
+
+static cookie_t memory_event_add(backend *be, alarm_event_t *event)
+{
+	memory_data *mem = MEMORY_DATA(be);
+	cookie_t cookie = ++mem->next_cookie;
+	alarm_event_t *copy = copy_alarm_event(event);
+
+	g_hash_table_insert(mem->events, GINT_TO_POINTER(cookie), copy);
+	insert_due(mem, cookie, copy);
+	return cookie;
+}
+
+static int memory_event_del(backend *be, cookie_t cookie)
+{
+	memory_data *mem = MEMORY_DATA(be);
+	alarm_event_t *event;
+
+	event = g_hash_table_lookup(mem->events, GINT_TO_POINTER(cookie));
+	if (event == NULL) return -1;
+
+	remove_due(mem, cookie, event);
+	g_hash_table_remove(mem->events, GINT_TO_POINTER(cookie));
+	return 0;
+}
+
+static void memory_event_get_batch(backend *be, const cookie_t *cookies, int n, 
+		alarm_event_t **events)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		events[i] = memory_event_get(be, cookies[i]);
+	}
+}
+
+static void memory_event_add_batch(backend *be, alarm_event_t **events, int n, 
+		cookie_t *cookies)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		cookies[i] = memory_event_add(be, events[i]);
+	}
+}
+
+static gint memory_key_get(backend *be, const char *key)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(MEMORY_DATA(be)->keys, key));
+}
+
+static int memory_key_set(backend *be, const char *key, gint val)
+{
+	g_hash_table_replace(MEMORY_DATA(be)->keys, g_strdup(key), GINT_TO_POINTER(val));
+	return 0;
+}
+
+static int memory_key_unset(backend *be, const char *key)
+{
+	g_hash_table_remove(MEMORY_DATA(be)->keys, key);
+	return 0;
+}
+
+typedef struct {
+	const char *dir;
+	backend_key_func func;
+	gpointer data;
+} memory_dir;
+
+static void foreach_dir_key(gpointer key, gpointer value, gpointer data)
+{
+	memory_dir *dir = (memory_dir*)data;
+
+	if (backend_key_in_dir(key, dir->dir)) {
+		dir->func(key, GPOINTER_TO_INT(value), dir->data);
+	}
+}
+
+static void memory_key_foreach(backend *be, const char *dir, backend_key_func func, 
+		gpointer data)
+{
+	memory_dir d = { dir, func, data };
+
+	g_hash_table_foreach(MEMORY_DATA(be)->keys, foreach_dir_key, &d);
+}
+
+static gboolean remove_dir_key(gpointer key, gpointer value, gpointer data)
+{
+	return backend_key_under_dir(key, (const char*)data);
+}
+
+static int memory_key_unset_dir(backend *be, const char *dir)
+{
+	g_hash_table_foreach_remove(MEMORY_DATA(be)->keys, remove_dir_key, 
+			(gpointer)dir);
+	return 0;
+}
+
+static int memory_sound_play(backend *be, const char *path)
+{
+	memory_data *mem = MEMORY_DATA(be);
+
+	g_free(mem->sound);
+	mem->sound = g_strdup(path);
+	malarm_debug("playing %s\n", path);
+	return 0;
+}
+
+static int memory_sound_stop(backend *be)
+{
+	memory_data *mem = MEMORY_DATA(be);
+
+	g_free(mem->sound);
+	mem->sound = NULL;
+	return 0;
+}
+
+static gboolean get_first_due(gpointer key, gpointer value, gpointer data)
+{
+	*(memory_due**)data = (memory_due*)key;
+	return TRUE;
+}
+
+// the next time an event fires, -1 if there is none
+time_t backend_memory_next_due(backend *be)
+{
+	memory_due *first = NULL;
+
+	g_tree_foreach(MEMORY_DATA(be)->due, get_first_due, &first);
+	return first ? first->time : -1;
+}
+
+/* Fire the events that are due at now, in order, as alarmd does: func
+ * gets each one, and returns TRUE to snooze it. Otherwise a repeating
+ * event moves on by its recurrence (a fixed number of minutes, also
+ * across DST changes), and a one-time event is deleted.
+ * func may add and delete events. Returns the number of fires.
+ */
+int backend_memory_fire(backend *be, time_t now, backend_fire_func func, 
+		gpointer data)
+{
+	memory_data *mem = MEMORY_DATA(be);
+	memory_due *first;
+	alarm_event_t *event;
+	cookie_t cookie;
+	gboolean snooze;
+	int nfired = 0;
+
+	for (;;) {
+		first = NULL;
+		g_tree_foreach(mem->due, get_first_due, &first);
+		if ((first == NULL) || (first->time > now)) {
+			break;
+		}
+
+		cookie = first->cookie;
+		event = g_hash_table_lookup(mem->events, GINT_TO_POINTER(cookie));
+		g_tree_remove(mem->due, first);
+
+		snooze = func(cookie, event, data);
+		nfired++;
+
+		// func may have deleted it
+		event = g_hash_table_lookup(mem->events, GINT_TO_POINTER(cookie));
+		if (event == NULL) continue;
+
+		if (snooze) {
+			event->snoozed += event->snooze ? event->snooze : MEMORY_SNOOZE;
+		} else if ((event->recurrence > 0) && (event->recurrence_count != 0)) {
+			event->snoozed = 0;
+			while (event->alarm_time <= now) {
+				event->alarm_time += (time_t)event->recurrence*60;
+			}
+			if (event->recurrence_count > 0) {
+				event->recurrence_count--;
+			}
+		} else {
+			g_hash_table_remove(mem->events, GINT_TO_POINTER(cookie));
+			continue;
+		}
+		insert_due(mem, cookie, event);
+	}
+
+	return nfired;
+}
+
+static void memory_destroy(backend *be)
+{
+	memory_data *mem = MEMORY_DATA(be);
+
+	g_tree_destroy(mem->due);
+	g_hash_table_destroy(mem->events);
+	g_hash_table_destroy(mem->keys);
+	g_free(mem->sound);
+	g_free(mem);
+	g_free(be);
+}
+
+backend *backend_memory_new(void)
+{
+	backend *be;
+	memory_data *mem;
+
+	mem = g_new0(memory_data, 1);
+	mem->events = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_alarm_event_copy);
+	mem->due = g_tree_new_full((GCompareDataFunc)compare_due, NULL, g_free, NULL);
+	mem->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	be = g_new0(backend, 1);
+	be->name = "memory";
+	be->priv = mem;
+	be->event_query = memory_event_query;
+	be->event_get = memory_event_get;
+	be->event_free = memory_event_free;
+	be->event_add = memory_event_add;
+	be->event_del = memory_event_del;
+	be->key_get = memory_key_get;
+	be->key_set = memory_key_set;
+	be->key_unset = memory_key_unset;
+	be->key_foreach = memory_key_foreach;
+	be->key_unset_dir = memory_key_unset_dir;
+	be->sound_play = memory_sound_play;
+	be->sound_stop = memory_sound_stop;
+	be->event_get_batch = memory_event_get_batch;
+	be->event_add_batch = memory_event_add_batch;
+	be->destroy = memory_destroy;
+	return be;
+}
@@ -0,0 +1,589 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_calendar.h"
+#include "malarm_util.h"
+
+#define CALENDAR_FILE  "calendars"
+#define CALENDAR_MAGIC  0x434c414d  /* "MALC" */
+#define CALENDAR_VERSION  2
+
+// bits 0, 7, 14, 21 and 28: the same weekday in a 32-day word
+#define CALENDAR_WEEK_MASK  0x10204081
+
+/* File layout, in host byte order:
+ *   u32 magic, u32 version, calendar holidays, u32 count
+ *   count records of:
+ *     u32 id, u32 recurrence, u32 skip_holidays, calendar days,
+ *     u32 weekdays (version 2)
+ * calendar: u32 first_day, u32 nwords, nwords u32 words
+ */
+
+// app->calendars and app->holidays
+static GStaticMutex calendar_mutex = G_STATIC_MUTEX_INIT;
+
+guint32 calendar_day(int year, int month, int mday)
+{
+	GDate date;
+
+	g_date_clear(&date, 1);
+	g_date_set_dmy(&date, mday, month, year);
+	return g_date_get_julian(&date);
+}
+
+static guint32 stm_to_day(const struct tm *stm)
+{
+	return calendar_day(stm->tm_year + 1900, stm->tm_mon + 1, stm->tm_mday);
+}
+
+calendar *calendar_new(void)
+{
+	return g_new0(calendar, 1);
+}
+
+calendar *calendar_copy(const calendar *cal)
+{
+	calendar *copy;
+
+	if (cal == NULL) return NULL;
+
+	copy = g_new(calendar, 1);
+	*copy = *cal;
+	copy->bits = g_memdup(cal->bits, cal->nwords*sizeof(guint32));
+	return copy;
+}
+
+void calendar_free(calendar *cal)
+{
+	if (cal == NULL) return;
+
+	g_free(cal->bits);
+	g_free(cal);
+}
+
+// word starting at day word_day, 0 outside the calendar
+static guint32 calendar_word(const calendar *cal, guint32 word_day)
+{
+	if ((cal == NULL) || (word_day < cal->first_day) || 
+			(word_day >= cal->first_day + cal->nwords*32)) {
+		return 0;
+	}
+	return cal->bits[(word_day - cal->first_day)/32];
+}
+
+gboolean calendar_is_set(const calendar *cal, guint32 day)
+{
+	return (calendar_word(cal, day & ~31) >> (day & 31)) & 1;
+}
+
+gboolean calendar_is_empty(const calendar *cal)
+{
+	guint i;
+
+	if (cal == NULL) return TRUE;
+
+	for (i=0; i<cal->nwords; i++) {
+		if (cal->bits[i]) return FALSE;
+	}
+	return TRUE;
+}
+
+void calendar_set(calendar *cal, guint32 day, gboolean excluded)
+{
+	guint32 word_day = day & ~31;
+	guint32 *bits;
+	guint n;
+
+	if (!excluded && !calendar_is_set(cal, day)) return;
+
+	// grow to cover day
+	if (cal->nwords == 0) {
+		cal->first_day = word_day;
+		cal->nwords = 1;
+		cal->bits = g_new0(guint32, 1);
+	} else if (word_day < cal->first_day) {
+		n = (cal->first_day - word_day)/32;
+		bits = g_new0(guint32, cal->nwords + n);
+		memcpy(bits + n, cal->bits, cal->nwords*sizeof(guint32));
+		g_free(cal->bits);
+		cal->bits = bits;
+		cal->first_day = word_day;
+		cal->nwords += n;
+	} else if (word_day >= cal->first_day + cal->nwords*32) {
+		n = (word_day - cal->first_day)/32 + 1;
+		cal->bits = g_renew(guint32, cal->bits, n);
+		memset(cal->bits + cal->nwords, 0, (n - cal->nwords)*sizeof(guint32));
+		cal->nwords = n;
+	}
+
+	if (excluded) {
+		cal->bits[(word_day - cal->first_day)/32] |= 1u << (day & 31);
+	} else {
+		cal->bits[(word_day - cal->first_day)/32] &= ~(1u << (day & 31));
+	}
+}
+
+// days from word_day to word_day + 31 that are not on one of weekdays
+static guint32 weekday_word(guint32 weekdays, guint32 word_day)
+{
+	guint64 pattern = 0;
+	int i;
+
+	if (weekdays == 0) return 0;
+
+	// bit i of pattern is weekday i%7, for i up to 6 + 31
+	for (i=0; i<6; i++) {
+		pattern |= (guint64)weekdays << (7*i);
+	}
+	return ~(guint32)(pattern >> ((word_day - 1) % 7));
+}
+
+/* First of day, day + stride, day + 2*stride, ... that is in neither
+ * calendar (either may be NULL), and on one of weekdays (0 for any day).
+ * stride is 1, or 7 without weekdays.
+ */
+guint32 calendar_next_free(const calendar *a, const calendar *b, 
+		guint32 weekdays, guint32 day, int stride)
+{
+	guint32 word_day, mask;
+
+	g_assert((stride == 1) || ((stride == 7) && (weekdays == 0)));
+	g_assert((weekdays & ~CALENDAR_ALL_WEEK) == 0);
+
+	// ends at the latest after the last word of both calendars
+	for (;;) {
+		word_day = day & ~31;
+		mask = ((stride == 1) ? ~0u : CALENDAR_WEEK_MASK) << (day - word_day);
+		mask &= ~(calendar_word(a, word_day) | calendar_word(b, word_day) | 
+				weekday_word(weekdays, word_day));
+		if (mask) {
+			return word_day + g_bit_nth_lsf(mask, -1);
+		}
+
+		// first candidate in the next word
+		while (day < word_day + 32) day += stride;
+	}
+}
+
+// e.g. "Mon-Fri" or "Mon, Wed, Fri", buf must hold 30 chars
+char *weekdays_to_string(guint32 weekdays, char *buf)
+{
+	static const char *names[] = { 
+		"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" 
+	};
+	int first, last, i;
+
+	buf[0] = '\0';
+	for (first=0; (first<7) && !(weekdays & (1 << first)); first++);
+	for (last=first; (last<7) && (weekdays & (1 << last)); last++);
+
+	if ((last - first >= 3) && ((weekdays >> last) == 0)) {
+		// one run of days
+		sprintf(buf, "%s-%s", names[first], names[last - 1]);
+		return buf;
+	}
+	for (i=0; i<7; i++) {
+		if (weekdays & (1 << i)) {
+			if (buf[0]) strcat(buf, ", ");
+			strcat(buf, names[i]);
+		}
+	}
+	return buf;
+}
+
+alarm_calendar *alarm_calendar_new(void)
+{
+	return g_new0(alarm_calendar, 1);
+}
+
+void alarm_calendar_free(alarm_calendar *entry)
+{
+	if (entry == NULL) return;
+
+	calendar_free(entry->days);
+	g_free(entry);
+}
+
+alarm_calendar *alarm_calendar_copy(const alarm_calendar *entry)
+{
+	alarm_calendar *copy;
+
+	copy = g_new(alarm_calendar, 1);
+	*copy = *entry;
+	copy->days = calendar_copy(entry->days);
+	return copy;
+}
+
+static char *calendar_path(void)
+{
+	return get_data_path(CALENDAR_FILE);
+}
+
+// leading and trailing empty words are not written
+static void put_calendar(GString *buf, const calendar *cal)
+{
+	guint first = 0, last = 0;
+
+	if (cal) {
+		last = cal->nwords;
+		while ((first < last) && (cal->bits[first] == 0)) first++;
+		while ((last > first) && (cal->bits[last - 1] == 0)) last--;
+	}
+
+	put_u32(buf, (first < last) ? cal->first_day + first*32 : 0);
+	put_u32(buf, last - first);
+	if (first < last) {
+		g_string_append_len(buf, (gchar*)(cal->bits + first), 
+				(last - first)*sizeof(guint32));
+	}
+}
+
+// cal is NULL for an empty calendar
+static int get_calendar(const gchar **p, const gchar *end, calendar **cal)
+{
+	guint32 first_day, nwords;
+
+	*cal = NULL;
+	if ((get_u32(p, end, &first_day) != 0) || (get_u32(p, end, &nwords) != 0) ||
+			((end - *p)/sizeof(guint32) < nwords)) {
+		return -1;
+	}
+	if (nwords == 0) return 0;
+
+	*cal = calendar_new();
+	(*cal)->first_day = first_day;
+	(*cal)->nwords = nwords;
+	(*cal)->bits = g_memdup(*p, nwords*sizeof(guint32));
+	*p += nwords*sizeof(guint32);
+	return 0;
+}
+
+static void put_record_cb(gpointer key, gpointer value, gpointer data)
+{
+	alarm_calendar *entry = (alarm_calendar*)value;
+	GString *buf = (GString*)data;
+
+	put_u32(buf, GPOINTER_TO_UINT(key));
+	put_u32(buf, entry->recurrence);
+	put_u32(buf, entry->skip_holidays);
+	put_calendar(buf, entry->days);
+	put_u32(buf, entry->weekdays);
+}
+
+// calendar_mutex must be held
+static int calendar_save(app_data *app)
+{
+	GString *buf;
+	char *path;
+	int ret;
+
+	buf = g_string_sized_new(256);
+	put_u32(buf, CALENDAR_MAGIC);
+	put_u32(buf, CALENDAR_VERSION);
+	put_calendar(buf, app->holidays);
+	put_u32(buf, g_hash_table_size(app->calendars));
+	g_hash_table_foreach(app->calendars, put_record_cb, buf);
+
+	path = calendar_path();
+	ret = save_file(path, buf->str, buf->len);
+
+	g_free(path);
+	g_string_free(buf, TRUE);
+	return ret;
+}
+
+// calendar_mutex must be held
+static void calendar_load(app_data *app)
+{
+	char *path;
+	gchar *contents = NULL;
+	gsize len;
+	const gchar *p, *end;
+	guint32 magic, version, count, id, skip;
+	alarm_calendar *entry;
+
+	if (app->calendars) return;
+
+	app->calendars = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)alarm_calendar_free);
+
+	path = calendar_path();
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		// no exception days yet
+		g_free(path);
+		return;
+	}
+
+	p = contents;
+	end = contents + len;
+	if ((get_u32(&p, end, &magic) != 0) || (get_u32(&p, end, &version) != 0) ||
+			(magic != CALENDAR_MAGIC) || (version > CALENDAR_VERSION) ||
+			(get_calendar(&p, end, &app->holidays) != 0) ||
+			(get_u32(&p, end, &count) != 0)) {
+		malarm_print("error: %s is not a malarm calendar file\n", path);
+		goto calendar_load_out;
+	}
+
+	while (count-- > 0) {
+		entry = alarm_calendar_new();
+		if ((get_u32(&p, end, &id) != 0) || 
+				(get_u32(&p, end, &entry->recurrence) != 0) ||
+				(get_u32(&p, end, &skip) != 0) ||
+				(get_calendar(&p, end, &entry->days) != 0) ||
+				((version >= 2) && (get_u32(&p, end, &entry->weekdays) != 0))) {
+			malarm_print("error: %s is truncated\n", path);
+			alarm_calendar_free(entry);
+			break;
+		}
+		entry->skip_holidays = skip;
+		g_hash_table_replace(app->calendars, GUINT_TO_POINTER(id), entry);
+	}
+	malarm_debug("loaded %u alarm calendars\n", g_hash_table_size(app->calendars));
+
+calendar_load_out:
+	g_free(contents);
+	g_free(path);
+}
+
+// drop the calendars in memory, e.g. after another process changed them
+void calendar_unload(app_data *app)
+{
+	g_static_mutex_lock(&calendar_mutex);
+	if (app->calendars) {
+		g_hash_table_destroy(app->calendars);
+		app->calendars = NULL;
+	}
+	calendar_free(app->holidays);
+	app->holidays = NULL;
+	g_static_mutex_unlock(&calendar_mutex);
+}
+
+int calendar_put_holidays(app_data *app, const calendar *holidays)
+{
+	int ret;
+
+	g_static_mutex_lock(&calendar_mutex);
+	calendar_load(app);
+	calendar_free(app->holidays);
+	app->holidays = calendar_is_empty(holidays) ? NULL : calendar_copy(holidays);
+	ret = calendar_save(app);
+	g_static_mutex_unlock(&calendar_mutex);
+
+	return ret;
+}
+
+static void copy_entry_cb(gpointer key, gpointer value, gpointer data)
+{
+	g_hash_table_insert((GHashTable*)data, key, 
+			alarm_calendar_copy((alarm_calendar*)value));
+}
+
+/* worker thread: copies of all alarm calendars (id -> alarm_calendar) and
+ * of the holidays (NULL if none), for the main loop (see calendar_cached_*)
+ */
+GHashTable *calendar_get_all(app_data *app, calendar **holidays)
+{
+	GHashTable *entries;
+
+	entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)alarm_calendar_free);
+
+	g_static_mutex_lock(&calendar_mutex);
+	calendar_load(app);
+	g_hash_table_foreach(app->calendars, copy_entry_cb, entries);
+	*holidays = app->holidays ? calendar_copy(app->holidays) : NULL;
+	g_static_mutex_unlock(&calendar_mutex);
+
+	return entries;
+}
+
+// set exception days of alarm id, or remove them if entry is NULL
+int calendar_put(app_data *app, guint id, const alarm_calendar *entry)
+{
+	int ret = 0;
+
+	g_static_mutex_lock(&calendar_mutex);
+	calendar_load(app);
+	if (entry) {
+		g_hash_table_replace(app->calendars, GUINT_TO_POINTER(id), 
+				alarm_calendar_copy(entry));
+		ret = calendar_save(app);
+	} else if (g_hash_table_remove(app->calendars, GUINT_TO_POINTER(id))) {
+		ret = calendar_save(app);
+	}
+	g_static_mutex_unlock(&calendar_mutex);
+
+	return ret;
+}
+
+// days between instances of the event, 0 if it has no exception days
+static int event_stride(const alarm_event_t *event)
+{
+	switch (event->recurrence) {
+	case 60*24:
+		return 1;
+	case 60*24*7:
+		return 7;
+	}
+	return 0;
+}
+
+// time of day of anchor_stm, on day
+static time_t day_to_time(const struct tm *anchor_stm, guint32 anchor, guint32 day)
+{
+	struct tm stm = *anchor_stm;
+
+	// mktime() keeps the local time of day across DST changes
+	stm.tm_mday += (gint32)(day - anchor);
+	stm.tm_isdst = -1;
+	return mktime(&stm);
+}
+
+/* Next instance of a daily or weekly event at or after time after, on a
+ * day that is not excluded by entry (NULL if none) and holidays. The
+ * instances are at the local time of day of event->alarm_time, weekly
+ * ones on its weekday, daily ones on the weekdays of the rule if it has
+ * some. Returns -1 if the alarm has no exception days.
+ */
+static time_t next_free_time(const alarm_calendar *entry, 
+		const calendar *holidays, const alarm_event_t *event, time_t after)
+{
+	struct tm anchor_stm, after_stm;
+	guint32 anchor, day;
+	int stride = event_stride(event);
+
+	if ((stride == 0) || (entry == NULL) || 
+			!(entry->skip_holidays || entry->days || entry->weekdays)) {
+		return -1;
+	}
+
+	localtime_r(&event->alarm_time, &anchor_stm);
+	anchor = stm_to_day(&anchor_stm);
+	localtime_r(&after, &after_stm);
+	day = stm_to_day(&after_stm);
+
+	// first day from after on, on the weekday of the anchor
+	day += (stride + anchor%stride - day%stride) % stride;
+	if (day_to_time(&anchor_stm, anchor, day) < after) {
+		day += stride;
+	}
+
+	day = calendar_next_free(entry->days, entry->skip_holidays ? holidays : NULL, 
+			(stride == 1) ? entry->weekdays : 0, day, stride);
+	return day_to_time(&anchor_stm, anchor, day);
+}
+
+// next instance of event of alarm id at or after time after, see
+// next_free_time(); locked, may load the file
+time_t calendar_next_alarm_time(app_data *app, guint id, 
+		const alarm_event_t *event, time_t after)
+{
+	time_t t;
+
+	if (event_stride(event) == 0) return -1;
+
+	g_static_mutex_lock(&calendar_mutex);
+	calendar_load(app);
+	t = next_free_time(g_hash_table_lookup(app->calendars, GUINT_TO_POINTER(id)), 
+			app->holidays, event, after);
+	g_static_mutex_unlock(&calendar_mutex);
+
+	return t;
+}
+
+// move event to its next instance that is not excluded, from now on;
+// returns FALSE if the alarm has no exception days
+gboolean calendar_arm(app_data *app, guint id, alarm_event_t *event, time_t now)
+{
+	time_t t;
+
+	t = calendar_next_alarm_time(app, id, event, MAX(now, event->alarm_time));
+	if (t < 0) return FALSE;
+
+	event->alarm_time = t;
+	return TRUE;
+}
+
+// give an event fetched from alarmd back its recurrence
+void calendar_restore_event(app_data *app, guint id, alarm_event_t *event)
+{
+	alarm_calendar *entry;
+
+	if (event->recurrence != 0) return;
+
+	g_static_mutex_lock(&calendar_mutex);
+	calendar_load(app);
+	entry = g_hash_table_lookup(app->calendars, GUINT_TO_POINTER(id));
+	if (entry && (entry->recurrence > 0)) {
+		event->recurrence = entry->recurrence;
+		event->recurrence_count = -1;
+	}
+	g_static_mutex_unlock(&calendar_mutex);
+}
+
+/* The main loop has its own copy of the calendars, app->ui_calendars and
+ * app->ui_holidays: it does not take calendar_mutex nor read the file
+ * while the worker may hold it. The UI loads the copy once and keeps it
+ * in step with its own changes, no other process writes the calendars.
+ */
+
+// main loop: as calendar_next_alarm_time(), from the copy
+time_t calendar_cached_next_alarm_time(app_data *app, guint id, 
+		const alarm_event_t *event, time_t after)
+{
+	if (app->ui_calendars == NULL) return -1;
+
+	return next_free_time(g_hash_table_lookup(app->ui_calendars, 
+				GUINT_TO_POINTER(id)), app->ui_holidays, event, after);
+}
+
+// main loop: a copy of the calendar of alarm id, free with
+// alarm_calendar_free(), or NULL if none
+alarm_calendar *calendar_cached_get(app_data *app, guint id)
+{
+	alarm_calendar *entry;
+
+	if (app->ui_calendars == NULL) return NULL;
+
+	entry = g_hash_table_lookup(app->ui_calendars, GUINT_TO_POINTER(id));
+	return entry ? alarm_calendar_copy(entry) : NULL;
+}
+
+// main loop: weekday mask of a daily alarm, 0 if it rings every day
+guint32 calendar_cached_weekdays(app_data *app, guint id)
+{
+	alarm_calendar *entry;
+
+	if (app->ui_calendars == NULL) return 0;
+
+	entry = g_hash_table_lookup(app->ui_calendars, GUINT_TO_POINTER(id));
+	return entry ? entry->weekdays : 0;
+}
+
+// main loop: alarm id got the exception days of entry (NULL for none)
+void calendar_cached_put(app_data *app, guint id, const alarm_calendar *entry)
+{
+	if (app->ui_calendars == NULL) return;
+
+	if (entry) {
+		g_hash_table_replace(app->ui_calendars, GUINT_TO_POINTER(id), 
+				alarm_calendar_copy(entry));
+	} else {
+		g_hash_table_remove(app->ui_calendars, GUINT_TO_POINTER(id));
+	}
+}
@@ -0,0 +1,90 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_CALENDAR_H_
+#define _MALARM_CALENDAR_H_
+
+#include "malarm_main.h"
+
+/* Exception calendars list the days on which a daily or weekly alarm does
+ * not ring: one global calendar of holidays, and the days off of each
+ * alarm. A calendar is a bitset of local dates, one bit per day, so the
+ * next day that is not excluded is found a word at a time.
+ * A daily alarm may also ring only on some days of the week, e.g. Mon-Fri,
+ * as one rule with a weekday mask.
+ *
+ * alarmd only ever gets the next instance that is not excluded, as a
+ * one-time event (calendar_arm()). The next one is armed when it triggers
+ * (alarm_triggered()), and the actual recurrence is kept here.
+ * Calendars are saved in MALARM_DATA_DIR. The worker thread uses them
+ * through the calendar_get/put fcns, which are locked; the main loop of
+ * the UI reads its own copy (calendar_cached_* fcns).
+ */
+
+// days are julian days (see GDate) of local dates
+struct _calendar {
+	guint32 first_day;  // day of the lowest bit of bits[0], a multiple of 32
+	guint nwords;
+	guint32 *bits;
+};
+
+// weekday bits, julian day 1 is a Monday
+#define CALENDAR_MONDAY  (1 << 0)
+#define CALENDAR_SUNDAY  (1 << 6)
+#define CALENDAR_WORKDAYS  0x1f
+#define CALENDAR_ALL_WEEK  0x7f
+
+struct _alarm_calendar {
+	guint32 recurrence;  // of the alarm, alarmd gets 0
+	int skip_holidays;
+	calendar *days;      // days off of this alarm only, NULL if none
+	guint32 weekdays;    // daily alarm rings on these days only, 0 for all
+};
+
+guint32 calendar_day(int year, int month, int mday);
+calendar *calendar_new(void);
+calendar *calendar_copy(const calendar *cal);
+void calendar_free(calendar *cal);
+void calendar_set(calendar *cal, guint32 day, gboolean excluded);
+gboolean calendar_is_set(const calendar *cal, guint32 day);
+gboolean calendar_is_empty(const calendar *cal);
+guint32 calendar_next_free(const calendar *a, const calendar *b, 
+		guint32 weekdays, guint32 day, int stride);
+char *weekdays_to_string(guint32 weekdays, char *buf);
+
+alarm_calendar *alarm_calendar_new(void);
+alarm_calendar *alarm_calendar_copy(const alarm_calendar *entry);
+void alarm_calendar_free(alarm_calendar *entry);
+
+void calendar_unload(app_data *app);
+int calendar_put_holidays(app_data *app, const calendar *holidays);
+GHashTable *calendar_get_all(app_data *app, calendar **holidays);
+int calendar_put(app_data *app, guint id, const alarm_calendar *entry);
+
+time_t calendar_next_alarm_time(app_data *app, guint id, 
+		const alarm_event_t *event, time_t after);
+gboolean calendar_arm(app_data *app, guint id, alarm_event_t *event, time_t now);
+void calendar_restore_event(app_data *app, guint id, alarm_event_t *event);
+
+time_t calendar_cached_next_alarm_time(app_data *app, guint id, 
+		const alarm_event_t *event, time_t after);
+alarm_calendar *calendar_cached_get(app_data *app, guint id);
+guint32 calendar_cached_weekdays(app_data *app, guint id);
+void calendar_cached_put(app_data *app, guint id, const alarm_calendar *entry);
+
+#endif /* #define _MALARM_CALENDAR_H_ */
@@ -0,0 +1,193 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dbus/dbus.h>
+
+#include "malarm_client.h"
+#include "malarm_proto.h"
+#include "malarm_ui.h"
+#include "malarm_backend.h"
+
+#define CLIENT_MATCH_DELTA  "type='signal',interface='" MALARM_CORE_DBUS_NAME \
+	"',member='" PROTO_DELTA "'"
+#define CLIENT_MATCH_OWNER  "type='signal',interface='" DBUS_INTERFACE_DBUS \
+	"',member='NameOwnerChanged',arg0='" MALARM_CORE_DBUS_NAME "'"
+
+// main loop: read alarmd here from now on
+static void snapshot_failed(app_data *app)
+{
+	malarm_print("error: no snapshot from %s, reading alarms\n", 
+			MALARM_CORE_DBUS_NAME);
+	app->client_state = CLIENT_OFF;
+	done_core_snapshot(app, NULL);
+}
+
+// retval is freed by libosso
+static void cb_snapshot(const gchar *interface, const gchar *method, 
+		osso_rpc_t *retval, gpointer data)
+{
+	app_data *app = (app_data*)data;
+	GArray *items = NULL;
+	guint32 serial, next_id;
+
+	// a D-Bus error is a string too, it does not decode
+	if (retval->type == DBUS_TYPE_STRING) {
+		items = proto_decode(retval->value.s, &serial, &next_id);
+	}
+	if (items == NULL) {
+		snapshot_failed(app);
+		return;
+	}
+
+	malarm_debug("snapshot %u: %u alarms\n", serial, items->len);
+	app->client_serial = serial;
+	app->next_id = MAX(app->next_id, next_id);
+	done_core_snapshot(app, items);
+}
+
+static void apply_delta(app_data *app, const char *text)
+{
+	GArray *items;
+	guint32 serial, next_id;
+
+	if ((items = proto_decode(text, &serial, &next_id)) == NULL) {
+		return;
+	}
+
+	if (serial <= app->client_serial) {
+		// already in the snapshot
+		free_scan_items(items);
+	} else if (serial != app->client_serial + 1) {
+		malarm_print("missed delta %u, getting a snapshot\n", 
+				app->client_serial + 1);
+		free_scan_items(items);
+		populate_tree(app);
+	} else {
+		app->client_serial = serial;
+		app->next_id = MAX(app->next_id, next_id);
+		apply_core_delta(app, items);
+	}
+}
+
+static DBusHandlerResult client_filter(DBusConnection *conn, DBusMessage *msg, 
+		void *data)
+{
+	app_data *app = (app_data*)data;
+	const char *text, *name, *old_owner, *new_owner;
+
+	// deltas that arrive before the snapshot are in it, and rows released
+	// by shed_caches() are read again with a snapshot
+	if ((app->client_state == CLIENT_OFF) || app->refreshing || 
+			app->caches_shed) {
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	if (dbus_message_is_signal(msg, MALARM_CORE_DBUS_NAME, PROTO_DELTA)) {
+		if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &text, 
+					DBUS_TYPE_INVALID)) {
+			apply_delta(app, text);
+		}
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged") &&
+			dbus_message_get_args(msg, NULL, 
+				DBUS_TYPE_STRING, &name, 
+				DBUS_TYPE_STRING, &old_owner, 
+				DBUS_TYPE_STRING, &new_owner, 
+				DBUS_TYPE_INVALID) &&
+			(strcmp(name, MALARM_CORE_DBUS_NAME) == 0) && (new_owner[0] != '\0')) {
+		// core was restarted, its serials start over
+		malarm_debug("core is now %s\n", new_owner);
+		populate_tree(app);
+	}
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+void client_start(app_data *app)
+{
+	DBusConnection *conn;
+
+	// a core started by D-Bus uses the maemo backend, test backends
+	// are private to this process
+	if (strcmp(app->backend->name, "maemo") != 0) return;
+
+	conn = (DBusConnection*)osso_get_dbus_connection(app->ctx);
+	if (!dbus_connection_add_filter(conn, client_filter, app, NULL)) {
+		malarm_print("error: failed to add D-Bus filter\n");
+		return;
+	}
+	dbus_bus_add_match(conn, CLIENT_MATCH_DELTA, NULL);
+	dbus_bus_add_match(conn, CLIENT_MATCH_OWNER, NULL);
+
+	app->core_conn = conn;
+	app->client_state = CLIENT_ON;
+}
+
+// main loop: the result is passed to done_core_snapshot()
+void client_snapshot(app_data *app)
+{
+	osso_return_t osso_ret;
+
+	// starts the core, if it is not running
+	osso_ret = osso_rpc_async_run(app->ctx, MALARM_CORE_DBUS_NAME, 
+			MALARM_CORE_DBUS_PATH, MALARM_CORE_DBUS_NAME, PROTO_SNAPSHOT, 
+			cb_snapshot, app, DBUS_TYPE_INVALID);
+	if (osso_ret != OSSO_OK) {
+		snapshot_failed(app);
+	}
+}
+
+// main loop: report alarms written by this UI, event NULL if removed
+void client_changed(app_data *app, const scan_item *items, guint nitems)
+{
+	osso_return_t osso_ret;
+	char *text;
+
+	if ((app->client_state == CLIENT_OFF) || (nitems == 0)) return;
+
+	text = proto_encode(0, app->next_id, items, nitems);
+	osso_ret = osso_rpc_async_run(app->ctx, MALARM_CORE_DBUS_NAME, 
+			MALARM_CORE_DBUS_PATH, MALARM_CORE_DBUS_NAME, PROTO_CHANGED, 
+			NULL, NULL, DBUS_TYPE_STRING, text, DBUS_TYPE_INVALID);
+	if (osso_ret != OSSO_OK) {
+		// the core finds the change with its next scan
+		malarm_print("error: failed to send %s\n", PROTO_CHANGED);
+	}
+	g_free(text);
+}
+
+// main loop: the core scans and re-arms, and sends what changed
+void client_rescan(app_data *app)
+{
+	client_triggered(app, PROTO_RESCAN);
+}
+
+// pass on the method of an alarm of an older malarm, the core logs the
+// fire (see malarm_history.h) and rescans
+void client_triggered(app_data *app, const char *method)
+{
+	osso_return_t osso_ret;
+
+	osso_ret = osso_rpc_async_run(app->ctx, MALARM_CORE_DBUS_NAME, 
+			MALARM_CORE_DBUS_PATH, MALARM_CORE_DBUS_NAME, method, 
+			NULL, NULL, DBUS_TYPE_INVALID);
+	if (osso_ret != OSSO_OK) {
+		malarm_print("error: failed to send %s\n", method);
+	}
+}
@@ -0,0 +1,42 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_CLIENT_H_
+#define _MALARM_CLIENT_H_
+
+#include "malarm_main.h"
+#include "malarm_scan.h"
+
+/* The GTK UI as a front end of the core service (see malarm_core.h).
+ * populate_tree() gets a snapshot instead of reading alarmd, deltas
+ * update the rows, and each change made here is reported to the core.
+ * If the core does not answer, the UI reads alarmd itself, as before.
+ */
+
+enum {
+	CLIENT_OFF,  // UI reads and arms alarms itself
+	CLIENT_ON,
+};
+
+void client_start(app_data *app);
+void client_snapshot(app_data *app);
+void client_changed(app_data *app, const scan_item *items, guint nitems);
+void client_rescan(app_data *app);
+void client_triggered(app_data *app, const char *method);
+
+#endif /* #define _MALARM_CLIENT_H_ */
@@ -0,0 +1,78 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "malarm_clock.h"
+
+static GStaticMutex clock_mutex = G_STATIC_MUTEX_INIT;
+static gboolean simulated;
+static gboolean running;
+static time_t sim_start;   // simulated time when the clock was set
+static time_t real_start;  // system time when the clock was set
+
+// main loop, at startup: a simulated clock from MALARM_CLOCK_ENV
+void clock_init(void)
+{
+	const char *val = g_getenv(MALARM_CLOCK_ENV);
+	char *end;
+	long t;
+
+	if (val == NULL) return;
+
+	t = strtol(val, &end, 10);
+	if ((*end != '\0') || (t < 0)) {
+		malarm_print("error: bad %s: %s\n", MALARM_CLOCK_ENV, val);
+		return;
+	}
+	clock_set(t, TRUE);
+	malarm_debug("simulated clock from %ld\n", t);
+}
+
+time_t clock_now(void)
+{
+	time_t now;
+
+	if (!simulated) {
+		return time(NULL);
+	}
+
+	g_static_mutex_lock(&clock_mutex);
+	now = sim_start;
+	if (running) {
+		now += time(NULL) - real_start;
+	}
+	g_static_mutex_unlock(&clock_mutex);
+	return now;
+}
+
+// the clock reads t from now on; it stands still if not running
+void clock_set(time_t t, gboolean run)
+{
+	g_static_mutex_lock(&clock_mutex);
+	sim_start = t;
+	real_start = time(NULL);
+	running = run;
+	simulated = TRUE;
+	g_static_mutex_unlock(&clock_mutex);
+}
+
+gboolean clock_is_simulated(void)
+{
+	return simulated;
+}
@@ -0,0 +1,43 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_CLOCK_H_
+#define _MALARM_CLOCK_H_
+
+#include "malarm_main.h"
+
+/* The time malarm schedules against. It is the system time, unless a
+ * simulated clock is set: then it starts at a given time and either
+ * stands still until it is set again (a driver steps it from alarm to
+ * alarm, see "malarmd --simulate"), or runs at the real rate.
+ * MALARM_CLOCK_ENV=<seconds since the epoch> starts a running simulated
+ * clock, e.g. to try the UI on another date with the memory backend.
+ *
+ * Local time is still localtime_r() and mktime(), which only depend on
+ * TZ: a simulation sets TZ to a zone with DST changes.
+ * Any thread may read the clock.
+ */
+
+#define MALARM_CLOCK_ENV  "MALARM_CLOCK"
+
+void clock_init(void);
+time_t clock_now(void);
+void clock_set(time_t t, gboolean running);
+gboolean clock_is_simulated(void);
+
+#endif /* #define _MALARM_CLOCK_H_ */
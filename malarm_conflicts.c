@@ -0,0 +1,504 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "malarm_conflicts.h"
+#include "malarm_calendar.h"
+#include "malarm_clock.h"
+
+// move the horizon on when it is this much shorter than configured
+#define CONFLICT_ADVANCE_SECS  (60*60)
+
+typedef struct {
+	time_t time;
+	guint id;
+} conflict_time;
+
+typedef struct {
+	guint id;
+	time_t alarm_time;
+	guint snoozed;
+	guint32 recurrence;
+	time_t next;    // first occurrence not in the tree yet, -1 if none
+	GArray *times;  // time_t of its occurrences in the tree, ascending
+	int conflicts;  // with another alarm, valid unless flags_stale
+} conflict_alarm;
+
+struct _conflict_index {
+	app_data *app;
+	time_t window;       // seconds between alarms that conflict
+	time_t horizon;      // seconds of occurrences from now on
+	time_t until;        // occurrences are in the tree up to this time
+	time_t from;         // and from this time on
+	GTree *times;        // conflict_time -> conflict_alarm, by time and id
+	GHashTable *alarms;  // id -> conflict_alarm, of the enabled alarms
+	int flags_stale;     // the tree changed since the conflicts were set
+};
+
+static gint compare_times(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const conflict_time *ta = (const conflict_time*)a;
+	const conflict_time *tb = (const conflict_time*)b;
+
+	if (ta->time != tb->time) return (ta->time < tb->time) ? -1 : 1;
+	return (ta->id < tb->id) ? -1 : (ta->id > tb->id);
+}
+
+static GTree *new_times_tree(void)
+{
+	return g_tree_new_full(compare_times, NULL, g_free, NULL);
+}
+
+static void free_alarm(conflict_alarm *a)
+{
+	g_array_free(a->times, TRUE);
+	g_free(a);
+}
+
+// weekday bits as in malarm_calendar.h, Monday first
+static int on_weekday(time_t t, guint32 weekdays)
+{
+	struct tm stm;
+
+	localtime_r(&t, &stm);
+	return (weekdays & (1 << ((stm.tm_wday + 6) % 7))) != 0;
+}
+
+/* First instance at or after time after, -1 if none. Exception days are
+ * taken from the calendar of id, or for an alarm not saved yet (id 0)
+ * from weekdays; holidays and days off of such an alarm are not known.
+ * The calendars are the main loop copy, no lock is taken.
+ */
+static time_t next_occurrence(app_data *app, guint id, time_t alarm_time, 
+		guint32 recurrence, guint32 weekdays, time_t after)
+{
+	time_t step = (time_t)recurrence*60;
+	alarm_event_t event;
+	time_t t;
+	int i;
+
+	if (step == 0) return (alarm_time >= after) ? alarm_time : -1;
+
+	if (id) {
+		memset(&event, 0, sizeof(event));
+		event.alarm_time = alarm_time;
+		event.recurrence = recurrence;
+		t = calendar_cached_next_alarm_time(app, id, &event, MAX(after, alarm_time));
+		if (t >= 0) return t;
+	}
+
+	t = alarm_time;
+	if (t < after) t += (after - alarm_time + step - 1)/step*step;
+	for (i=0; (i<7) && weekdays && !on_weekday(t, weekdays); i++) {
+		t += step;
+	}
+	return t;
+}
+
+// the time the list shows if it is still to come, else the next instance
+static time_t first_occurrence(conflict_index *idx, guint id, time_t alarm_time, 
+		guint snoozed, guint32 recurrence, guint32 weekdays)
+{
+	time_t t = alarm_time + (time_t)snoozed*60;
+
+	if (snoozed && (t >= idx->from)) return t;
+	return next_occurrence(idx->app, id, alarm_time, recurrence, weekdays, idx->from);
+}
+
+// put the occurrences of a up to the horizon in the tree
+static void expand_alarm(conflict_index *idx, conflict_alarm *a)
+{
+	conflict_time *key;
+
+	while ((a->next >= 0) && (a->next <= idx->until)) {
+		key = g_new(conflict_time, 1);
+		key->time = a->next;
+		key->id = a->id;
+		g_tree_insert(idx->times, key, a);
+		g_array_append_val(a->times, a->next);
+		idx->flags_stale = 1;
+		a->next = next_occurrence(idx->app, a->id, a->alarm_time, 
+				a->recurrence, 0, a->next + 1);
+	}
+}
+
+static void remove_alarm_times(conflict_index *idx, conflict_alarm *a, guint n)
+{
+	conflict_time key;
+	guint i;
+
+	key.id = a->id;
+	for (i=0; i<n; i++) {
+		key.time = g_array_index(a->times, time_t, i);
+		g_tree_remove(idx->times, &key);
+	}
+	g_array_remove_range(a->times, 0, n);
+	if (n > 0) idx->flags_stale = 1;
+}
+
+// drop the occurrences that are past, and add the ones up to the horizon
+static void advance_alarm(gpointer key, gpointer value, gpointer data)
+{
+	conflict_index *idx = (conflict_index*)data;
+	conflict_alarm *a = (conflict_alarm*)value;
+	guint n = 0;
+
+	while ((n < a->times->len) && (g_array_index(a->times, time_t, n) < idx->from)) {
+		n++;
+	}
+	remove_alarm_times(idx, a, n);
+	expand_alarm(idx, a);
+}
+
+// occurrences are expanded lazily, when the horizon has moved on
+static void advance(conflict_index *idx)
+{
+	time_t now = clock_now();
+
+	if (now + idx->horizon < idx->until + CONFLICT_ADVANCE_SECS) return;
+
+	idx->from = now;
+	idx->until = now + idx->horizon;
+	g_hash_table_foreach(idx->alarms, advance_alarm, idx);
+}
+
+static void reset_alarm(gpointer key, gpointer value, gpointer data)
+{
+	conflict_index *idx = (conflict_index*)data;
+	conflict_alarm *a = (conflict_alarm*)value;
+
+	g_array_set_size(a->times, 0);
+	a->next = first_occurrence(idx, a->id, a->alarm_time, a->snoozed, 
+			a->recurrence, 0);
+	expand_alarm(idx, a);
+}
+
+// expand all alarms again, from now on
+static void rebuild(conflict_index *idx)
+{
+	g_tree_destroy(idx->times);
+	idx->times = new_times_tree();
+	idx->from = clock_now();
+	idx->until = idx->from + idx->horizon;
+	g_hash_table_foreach(idx->alarms, reset_alarm, idx);
+	idx->flags_stale = 1;
+}
+
+// alarms changed their exception days, e.g. the calendars were loaded
+void conflicts_reset(conflict_index *idx)
+{
+	rebuild(idx);
+}
+
+conflict_index *conflicts_new(app_data *app)
+{
+	conflict_index *idx;
+
+	idx = g_new0(conflict_index, 1);
+	idx->app = app;
+	idx->window = CONFLICT_MINUTES*60;
+	idx->horizon = CONFLICT_DAYS*24*60*60;
+	idx->from = clock_now();
+	idx->until = idx->from + idx->horizon;
+	idx->times = new_times_tree();
+	idx->alarms = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_alarm);
+	return idx;
+}
+
+// minutes or days of 0 or less are the defaults
+void conflicts_configure(conflict_index *idx, int minutes, int days)
+{
+	if (minutes <= 0) minutes = CONFLICT_MINUTES;
+	if (days <= 0) days = CONFLICT_DAYS;
+
+	malarm_debug("conflicts within %d min, over %d days\n", minutes, days);
+	idx->window = (time_t)minutes*60;
+	idx->horizon = (time_t)days*24*60*60;
+	rebuild(idx);
+}
+
+int conflicts_get_minutes(conflict_index *idx)
+{
+	return idx->window/60;
+}
+
+// event is the cached event of id, with the actual alarm time
+void conflicts_put(conflict_index *idx, guint id, const alarm_event_t *event, 
+		int enabled)
+{
+	conflict_alarm *a;
+
+	conflicts_remove(idx, id);
+	if (!enabled || (event == NULL)) return;
+
+	a = g_new0(conflict_alarm, 1);
+	a->id = id;
+	a->alarm_time = event->alarm_time;
+	a->snoozed = event->snoozed;
+	a->recurrence = event->recurrence;
+	a->times = g_array_new(FALSE, FALSE, sizeof(time_t));
+	a->next = first_occurrence(idx, id, a->alarm_time, a->snoozed, 
+			a->recurrence, 0);
+	expand_alarm(idx, a);
+	g_hash_table_insert(idx->alarms, GUINT_TO_POINTER(id), a);
+}
+
+void conflicts_remove(conflict_index *idx, guint id)
+{
+	conflict_alarm *a;
+
+	a = g_hash_table_lookup(idx->alarms, GUINT_TO_POINTER(id));
+	if (a == NULL) return;
+
+	remove_alarm_times(idx, a, a->times->len);
+	g_hash_table_remove(idx->alarms, GUINT_TO_POINTER(id));
+}
+
+void conflicts_clear(conflict_index *idx)
+{
+	g_hash_table_remove_all(idx->alarms);
+	g_tree_destroy(idx->times);
+	idx->times = new_times_tree();
+	idx->flags_stale = 0;
+}
+
+/* GTree has no lower bound search, but g_tree_search() calls the search
+ * function on each node of its path: the lowest key at or after the bound
+ * on that path is the lower bound.
+ */
+typedef struct {
+	conflict_time bound;
+	const conflict_time *found;
+} bound_search;
+
+static gint search_lower_bound(gconstpointer key, gconstpointer data)
+{
+	bound_search *search = (bound_search*)data;
+
+	if (compare_times(key, &search->bound, NULL) >= 0) {
+		search->found = (const conflict_time*)key;
+		return -1;
+	}
+	return 1;
+}
+
+/* An alarm other than skip_id with an occurrence within the window of
+ * time, 0 if none. If ids is not NULL, all such alarms are added to it.
+ */
+static guint find_near(conflict_index *idx, time_t time, guint skip_id, GArray *ids)
+{
+	bound_search search;
+	guint found_id = 0;
+	guint i;
+
+	search.bound.time = time - idx->window;
+	search.bound.id = 0;
+	for (;;) {
+		search.found = NULL;
+		g_tree_search(idx->times, search_lower_bound, &search);
+		if ((search.found == NULL) || (search.found->time > time + idx->window)) {
+			return found_id;
+		}
+
+		if (search.found->id != skip_id) {
+			found_id = search.found->id;
+			if (ids == NULL) return found_id;
+
+			for (i=0; (i<ids->len) && (g_array_index(ids, guint, i) != found_id); i++);
+			if (i == ids->len) g_array_append_val(ids, found_id);
+		}
+
+		// on to the next occurrence
+		search.bound = *search.found;
+		if (++search.bound.id == 0) search.bound.time++;
+	}
+}
+
+/* An alarm that fires within the window of an occurrence of event, 0 if
+ * none; alarm skip_id is the one edited, 0 for a new alarm. event is not
+ * in the index, its occurrences are checked up to the horizon.
+ */
+guint conflicts_check(conflict_index *idx, const alarm_event_t *event, 
+		guint32 weekdays, guint skip_id)
+{
+	time_t t;
+	guint id;
+
+	advance(idx);
+
+	t = first_occurrence(idx, 0, event->alarm_time, event->snoozed, 
+			event->recurrence, weekdays);
+	while ((t >= 0) && (t <= idx->until)) {
+		if ((id = find_near(idx, t, skip_id, NULL)) != 0) return id;
+		t = next_occurrence(idx->app, 0, event->alarm_time, event->recurrence, 
+				weekdays, t + 1);
+	}
+	return 0;
+}
+
+typedef struct {
+	time_t window;
+	GHashTable *alarms;
+	GQueue *near;  // conflict_time of the occurrences within the window
+} flag_search;
+
+/* Occurrences in time order, each compared with the earlier ones still
+ * within the window: one pass over the tree sets the flags of all alarms.
+ */
+static gboolean flag_conflicts(gpointer key, gpointer value, gpointer data)
+{
+	flag_search *search = (flag_search*)data;
+	const conflict_time *t = (const conflict_time*)key;
+	const conflict_time *prev;
+	GList *l;
+
+	while ((prev = g_queue_peek_head(search->near)) && 
+			(t->time - prev->time > search->window)) {
+		g_queue_pop_head(search->near);
+	}
+	for (l = search->near->head; l; l = l->next) {
+		prev = (const conflict_time*)l->data;
+		if (prev->id != t->id) {
+			((conflict_alarm*)value)->conflicts = 1;
+			((conflict_alarm*)g_hash_table_lookup(search->alarms, 
+				GUINT_TO_POINTER(prev->id)))->conflicts = 1;
+		}
+	}
+	g_queue_push_tail(search->near, (gpointer)t);
+	return FALSE;
+}
+
+static void clear_flag(gpointer key, gpointer value, gpointer data)
+{
+	((conflict_alarm*)value)->conflicts = 0;
+}
+
+// set the conflict flags again if the tree changed
+static void update_flags(conflict_index *idx)
+{
+	flag_search search;
+
+	if (!idx->flags_stale) return;
+
+	g_hash_table_foreach(idx->alarms, clear_flag, NULL);
+	search.window = idx->window;
+	search.alarms = idx->alarms;
+	search.near = g_queue_new();
+	g_tree_foreach(idx->times, flag_conflicts, &search);
+	g_queue_free(search.near);
+	idx->flags_stale = 0;
+}
+
+// true if alarm id conflicts with another one; O(1) unless the index
+// changed since the last call
+gboolean conflicts_has(conflict_index *idx, guint id)
+{
+	conflict_alarm *a;
+
+	advance(idx);
+	update_flags(idx);
+
+	a = g_hash_table_lookup(idx->alarms, GUINT_TO_POINTER(id));
+	return a && a->conflicts;
+}
+
+// ids of alarm id and of the alarms it conflicts with, id first
+GArray *conflicts_get_cluster(conflict_index *idx, guint id)
+{
+	conflict_alarm *a;
+	GArray *ids;
+	guint i;
+
+	advance(idx);
+
+	ids = g_array_new(FALSE, FALSE, sizeof(guint));
+	g_array_append_val(ids, id);
+
+	a = g_hash_table_lookup(idx->alarms, GUINT_TO_POINTER(id));
+	if (a == NULL) return ids;
+
+	for (i=0; i<a->times->len; i++) {
+		find_near(idx, g_array_index(a->times, time_t, i), id, ids);
+	}
+	return ids;
+}
+
+/* true if alarms id and other_id repeat alike and each of their
+ * occurrences up to the horizon is within the window of the other's: a
+ * copy, e.g. left by a clone, that can be merged into id
+ */
+gboolean conflicts_is_duplicate(conflict_index *idx, guint id, guint other_id)
+{
+	conflict_alarm *a, *b;
+	time_t ta, tb;
+	guint i;
+
+	advance(idx);
+
+	a = g_hash_table_lookup(idx->alarms, GUINT_TO_POINTER(id));
+	b = g_hash_table_lookup(idx->alarms, GUINT_TO_POINTER(other_id));
+	if ((a == NULL) || (b == NULL) || (a->recurrence != b->recurrence) || 
+			(a->times->len != b->times->len) || (a->times->len == 0)) {
+		return FALSE;
+	}
+
+	for (i=0; i<a->times->len; i++) {
+		ta = g_array_index(a->times, time_t, i);
+		tb = g_array_index(b->times, time_t, i);
+		if (((ta > tb) ? ta - tb : tb - ta) > idx->window) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+typedef struct {
+	time_t window;
+	const conflict_time *prev;
+	guint found_id;
+} first_search;
+
+/* If two alarms conflict, two occurrences next to each other in the tree
+ * are of different alarms and within the window, as the ones in between
+ * are at most as far apart.
+ */
+static gboolean find_first(gpointer key, gpointer value, gpointer data)
+{
+	first_search *search = (first_search*)data;
+	const conflict_time *t = (const conflict_time*)key;
+
+	if (search->prev && (search->prev->id != t->id) && 
+			(t->time - search->prev->time <= search->window)) {
+		search->found_id = search->prev->id;
+		return TRUE;
+	}
+	search->prev = t;
+	return FALSE;
+}
+
+// the alarm of the first conflict from now on, 0 if none
+guint conflicts_first(conflict_index *idx)
+{
+	first_search search = { idx->window, NULL, 0 };
+
+	advance(idx);
+	g_tree_foreach(idx->times, find_first, &search);
+	return search.found_id;
+}
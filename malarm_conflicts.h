@@ -0,0 +1,59 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_CONFLICTS_H_
+#define _MALARM_CONFLICTS_H_
+
+#include "malarm_main.h"
+
+/* Conflicts are enabled alarms that fire within a window of minutes of
+ * each other, e.g. duplicates left by a clone. The index keeps the
+ * occurrences of the alarms shown, in a balanced tree ordered by time:
+ * an alarm is put or removed, and the alarms near a time are found, in
+ * O(log n) per occurrence. Recurring alarms are expanded over a horizon
+ * of days only, and further as time goes on.
+ * The UI keeps it in step with its cached events (app->events), and uses
+ * it from the main loop only. Exception days come from the main loop copy
+ * of the calendars. Whether an alarm conflicts is set for all alarms in
+ * one pass when the index has changed, a row that is drawn only reads it.
+ */
+
+#define CONFLICT_MINUTES  2
+#define CONFLICT_DAYS     7   // a week has each daily and weekly instance
+
+#define MALARM_GCONF_CONFLICT_MINUTES  MALARM_GCONF_DIR "conflict_minutes"
+#define MALARM_GCONF_CONFLICT_DAYS     MALARM_GCONF_DIR "conflict_days"
+
+conflict_index *conflicts_new(app_data *app);
+void conflicts_configure(conflict_index *idx, int minutes, int days);
+int conflicts_get_minutes(conflict_index *idx);
+
+void conflicts_put(conflict_index *idx, guint id, const alarm_event_t *event, 
+		int enabled);
+void conflicts_remove(conflict_index *idx, guint id);
+void conflicts_clear(conflict_index *idx);
+void conflicts_reset(conflict_index *idx);
+
+guint conflicts_check(conflict_index *idx, const alarm_event_t *event, 
+		guint32 weekdays, guint skip_id);
+gboolean conflicts_has(conflict_index *idx, guint id);
+GArray *conflicts_get_cluster(conflict_index *idx, guint id);
+gboolean conflicts_is_duplicate(conflict_index *idx, guint id, guint other_id);
+guint conflicts_first(conflict_index *idx);
+
+#endif /* #define _MALARM_CONFLICTS_H_ */
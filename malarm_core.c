@@ -0,0 +1,508 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dbus/dbus.h>
+
+#include "malarm_core.h"
+#include "malarm_proto.h"
+#include "malarm_scan.h"
+#include "malarm_worker.h"
+#include "malarm_store.h"
+#include "malarm_registry.h"
+#include "malarm_util.h"
+#include "malarm_trace.h"
+#include "malarm_history.h"
+#include "malarm_journal.h"
+#include "malarm_clock.h"
+#include "malarm_warmup.h"
+#include "malarm_publish.h"
+
+// rescan this long after a fire, to see if it was snoozed or dismissed
+#define CORE_FOLLOW_UP_SECS  (5*60)
+
+typedef struct {
+	GArray *items;
+	guint next_id;
+} core_scan;
+
+typedef struct {
+	guint id;
+	time_t time;      // of the last fire, 0 when snoozed
+	guint32 snoozed;  // event->snoozed at the last fire or snooze
+} core_fire;
+
+static void free_core_item(scan_item *item)
+{
+	free_alarm_event_copy(item->event);
+	g_free(item);
+}
+
+// worker thread
+static void add_core_item(scan_item *item, gpointer data)
+{
+	g_array_append_val(((core_scan*)data)->items, *item);
+}
+
+// worker thread
+static void restart_core_scan(gpointer data)
+{
+	core_scan *scan = (core_scan*)data;
+	int i;
+
+	for (i=0; i<scan->items->len; i++) {
+		free_alarm_event_copy(g_array_index(scan->items, scan_item, i).event);
+	}
+	g_array_set_size(scan->items, 0);
+}
+
+/* worker thread: move enabled alarms that skip days to their next
+ * instance that is not excluded, as arm_calendar_alarms() of the UI.
+ */
+static void arm_core_items(app_data *app, GArray *items)
+{
+	scan_item *item;
+	cookie_t cookie;
+	time_t now;
+	int i;
+
+	now = clock_now();
+	journal_begin(app, 0, 0, 0);
+	for (i=0; i<items->len; i++) {
+		item = &g_array_index(items, scan_item, i);
+		if (!item->enabled || (item->event->snoozed > 0)) {
+			continue;
+		}
+		cookie = registry_arm_next(app, item->id, item->cookie, &item->event, now);
+		if (cookie != 0) {
+			item->cookie = cookie;
+		}
+	}
+	journal_commit(app);
+}
+
+// worker thread: read all alarms again, front ends may have written them
+static void run_core_scan(app_data *app, gpointer data)
+{
+	core_scan *scan = (core_scan*)data;
+	guint nevents;
+	gsize size;
+
+	trace_set_phase(TRACE_PHASE_REFRESH);
+	store_unload(app, &nevents, &size);
+	calendar_unload(app);
+
+	// a front end does not change the alarms between the scan and the arming
+	journal_lock(app);
+	scan->next_id = scan_alarms(app, add_core_item, restart_core_scan, scan);
+	arm_core_items(app, scan->items);
+	journal_unlock(app);
+}
+
+// send the changed alarms to all front ends
+static void send_delta(app_data *app, GArray *items)
+{
+	DBusMessage *msg;
+	char *text;
+
+	app->core_serial++;
+	text = proto_encode(app->core_serial, app->next_id, 
+			(scan_item*)items->data, items->len);
+
+	msg = dbus_message_new_signal(MALARM_CORE_DBUS_PATH, 
+			MALARM_CORE_DBUS_NAME, PROTO_DELTA);
+	if ((msg == NULL) || 
+			!dbus_message_append_args(msg, DBUS_TYPE_STRING, &text, 
+				DBUS_TYPE_INVALID) ||
+			!dbus_connection_send((DBusConnection*)app->core_conn, msg, NULL)) {
+		// front ends see the gap, and get a snapshot
+		malarm_print("error: failed to send delta %u\n", app->core_serial);
+	}
+	malarm_debug("delta %u: %u alarms\n", app->core_serial, items->len);
+
+	if (msg) dbus_message_unref(msg);
+	g_free(text);
+}
+
+static int same_event(const alarm_event_t *a, const alarm_event_t *b)
+{
+	GString *abuf, *bbuf;
+	int same;
+
+	abuf = g_string_sized_new(256);
+	bbuf = g_string_sized_new(256);
+	put_alarm_event(abuf, a);
+	put_alarm_event(bbuf, b);
+	same = (abuf->len == bbuf->len) && (memcmp(abuf->str, bbuf->str, abuf->len) == 0);
+	g_string_free(abuf, TRUE);
+	g_string_free(bbuf, TRUE);
+	return same;
+}
+
+typedef struct {
+	GHashTable *alarms;
+	GArray *delta;
+} core_diff;
+
+static void add_removed_item(gpointer key, gpointer value, gpointer data)
+{
+	core_diff *diff = (core_diff*)data;
+	scan_item item = { GPOINTER_TO_UINT(key), 0, NULL, FALSE };
+
+	if (g_hash_table_lookup(diff->alarms, key) == NULL) {
+		g_array_append_val(diff->delta, item);
+	}
+}
+
+// the time of the instance of event that fired at now, -1 if not known
+static time_t fired_alarm_time(const alarm_event_t *event, time_t now)
+{
+	time_t t = event->alarm_time;
+	time_t step;
+
+	if (t <= now) {
+		return t;
+	}
+	// alarmd already moved a recurring alarm to its next instance
+	if (event->recurrence <= 0) {
+		return -1;
+	}
+	step = (time_t)event->recurrence*60;
+	return t - ((t - now + step - 1)/step)*step;
+}
+
+static void record_fire(app_data *app, guint id, time_t now)
+{
+	scan_item *item;
+	core_fire *fire;
+	time_t t = -1;
+	gint32 late = -1;
+	int flags = 0;
+
+	item = g_hash_table_lookup(app->core_alarms, GUINT_TO_POINTER(id));
+	if (item) {
+		t = fired_alarm_time(item->event, now);
+	}
+	if (t >= 0) {
+		late = MAX(now - t, 0);
+		if (late > HISTORY_LATE_SECS) {
+			flags |= HISTORY_LATE;
+		}
+	}
+	history_add(app->history, id, HISTORY_FIRE, flags, late);
+
+	fire = g_hash_table_lookup(app->history_pending, GUINT_TO_POINTER(id));
+	if (fire == NULL) {
+		fire = g_new0(core_fire, 1);
+		fire->id = id;
+		fire->snoozed = item ? item->event->snoozed : 0;
+		g_hash_table_insert(app->history_pending, GUINT_TO_POINTER(id), fire);
+	}
+	fire->time = now;
+}
+
+/* A fire is snoozed if the snooze count of its alarm goes up, and
+ * dismissed if the alarm is gone, or its count drops or stays the same
+ * for CORE_FOLLOW_UP_SECS. A snoozed alarm waits for its next fire.
+ * Both are seen by a scan, their time is when the core noticed them.
+ */
+static gboolean update_fire(gpointer key, gpointer value, gpointer data)
+{
+	app_data *app = (app_data*)data;
+	core_fire *fire = (core_fire*)value;
+	scan_item *item;
+
+	item = g_hash_table_lookup(app->core_alarms, key);
+	if (item && (item->event->snoozed > fire->snoozed)) {
+		history_add(app->history, fire->id, HISTORY_SNOOZE, 0, 
+				item->event->snoozed - fire->snoozed);
+		fire->snoozed = item->event->snoozed;
+		fire->time = 0;
+		return FALSE;
+	}
+	if (item && (item->event->snoozed == fire->snoozed) && 
+			((fire->time == 0) || (clock_now() < fire->time + CORE_FOLLOW_UP_SECS))) {
+		return FALSE;
+	}
+
+	history_add(app->history, fire->id, HISTORY_DISMISS, 0, 0);
+	return TRUE;
+}
+
+static void update_history(app_data *app)
+{
+	core_fire *fire;
+	int i;
+
+	if (app->history == NULL) {
+		return;
+	}
+
+	// fires that started the core are matched with its first scan
+	for (i=0; i<app->history_fired->len; i++) {
+		fire = &g_array_index(app->history_fired, core_fire, i);
+		record_fire(app, fire->id, fire->time);
+	}
+	g_array_set_size(app->history_fired, 0);
+
+	g_hash_table_foreach_remove(app->history_pending, update_fire, app);
+}
+
+static gboolean cb_follow_up(gpointer data)
+{
+	app_data *app = (app_data*)data;
+
+	app->history_follow_up = 0;
+	core_rescan(app);
+	return FALSE;
+}
+
+// main loop: alarm id triggered
+static void alarm_fired(app_data *app, guint id)
+{
+	core_fire fire = { id, clock_now(), 0 };
+
+	if (id == 0) {
+		return;
+	}
+	if (app->core_loaded) {
+		warmup_fired(app, id);
+	}
+	if (app->history == NULL) {
+		return;
+	}
+
+	if (app->core_loaded) {
+		record_fire(app, id, fire.time);
+	} else {
+		g_array_append_val(app->history_fired, fire);
+	}
+
+	if (app->history_follow_up) {
+		g_source_remove(app->history_follow_up);
+	}
+	app->history_follow_up = g_timeout_add((CORE_FOLLOW_UP_SECS + 1)*1000, 
+			cb_follow_up, app);
+}
+
+// main loop: replace the model, and send what changed
+static void done_core_scan(app_data *app, gpointer data)
+{
+	core_scan *scan = (core_scan*)data;
+	core_diff diff;
+	scan_item *item, *old;
+	int i;
+
+	app->core_scanning = 0;
+	if (app->core_rescan) {
+		// alarms changed during the scan, its result may be stale
+		free_scan_items(scan->items);
+		g_free(scan);
+		app->core_rescan = 0;
+		core_rescan(app);
+		return;
+	}
+
+	diff.alarms = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_core_item);
+	diff.delta = g_array_new(FALSE, FALSE, sizeof(scan_item));
+
+	for (i=0; i<scan->items->len; i++) {
+		item = g_new(scan_item, 1);
+		*item = g_array_index(scan->items, scan_item, i);
+		g_hash_table_replace(diff.alarms, GUINT_TO_POINTER(item->id), item);
+
+		old = g_hash_table_lookup(app->core_alarms, GUINT_TO_POINTER(item->id));
+		if ((old == NULL) || (old->cookie != item->cookie) || 
+				(old->enabled != item->enabled) || 
+				!same_event(old->event, item->event)) {
+			g_array_append_val(diff.delta, *item);
+		}
+	}
+	g_hash_table_foreach(app->core_alarms, add_removed_item, &diff);
+
+	app->next_id = MAX(app->next_id, scan->next_id);
+	if (diff.delta->len > 0) {
+		send_delta(app, diff.delta);
+	}
+
+	// the events of the delta are owned by the new model
+	g_array_free(diff.delta, TRUE);
+	g_hash_table_destroy(app->core_alarms);
+	app->core_alarms = diff.alarms;
+	g_array_free(scan->items, TRUE);
+	g_free(scan);
+
+	app->core_loaded = 1;
+	update_history(app);
+	warmup_schedule(app);
+	publish_alarms(app);
+}
+
+// main loop: read all alarms in the worker, at most one scan at a time
+void core_rescan(app_data *app)
+{
+	core_scan *scan;
+
+	if (app->core_scanning) {
+		app->core_rescan = 1;
+		return;
+	}
+	app->core_scanning = 1;
+
+	scan = g_new0(core_scan, 1);
+	scan->items = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	worker_submit(app, run_core_scan, done_core_scan, scan);
+}
+
+static void add_snapshot_item(gpointer key, gpointer value, gpointer data)
+{
+	g_array_append_val((GArray*)data, *(scan_item*)value);
+}
+
+static char *encode_snapshot(app_data *app)
+{
+	GArray *items;
+	char *text;
+
+	items = g_array_sized_new(FALSE, FALSE, sizeof(scan_item), 
+			g_hash_table_size(app->core_alarms));
+	g_hash_table_foreach(app->core_alarms, add_snapshot_item, items);
+	text = proto_encode(app->core_serial, app->next_id, 
+			(scan_item*)items->data, items->len);
+	g_array_free(items, TRUE);
+	return text;
+}
+
+// apply the alarms changed by a front end, and pass them on
+static int apply_changed(app_data *app, const char *text)
+{
+	GArray *items;
+	guint32 serial, next_id;
+	scan_item *item;
+	int i;
+
+	if ((items = proto_decode(text, &serial, &next_id)) == NULL) {
+		return -1;
+	}
+
+	for (i=0; i<items->len; i++) {
+		item = &g_array_index(items, scan_item, i);
+		if (item->event) {
+			g_hash_table_replace(app->core_alarms, GUINT_TO_POINTER(item->id), 
+					g_memdup(item, sizeof(scan_item)));
+		} else {
+			g_hash_table_remove(app->core_alarms, GUINT_TO_POINTER(item->id));
+		}
+	}
+	app->next_id = MAX(app->next_id, next_id);
+	if (app->core_scanning) {
+		app->core_rescan = 1;
+	}
+	if (items->len > 0) {
+		send_delta(app, items);
+		warmup_schedule(app);
+		publish_alarms(app);
+	}
+
+	// the events are owned by the model now
+	g_array_free(items, TRUE);
+	return 0;
+}
+
+static gint cb_core_rpc(const gchar *interface, const gchar *method, 
+		GArray *arguments, gpointer data, osso_rpc_t *retval)
+{
+	app_data *app = (app_data*)data;
+	osso_rpc_t *arg = NULL;
+
+	g_assert(app != NULL);
+
+	malarm_debug("interface=%s, method=%s\n", interface, method);
+	retval->type = DBUS_TYPE_INVALID;
+
+	if (arguments && (arguments->len > 0)) {
+		arg = &g_array_index(arguments, osso_rpc_t, 0);
+	}
+
+	if (strcmp(method, PROTO_SNAPSHOT) == 0) {
+		// freed by libosso
+		retval->type = DBUS_TYPE_STRING;
+		retval->value.s = encode_snapshot(app);
+	} else if (strcmp(method, PROTO_CHANGED) == 0) {
+		if ((arg == NULL) || (arg->type != DBUS_TYPE_STRING) || 
+				(apply_changed(app, arg->value.s) != 0)) {
+			malarm_print("error: bad %s message\n", PROTO_CHANGED);
+			return OSSO_ERROR;
+		}
+	} else {
+		// PROTO_RESCAN, or MALARM_DBUS_METHOD "_<id>" when an alarm triggers
+		alarm_fired(app, method_to_id(method));
+		core_rescan(app);
+	}
+	return OSSO_OK;
+}
+
+int core_start(app_data *app)
+{
+	osso_return_t osso_ret;
+
+	app->core_conn = osso_get_dbus_connection(app->ctx);
+	app->core_alarms = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_core_item);
+	app->history = history_open(TRUE);
+	app->history_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, g_free);
+	app->history_fired = g_array_new(FALSE, FALSE, sizeof(core_fire));
+	publish_start(app);
+
+	osso_ret = osso_rpc_set_cb_f(app->ctx, MALARM_CORE_DBUS_NAME, 
+			MALARM_CORE_DBUS_PATH, MALARM_CORE_DBUS_NAME, cb_core_rpc, app);
+	if (osso_ret != OSSO_OK) {
+		malarm_print("error: failed to register LibOSSO callback function\n");
+		return -1;
+	}
+
+	// snapshots are empty until the first scan is done, front ends get
+	// its alarms as a delta
+	core_rescan(app);
+	return 0;
+}
+
+// after worker_stop()
+void core_stop(app_data *app)
+{
+	osso_rpc_unset_cb_f(app->ctx, MALARM_CORE_DBUS_NAME, 
+			MALARM_CORE_DBUS_PATH, MALARM_CORE_DBUS_NAME, cb_core_rpc, app);
+	warmup_stop(app);
+	publish_stop(app);
+
+	if (app->core_alarms) {
+		g_hash_table_destroy(app->core_alarms);
+		app->core_alarms = NULL;
+	}
+
+	// fires not yet dismissed are not logged as such
+	if (app->history_follow_up) {
+		g_source_remove(app->history_follow_up);
+		app->history_follow_up = 0;
+	}
+	history_close(app->history);
+	app->history = NULL;
+	g_hash_table_destroy(app->history_pending);
+	g_array_free(app->history_fired, TRUE);
+}
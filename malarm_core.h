@@ -0,0 +1,44 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_CORE_H_
+#define _MALARM_CORE_H_
+
+#include "malarm_main.h"
+
+/* The core service, malarmd, keeps all alarms in memory, as read by
+ * scan_alarms(). It has no GTK and stays resident once started, so
+ * opening the UI does not wait for an alarmd scan: front ends get a
+ * snapshot, then deltas (see malarm_proto.h). The GTK UI is one front
+ * end (see malarm_client.h), "malarmd --list" another.
+ *
+ * Alarms created by this version call the core when they trigger; it
+ * scans again, re-arms alarms that skip days, and sends the changes.
+ * Front ends still write alarmd and the store through their own worker,
+ * and report each change with PROTO_CHANGED.
+ *
+ * Fires, and the snoozes and dismissals the scans see, are logged to the
+ * alarm history (see malarm_history.h). The sounds of the next alarms
+ * are read ahead of their time (see malarm_warmup.h).
+ */
+
+int core_start(app_data *app);
+void core_stop(app_data *app);
+void core_rescan(app_data *app);
+
+#endif /* #define _MALARM_CORE_H_ */
@@ -0,0 +1,234 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* malarmd, the core service (see malarm_core.h). Started by D-Bus when
+ * the UI or alarmd first calls it, it then stays resident.
+ *
+ *   malarmd                    run the service
+ *   malarmd --list             print the alarms of the running service
+ *   malarmd --history [days]   print what the alarms of the last days
+ *                              (default 30) did, from the alarm history
+ *   malarmd --simulate [days] [alarms]
+ *                              run alarms for a year (or days) on a
+ *                              simulated clock, see malarm_simulate.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "malarm_main.h"
+#include "malarm_core.h"
+#include "malarm_proto.h"
+#include "malarm_util.h"
+#include "malarm_worker.h"
+#include "malarm_journal.h"
+#include "malarm_fetch.h"
+#include "malarm_trace.h"
+#include "malarm_backend.h"
+#include "malarm_history.h"
+#include "malarm_clock.h"
+#include "malarm_simulate.h"
+
+static GMainLoop *main_loop;
+
+static void cb_osso_exit(gboolean die_now, gpointer data)
+{
+	g_main_loop_quit(main_loop);
+}
+
+static gint compare_items(gconstpointer a, gconstpointer b)
+{
+	guint ida = ((const scan_item*)a)->id;
+	guint idb = ((const scan_item*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+// a command line front end: one line per alarm, from a snapshot
+static int list_alarms(osso_context_t *ctx)
+{
+	osso_rpc_t retval = { };
+	osso_return_t osso_ret;
+	GArray *items = NULL;
+	guint32 serial, next_id;
+	scan_item *item;
+	struct tm stm;
+	char buf[100];
+	int i;
+
+	osso_ret = osso_rpc_run(ctx, MALARM_CORE_DBUS_NAME, MALARM_CORE_DBUS_PATH, 
+			MALARM_CORE_DBUS_NAME, PROTO_SNAPSHOT, &retval, DBUS_TYPE_INVALID);
+	if ((osso_ret == OSSO_OK) && (retval.type == DBUS_TYPE_STRING)) {
+		items = proto_decode(retval.value.s, &serial, &next_id);
+	}
+	osso_rpc_free_val(&retval);
+	if (items == NULL) {
+		malarm_print("error: no snapshot from %s\n", MALARM_CORE_DBUS_NAME);
+		return -1;
+	}
+
+	g_array_sort(items, compare_items);
+	for (i=0; i<items->len; i++) {
+		item = &g_array_index(items, scan_item, i);
+		localtime_r(&item->event->alarm_time, &stm);
+		date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+		printf("%u\t%s\t%s\t%s\n", item->id, item->enabled ? "on" : "off", buf, 
+				item->event->message ? 
+					alarm_unescape_string_noalloc(item->event->message) : "");
+	}
+
+	free_scan_items(items);
+	return 0;
+}
+
+typedef struct {
+	guint n[2];      // sounds at fire, cold and warm
+	gint64 percent[2];
+	gint32 min[2];   // least cached
+} sound_stats;
+
+static void add_sound_load(const history_record *rec, gpointer data)
+{
+	sound_stats *st = (sound_stats*)data;
+	int warm = (rec->flags & HISTORY_WARM) != 0;
+
+	if (rec->type != HISTORY_SOUND) return;
+
+	st->min[warm] = st->n[warm] ? MIN(st->min[warm], rec->value) : rec->value;
+	st->n[warm]++;
+	st->percent[warm] += rec->value;
+}
+
+// reads the log directly, the service need not be running
+static int print_history(int days)
+{
+	history *hist;
+	GArray *stats;
+	history_stats *st;
+	sound_stats sounds = { };
+	time_t now, since;
+	int i;
+
+	if ((hist = history_open(FALSE)) == NULL) {
+		malarm_print("error: no alarm history\n");
+		return -1;
+	}
+
+	now = clock_now();
+	since = now - (time_t)days*24*60*60;
+	printf("fires in the last week: %u\n", 
+			history_count(hist, now - 7*24*60*60, HISTORY_FIRE));
+	printf("last %d days:\nid\tfires\tlate\tsnoozes\tper fire\tdismissed\n", days);
+
+	stats = history_get_stats(hist, since);
+	for (i=0; i<stats->len; i++) {
+		st = &g_array_index(stats, history_stats, i);
+		printf("%u\t%u\t%u\t%u\t%.2f\t\t%u\n", st->id, st->fires, 
+				st->late_fires, st->snoozes, 
+				st->fires ? (double)st->snoozes/st->fires : 0.0, st->dismisses);
+	}
+
+	g_array_free(stats, TRUE);
+
+	history_foreach(hist, since, add_sound_load, &sounds);
+	for (i=1; i>=0; i--) {
+		if (sounds.n[i] == 0) continue;
+		printf("sounds cached at fire, %s: %u, %.1f%% average, %d%% min\n", 
+				i ? "warmed up" : "cold", sounds.n[i], 
+				(double)sounds.percent[i]/sounds.n[i], sounds.min[i]);
+	}
+
+	history_close(hist);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	app_data app = { };
+	osso_context_t *ctx;
+	int ret;
+
+	g_thread_init(NULL);
+	// libalarm is called from several fetch threads at once
+	dbus_threads_init_default();
+	g_type_init();
+	clock_init();
+
+	if ((argc > 1) && (strcmp(argv[1], "--list") == 0)) {
+		ctx = osso_initialize(MALARM_CORE_DBUS_NAME ".list", MALARM_VERSION, 
+				FALSE, NULL);
+		if (ctx == NULL) {
+			malarm_print("error: failed to init LibOSSO\n");
+			return 1;
+		}
+		ret = list_alarms(ctx);
+		osso_deinitialize(ctx);
+		return (ret == 0) ? 0 : 1;
+	}
+
+	if ((argc > 1) && (strcmp(argv[1], "--history") == 0)) {
+		return (print_history((argc > 2) ? MAX(atoi(argv[2]), 1) : 30) == 0) ? 0 : 1;
+	}
+
+	if ((argc > 1) && (strcmp(argv[1], "--simulate") == 0)) {
+		ret = simulate_run((argc > 2) ? MAX(atoi(argv[2]), 1) : SIMULATE_DAYS, 
+				(argc > 3) ? MAX(atoi(argv[3]), 1) : SIMULATE_ALARMS);
+		return (ret == 0) ? 0 : 1;
+	}
+
+	trace_start();
+
+	app.ctx = osso_initialize(MALARM_CORE_DBUS_NAME, MALARM_VERSION, TRUE, NULL);
+	if (app.ctx == NULL) {
+		malarm_print("error: failed to init LibOSSO\n");
+		return 1;
+	}
+
+	app.gconf = gconf_client_get_default();
+	g_assert(GCONF_IS_CLIENT(app.gconf));
+
+	if (backend_open(&app) != 0) {
+		return 1;
+	}
+
+	worker_start(&app);
+	journal_start(&app, "journal-core");
+	if (core_start(&app) != 0) {
+		return 1;
+	}
+
+	if (osso_application_set_exit_cb(app.ctx, cb_osso_exit, NULL) != OSSO_OK) {
+		// not fatal, the service is just killed
+		malarm_print("error: failed to register LibOSSO exit callback\n");
+	}
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+	g_main_loop_run(main_loop);
+	g_main_loop_unref(main_loop);
+
+	worker_stop(&app);
+	journal_stop(&app);
+	fetch_stop(&app);
+	core_stop(&app);
+	backend_close(&app);
+
+	osso_deinitialize(app.ctx);
+	trace_stop();
+
+	return 0;
+}
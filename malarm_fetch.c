@@ -0,0 +1,106 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_fetch.h"
+#include "malarm_backend.h"
+
+typedef struct {
+	app_data *app;
+	cookie_t cookie;
+	alarm_event_t *event;
+	GAsyncQueue *done;
+} fetch_task;
+
+// fetch pool thread: one blocking alarmd request
+static void fetch_one(gpointer data, gpointer user_data)
+{
+	fetch_task *task = (fetch_task*)data;
+
+	task->event = backend_event_get(task->app, task->cookie);
+	g_async_queue_push(task->done, task);
+}
+
+void fetch_events(app_data *app, const cookie_t *cookies, int ncookies, 
+		fetch_func func, gpointer data)
+{
+	GAsyncQueue *done;
+	fetch_task *tasks;
+	fetch_task *task;
+	alarm_event_t **events;
+	GError *error = NULL;
+	int i;
+
+	if (ncookies <= 0) return;
+
+	if (backend_has_event_get_batch(app)) {
+		// the backend answers a batch without a request per event
+		events = g_new(alarm_event_t*, ncookies);
+		backend_event_get_batch(app, cookies, ncookies, events);
+		for (i=0; i<ncookies; i++) {
+			func(cookies[i], events[i], data);
+		}
+		g_free(events);
+		return;
+	}
+
+	if (app->fetch_pool == NULL) {
+		app->fetch_pool = g_thread_pool_new(fetch_one, NULL, FETCH_THREADS, 
+				TRUE, &error);
+		if (app->fetch_pool == NULL) {
+			malarm_print("error: failed to create fetch threads: %s\n", 
+					error->message);
+			g_error_free(error);
+		}
+	}
+
+	if (app->fetch_pool == NULL) {
+		// fall back to fetching one at a time
+		for (i=0; i<ncookies; i++) {
+			func(cookies[i], backend_event_get(app, cookies[i]), data);
+		}
+		return;
+	}
+
+	done = g_async_queue_new();
+	tasks = g_new0(fetch_task, ncookies);
+
+	// all requests are queued at once, FETCH_THREADS of them are in flight
+	for (i=0; i<ncookies; i++) {
+		tasks[i].app = app;
+		tasks[i].cookie = cookies[i];
+		tasks[i].done = done;
+		g_thread_pool_push(app->fetch_pool, &tasks[i], NULL);
+	}
+
+	// decode results while the other requests are still in flight
+	for (i=0; i<ncookies; i++) {
+		task = g_async_queue_pop(done);
+		func(task->cookie, task->event, data);
+	}
+
+	g_free(tasks);
+	g_async_queue_unref(done);
+}
+
+void fetch_stop(app_data *app)
+{
+	if (app->fetch_pool == NULL) return;
+
+	g_thread_pool_free(app->fetch_pool, FALSE, TRUE);
+	app->fetch_pool = NULL;
+}
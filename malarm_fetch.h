@@ -0,0 +1,37 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_FETCH_H_
+#define _MALARM_FETCH_H_
+
+#include "malarm_main.h"
+
+// number of backend_event_get() requests kept in flight
+#define FETCH_THREADS  4
+
+/* Called for each fetched event, in the thread that called fetch_events(),
+ * in completion order (not in cookie order). event is NULL if the cookie
+ * is gone, else func must free it with backend_event_free().
+ */
+typedef void (*fetch_func)(cookie_t cookie, alarm_event_t *event, gpointer data);
+
+void fetch_events(app_data *app, const cookie_t *cookies, int ncookies, 
+		fetch_func func, gpointer data);
+void fetch_stop(app_data *app);
+
+#endif /* #define _MALARM_FETCH_H_ */
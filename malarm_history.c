@@ -0,0 +1,306 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "malarm_history.h"
+#include "malarm_util.h"
+#include "malarm_clock.h"
+
+#define HISTORY_FILE  "history"
+#define HISTORY_MAGIC    0x484c414d  /* "MALH" */
+#define HISTORY_VERSION  1
+#define HISTORY_HEADER_SIZE  32
+#define HISTORY_RECORDS  16384  /* 256 KB, years of alarms */
+#define HISTORY_FLUSH_MS  (60*1000)
+
+#define HISTORY_SIZE \
+	(HISTORY_HEADER_SIZE + HISTORY_RECORDS*sizeof(history_record))
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 record_size;
+	guint32 nrecords;
+	guint32 next;   // slot of the next record
+	guint32 count;  // records written, at most nrecords
+} history_header;
+
+struct _history {
+	int fd;
+	guchar *map;
+	int writable;
+	int dirty;
+	guint flush_timer;
+};
+
+#define HISTORY_HEADER(h)  ((history_header*)(h)->map)
+#define HISTORY_RECORD(h, i) \
+	((history_record*)((h)->map + HISTORY_HEADER_SIZE) + (i))
+
+static char *get_history_path(void)
+{
+	return get_data_path(HISTORY_FILE);
+}
+
+// NULL if there is no log yet, or it cannot be mapped
+history *history_open(int writable)
+{
+	history *hist;
+	history_header *header;
+	struct stat st;
+	char *path, *dir;
+	int created = 0;
+
+	path = get_history_path();
+	if (writable) {
+		dir = g_path_get_dirname(path);
+		g_mkdir_with_parents(dir, 0700);
+		g_free(dir);
+	}
+
+	hist = g_new0(history, 1);
+	hist->writable = writable;
+	hist->fd = g_open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0600);
+	if ((hist->fd < 0) || (fstat(hist->fd, &st) != 0)) {
+		if (writable || (errno != ENOENT)) {
+			malarm_print("error: failed to open %s: %s\n", path, g_strerror(errno));
+		}
+		goto error;
+	}
+
+	if (writable && (st.st_size == 0)) {
+		if (ftruncate(hist->fd, HISTORY_SIZE) != 0) {
+			malarm_print("error: failed to create %s: %s\n", path, g_strerror(errno));
+			goto error;
+		}
+		created = 1;
+	} else if (st.st_size != HISTORY_SIZE) {
+		malarm_print("error: %s has the wrong size\n", path);
+		goto error;
+	}
+
+	hist->map = mmap(NULL, HISTORY_SIZE, 
+			writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, hist->fd, 0);
+	if (hist->map == MAP_FAILED) {
+		malarm_print("error: failed to map %s: %s\n", path, g_strerror(errno));
+		hist->map = NULL;
+		goto error;
+	}
+
+	header = HISTORY_HEADER(hist);
+	if (created) {
+		header->magic = HISTORY_MAGIC;
+		header->version = HISTORY_VERSION;
+		header->record_size = sizeof(history_record);
+		header->nrecords = HISTORY_RECORDS;
+	} else if ((header->magic != HISTORY_MAGIC) || 
+			(header->version != HISTORY_VERSION) || 
+			(header->record_size != sizeof(history_record)) || 
+			(header->nrecords != HISTORY_RECORDS) || 
+			(header->next >= HISTORY_RECORDS) || 
+			(header->count > HISTORY_RECORDS)) {
+		malarm_print("error: %s is not a history log\n", path);
+		goto error;
+	}
+
+	g_free(path);
+	return hist;
+
+error:
+	g_free(path);
+	history_close(hist);
+	return NULL;
+}
+
+void history_close(history *hist)
+{
+	if (hist == NULL) {
+		return;
+	}
+	history_flush(hist);
+	if (hist->map) {
+		munmap(hist->map, HISTORY_SIZE);
+	}
+	if (hist->fd >= 0) {
+		close(hist->fd);
+	}
+	g_free(hist);
+}
+
+void history_flush(history *hist)
+{
+	if (hist->flush_timer) {
+		g_source_remove(hist->flush_timer);
+		hist->flush_timer = 0;
+	}
+	if (hist->dirty) {
+		if (msync(hist->map, HISTORY_SIZE, MS_SYNC) != 0) {
+			malarm_print("error: failed to sync history: %s\n", g_strerror(errno));
+		}
+		hist->dirty = 0;
+	}
+}
+
+static gboolean cb_flush_history(gpointer data)
+{
+	history *hist = (history*)data;
+
+	hist->flush_timer = 0;
+	history_flush(hist);
+	return FALSE;
+}
+
+// main loop: the record is on disk within HISTORY_FLUSH_MS
+void history_add(history *hist, guint id, int type, int flags, gint32 value)
+{
+	history_header *header = HISTORY_HEADER(hist);
+	history_record *rec;
+
+	g_assert(hist->writable);
+
+	rec = HISTORY_RECORD(hist, header->next);
+	rec->time = clock_now();
+	rec->id = id;
+	rec->value = value;
+	rec->type = type;
+	rec->flags = flags;
+
+	// a reader sees the record only once it is complete
+	header->next = (header->next + 1) % HISTORY_RECORDS;
+	if (header->count < HISTORY_RECORDS) {
+		header->count++;
+	}
+
+	hist->dirty = 1;
+	if (hist->flush_timer == 0) {
+		hist->flush_timer = g_timeout_add(HISTORY_FLUSH_MS, cb_flush_history, hist);
+	}
+	malarm_debug("id %u: type %d, flags %d, value %d\n", id, type, flags, value);
+}
+
+// records since a time, oldest first
+void history_foreach(history *hist, time_t since, history_func func, 
+		gpointer data)
+{
+	history_header *header = HISTORY_HEADER(hist);
+	const history_record *rec;
+	guint32 next, count, i;
+
+	// copied once, the core may append while a reader scans
+	next = header->next;
+	count = MIN(header->count, HISTORY_RECORDS);
+	if (next >= HISTORY_RECORDS) {
+		return;
+	}
+
+	for (i=0; i<count; i++) {
+		rec = HISTORY_RECORD(hist, 
+				(next + HISTORY_RECORDS - count + i) % HISTORY_RECORDS);
+		if (rec->time >= since) {
+			func(rec, data);
+		}
+	}
+}
+
+typedef struct {
+	int type;
+	guint count;
+} count_data;
+
+static void count_record(const history_record *rec, gpointer data)
+{
+	count_data *cd = (count_data*)data;
+
+	if (rec->type == cd->type) {
+		cd->count++;
+	}
+}
+
+// e.g. fires of the last week
+guint history_count(history *hist, time_t since, int type)
+{
+	count_data cd = { type, 0 };
+
+	history_foreach(hist, since, count_record, &cd);
+	return cd.count;
+}
+
+static void add_stats_record(const history_record *rec, gpointer data)
+{
+	GHashTable *table = (GHashTable*)data;
+	history_stats *stats;
+
+	stats = g_hash_table_lookup(table, GUINT_TO_POINTER(rec->id));
+	if (stats == NULL) {
+		stats = g_new0(history_stats, 1);
+		stats->id = rec->id;
+		g_hash_table_insert(table, GUINT_TO_POINTER(rec->id), stats);
+	}
+
+	switch (rec->type) {
+	case HISTORY_FIRE:
+		stats->fires++;
+		if (rec->flags & HISTORY_LATE) {
+			stats->late_fires++;
+		}
+		break;
+	case HISTORY_SNOOZE:
+		stats->snoozes += MAX(rec->value, 1);
+		break;
+	case HISTORY_DISMISS:
+		stats->dismisses++;
+		break;
+	}
+}
+
+static void append_stats(gpointer key, gpointer value, gpointer data)
+{
+	g_array_append_val((GArray*)data, *(history_stats*)value);
+}
+
+static gint compare_stats(gconstpointer a, gconstpointer b)
+{
+	guint ida = ((const history_stats*)a)->id;
+	guint idb = ((const history_stats*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+// one history_stats per alarm seen since a time, sorted by id
+GArray *history_get_stats(history *hist, time_t since)
+{
+	GHashTable *table;
+	GArray *stats;
+
+	table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	history_foreach(hist, since, add_stats_record, table);
+
+	stats = g_array_sized_new(FALSE, FALSE, sizeof(history_stats), 
+			g_hash_table_size(table));
+	g_hash_table_foreach(table, append_stats, stats);
+	g_array_sort(stats, compare_stats);
+
+	g_hash_table_destroy(table);
+	return stats;
+}
@@ -0,0 +1,75 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_HISTORY_H_
+#define _MALARM_HISTORY_H_
+
+#include "malarm_main.h"
+
+/* Append-only log of alarm fires, snoozes and dismissals, written by the
+ * core service (see malarm_core.h). It is a ring of HISTORY_RECORDS fixed
+ * size records in MALARM_DATA_DIR, mapped into memory: a query is a
+ * sequential scan of at most a few hundred KB, oldest record first.
+ * Records are written to the mapping, and synced at most once every
+ * HISTORY_FLUSH_MS, so an alarm does not cost a disk sync.
+ *
+ * Any process can map the log read-only, e.g. "malarmd --history".
+ */
+
+#define HISTORY_FIRE     1
+#define HISTORY_SNOOZE   2
+#define HISTORY_DISMISS  3
+// 4 was the ms to load the sound of a fire, those records are skipped
+#define HISTORY_SOUND    5  // sound of a fire cached, see malarm_warmup.h
+
+#define HISTORY_LATE  (1 << 0)  // fire flag, see HISTORY_LATE_SECS
+#define HISTORY_WARM  (1 << 1)  // sound flag, it was warmed up
+
+// a fire this late was held back by alarmd, e.g. the device was off
+#define HISTORY_LATE_SECS  (5*60)
+
+typedef struct {
+	guint32 time;
+	guint32 id;
+	gint32 value;   // fire: seconds late (-1 if not known), snooze: count,
+	                // sound: percent of it in the page cache
+	guint16 type;   // HISTORY_FIRE, ...
+	guint16 flags;
+} history_record;
+
+typedef struct {
+	guint id;
+	guint fires;
+	guint late_fires;
+	guint snoozes;
+	guint dismisses;
+} history_stats;
+
+typedef void (*history_func)(const history_record *rec, gpointer data);
+
+history *history_open(int writable);
+void history_close(history *hist);
+void history_add(history *hist, guint id, int type, int flags, gint32 value);
+void history_flush(history *hist);
+
+void history_foreach(history *hist, time_t since, history_func func, 
+		gpointer data);
+guint history_count(history *hist, time_t since, int type);
+GArray *history_get_stats(history *hist, time_t since);
+
+#endif /* #define _MALARM_HISTORY_H_ */
@@ -0,0 +1,363 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <glib/gstdio.h>
+
+#include "malarm_journal.h"
+#include "malarm_worker.h"
+#include "malarm_backend.h"
+#include "malarm_registry.h"
+#include "malarm_store.h"
+#include "malarm_calendar.h"
+#include "malarm_util.h"
+
+#define JOURNAL_MAGIC  0x4a4c414d  /* "MALJ" */
+#define LOCK_FILE  "lock"
+
+// record types
+#define JOURNAL_BEGIN  1
+#define JOURNAL_ADDED  2
+
+typedef struct {
+	guint32 type;
+	guint32 id;
+	gint64 cookie;   // old cookie for JOURNAL_BEGIN, new for JOURNAL_ADDED
+	guint32 flags;
+	guint32 check;   // a torn record at the end is ignored
+} journal_record;
+
+struct _journal {
+	char *path;
+	int fd;
+	int open_ops;  // begun since the last commit
+	int lock_fd;   // the lock of all programs on MALARM_DATA_DIR
+	int locks;     // nested journal_lock() calls
+	guint32 generation;  // of the data, when this program last held the lock
+};
+
+// an operation left in the journal
+typedef struct {
+	guint id;
+	cookie_t old_cookie;
+	cookie_t new_cookie;  // 0 if not logged
+	int flags;
+} journal_op;
+
+static guint32 record_check(const journal_record *rec)
+{
+	return JOURNAL_MAGIC ^ rec->type ^ rec->id ^ rec->flags ^ 
+		(guint32)rec->cookie ^ (guint32)((guint64)rec->cookie >> 32);
+}
+
+static void write_record(journal *jn, int type, guint id, cookie_t cookie, 
+		int flags)
+{
+	journal_record rec = { type, id, cookie, flags, 0 };
+
+	if (jn->fd < 0) return;
+
+	rec.check = record_check(&rec);
+	if (write(jn->fd, &rec, sizeof(rec)) != sizeof(rec)) {
+		malarm_print("error: failed to write %s: %s\n", jn->path, g_strerror(errno));
+	}
+}
+
+static void truncate_journal(journal *jn)
+{
+	if ((jn->fd >= 0) && (ftruncate(jn->fd, 0) != 0)) {
+		malarm_print("error: failed to truncate %s: %s\n", jn->path, 
+				g_strerror(errno));
+	}
+}
+
+static int lock_file(journal *jn, int op)
+{
+	while (flock(jn->lock_fd, op) != 0) {
+		if (errno != EINTR) {
+			malarm_print("error: failed to lock %s: %s\n", LOCK_FILE, 
+					g_strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* worker thread: keep the other programs off alarmd, the registry and the
+ * files of MALARM_DATA_DIR until journal_unlock(). Calls nest. If another
+ * program changed them since this one last held the lock, the store and
+ * the calendars in memory are dropped, to be read again.
+ */
+void journal_lock(app_data *app)
+{
+	journal *jn = app->journal;
+	guint32 generation = 0;
+	guint nevents;
+	gsize size;
+	int same;
+
+	g_assert(jn != NULL);
+
+	if ((jn->locks++ > 0) || (jn->lock_fd < 0) || 
+			(lock_file(jn, LOCK_EX) != 0)) {
+		return;
+	}
+	same = (pread(jn->lock_fd, &generation, sizeof(generation), 0) == 
+			sizeof(generation)) && (generation == jn->generation);
+	// the count is shared, this program goes on from the last one written
+	jn->generation = generation;
+	if (same) {
+		return;
+	}
+	store_unload(app, &nevents, &size);
+	calendar_unload(app);
+}
+
+/* worker thread: let the other programs in again. The data may have
+ * changed under the lock, the generation tells them to read it again.
+ */
+void journal_unlock(app_data *app)
+{
+	journal *jn = app->journal;
+
+	g_assert(jn->locks > 0);
+
+	if ((--jn->locks > 0) || (jn->lock_fd < 0)) {
+		return;
+	}
+	// one past the generation read under this lock
+	jn->generation++;
+	if (pwrite(jn->lock_fd, &jn->generation, sizeof(jn->generation), 0) != 
+			sizeof(jn->generation)) {
+		malarm_print("error: failed to write %s: %s\n", LOCK_FILE, 
+				g_strerror(errno));
+	}
+	lock_file(jn, LOCK_UN);
+}
+
+/* worker thread: an operation on alarm id starts. flags are JOURNAL_*,
+ * 0 if a crash cannot leave it half done (it only queues key changes).
+ */
+void journal_begin(app_data *app, guint id, cookie_t old_cookie, int flags)
+{
+	journal *jn = app->journal;
+
+	g_assert(jn != NULL);
+
+	if (jn->open_ops++ == 0) {
+		journal_lock(app);
+		backend_key_begin(app);
+	}
+	if (flags) {
+		write_record(jn, JOURNAL_BEGIN, id, old_cookie, flags);
+	}
+}
+
+// worker thread: the new event of id was added to alarmd
+void journal_added(app_data *app, guint id, cookie_t new_cookie)
+{
+	journal *jn = app->journal;
+
+	if ((jn != NULL) && (jn->open_ops > 0)) {
+		write_record(jn, JOURNAL_ADDED, id, new_cookie, 0);
+	}
+}
+
+// worker thread: make the queued key changes, the operations are done
+int journal_commit(app_data *app)
+{
+	journal *jn = app->journal;
+	int ret;
+
+	g_assert(jn->open_ops > 0);
+	jn->open_ops = 0;
+
+	ret = backend_key_commit(app);
+	if (ret != 0) {
+		// the next scan finds the registry inconsistent and rebuilds it
+		backend_key_unset(app, MALARM_GCONF_REGISTRY_VALID);
+	}
+	truncate_journal(jn);
+	journal_unlock(app);
+	return ret;
+}
+
+// delete the events of ids that were added, but not logged
+static void remove_lost_events(app_data *app, GHashTable *lost)
+{
+	cookie_t *cookies;
+	alarm_event_t *event;
+	gpointer old;
+	int i;
+
+	// only after a crash in alarm_event_add(), the one full query
+	cookies = backend_event_query(app, 0, TIME_T_MAX, 0, 0);
+	for (i=0; cookies && cookies[i]; i++) {
+		if ((event = backend_event_get(app, cookies[i])) == NULL) {
+			continue;
+		}
+		if ((strcmp(event->title, MALARM_NAME) == 0) && 
+				g_hash_table_lookup_extended(lost, 
+					GUINT_TO_POINTER(get_alarm_event_id(event)), NULL, &old) && 
+				(cookies[i] != GPOINTER_TO_INT(old))) {
+			malarm_print("journal: removed lost cookie %ld\n", cookies[i]);
+			backend_event_del(app, cookies[i]);
+		}
+		backend_event_free(app, event);
+	}
+	free(cookies);
+}
+
+typedef struct {
+	app_data *app;
+	GHashTable *lost;  // id -> old cookie
+} journal_recovery;
+
+static void recover_op(gpointer key, gpointer value, gpointer data)
+{
+	journal_recovery *rec = (journal_recovery*)data;
+	app_data *app = rec->app;
+	journal_op *op = (journal_op*)value;
+
+	if (op->new_cookie > 0) {
+		// the new event is in alarmd, finish the operation
+		registry_set(app, op->id, op->new_cookie);
+		if ((op->old_cookie > 0) && !(op->flags & JOURNAL_KEEP_OLD)) {
+			backend_event_del(app, op->old_cookie);
+		}
+		malarm_print("journal: finished id %u, cookie %ld\n", 
+				op->id, op->new_cookie);
+
+	} else if (op->flags & JOURNAL_ADD) {
+		// roll back, the registry still has the old cookie
+		g_hash_table_insert(rec->lost, GUINT_TO_POINTER(op->id), 
+				GINT_TO_POINTER(op->old_cookie));
+		malarm_print("journal: rolled back id %u\n", op->id);
+
+	} else if (op->flags & JOURNAL_DISABLE) {
+		// finish if the event got to the store, else there is nothing to undo
+		store_load(app);
+		if (g_hash_table_lookup(app->disabled_events, GUINT_TO_POINTER(op->id))) {
+			if (op->old_cookie > 0) {
+				backend_event_del(app, op->old_cookie);
+			}
+			registry_unset(app, op->id);
+			malarm_print("journal: finished disabling id %u\n", op->id);
+		}
+	}
+}
+
+// worker thread: the first request, before any scan
+static void run_journal_recovery(app_data *app, gpointer data)
+{
+	journal *jn = app->journal;
+	journal_recovery rec = { app, NULL };
+	GHashTable *ops;
+	journal_record *records;
+	journal_op *op;
+	gchar *contents = NULL;
+	gsize len;
+	int i, n;
+
+	if (!g_file_get_contents(jn->path, &contents, &len, NULL) || (len == 0)) {
+		g_free(contents);
+		return;
+	}
+
+	ops = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	records = (journal_record*)contents;
+	n = len/sizeof(journal_record);
+	for (i=0; i<n; i++) {
+		if (records[i].check != record_check(&records[i])) {
+			break;
+		}
+		if (records[i].type == JOURNAL_BEGIN) {
+			op = g_new0(journal_op, 1);
+			op->id = records[i].id;
+			op->old_cookie = records[i].cookie;
+			op->flags = records[i].flags;
+			g_hash_table_replace(ops, GUINT_TO_POINTER(op->id), op);
+		} else if ((records[i].type == JOURNAL_ADDED) && 
+				(op = g_hash_table_lookup(ops, GUINT_TO_POINTER(records[i].id)))) {
+			op->new_cookie = records[i].cookie;
+		}
+	}
+	g_free(contents);
+
+	rec.lost = g_hash_table_new(g_direct_hash, g_direct_equal);
+	journal_begin(app, 0, 0, 0);
+	g_hash_table_foreach(ops, recover_op, &rec);
+	if (g_hash_table_size(rec.lost) > 0) {
+		remove_lost_events(app, rec.lost);
+	}
+	journal_commit(app);
+
+	g_hash_table_destroy(rec.lost);
+	g_hash_table_destroy(ops);
+}
+
+static void done_journal_recovery(app_data *app, gpointer data)
+{
+}
+
+// main loop, after worker_start(): recovery is the first worker request
+void journal_start(app_data *app, const char *name)
+{
+	journal *jn;
+	char *dir, *path;
+
+	jn = g_new0(journal, 1);
+	dir = get_data_path(NULL);
+	g_mkdir_with_parents(dir, 0700);
+	jn->path = g_build_filename(dir, name, NULL);
+
+	jn->fd = g_open(jn->path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (jn->fd < 0) {
+		// operations still run, without a journal
+		malarm_print("error: failed to open %s: %s\n", jn->path, g_strerror(errno));
+	}
+	path = g_build_filename(dir, LOCK_FILE, NULL);
+	jn->lock_fd = g_open(path, O_RDWR | O_CREAT, 0600);
+	if (jn->lock_fd < 0) {
+		// and without a lock
+		malarm_print("error: failed to open %s: %s\n", path, g_strerror(errno));
+	}
+	g_free(path);
+	g_free(dir);
+	app->journal = jn;
+
+	worker_submit(app, run_journal_recovery, done_journal_recovery, NULL);
+}
+
+// after worker_stop()
+void journal_stop(app_data *app)
+{
+	journal *jn = app->journal;
+
+	if (jn == NULL) return;
+
+	if (jn->fd >= 0) close(jn->fd);
+	if (jn->lock_fd >= 0) close(jn->lock_fd);
+	g_free(jn->path);
+	g_free(jn);
+	app->journal = NULL;
+}
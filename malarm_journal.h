@@ -0,0 +1,58 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_JOURNAL_H_
+#define _MALARM_JOURNAL_H_
+
+#include "malarm_main.h"
+
+/* Write-ahead journal of the operations that change one alarm in several
+ * steps, e.g. an edit adds the new event to alarmd, points the registry
+ * at it, then deletes the old event. A crash between the steps would
+ * leave the old event firing unregistered, next to the new one.
+ *
+ * journal_begin() logs what an operation is about to do, and starts
+ * queueing key changes (see backend_key_begin()). registry_add() logs
+ * the cookie of each new event. journal_commit() makes all queued key
+ * changes in one call, then empties the journal. At startup, the
+ * operations left in the journal are finished if their new event was
+ * added, or rolled back if not, before the first scan.
+ *
+ * Records are written, not synced: they survive a crash of the process.
+ * Each program has its own journal in MALARM_DATA_DIR.
+ *
+ * The programs share alarmd, the registry and the files, so each one
+ * holds the lock of MALARM_DATA_DIR from journal_begin() to
+ * journal_commit(). Work that reads what it then changes, e.g. a scan,
+ * takes it over the whole span with journal_lock().
+ * Only the worker thread uses the journal, once journal_start() is done.
+ */
+
+#define JOURNAL_ADD       (1 << 0)  // a new event is added to alarmd
+#define JOURNAL_DISABLE   (1 << 1)  // the event is put in the store
+#define JOURNAL_KEEP_OLD  (1 << 2)  // the old event stays with alarmd
+
+void journal_start(app_data *app, const char *name);
+void journal_stop(app_data *app);
+void journal_begin(app_data *app, guint id, cookie_t old_cookie, int flags);
+void journal_added(app_data *app, guint id, cookie_t new_cookie);
+int journal_commit(app_data *app);
+void journal_lock(app_data *app);
+void journal_unlock(app_data *app);
+
+#endif /* #define _MALARM_JOURNAL_H_ */
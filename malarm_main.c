@@ -20,6 +20,15 @@
 
 #include "malarm_main.h"
 #include "malarm_ui.h"
+#include "malarm_worker.h"
+#include "malarm_journal.h"
+#include "malarm_clock.h"
+#include "malarm_fetch.h"
+#include "malarm_sched.h"
+#include "malarm_trace.h"
+#include "malarm_backend.h"
+#include "malarm_sounds.h"
+#include "malarm_client.h"
 
 static gint cb_osso_rpc(const gchar *interface, const gchar *method, 
 		GArray *arguments, gpointer data, osso_rpc_t *retval)
@@ -28,18 +37,50 @@ static gint cb_osso_rpc(const gchar *interface, const gchar *method,
 
 	g_assert(app != NULL);
 
+	// method is MALARM_DBUS_METHOD "_<id>" when an alarm is triggered;
+	// alarms created by this version call the core service instead
 	malarm_debug("interface=%s, method=%s\n", interface, method);
-	populate_tree(app);
+	if (app->client_state != CLIENT_OFF) {
+		// the core logs the fire, re-arms and scans, and sends what changed
+		client_triggered(app, method);
+	} else {
+		// alarms that skip days have one instance at a time in alarmd
+		arm_calendar_alarms(app);
+		populate_tree(app);
+	}
 
 	retval->type = DBUS_TYPE_INVALID;
 	return OSSO_OK;
 }
 
+static void cb_osso_hw_event(osso_hw_state_t *state, gpointer data)
+{
+	app_data *app = (app_data*)data;
+
+	g_assert(app != NULL);
+
+	// called on any state change, release caches only when memory gets low
+	if (state->memory_low_ind && !app->memory_low) {
+		malarm_print("memory is low, releasing caches\n");
+		shed_caches(app);
+	}
+	app->memory_low = state->memory_low_ind;
+
+	sched_set_inactive(app, state->system_inactivity_ind);
+}
+
 int main(int argc, char **argv)
 {
 	app_data app = { };
 	osso_return_t osso_ret;
-
+	osso_hw_state_t hw_state = { };
+
+	// alarmd and gconf calls are done in a worker thread
+	g_thread_init(NULL);
+	// libalarm is called from several fetch threads at once
+	dbus_threads_init_default();
+	clock_init();
+	trace_start();
 	gtk_init(&argc, &argv);
 
 	app.program = HILDON_PROGRAM(hildon_program_get_instance());
@@ -63,15 +104,40 @@ int main(int argc, char **argv)
 	app.gconf = gconf_client_get_default();
 	g_assert(GCONF_IS_CLIENT(app.gconf));
 
+	if (backend_open(&app) != 0) {
+		return -1;
+	}
+
+	worker_start(&app);
+	journal_start(&app, "journal");
+	client_start(&app);
 	create_ui(&app);
 
+	hw_state.memory_low_ind = TRUE;
+	hw_state.system_inactivity_ind = TRUE;
+	osso_ret = osso_hw_set_event_cb(app.ctx, &hw_state, cb_osso_hw_event, &app);
+	if (osso_ret != OSSO_OK) {
+		// not fatal, caches are just kept
+		malarm_print("error: failed to register LibOSSO hw event callback\n");
+	}
+
 	g_signal_connect(G_OBJECT(app.window), "delete-event", gtk_main_quit, NULL);
 
 	gtk_widget_show_all(GTK_WIDGET(app.window));
+	sched_start(&app);
 
 	gtk_main();
 
+	sched_stop(&app);
+	sounds_stop(&app);
+	flush_removals(&app);
+	worker_stop(&app);
+	journal_stop(&app);
+	fetch_stop(&app);
+	backend_close(&app);
+
 	osso_deinitialize(app.ctx);
+	trace_stop();
 
 	return 0;
 }
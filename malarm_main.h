@@ -19,7 +19,14 @@
 #ifndef _MALARM_MAIN_H_
 #define _MALARM_MAIN_H_
 
-#include <hildon/hildon.h>
+/* Shared by the UI and the core service, which does not link GTK: only
+ * the UI sources include <hildon/hildon.h> (see malarm_ui.h), and the
+ * widgets in app_data are declared by their struct tags.
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
 #include <libosso.h>
 #include <gconf/gconf-client.h>
 #include <alarmd/alarm_event.h>
@@ -31,6 +38,29 @@
 #define MALARM_DBUS_NAME "org.maemo." MALARM_NAME
 #define MALARM_DBUS_PATH "/org/maemo/" MALARM_NAME
 #define MALARM_GCONF_DIR  "/apps/maemo/" MALARM_NAME "/"
+#define MALARM_DATA_DIR  "." MALARM_NAME  /* in home dir */
+#define MALARM_DATA_ENV  "MALARM_DATA"  /* another data dir, see get_data_path() */
+
+/* Each alarm has a stable malarm id, which survives enable/disable and
+ * edit (these get a new alarmd cookie). alarmd 1.x events have no
+ * argument fields, so the id is kept in the D-Bus method name that
+ * alarmd calls: MALARM_DBUS_METHOD "_<id>".
+ */
+#define MALARM_DBUS_METHOD  "alarm_triggered"
+#define MALARM_GCONF_NEXT_ID  MALARM_GCONF_DIR "next_id"
+
+#define TIME_T_MAX  (LONG_MAX)
+
+// older malarm versions parked disabled alarms in alarmd at this time,
+// now they are kept in the store (see malarm_store.h)
+// 0, TIME_T_MAX do not work!
+/* #define ALARM_DISABLED  (0) */
+/* #define ALARM_DISABLED  (TIME_T_MAX) // gives negative cookie */
+#define ALARM_DISABLED  (TIME_T_MAX - 200)
+
+#define ALARM_EVENT_FLAGS  (ALARM_EVENT_BOOT | ALARM_EVENT_ACTDEAD | \
+		ALARM_EVENT_SHOW_ICON | ALARM_EVENT_RUN_DELAYED)
+		/* ALARM_EVENT_SHOW_ICON | ALARM_EVENT_POSTPONE_DELAYED) */
 
 
 // #define MALARM_DEBUG
@@ -46,22 +76,106 @@
 	g_print("%s [%d]: " f, __func__,__LINE__, ##x)
 
 
+// alarm event, key-value and sound calls, see malarm_backend.h
+typedef struct _backend backend;
+
+// exception days of recurring alarms, see malarm_calendar.h
+typedef struct _calendar calendar;
+typedef struct _alarm_calendar alarm_calendar;
+
+// fire, snooze and dismiss log, see malarm_history.h
+typedef struct _history history;
+
+// write-ahead log of row operations, see malarm_journal.h
+typedef struct _journal journal;
+
+// next alarms in shared memory, see malarm_publish.h
+typedef struct _publication publication;
+
+// alarms that fire close to each other, see malarm_conflicts.h
+typedef struct _conflict_index conflict_index;
+
+// prebuilt "Add alarm" / "Edit alarm" dialog, see malarm_ui.c
+typedef struct _alarm_dialog_data alarm_dialog_data;
+
 typedef struct {
-	HildonProgram *program;
-	HildonWindow *window;
+	struct _HildonProgram *program;
+	struct _HildonWindow *window;
 	osso_context_t *ctx;
 	GConfClient *gconf;
 
-	GtkTreeStore *store;
-	GtkWidget *view;
-	GtkWidget *sound_combo_box;
-	GtkWidget *preview_button;
-	GtkCellRenderer *toggled_renderer;
+	struct _GtkTreeStore *store;
+	struct _GtkWidget *view;
+	alarm_dialog_data *dlg;
+	GHashTable *events;  // id -> copy of alarm event shown in tree
+	conflict_index *conflicts;  // of the enabled alarms in events
+	GHashTable *ui_calendars;   // id -> alarm_calendar, main loop copy
+	calendar *ui_holidays;      // NULL if none, see malarm_calendar.h
+	struct _GtkWidget *sound_combo_box;
+	struct _GtkWidget *preview_button;
+	struct _GtkCellRenderer *toggled_renderer;
 	gint sound_idx;
+	GPtrArray *sound_files;  // URIs of the sounds after the built-in ones
+	GHashTable *sound_uris;  // URI -> index + 1 in the sound combo box
+	GHashTable *sound_index; // sound directories, scan thread while running
+	GThread *sound_thread;   // running scan, see malarm_sounds.h
+	volatile int sound_scan_cancel;
+	int clone_count;     // last values of the clone dialog
+	int clone_interval;
+	int clone_unit;
+	GPtrArray *removals;     // of removed rows, until the undo timeout
+	guint removal_timeout;
+	struct _GtkWidget *undo_button;  // shown while removals can be undone
+	struct _GtkWidget *undo_item;
 	int sound_playing;
 	gulong cb_toggled_handler_id;
-	int toggled_processing;
-	GtkTreeIter toggled_iter;
+
+	// backend (alarmd, gconf) requests are run by the worker thread
+	backend *backend;
+	GThread *worker_thread;
+	GAsyncQueue *worker_queue;
+	guint next_id;         // malarm id of the next new alarm
+	int ops_pending;       // row operations in flight
+	int refreshing;        // tree is being repopulated
+	int refresh_deferred;  // repopulate when ops_pending drops to 0
+	GHashTable *disabled_events;  // id -> event, worker thread only
+	GThreadPool *fetch_pool;      // alarm_event_get() requests of the worker
+	journal *journal;             // worker thread only
+	GHashTable *calendars;  // id -> alarm_calendar, locked
+	calendar *holidays;     // NULL if none, locked
+	GHashTable *profiles;   // name -> GArray of profile_state, locked
+	int profiles_pending;   // the Profiles dialog waits for the worker
+	int caches_shed;       // rows were released on low memory
+	int memory_low;
+
+	// non-essential timers, see malarm_sched.h
+	GSList *sched_timers;
+	guint sched_next_id;
+	int display_on;
+	int system_inactive;
+	int sched_topmost;
+	int sched_running;
+	guint sched_catch_up;  // idle source of the catch-up tick
+	guint sched_wakeups;
+	guint sched_resumes;
+	time_t fires_in_now;  // current minute of the "fires in" column
+
+	// core service (see malarm_core.h), or the UI as its client
+	GHashTable *core_alarms;  // id -> scan_item, core only
+	gpointer core_conn;       // DBusConnection of ctx
+	guint32 core_serial;      // of the last delta sent
+	int core_scanning;
+	int core_rescan;          // rescan again when the scan is done
+	int client_state;         // CLIENT_*, see malarm_client.h
+	guint32 client_serial;    // of the last snapshot or delta applied
+	int core_loaded;          // first scan is done
+	history *history;         // NULL if the log cannot be opened
+	GHashTable *history_pending;  // id -> core_fire, not yet dismissed
+	GArray *history_fired;        // core_fire of ids, before the first scan
+	guint history_follow_up;      // rescan to see snoozes and dismissals
+	guint warmup_timeout;         // next sound warm-up
+	GHashTable *warmup_done;      // id -> alarm time its sound was read for
+	publication *publication;     // NULL if the segment cannot be created
 
 	int widget_running;
 	int visibility;
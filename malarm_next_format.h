@@ -0,0 +1,76 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_NEXT_FORMAT_H_
+#define _MALARM_NEXT_FORMAT_H_
+
+/* The next alarms, published by malarmd (see malarm_publish.h) for
+ * status bar and home applets: a read-only shared memory segment at
+ * NEXT_PATH with the first NEXT_ALARMS enabled alarms, sorted by the time
+ * the list shows. Readers map it and need no D-Bus call or alarmd scan.
+ * Only needs glib, like malarm_trace_format.h; tools/malarm_next.c is a
+ * reader.
+ *
+ * The writer changes the alarms under a seqlock, readers never block it:
+ *
+ *   do {
+ *       seq = g_atomic_int_get(&seg->seq);
+ *       copy count and alarms
+ *   } while ((seq & 1) || (seq != g_atomic_int_get(&seg->seq)));
+ *
+ * After each change the writer also writes seq to the file with write(),
+ * so a reader can wait for changes with inotify (IN_MODIFY) on NEXT_PATH,
+ * and poll() that fd instead of the segment.
+ * A reader checks magic and version, and that size is at least
+ * sizeof(next_segment); later versions only add fields at the end.
+ * Values are in the byte order of the device.
+ */
+
+#include <glib.h>
+
+#define NEXT_PATH     "/dev/shm/malarm-next"
+#define NEXT_MAGIC    0x4e4c414d  /* "MALN" */
+#define NEXT_VERSION  1
+#define NEXT_ALARMS   16
+
+// of the unescaped message, with the terminating 0; cut at a character
+#define NEXT_MESSAGE_LEN  64
+
+typedef struct {
+	gint64 time;         // next time, alarm time plus snoozed minutes
+	gint32 cookie;       // of the alarmd event
+	guint32 id;          // malarm id
+	gint32 flags;        // alarmd event flags
+	guint32 snoozed;
+	guint32 recurrence;  // minutes, 0 for a one-time alarm
+	guint32 reserved;
+	char message[NEXT_MESSAGE_LEN];
+} next_alarm;
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 size;          // of the segment
+	volatile gint32 seq;   // odd while the alarms change
+	guint32 count;         // alarms in use
+	guint32 reserved;
+	gint64 updated;        // time of the last change
+	next_alarm alarms[NEXT_ALARMS];
+} next_segment;
+
+#endif /* #define _MALARM_NEXT_FORMAT_H_ */
@@ -0,0 +1,256 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_profiles.h"
+#include "malarm_util.h"
+
+#define PROFILES_FILE  "profiles"
+#define PROFILES_MAGIC  0x524c414d  /* "MALR" */
+#define PROFILES_VERSION  1
+
+/* File layout, in host byte order:
+ *   u32 magic, u32 version, u32 count
+ *   count records of:
+ *     string name, u32 n, n states of u32 id, u32 enabled
+ */
+
+// app->profiles
+static GStaticMutex profile_mutex = G_STATIC_MUTEX_INIT;
+
+static void free_states(gpointer states)
+{
+	g_array_free((GArray*)states, TRUE);
+}
+
+static GArray *copy_states(const GArray *states)
+{
+	GArray *copy;
+
+	copy = g_array_sized_new(FALSE, FALSE, sizeof(profile_state), states->len);
+	g_array_append_vals(copy, states->data, states->len);
+	return copy;
+}
+
+static gint compare_states(gconstpointer a, gconstpointer b)
+{
+	guint32 ida = ((const profile_state*)a)->id;
+	guint32 idb = ((const profile_state*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+static void put_profile_cb(gpointer key, gpointer value, gpointer data)
+{
+	GArray *states = (GArray*)value;
+	GString *buf = (GString*)data;
+	profile_state *st;
+	int i;
+
+	put_string(buf, (const char*)key);
+	put_u32(buf, states->len);
+	for (i=0; i<states->len; i++) {
+		st = &g_array_index(states, profile_state, i);
+		put_u32(buf, st->id);
+		put_u32(buf, st->enabled);
+	}
+}
+
+// profile_mutex must be held
+static int profile_save(app_data *app)
+{
+	GString *buf;
+	char *path;
+	int ret;
+
+	buf = g_string_sized_new(256);
+	put_u32(buf, PROFILES_MAGIC);
+	put_u32(buf, PROFILES_VERSION);
+	put_u32(buf, g_hash_table_size(app->profiles));
+	g_hash_table_foreach(app->profiles, put_profile_cb, buf);
+
+	path = get_data_path(PROFILES_FILE);
+	ret = save_file(path, buf->str, buf->len);
+
+	g_free(path);
+	g_string_free(buf, TRUE);
+	return ret;
+}
+
+// profile_mutex must be held
+static void profile_load(app_data *app)
+{
+	char *path;
+	gchar *contents = NULL;
+	gsize len;
+	const gchar *p, *end;
+	guint32 magic, version, count, n;
+	profile_state st;
+	GArray *states;
+	char *name;
+
+	if (app->profiles) return;
+
+	app->profiles = g_hash_table_new_full(g_str_hash, g_str_equal, 
+			g_free, free_states);
+
+	path = get_data_path(PROFILES_FILE);
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		// no profiles yet
+		g_free(path);
+		return;
+	}
+
+	p = contents;
+	end = contents + len;
+	if ((get_u32(&p, end, &magic) != 0) || (get_u32(&p, end, &version) != 0) ||
+			(magic != PROFILES_MAGIC) || (version > PROFILES_VERSION) ||
+			(get_u32(&p, end, &count) != 0)) {
+		malarm_print("error: %s is not a malarm profiles file\n", path);
+		goto profile_load_out;
+	}
+
+	while (count-- > 0) {
+		if ((get_string(&p, end, &name) != 0) || (name == NULL) ||
+				(get_u32(&p, end, &n) != 0) || 
+				((end - p)/(2*sizeof(guint32)) < n)) {
+			malarm_print("error: %s is truncated\n", path);
+			g_free(name);
+			break;
+		}
+		states = g_array_sized_new(FALSE, FALSE, sizeof(profile_state), n);
+		while (n-- > 0) {
+			get_u32(&p, end, &st.id);
+			get_u32(&p, end, &st.enabled);
+			g_array_append_val(states, st);
+		}
+		g_hash_table_replace(app->profiles, name, states);
+	}
+	malarm_debug("loaded %u profiles\n", g_hash_table_size(app->profiles));
+
+profile_load_out:
+	g_free(contents);
+	g_free(path);
+}
+
+// drop the profiles in memory, they are loaded again when needed
+void profile_unload(app_data *app)
+{
+	g_static_mutex_lock(&profile_mutex);
+	if (app->profiles) {
+		g_hash_table_destroy(app->profiles);
+		app->profiles = NULL;
+	}
+	g_static_mutex_unlock(&profile_mutex);
+}
+
+static void add_name(gpointer key, gpointer value, gpointer data)
+{
+	g_ptr_array_add((GPtrArray*)data, g_strdup((const char*)key));
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b)
+{
+	return g_utf8_collate(*(char * const *)a, *(char * const *)b);
+}
+
+// sorted names, free with g_free() each and g_ptr_array_free()
+GPtrArray *profile_get_names(app_data *app)
+{
+	GPtrArray *names;
+
+	names = g_ptr_array_new();
+	g_static_mutex_lock(&profile_mutex);
+	profile_load(app);
+	g_hash_table_foreach(app->profiles, add_name, names);
+	g_static_mutex_unlock(&profile_mutex);
+
+	g_ptr_array_sort(names, compare_names);
+	return names;
+}
+
+// returns a copy, sorted by id, free with g_array_free(), or NULL if none
+GArray *profile_get(app_data *app, const char *name)
+{
+	GArray *states;
+
+	g_static_mutex_lock(&profile_mutex);
+	profile_load(app);
+	states = g_hash_table_lookup(app->profiles, name);
+	if (states) states = copy_states(states);
+	g_static_mutex_unlock(&profile_mutex);
+
+	return states;
+}
+
+/* save states as profile name, or delete it if states is NULL. The
+ * profiles in memory are left as they were if the file is not saved.
+ */
+int profile_put(app_data *app, const char *name, const GArray *states)
+{
+	GArray *copy;
+	gpointer old_name = NULL, old_states = NULL;
+	int found, ret = 0;
+
+	g_static_mutex_lock(&profile_mutex);
+	profile_load(app);
+	found = g_hash_table_lookup_extended(app->profiles, name, 
+			&old_name, &old_states);
+	if (found) {
+		g_hash_table_steal(app->profiles, name);
+	}
+	if (states) {
+		copy = copy_states(states);
+		g_array_sort(copy, compare_states);
+		g_hash_table_insert(app->profiles, g_strdup(name), copy);
+		ret = profile_save(app);
+	} else if (found) {
+		ret = profile_save(app);
+	}
+
+	if (ret != 0) {
+		// back to the profiles of the file
+		g_hash_table_remove(app->profiles, name);
+		if (found) {
+			g_hash_table_insert(app->profiles, old_name, old_states);
+		}
+	} else if (found) {
+		g_free(old_name);
+		free_states(old_states);
+	}
+	g_static_mutex_unlock(&profile_mutex);
+
+	return ret;
+}
+
+// state of id in states from profile_get(), NULL if it is not in the profile
+const profile_state *profile_find(const GArray *states, guint id)
+{
+	const profile_state *st = (const profile_state*)states->data;
+	guint lo = 0, hi = states->len, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi)/2;
+		if (st[mid].id == id) return &st[mid];
+		if (st[mid].id < id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
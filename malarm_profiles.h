@@ -0,0 +1,44 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_PROFILES_H_
+#define _MALARM_PROFILES_H_
+
+#include "malarm_main.h"
+
+/* A profile is a named set of alarm states, e.g. "workweek", "weekend"
+ * and "travel": the ids of the alarms, each enabled or disabled, as they
+ * were when the profile was saved. Switching to a profile changes only
+ * the alarms whose state differs, as one batch (see malarm_ui.c); alarms
+ * that are not in the profile are left as they are.
+ * Profiles are saved in MALARM_DATA_DIR. Only the worker thread reads
+ * and writes them; the profile fcns are locked all the same.
+ */
+
+typedef struct {
+	guint32 id;
+	guint32 enabled;
+} profile_state;
+
+void profile_unload(app_data *app);
+GPtrArray *profile_get_names(app_data *app);
+GArray *profile_get(app_data *app, const char *name);
+int profile_put(app_data *app, const char *name, const GArray *states);
+const profile_state *profile_find(const GArray *states, guint id);
+
+#endif /* #define _MALARM_PROFILES_H_ */
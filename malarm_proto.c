@@ -0,0 +1,110 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_proto.h"
+#include "malarm_util.h"
+
+#define PROTO_MAGIC  0x504c414d  /* "MALP" */
+
+/* Message layout, in host byte order (both ends are on the device):
+ *   u32 magic, u32 serial, u32 next_id, u32 count
+ *   count records of:
+ *     u32 id, i64 cookie, u32 enabled, u32 has_event,
+ *     event (see put_alarm_event()) if has_event
+ */
+
+// a record without an event
+#define PROTO_MIN_RECORD_SIZE  (4 + 8 + 4 + 4)
+
+// returns a new string, free with g_free()
+char *proto_encode(guint32 serial, guint32 next_id, 
+		const scan_item *items, guint nitems)
+{
+	GString *buf;
+	char *text;
+	guint i;
+
+	buf = g_string_sized_new(256 * nitems + 16);
+	put_u32(buf, PROTO_MAGIC);
+	put_u32(buf, serial);
+	put_u32(buf, next_id);
+	put_u32(buf, nitems);
+	for (i=0; i<nitems; i++) {
+		put_u32(buf, items[i].id);
+		put_i64(buf, items[i].cookie);
+		put_u32(buf, items[i].enabled);
+		put_u32(buf, items[i].event != NULL);
+		if (items[i].event) put_alarm_event(buf, items[i].event);
+	}
+
+	text = g_base64_encode((const guchar*)buf->str, buf->len);
+	g_string_free(buf, TRUE);
+	return text;
+}
+
+// returns the items, free with free_scan_items(), or NULL if text is not
+// a message of this protocol (e.g. a D-Bus error text)
+GArray *proto_decode(const char *text, guint32 *serial, guint32 *next_id)
+{
+	guchar *data;
+	gsize len;
+	const gchar *p, *end;
+	guint32 magic, count, enabled, has_event;
+	gint64 cookie;
+	scan_item item;
+	GArray *items = NULL;
+
+	data = g_base64_decode(text, &len);
+	p = (const gchar*)data;
+	end = p + len;
+	if ((get_u32(&p, end, &magic) != 0) || (magic != PROTO_MAGIC) ||
+			(get_u32(&p, end, serial) != 0) ||
+			(get_u32(&p, end, next_id) != 0) ||
+			(get_u32(&p, end, &count) != 0)) {
+		g_free(data);
+		return NULL;
+	}
+
+	// count comes from another process, it sizes the array
+	if (count > (end - p)/PROTO_MIN_RECORD_SIZE) {
+		malarm_print("error: message has too many records\n");
+		g_free(data);
+		return NULL;
+	}
+
+	items = g_array_sized_new(FALSE, FALSE, sizeof(scan_item), count);
+	while (count-- > 0) {
+		item.event = NULL;
+		if ((get_u32(&p, end, &item.id) != 0) ||
+				(get_bytes(&p, end, &cookie, sizeof(cookie)) != 0) ||
+				(get_u32(&p, end, &enabled) != 0) ||
+				(get_u32(&p, end, &has_event) != 0) ||
+				(has_event && ((item.event = get_alarm_event(&p, end)) == NULL))) {
+			malarm_print("error: truncated message\n");
+			free_scan_items(items);
+			items = NULL;
+			break;
+		}
+		item.cookie = cookie;
+		item.enabled = enabled;
+		g_array_append_val(items, item);
+	}
+
+	g_free(data);
+	return items;
+}
@@ -0,0 +1,52 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_PROTO_H_
+#define _MALARM_PROTO_H_
+
+#include "malarm_main.h"
+#include "malarm_scan.h"
+
+/* D-Bus protocol of the core service (see malarm_core.h). Alarms are
+ * sent as scan_items, in one string argument: a base64 encoded message.
+ *
+ * Methods of MALARM_CORE_DBUS_NAME:
+ *   PROTO_SNAPSHOT: returns all alarms, with the serial of the last delta
+ *   PROTO_CHANGED:  a client tells the alarms it changed (event NULL if
+ *                   removed); the core applies them and sends a delta
+ *   PROTO_RESCAN:   alarms may have changed outside the core, e.g. an
+ *                   alarm of an older malarm triggered
+ *   MALARM_DBUS_METHOD "_<id>": alarm id triggered, called by alarmd
+ * Signal:
+ *   PROTO_DELTA:    the alarms that changed, with serial + 1; a client
+ *                   that misses a serial gets a new snapshot
+ */
+
+#define MALARM_CORE_DBUS_NAME  MALARM_DBUS_NAME ".core"
+#define MALARM_CORE_DBUS_PATH  MALARM_DBUS_PATH "/core"
+
+#define PROTO_SNAPSHOT  "snapshot"
+#define PROTO_CHANGED  "changed"
+#define PROTO_RESCAN  "rescan"
+#define PROTO_DELTA  "delta"
+
+char *proto_encode(guint32 serial, guint32 next_id, 
+		const scan_item *items, guint nitems);
+GArray *proto_decode(const char *text, guint32 *serial, guint32 *next_id);
+
+#endif /* #define _MALARM_PROTO_H_ */
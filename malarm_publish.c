@@ -0,0 +1,208 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib/gstdio.h>
+
+#include "malarm_publish.h"
+#include "malarm_next_format.h"
+#include "malarm_scan.h"
+#include "malarm_util.h"
+#include "malarm_clock.h"
+
+struct _publication {
+	int fd;
+	next_segment *seg;
+};
+
+// the time the list shows, see get_next_alarm_time()
+static time_t next_alarm_time(const alarm_event_t *event)
+{
+	return event->alarm_time + (time_t)event->snoozed*60;
+}
+
+static void add_enabled_item(gpointer key, gpointer value, gpointer data)
+{
+	scan_item *item = (scan_item*)value;
+
+	if (item->enabled && item->event) {
+		g_ptr_array_add((GPtrArray*)data, item);
+	}
+}
+
+static gint compare_next_time(gconstpointer a, gconstpointer b)
+{
+	const scan_item *ia = *(scan_item**)a;
+	const scan_item *ib = *(scan_item**)b;
+	time_t ta = next_alarm_time(ia->event);
+	time_t tb = next_alarm_time(ib->event);
+
+	if (ta != tb) return (ta < tb) ? -1 : 1;
+	return (ia->id < ib->id) ? -1 : (ia->id > ib->id);
+}
+
+// copy the unescaped message, cut at a character if it is too long; the
+// event belongs to the model and keeps its escapes
+static void copy_message(char *buf, const alarm_event_t *event)
+{
+	char *message;
+	const gchar *end;
+
+	message = unescape_message(event->message);
+	g_strlcpy(buf, message, NEXT_MESSAGE_LEN);
+	g_free(message);
+	if (!g_utf8_validate(buf, -1, &end)) {
+		buf[end - buf] = '\0';
+	}
+}
+
+static void fill_alarm(next_alarm *next, const scan_item *item)
+{
+	memset(next, 0, sizeof(next_alarm));
+	next->time = next_alarm_time(item->event);
+	next->cookie = item->cookie;
+	next->id = item->id;
+	next->flags = item->event->flags;
+	next->snoozed = item->event->snoozed;
+	next->recurrence = item->event->recurrence;
+	copy_message(next->message, item->event);
+}
+
+// readers see the change through the seqlock, and inotify through a write
+static void begin_change(next_segment *seg)
+{
+	g_atomic_int_inc((gint*)&seg->seq);
+}
+
+static void end_change(publication *pub)
+{
+	next_segment *seg = pub->seg;
+	gint32 seq;
+
+	seg->updated = clock_now();
+	g_atomic_int_inc((gint*)&seg->seq);
+
+	// changes to the map are not seen by inotify, a write is
+	seq = g_atomic_int_get((gint*)&seg->seq);
+	if (pwrite(pub->fd, &seq, sizeof(seq), G_STRUCT_OFFSET(next_segment, seq)) < 0) {
+		malarm_debug("failed to write %s: %s\n", NEXT_PATH, g_strerror(errno));
+	}
+}
+
+static void clear_alarms(publication *pub)
+{
+	begin_change(pub->seg);
+	pub->seg->count = 0;
+	memset(pub->seg->alarms, 0, sizeof(pub->seg->alarms));
+	end_change(pub);
+}
+
+void publish_start(app_data *app)
+{
+	publication *pub;
+	next_segment *seg;
+
+	pub = g_new0(publication, 1);
+	// not truncated, readers may still have the segment of the last run
+	// mapped
+	pub->fd = g_open(NEXT_PATH, O_RDWR | O_CREAT, 0644);
+	if ((pub->fd < 0) || (ftruncate(pub->fd, sizeof(next_segment)) != 0)) {
+		malarm_print("error: failed to create %s: %s\n", NEXT_PATH, g_strerror(errno));
+		goto error;
+	}
+
+	seg = mmap(NULL, sizeof(next_segment), PROT_READ | PROT_WRITE, 
+			MAP_SHARED, pub->fd, 0);
+	if (seg == MAP_FAILED) {
+		malarm_print("error: failed to map %s: %s\n", NEXT_PATH, g_strerror(errno));
+		goto error;
+	}
+
+	// a run that stopped in the middle of a change left seq odd
+	if (seg->seq & 1) {
+		g_atomic_int_inc((gint*)&seg->seq);
+	}
+	pub->seg = seg;
+	clear_alarms(pub);
+
+	// readers check magic last
+	seg->version = NEXT_VERSION;
+	seg->size = sizeof(next_segment);
+	g_atomic_int_set((gint*)&seg->magic, NEXT_MAGIC);
+	app->publication = pub;
+	return;
+
+error:
+	if (pub->fd >= 0) close(pub->fd);
+	g_free(pub);
+}
+
+// main loop: publish the first NEXT_ALARMS enabled alarms of the model,
+// if they changed
+void publish_alarms(app_data *app)
+{
+	publication *pub = app->publication;
+	next_alarm alarms[NEXT_ALARMS];
+	GPtrArray *items;
+	next_segment *seg;
+	guint count, i;
+
+	if (pub == NULL) return;
+	seg = pub->seg;
+
+	items = g_ptr_array_new();
+	g_hash_table_foreach(app->core_alarms, add_enabled_item, items);
+	g_ptr_array_sort(items, compare_next_time);
+	count = MIN(items->len, NEXT_ALARMS);
+	for (i=0; i<count; i++) {
+		fill_alarm(&alarms[i], g_ptr_array_index(items, i));
+	}
+	g_ptr_array_free(items, TRUE);
+
+	// a rescan mostly finds the same alarms, do not wake the readers
+	if ((seg->count == count) && 
+			(memcmp(seg->alarms, alarms, count*sizeof(next_alarm)) == 0)) {
+		return;
+	}
+
+	begin_change(seg);
+	memcpy(seg->alarms, alarms, count*sizeof(next_alarm));
+	memset(seg->alarms + count, 0, (NEXT_ALARMS - count)*sizeof(next_alarm));
+	seg->count = count;
+	end_change(pub);
+	malarm_debug("published %u alarms, seq %d\n", count, seg->seq);
+}
+
+// the segment is left empty, readers see no alarms until the core runs
+// again
+void publish_stop(app_data *app)
+{
+	publication *pub = app->publication;
+
+	if (pub == NULL) return;
+	app->publication = NULL;
+
+	clear_alarms(pub);
+	munmap(pub->seg, sizeof(next_segment));
+	close(pub->fd);
+	g_free(pub);
+}
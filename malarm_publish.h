@@ -0,0 +1,34 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_PUBLISH_H_
+#define _MALARM_PUBLISH_H_
+
+#include "malarm_main.h"
+
+/* The core service publishes its next alarms to a shared memory segment
+ * (see malarm_next_format.h) after each scan and each change from a front
+ * end. The segment is on tmpfs, so a change costs no flash write.
+ * Only the main loop of the core uses it.
+ */
+
+void publish_start(app_data *app);
+void publish_alarms(app_data *app);
+void publish_stop(app_data *app);
+
+#endif /* #define _MALARM_PUBLISH_H_ */
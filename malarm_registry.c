@@ -0,0 +1,189 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_registry.h"
+#include "malarm_backend.h"
+#include "malarm_util.h"
+#include "malarm_calendar.h"
+#include "malarm_journal.h"
+#include "malarm_clock.h"
+
+static char *id_to_registry_key(guint id, char *key)
+{
+	sprintf(key, "%s/%u", MALARM_GCONF_REGISTRY_DIR, id);
+	return key;
+}
+
+static void load_registry_key(const char *key, gint val, gpointer data)
+{
+	const char *name = strrchr(key, '/');
+	guint id = name ? strtoul(name + 1, NULL, 10) : 0;
+
+	if ((id > 0) && (val > 0)) {
+		g_hash_table_insert((GHashTable*)data, GUINT_TO_POINTER(id), 
+				GINT_TO_POINTER(val));
+	}
+}
+
+// returns id -> cookie table, or NULL if the registry must be rebuilt
+GHashTable *registry_load(app_data *app)
+{
+	GHashTable *registry;
+
+	// an int since the backends only store ints; the bool key of older
+	// versions reads as 0, and the registry is rebuilt once
+	if (backend_key_get(app, MALARM_GCONF_REGISTRY_VALID) != 1) {
+		malarm_debug("no registry\n");
+		return NULL;
+	}
+
+	registry = g_hash_table_new(g_direct_hash, g_direct_equal);
+	backend_key_foreach(app, MALARM_GCONF_REGISTRY_DIR, load_registry_key, registry);
+
+	malarm_debug("%u registered alarms\n", g_hash_table_size(registry));
+	return registry;
+}
+
+void registry_set(app_data *app, guint id, cookie_t cookie)
+{
+	char key[100];
+
+	id_to_registry_key(id, key);
+	if (backend_key_set(app, key, cookie) != 0) {
+		// next refresh finds the registry inconsistent and rebuilds it
+		malarm_print("error: failed to set gconf key %s to %ld\n", key, cookie);
+		backend_key_unset(app, MALARM_GCONF_REGISTRY_VALID);
+	}
+}
+
+void registry_unset(app_data *app, guint id)
+{
+	char key[100];
+
+	id_to_registry_key(id, key);
+	backend_key_unset(app, key);
+}
+
+/* Add event to alarmd and register it as id. An alarm that skips days
+ * only gets its next instance, see calendar_arm(). Returns the cookie,
+ * or 0 if alarmd failed.
+ */
+cookie_t registry_add(app_data *app, guint id, alarm_event_t *event)
+{
+	alarm_event_t flagged;
+	cookie_t cookie;
+
+	flagged = *event;
+	if (calendar_arm(app, id, event, clock_now())) {
+		flagged.alarm_time = event->alarm_time;
+		flagged.recurrence = 0;
+		flagged.recurrence_count = 0;
+	}
+	flagged.flags = ALARM_EVENT_FLAGS;
+	cookie = backend_event_add(app, &flagged);
+	if (cookie <= 0) {
+		return 0;
+	}
+	print_alarm_event(cookie, &flagged);
+	journal_added(app, id, cookie);
+	registry_set(app, id, cookie);
+	return cookie;
+}
+
+/* Move the alarm id that skips days on to its next instance after now,
+ * when alarmd triggered the one it has: *event (the copy of cookie) is
+ * replaced by the new instance. The triggered instance stays with alarmd,
+ * it can still be snoozed. Must be called between journal_begin() and
+ * journal_commit(). Returns the new cookie, or 0 if the alarm stays.
+ */
+cookie_t registry_arm_next(app_data *app, guint id, cookie_t cookie, 
+		alarm_event_t **event, time_t now)
+{
+	alarm_event_t *next;
+	cookie_t next_cookie;
+	time_t t;
+
+	t = calendar_next_alarm_time(app, id, *event, now + 1);
+	if ((t < 0) || (t == (*event)->alarm_time)) {
+		return 0;
+	}
+
+	journal_begin(app, id, cookie, JOURNAL_ADD | 
+			(((*event)->alarm_time > now) ? 0 : JOURNAL_KEEP_OLD));
+	next = copy_alarm_event(*event);
+	next->alarm_time = t;
+	if ((next_cookie = registry_add(app, id, next)) == 0) {
+		malarm_print("error: failed to set next alarm of id %u\n", id);
+		free_alarm_event_copy(next);
+		return 0;
+	}
+	if ((*event)->alarm_time > now) {
+		backend_event_del(app, cookie);
+	}
+	free_alarm_event_copy(*event);
+	*event = next;
+	return next_cookie;
+}
+
+typedef struct {
+	const char **keys;
+	gint *vals;
+	int n;
+} registry_batch;
+
+static void add_registry_key(gpointer key, gpointer value, gpointer data)
+{
+	registry_batch *batch = (registry_batch*)data;
+	char name[100];
+
+	id_to_registry_key(GPOINTER_TO_UINT(key), name);
+	batch->keys[batch->n] = g_strdup(name);
+	batch->vals[batch->n] = GPOINTER_TO_INT(value);
+	batch->n++;
+}
+
+// replace registry contents with id -> cookie table from a full alarmd scan
+void registry_rebuild(app_data *app, GHashTable *registry)
+{
+	registry_batch batch;
+	guint n = g_hash_table_size(registry);
+	int i, ret;
+
+	backend_key_unset(app, MALARM_GCONF_REGISTRY_VALID);
+	backend_key_unset_dir(app, MALARM_GCONF_REGISTRY_DIR);
+
+	batch.keys = g_new(const char*, n);
+	batch.vals = g_new(gint, n);
+	batch.n = 0;
+	g_hash_table_foreach(registry, add_registry_key, &batch);
+
+	ret = backend_key_set_batch(app, batch.keys, batch.vals, batch.n);
+
+	for (i=0; i<batch.n; i++) {
+		g_free((char*)batch.keys[i]);
+	}
+	g_free(batch.keys);
+	g_free(batch.vals);
+
+	if (ret != 0) {
+		malarm_print("error: failed to write registry\n");
+		return;
+	}
+	backend_key_set(app, MALARM_GCONF_REGISTRY_VALID, 1);
+	malarm_debug("registered %u alarms\n", n);
+}
@@ -0,0 +1,42 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_REGISTRY_H_
+#define _MALARM_REGISTRY_H_
+
+#include "malarm_main.h"
+
+/* The registry maps the id of each enabled alarm to its alarmd cookie,
+ * so a refresh only fetches malarm's own events. It is kept in gconf,
+ * one int key per id under MALARM_GCONF_REGISTRY_DIR, written through
+ * the backend (see malarm_backend.h).
+ * Only the worker thread uses the registry.
+ */
+
+#define MALARM_GCONF_REGISTRY_DIR  MALARM_GCONF_DIR "registry"
+#define MALARM_GCONF_REGISTRY_VALID  MALARM_GCONF_DIR "registry_valid"
+
+GHashTable *registry_load(app_data *app);
+void registry_set(app_data *app, guint id, cookie_t cookie);
+void registry_unset(app_data *app, guint id);
+cookie_t registry_add(app_data *app, guint id, alarm_event_t *event);
+cookie_t registry_arm_next(app_data *app, guint id, cookie_t cookie, 
+		alarm_event_t **event, time_t now);
+void registry_rebuild(app_data *app, GHashTable *registry);
+
+#endif /* #define _MALARM_REGISTRY_H_ */
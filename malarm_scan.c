@@ -0,0 +1,348 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_scan.h"
+#include "malarm_util.h"
+#include "malarm_store.h"
+#include "malarm_registry.h"
+#include "malarm_fetch.h"
+#include "malarm_clock.h"
+#include "malarm_journal.h"
+
+typedef struct {
+	app_data *app;
+	scan_item_func func;
+	scan_restart_func restart;
+	gpointer data;
+	GHashTable *registry;  // id -> cookie
+	GArray *old_items;     // full scan only
+	GHashTable *items;     // full scan only, id -> scan_item
+	int inconsistent;
+	guint next_id;
+} scan_state;
+
+static void add_item(scan_state *scan, scan_item *item)
+{
+	scan->next_id = MAX(scan->next_id, item->id + 1);
+	scan->func(item, scan->data);
+}
+
+// move an event created by an older malarm to the current format:
+// enabled alarms get an id, disabled alarms leave alarmd
+static cookie_t migrate_alarm_event(app_data *app, cookie_t cookie, 
+		scan_item *item, guint id)
+{
+	alarm_event_t event = *item->event;
+	cookie_t new_cookie = 0;
+	gchar key[100];
+
+	if (item->id == 0) {
+		set_alarm_event_id(item->event, id);
+	}
+
+	if (item->enabled) {
+		event.dbus_name = item->event->dbus_name;
+		new_cookie = backend_event_add(app, &event);
+		if (new_cookie <= 0) {
+			return -1;
+		}
+	} else {
+		if (store_put(app, id, item->event) != 0) {
+			return -1;
+		}
+		if (item->id == 0) {
+			cookie_to_gconf_key(cookie, key);
+		} else {
+			id_to_gconf_key(id, key);
+		}
+		backend_key_unset(app, key);
+	}
+	backend_event_del(app, cookie);
+
+	malarm_debug("migrated cookie %ld to id %u, cookie %ld\n", 
+			cookie, id, new_cookie);
+	return new_cookie;
+}
+
+static void add_disabled_item(gpointer key, gpointer value, gpointer data)
+{
+	scan_item item;
+
+	item.id = GPOINTER_TO_UINT(key);
+	item.cookie = 0;
+	item.event = copy_alarm_event((alarm_event_t*)value);
+	item.enabled = FALSE;
+	add_item((scan_state*)data, &item);
+}
+
+static void get_registry_cookie(gpointer key, gpointer value, gpointer data)
+{
+	cookie_t cookie = GPOINTER_TO_INT(value);
+	g_array_append_val((GArray*)data, cookie);
+}
+
+// check one fetched registered event
+static void scan_registered_alarm(cookie_t cookie, alarm_event_t *event, 
+		gpointer data)
+{
+	scan_state *scan = (scan_state*)data;
+	scan_item item;
+
+	if (event == NULL) {
+		// one-time alarm that was triggered, or removed outside malarm;
+		// its registry entry is unset below
+		malarm_debug("cookie %ld is gone\n", cookie);
+		return;
+	}
+
+	item.id = get_alarm_event_id(event);
+	item.cookie = cookie;
+	item.enabled = TRUE;
+
+	if (scan->inconsistent || (strcmp(event->title, MALARM_NAME) != 0) || 
+			(GPOINTER_TO_INT(g_hash_table_lookup(scan->registry, 
+				GUINT_TO_POINTER(item.id))) != cookie)) {
+		if (!scan->inconsistent) {
+			malarm_print("registry: cookie %ld is not a registered alarm\n", 
+					cookie);
+		}
+		backend_event_free(scan->app, event);
+		scan->inconsistent = 1;
+		return;
+	}
+
+	print_alarm_event(item.cookie, event);
+	item.event = copy_alarm_event(event);
+	calendar_restore_event(scan->app, item.id, item.event);
+	backend_event_free(scan->app, event);
+
+	// stale copy in the store, if enabling was interrupted
+	store_remove(scan->app, item.id);
+	g_hash_table_remove(scan->registry, GUINT_TO_POINTER(item.id));
+	add_item(scan, &item);
+}
+
+// remove registry entries of fetched events, the rest are gone
+static void unset_registry_item(gpointer key, gpointer value, gpointer data)
+{
+	registry_unset((app_data*)data, GPOINTER_TO_UINT(key));
+}
+
+/* Fetch only the registered events, other apps' alarms are never
+ * fetched. Returns -1 if the registry does not match alarmd, then the
+ * caller must do a full scan.
+ */
+static int scan_registered_alarms(scan_state *scan)
+{
+	app_data *app = scan->app;
+	GArray *cookies;
+
+	cookies = g_array_sized_new(FALSE, FALSE, sizeof(cookie_t), 
+			g_hash_table_size(scan->registry));
+	g_hash_table_foreach(scan->registry, get_registry_cookie, cookies);
+	fetch_events(app, (cookie_t*)cookies->data, cookies->len, 
+			scan_registered_alarm, scan);
+	g_array_free(cookies, TRUE);
+
+	if (scan->inconsistent) return -1;
+
+	g_hash_table_foreach(scan->registry, unset_registry_item, app);
+	return 0;
+}
+
+/* Keep one event of each id. registry_arm_next() leaves the instance
+ * that triggered with alarmd, where it can be snoozed until it is
+ * dismissed, and registers the next one: the later event is the alarm.
+ * An older one that has not triggered is a stray copy, it is removed.
+ */
+static void add_full_scan_item(scan_state *scan, scan_item *item)
+{
+	scan_item *prev, *older;
+
+	prev = g_hash_table_lookup(scan->items, GUINT_TO_POINTER(item->id));
+	if (prev == NULL) {
+		g_hash_table_insert(scan->items, GUINT_TO_POINTER(item->id), 
+				g_memdup(item, sizeof(scan_item)));
+		return;
+	}
+
+	older = g_new(scan_item, 1);
+	if (prev->event->alarm_time <= item->event->alarm_time) {
+		*older = *prev;
+		*prev = *item;
+	} else {
+		*older = *item;
+	}
+	if (older->event->alarm_time > clock_now()) {
+		backend_event_del(scan->app, older->cookie);
+		malarm_debug("removed stray copy of id %u, cookie %ld\n", 
+				older->id, older->cookie);
+	} else {
+		malarm_debug("triggered instance of id %u, cookie %ld, stays\n", 
+				older->id, older->cookie);
+	}
+	free_alarm_event_copy(older->event);
+	g_free(older);
+}
+
+static void add_registered_item(gpointer key, gpointer value, gpointer data)
+{
+	scan_state *scan = (scan_state*)data;
+	scan_item *item = (scan_item*)value;
+
+	// stale copy in the store, if enabling was interrupted
+	store_remove(scan->app, item->id);
+	g_hash_table_insert(scan->registry, GUINT_TO_POINTER(item->id), 
+			GINT_TO_POINTER(item->cookie));
+	add_item(scan, item);
+}
+
+// check one fetched event of any owner
+static void scan_alarm(cookie_t cookie, alarm_event_t *event, gpointer data)
+{
+	scan_state *scan = (scan_state*)data;
+	app_data *app = scan->app;
+	scan_item item;
+
+	if (event == NULL) {
+		return;
+	}
+	if (strcmp(event->title, MALARM_NAME) != 0) {
+		backend_event_free(app, event);
+		return;
+	}
+
+	print_alarm_event(cookie, event);
+	item.id = get_alarm_event_id(event);
+	item.cookie = cookie;
+	item.enabled = TRUE;
+	if (event->alarm_time == ALARM_DISABLED) {
+		// parked in alarmd by an older malarm
+		event->alarm_time = (item.id > 0) ? 
+			get_actual_alarm_time(app, item.id) :
+			get_actual_alarm_time_old(app, cookie);
+		item.enabled = FALSE;
+	}
+
+	if (event->alarm_time < 0) {
+		// cannot find actual time of disabled alarm
+		backend_event_del(app, cookie);
+		malarm_debug("removed alarm cookie %ld\n", cookie);
+	} else {
+		item.event = copy_alarm_event(event);
+		calendar_restore_event(app, item.id, item.event);
+		if ((item.id == 0) || !item.enabled) {
+			g_array_append_val(scan->old_items, item);
+		} else {
+			add_full_scan_item(scan, &item);
+		}
+		scan->next_id = MAX(scan->next_id, item.id + 1);
+	}
+	backend_event_free(app, event);
+}
+
+// scan all alarmd events for malarm events, and rebuild the registry
+// from them
+static void scan_all_alarms(scan_state *scan)
+{
+	app_data *app = scan->app;
+	cookie_t *cookies;
+	int ncookies;
+	int i;
+
+	scan->registry = g_hash_table_new(g_direct_hash, g_direct_equal);
+	scan->old_items = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	scan->items = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, g_free);
+
+	// also need to show snoozed alarms, which have alarm_time in the past
+	cookies = backend_event_query(app, 0, TIME_T_MAX, 0, 0);
+	for (ncookies = 0; cookies && cookies[ncookies]; ncookies++);
+	fetch_events(app, cookies, ncookies, scan_alarm, scan);
+	free(cookies);
+
+	g_hash_table_foreach(scan->items, add_registered_item, scan);
+	g_hash_table_destroy(scan->items);
+	scan->items = NULL;
+
+	// new ids are given after all ids in use are known
+	for (i=0; i<scan->old_items->len; i++) {
+		scan_item *old = &g_array_index(scan->old_items, scan_item, i);
+		guint id = (old->id > 0) ? old->id : scan->next_id++;
+		cookie_t new_cookie;
+
+		new_cookie = migrate_alarm_event(app, old->cookie, old, id);
+		if (new_cookie > 0) {
+			// enabled alarm, now with an id
+			old->id = id;
+			old->cookie = new_cookie;
+			g_hash_table_insert(scan->registry, GUINT_TO_POINTER(old->id), 
+					GINT_TO_POINTER(old->cookie));
+			add_item(scan, old);
+		} else {
+			// disabled alarms are now in the store
+			free_alarm_event_copy(old->event);
+		}
+	}
+	g_array_free(scan->old_items, TRUE);
+
+	registry_rebuild(app, scan->registry);
+	g_hash_table_destroy(scan->registry);
+}
+
+// get enabled malarm events from alarmd, and all disabled ones from the store
+guint scan_alarms(app_data *app, scan_item_func func, 
+		scan_restart_func restart, gpointer data)
+{
+	scan_state scan = { app, func, restart, data, NULL, NULL, NULL, 0, 0 };
+	int ret = -1;
+
+	// it removes and rebuilds what the other programs may be changing
+	journal_lock(app);
+	store_load(app);
+
+	scan.next_id = backend_key_get(app, MALARM_GCONF_NEXT_ID);
+	if (scan.next_id == 0) scan.next_id = 1;
+
+	if ((scan.registry = registry_load(app)) != NULL) {
+		ret = scan_registered_alarms(&scan);
+		g_hash_table_destroy(scan.registry);
+	}
+	if (ret != 0) {
+		// registry is missing or inconsistent
+		scan.inconsistent = 0;
+		restart(data);
+		scan_all_alarms(&scan);
+	}
+
+	g_hash_table_foreach(app->disabled_events, add_disabled_item, &scan);
+
+	backend_key_set(app, MALARM_GCONF_NEXT_ID, scan.next_id);
+	journal_unlock(app);
+	return scan.next_id;
+}
+
+void free_scan_items(GArray *items)
+{
+	int i;
+
+	for (i=0; i<items->len; i++) {
+		free_alarm_event_copy(g_array_index(items, scan_item, i).event);
+	}
+	g_array_free(items, TRUE);
+}
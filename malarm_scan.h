@@ -0,0 +1,50 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_SCAN_H_
+#define _MALARM_SCAN_H_
+
+#include "malarm_main.h"
+
+/* Reads all malarm alarms: the enabled ones from alarmd, through the
+ * registry (see malarm_registry.h), and the disabled ones from the store.
+ * Events of older malarm versions are moved to the current format on the
+ * way. Used by the UI to fill the tree, and by the core service (see
+ * malarm_core.h) to build its model; no GTK calls.
+ */
+
+typedef struct {
+	guint id;
+	cookie_t cookie;       // 0 if disabled
+	alarm_event_t *event;  // with actual alarm time, NULL if removed
+	int enabled;
+} scan_item;
+
+/* Called in the calling thread for each alarm, func takes item->event.
+ * restart is called if the registry turns out to be inconsistent: the
+ * items given so far are dropped, and all of them are given again.
+ */
+typedef void (*scan_item_func)(scan_item *item, gpointer data);
+typedef void (*scan_restart_func)(gpointer data);
+
+// worker thread: returns the next free id
+guint scan_alarms(app_data *app, scan_item_func func, 
+		scan_restart_func restart, gpointer data);
+void free_scan_items(GArray *items);
+
+#endif /* #define _MALARM_SCAN_H_ */
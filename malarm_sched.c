@@ -0,0 +1,269 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_sched.h"
+
+typedef struct {
+	app_data *app;
+	guint id;
+	const char *name;
+	guint interval;   // msec
+	int aligned;      // ticks on multiples of interval since the epoch
+	sched_func func;
+	gpointer data;
+	guint source;     // 0 while suspended
+	guint wakeups;    // ticks, including catch-up ticks
+} sched_timer;
+
+static void free_timer(app_data *app, sched_timer *timer)
+{
+	if (timer->source) g_source_remove(timer->source);
+	app->sched_timers = g_slist_remove(app->sched_timers, timer);
+	g_free(timer);
+}
+
+// msec until the next multiple of interval
+static guint time_to_boundary(guint interval)
+{
+	GTimeVal tv;
+	guint ms;
+
+	g_get_current_time(&tv);
+	ms = (tv.tv_sec % (24*60*60))*1000 + tv.tv_usec/1000;
+	// a little late, so the tick is past the boundary
+	return interval - (ms % interval) + 10;
+}
+
+static gboolean sched_tick(gpointer data)
+{
+	sched_timer *timer = (sched_timer*)data;
+	app_data *app = timer->app;
+
+	timer->wakeups++;
+	app->sched_wakeups++;
+
+	if (!timer->func(app, timer->data)) {
+		// source is removed by returning FALSE
+		timer->source = 0;
+		free_timer(app, timer);
+		return FALSE;
+	}
+
+	if (timer->aligned) {
+		// timeouts drift, so each tick is aligned again
+		timer->source = g_timeout_add(time_to_boundary(timer->interval), 
+				sched_tick, timer);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void start_timer(sched_timer *timer)
+{
+	timer->source = g_timeout_add(timer->aligned ? 
+			time_to_boundary(timer->interval) : timer->interval, 
+			sched_tick, timer);
+}
+
+// one tick for each timer, for the time they were suspended
+static gboolean sched_catch_up(gpointer data)
+{
+	app_data *app = (app_data*)data;
+	GSList *timers, *l;
+
+	app->sched_catch_up = 0;
+	if (!app->sched_running) return FALSE;
+
+	// a tick may remove its timer
+	timers = g_slist_copy(app->sched_timers);
+	for (l = timers; l; l = l->next) {
+		sched_timer *timer = (sched_timer*)l->data;
+		if (g_slist_find(app->sched_timers, timer) == NULL) continue;
+
+		timer->wakeups++;
+		app->sched_wakeups++;
+		if (!timer->func(app, timer->data)) {
+			free_timer(app, timer);
+		}
+	}
+	g_slist_free(timers);
+	return FALSE;
+}
+
+// suspend or resume all timers when the state changes
+static void sched_update(app_data *app)
+{
+	int running = app->display_on && !app->system_inactive && app->sched_topmost;
+	GSList *l;
+
+	if (running == app->sched_running) return;
+	app->sched_running = running;
+
+	malarm_debug("%s %u timers (display %s, %s, %s)\n", 
+			running ? "resuming" : "suspending", 
+			g_slist_length(app->sched_timers),
+			app->display_on ? "on" : "off",
+			app->system_inactive ? "inactive" : "active",
+			app->sched_topmost ? "topmost" : "not topmost");
+
+	for (l = app->sched_timers; l; l = l->next) {
+		sched_timer *timer = (sched_timer*)l->data;
+
+		if (running) {
+			start_timer(timer);
+		} else if (timer->source) {
+			g_source_remove(timer->source);
+			timer->source = 0;
+		}
+	}
+
+	if (running) {
+		app->sched_resumes++;
+		if (!app->sched_catch_up) {
+			app->sched_catch_up = g_idle_add(sched_catch_up, app);
+		}
+	}
+}
+
+static void cb_display_event(osso_display_state_t state, gpointer data)
+{
+	app_data *app = (app_data*)data;
+
+	g_assert(app != NULL);
+
+	// a dimmed display still shows the window
+	sched_set_display(app, state != OSSO_DISPLAY_OFF);
+}
+
+static void cb_topmost(GObject *object, GParamSpec *pspec, gpointer data)
+{
+	app_data *app = (app_data*)data;
+
+	g_assert(app != NULL);
+
+	app->sched_topmost = hildon_window_get_is_topmost(HILDON_WINDOW(app->window));
+	sched_update(app);
+}
+
+void sched_start(app_data *app)
+{
+	osso_return_t osso_ret;
+
+	app->display_on = 1;
+	app->system_inactive = 0;
+	app->sched_topmost = hildon_window_get_is_topmost(HILDON_WINDOW(app->window));
+	app->sched_running = 0;
+
+	osso_ret = osso_hw_set_display_event_cb(app->ctx, cb_display_event, app);
+	if (osso_ret != OSSO_OK) {
+		// not fatal, timers then only follow the window state
+		malarm_print("error: failed to register LibOSSO display callback\n");
+	}
+
+	g_signal_connect(G_OBJECT(app->window), "notify::is-topmost", 
+			G_CALLBACK(cb_topmost), app);
+
+	sched_update(app);
+}
+
+void sched_stop(app_data *app)
+{
+	sched_print_stats(app);
+
+	app->sched_running = 0;
+	if (app->sched_catch_up) {
+		g_source_remove(app->sched_catch_up);
+		app->sched_catch_up = 0;
+	}
+	while (app->sched_timers) {
+		free_timer(app, (sched_timer*)app->sched_timers->data);
+	}
+}
+
+static guint add_timer(app_data *app, const char *name, guint interval, 
+		int aligned, sched_func func, gpointer data)
+{
+	sched_timer *timer;
+
+	timer = g_new0(sched_timer, 1);
+	timer->app = app;
+	timer->id = ++app->sched_next_id;
+	timer->name = name;
+	timer->interval = interval;
+	timer->aligned = aligned;
+	timer->func = func;
+	timer->data = data;
+	app->sched_timers = g_slist_append(app->sched_timers, timer);
+
+	if (app->sched_running) start_timer(timer);
+	return timer->id;
+}
+
+// interval is in msec, returns id for sched_remove()
+guint sched_add(app_data *app, const char *name, guint interval, 
+		sched_func func, gpointer data)
+{
+	return add_timer(app, name, interval, FALSE, func, data);
+}
+
+// like sched_add(), but ticks on wall clock multiples of interval,
+// e.g. at each minute boundary for 60*1000
+guint sched_add_aligned(app_data *app, const char *name, guint interval, 
+		sched_func func, gpointer data)
+{
+	return add_timer(app, name, interval, TRUE, func, data);
+}
+
+void sched_remove(app_data *app, guint id)
+{
+	GSList *l;
+
+	for (l = app->sched_timers; l; l = l->next) {
+		sched_timer *timer = (sched_timer*)l->data;
+		if (timer->id == id) {
+			free_timer(app, timer);
+			return;
+		}
+	}
+}
+
+void sched_set_display(app_data *app, int display_on)
+{
+	app->display_on = display_on;
+	sched_update(app);
+}
+
+void sched_set_inactive(app_data *app, int inactive)
+{
+	app->system_inactive = inactive;
+	sched_update(app);
+}
+
+void sched_print_stats(app_data *app)
+{
+	GSList *l;
+
+	malarm_print("scheduler: %u wakeups, resumed %u times, timers %s\n", 
+			app->sched_wakeups, app->sched_resumes, 
+			app->sched_running ? "running" : "suspended");
+	for (l = app->sched_timers; l; l = l->next) {
+		sched_timer *timer = (sched_timer*)l->data;
+		malarm_print("  %s: every %u msec, %u wakeups\n", 
+				timer->name, timer->interval, timer->wakeups);
+	}
+}
@@ -0,0 +1,47 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_SCHED_H_
+#define _MALARM_SCHED_H_
+
+#include <hildon/hildon.h>
+
+#include "malarm_main.h"
+
+/* Non-essential periodic timers (display updates and the like) are added
+ * through the scheduler. They only run while the display is on, the
+ * device is not inactive and the window is topmost. When they are
+ * resumed, each timer gets one catch-up tick right away.
+ * Alarms themselves are run by alarmd, and worker jobs are not timers.
+ * func returns FALSE to remove the timer, like a GSourceFunc.
+ */
+typedef gboolean (*sched_func)(app_data *app, gpointer data);
+
+void sched_start(app_data *app);
+void sched_stop(app_data *app);
+guint sched_add(app_data *app, const char *name, guint interval, 
+		sched_func func, gpointer data);
+guint sched_add_aligned(app_data *app, const char *name, guint interval, 
+		sched_func func, gpointer data);
+void sched_remove(app_data *app, guint id);
+
+void sched_set_display(app_data *app, int display_on);
+void sched_set_inactive(app_data *app, int inactive);
+void sched_print_stats(app_data *app);
+
+#endif /* #define _MALARM_SCHED_H_ */
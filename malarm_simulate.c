@@ -0,0 +1,381 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "malarm_simulate.h"
+#include "malarm_proto.h"
+#include "malarm_backend.h"
+#include "malarm_calendar.h"
+#include "malarm_registry.h"
+#include "malarm_journal.h"
+#include "malarm_worker.h"
+#include "malarm_clock.h"
+#include "malarm_util.h"
+
+enum {
+	SIM_ONCE,
+	SIM_DAILY,     // repeated by alarmd
+	SIM_WEEKLY,    // repeated by alarmd
+	SIM_WORKDAYS,  // Mon-Fri, armed by malarm
+	SIM_HOLIDAYS,  // daily but not on holidays, armed by malarm
+	SIM_KINDS
+};
+
+static const char *kind_names[SIM_KINDS] = {
+	"once", "daily", "weekly", "Mon-Fri", "holidays off"
+};
+
+typedef struct {
+	int kind;
+	int hour, min;
+	guint32 day;      // of the first instance
+	calendar *fired;  // days it rang on, snoozes not counted
+	guint fires, snoozes;
+	guint drifts, duplicates, extra, missed;
+	guint shifts;     // drifts of alarmd repeats after a DST change
+} sim_alarm;
+
+typedef struct {
+	app_data *app;
+	int days, nalarms;
+	guint32 first_day;
+	time_t start, end;
+	calendar *holidays;
+	sim_alarm *alarms;  // of ids 1 to nalarms
+	guint fires, snoozes, steps;
+	gdouble seconds;
+} simulation;
+
+// days of the year that are holidays, from Jan 1
+static const int holiday_offsets[] = { 0, 5, 95, 98, 120, 140, 175, 358, 359 };
+
+static GMainLoop *sim_loop;
+
+// local time hour:min on day, across DST changes as mktime() sees it
+static time_t day_time(const simulation *sim, guint32 day, int hour, int min)
+{
+	struct tm stm;
+
+	localtime_r(&sim->start, &stm);
+	stm.tm_mday += (gint32)(day - sim->first_day);
+	stm.tm_hour = hour;
+	stm.tm_min = min;
+	stm.tm_sec = 0;
+	stm.tm_isdst = -1;
+	return mktime(&stm);
+}
+
+static guint32 time_to_day(time_t t, struct tm *stm)
+{
+	localtime_r(&t, stm);
+	return calendar_day(stm->tm_year + 1900, stm->tm_mon + 1, stm->tm_mday);
+}
+
+static gboolean rings_on(const simulation *sim, const sim_alarm *alarm, guint32 day)
+{
+	if (day < alarm->day) return FALSE;
+
+	switch (alarm->kind) {
+	case SIM_ONCE:
+		return day == alarm->day;
+	case SIM_WEEKLY:
+		return (day - alarm->day)%7 == 0;
+	case SIM_WORKDAYS:
+		// julian day 1 is a Monday
+		return (CALENDAR_WORKDAYS & (1 << ((day - 1)%7))) != 0;
+	case SIM_HOLIDAYS:
+		return !calendar_is_set(sim->holidays, day);
+	}
+	return TRUE;
+}
+
+// worker thread: the alarms, as the UI adds them
+static void add_alarms(app_data *app, simulation *sim)
+{
+	alarm_event_t event, *copy;
+	alarm_calendar *entry;
+	sim_alarm *alarm;
+	guint id;
+
+	calendar_put_holidays(app, sim->holidays);
+
+	memset(&event, 0, sizeof(alarm_event_t));
+	event.title = MALARM_NAME;
+	event.message = "simulated";
+	event.icon = "qgn_list_hclk_alarm";
+	event.flags = ALARM_EVENT_FLAGS;
+	event.dbus_interface = MALARM_CORE_DBUS_NAME;
+	event.dbus_service = MALARM_CORE_DBUS_NAME;
+	event.dbus_path = MALARM_CORE_DBUS_PATH;
+	event.dbus_name = MALARM_DBUS_METHOD;
+
+	journal_begin(app, 0, 0, 0);
+	for (id=1; id<=sim->nalarms; id++) {
+		alarm = &sim->alarms[id - 1];
+		alarm->kind = (id - 1)%SIM_KINDS;
+		// 5:00 to 21:59, clear of the DST changes at night
+		alarm->hour = 5 + (id*7)%17;
+		alarm->min = (id*13)%60;
+		alarm->day = sim->first_day;
+		if (alarm->kind == SIM_ONCE) {
+			alarm->day += (id*37)%sim->days;
+		} else if (alarm->kind == SIM_WEEKLY) {
+			alarm->day += id%7;
+		}
+		alarm->fired = calendar_new();
+
+		event.alarm_time = day_time(sim, alarm->day, alarm->hour, alarm->min);
+		event.recurrence = (alarm->kind == SIM_ONCE) ? 0 : 
+			(alarm->kind == SIM_WEEKLY) ? 60*24*7 : 60*24;
+		event.recurrence_count = (alarm->kind == SIM_ONCE) ? 0 : -1;
+
+		if ((alarm->kind == SIM_WORKDAYS) || (alarm->kind == SIM_HOLIDAYS)) {
+			entry = alarm_calendar_new();
+			entry->recurrence = event.recurrence;
+			entry->weekdays = (alarm->kind == SIM_WORKDAYS) ? CALENDAR_WORKDAYS : 0;
+			entry->skip_holidays = (alarm->kind == SIM_HOLIDAYS);
+			calendar_put(app, id, entry);
+			alarm_calendar_free(entry);
+		}
+
+		copy = copy_alarm_event(&event);
+		set_alarm_event_id(copy, id);
+		if (registry_add(app, id, copy) == 0) {
+			malarm_print("error: failed to add alarm %u\n", id);
+		}
+		free_alarm_event_copy(copy);
+	}
+	journal_commit(app);
+}
+
+/* worker thread, called by backend_memory_fire(): check the fire, arm
+ * the next instance as the core does, and snooze some first fires
+ */
+static gboolean fire_alarm(cookie_t cookie, const alarm_event_t *event, 
+		gpointer data)
+{
+	simulation *sim = (simulation*)data;
+	app_data *app = sim->app;
+	guint id = get_alarm_event_id(event);
+	time_t now = clock_now();
+	alarm_event_t *copy;
+	sim_alarm *alarm;
+	struct tm stm;
+	guint32 day;
+
+	sim->fires++;
+	if ((id == 0) || (id > sim->nalarms)) {
+		malarm_print("error: unknown alarm fired, cookie %ld\n", cookie);
+		return FALSE;
+	}
+	alarm = &sim->alarms[id - 1];
+	alarm->fires++;
+
+	// a snoozed instance rings again, then it is dismissed
+	if (event->snoozed > 0) return FALSE;
+
+	day = time_to_day(now, &stm);
+	if ((stm.tm_hour != alarm->hour) || (stm.tm_min != alarm->min)) {
+		// alarmd repeats by a fixed number of minutes, the real one too,
+		// so its daily and weekly alarms move by an hour at a DST change
+		if ((alarm->kind == SIM_DAILY) || (alarm->kind == SIM_WEEKLY)) {
+			alarm->shifts++;
+		} else {
+			alarm->drifts++;
+		}
+	}
+	if (!rings_on(sim, alarm, day)) {
+		alarm->extra++;
+	} else if (calendar_is_set(alarm->fired, day)) {
+		alarm->duplicates++;
+	}
+	calendar_set(alarm->fired, day, TRUE);
+
+	copy = copy_alarm_event(event);
+	calendar_restore_event(app, id, copy);
+	journal_begin(app, 0, 0, 0);
+	registry_arm_next(app, id, cookie, &copy, now);
+	journal_commit(app);
+	free_alarm_event_copy(copy);
+
+	if (alarm->fires%4 == 1) {
+		alarm->snoozes++;
+		sim->snoozes++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// worker thread: step the clock from one due alarm to the next
+static void run_simulation(app_data *app, gpointer data)
+{
+	simulation *sim = (simulation*)data;
+	GTimer *timer;
+	time_t t;
+
+	add_alarms(app, sim);
+
+	timer = g_timer_new();
+	while (((t = backend_memory_next_due(app->backend)) >= 0) && (t < sim->end)) {
+		clock_set(t, FALSE);
+		backend_memory_fire(app->backend, t, fire_alarm, sim);
+		sim->steps++;
+	}
+	sim->seconds = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+}
+
+static void done_simulation(app_data *app, gpointer data)
+{
+	g_main_loop_quit(sim_loop);
+}
+
+// returns -1 if any alarm did not ring as it should
+static int report(simulation *sim)
+{
+	sim_alarm *alarm;
+	guint32 day;
+	guint drifts = 0, duplicates = 0, extra = 0, missed = 0, shifts = 0;
+	struct tm stm;
+	char buf[100];
+	int i;
+
+	for (i=0; i<sim->nalarms; i++) {
+		alarm = &sim->alarms[i];
+		for (day=sim->first_day; day<sim->first_day + sim->days; day++) {
+			if (rings_on(sim, alarm, day) && !calendar_is_set(alarm->fired, day)) {
+				alarm->missed++;
+			}
+		}
+		if (alarm->drifts || alarm->duplicates || alarm->extra || alarm->missed) {
+			if (drifts + duplicates + extra + missed == 0) {
+				printf("id\tkind\t\ttime\tfires\tdrift\tdup\textra\tmissed\n");
+			}
+			printf("%d\t%-12s\t%02d:%02d\t%u\t%u\t%u\t%u\t%u\n", i + 1, 
+					kind_names[alarm->kind], alarm->hour, alarm->min, 
+					alarm->fires, alarm->drifts, alarm->duplicates, 
+					alarm->extra, alarm->missed);
+		}
+		drifts += alarm->drifts;
+		duplicates += alarm->duplicates;
+		extra += alarm->extra;
+		missed += alarm->missed;
+		shifts += alarm->shifts;
+	}
+
+	localtime_r(&sim->start, &stm);
+	date_to_string(&stm, buf, 0);
+	printf("%d days from %s (TZ %s), %d alarms\n", sim->days, buf, 
+			g_getenv("TZ"), sim->nalarms);
+	printf("%u fires (%u snoozed) in %u steps, %.3f s: %.0f fires/s\n", 
+			sim->fires, sim->snoozes, sim->steps, sim->seconds, 
+			sim->fires/MAX(sim->seconds, 1e-6));
+	printf("drift %u, duplicates %u, extra %u, missed %u\n", 
+			drifts, duplicates, extra, missed);
+	printf("%u fires of alarmd repeats shifted by DST (not failures)\n", shifts);
+
+	return (drifts + duplicates + extra + missed == 0) ? 0 : -1;
+}
+
+static void remove_data_dir(const char *dir)
+{
+	GDir *gdir;
+	const char *name;
+	char *path;
+
+	if ((gdir = g_dir_open(dir, 0, NULL)) != NULL) {
+		while ((name = g_dir_read_name(gdir)) != NULL) {
+			path = g_build_filename(dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+		g_dir_close(gdir);
+	}
+	g_rmdir(dir);
+}
+
+int simulate_run(int days, int nalarms)
+{
+	app_data app = { };
+	simulation sim = { };
+	struct tm stm;
+	char *dir;
+	int i, ret;
+
+	dir = g_build_filename(g_get_tmp_dir(), "malarm-sim-XXXXXX", NULL);
+	if (mkdtemp(dir) == NULL) {
+		malarm_print("error: failed to create %s\n", dir);
+		g_free(dir);
+		return -1;
+	}
+	g_setenv(MALARM_DATA_ENV, dir, TRUE);
+	g_setenv(MALARM_BACKEND_ENV, "memory", TRUE);
+	g_setenv("TZ", SIMULATE_TZ, FALSE);
+	tzset();
+
+	// from midnight of Jan 1 of this year
+	sim.start = clock_now();
+	localtime_r(&sim.start, &stm);
+	stm.tm_mon = 0;
+	stm.tm_mday = 1;
+	stm.tm_hour = stm.tm_min = stm.tm_sec = 0;
+	stm.tm_isdst = -1;
+	sim.start = mktime(&stm);
+	sim.first_day = calendar_day(stm.tm_year + 1900, 1, 1);
+	sim.days = days;
+	sim.end = day_time(&sim, sim.first_day + days, 0, 0);
+	sim.nalarms = nalarms;
+	sim.alarms = g_new0(sim_alarm, nalarms);
+	sim.app = &app;
+
+	sim.holidays = calendar_new();
+	for (i=0; i<G_N_ELEMENTS(holiday_offsets); i++) {
+		calendar_set(sim.holidays, sim.first_day + holiday_offsets[i], TRUE);
+	}
+
+	clock_set(sim.start, FALSE);
+	ret = backend_open(&app);
+	if (ret == 0) {
+		worker_start(&app);
+		journal_start(&app, "journal");
+		worker_submit(&app, run_simulation, done_simulation, &sim);
+
+		sim_loop = g_main_loop_new(NULL, FALSE);
+		g_main_loop_run(sim_loop);
+		g_main_loop_unref(sim_loop);
+
+		worker_stop(&app);
+		journal_stop(&app);
+		calendar_unload(&app);
+		backend_close(&app);
+
+		ret = report(&sim);
+	}
+
+	for (i=0; i<nalarms; i++) {
+		calendar_free(sim.alarms[i].fired);
+	}
+	g_free(sim.alarms);
+	calendar_free(sim.holidays);
+	remove_data_dir(dir);
+	g_free(dir);
+	return ret;
+}
@@ -0,0 +1,47 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_SIMULATE_H_
+#define _MALARM_SIMULATE_H_
+
+#include "malarm_main.h"
+
+/* "malarmd --simulate": a year of alarm scheduling in seconds. The
+ * simulated clock (see malarm_clock.h) steps from one due alarm to the
+ * next, in a zone with DST changes, and the memory backend fires them
+ * as alarmd would. The alarms that skip days are armed again as the
+ * core does when they trigger, some fires are snoozed.
+ *
+ * Each fire is checked against the days the alarm should ring on: a fire
+ * at another local time of day is a drift, a day without its fire a miss,
+ * a second fire on a day a duplicate. The daily and weekly alarms are
+ * repeated by alarmd in fixed minutes, they move by an hour after a DST
+ * change: those fires are counted apart and do not fail the run. It
+ * reports fires per second of real time, and fails if any fire was wrong.
+ * The data files go to a temporary MALARM_DATA_ENV directory.
+ */
+
+#define SIMULATE_DAYS  365
+#define SIMULATE_ALARMS  50
+
+// zone of the simulation if TZ is not set, DST from March to October
+#define SIMULATE_TZ  "EET-2EEST,M3.5.0/3,M10.5.0/4"
+
+int simulate_run(int days, int nalarms);
+
+#endif /* #define _MALARM_SIMULATE_H_ */
@@ -0,0 +1,431 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "malarm_sounds.h"
+#include "malarm_util.h"
+
+#define SOUNDS_FILE  "sounds"
+#define SOUNDS_MAGIC  0x49414c4d  /* "MALI" */
+#define SOUNDS_VERSION  1
+
+// deep enough for music collections, stops loops of bind mounts
+#define SOUNDS_MAX_DEPTH  8
+
+/* File layout, in host byte order:
+ *   u32 magic, u32 version, u32 count
+ *   count records of:
+ *     string path, i64 mtime,
+ *     u32 nfiles, nfiles strings, u32 nsubdirs, nsubdirs strings
+ * strings are u32 length + chars, names are relative to path
+ */
+
+static const char *sound_exts[] = {
+	".mp3", ".wav", ".aac", ".m4a", ".ogg", ".wma", ".amr", NULL
+};
+
+typedef struct {
+	gint64 mtime;
+	GPtrArray *files;    // names of the sound files in the directory
+	GPtrArray *subdirs;  // names of the subdirectories
+	int seen;            // reached by the current scan
+} sound_dir;
+
+typedef struct {
+	app_data *app;
+	sounds_func func;
+	gpointer data;
+	GThread *thread;  // the thread of this scan, app->sound_thread while it runs
+} sounds_scan_data;
+
+typedef struct {
+	sounds_scan_data *scan;
+	GPtrArray *paths;  // NULL if nothing changed
+	int last;
+} sounds_result;
+
+static char *sounds_path(void)
+{
+	return get_data_path(SOUNDS_FILE);
+}
+
+static void free_names(GPtrArray *names)
+{
+	g_ptr_array_foreach(names, (GFunc)g_free, NULL);
+	g_ptr_array_free(names, TRUE);
+}
+
+static sound_dir *sound_dir_new(gint64 mtime)
+{
+	sound_dir *dir;
+
+	dir = g_new0(sound_dir, 1);
+	dir->mtime = mtime;
+	dir->files = g_ptr_array_new();
+	dir->subdirs = g_ptr_array_new();
+	return dir;
+}
+
+static void sound_dir_free(sound_dir *dir)
+{
+	free_names(dir->files);
+	free_names(dir->subdirs);
+	g_free(dir);
+}
+
+static int is_sound_file(const char *name)
+{
+	char *lower;
+	int i, found = 0;
+
+	lower = g_ascii_strdown(name, -1);
+	for (i=0; sound_exts[i] && !found; i++) {
+		found = g_str_has_suffix(lower, sound_exts[i]);
+	}
+	g_free(lower);
+	return found;
+}
+
+// list the sound files and subdirectories of a new or changed directory
+static sound_dir *read_sound_dir(const char *path, gint64 mtime)
+{
+	GDir *gdir;
+	const char *name;
+	char *child;
+	struct stat st;
+	sound_dir *dir;
+
+	dir = sound_dir_new(mtime);
+	if ((gdir = g_dir_open(path, 0, NULL)) == NULL) {
+		return dir;
+	}
+
+	while ((name = g_dir_read_name(gdir)) != NULL) {
+		// hidden directories are skipped, except the sounds of the device
+		if ((name[0] == '.') && (strcmp(name, ".sounds") != 0)) continue;
+
+		child = g_build_filename(path, name, NULL);
+		// symlinks are not followed, they could loop
+		if (g_lstat(child, &st) == 0) {
+			if (S_ISDIR(st.st_mode)) {
+				g_ptr_array_add(dir->subdirs, g_strdup(name));
+			} else if (S_ISREG(st.st_mode) && is_sound_file(name)) {
+				g_ptr_array_add(dir->files, g_strdup(name));
+			}
+		}
+		g_free(child);
+	}
+	g_dir_close(gdir);
+
+	return dir;
+}
+
+// returns TRUE if the index changed
+static gboolean walk_sound_dir(app_data *app, const char *path, int depth)
+{
+	GHashTable *index = app->sound_index;
+	struct stat st;
+	sound_dir *dir;
+	char *child;
+	gboolean changed = FALSE;
+	guint i;
+
+	if ((depth > SOUNDS_MAX_DEPTH) || app->sound_scan_cancel || 
+			(g_stat(path, &st) != 0) || !S_ISDIR(st.st_mode)) {
+		return FALSE;
+	}
+
+	dir = g_hash_table_lookup(index, path);
+	if ((dir == NULL) || (dir->mtime != st.st_mtime)) {
+		dir = read_sound_dir(path, st.st_mtime);
+		g_hash_table_replace(index, g_strdup(path), dir);
+		changed = TRUE;
+	}
+	dir->seen = 1;
+
+	// a subdirectory can change without changing its parent's mtime
+	for (i=0; i<dir->subdirs->len; i++) {
+		child = g_build_filename(path, g_ptr_array_index(dir->subdirs, i), NULL);
+		changed |= walk_sound_dir(app, child, depth + 1);
+		g_free(child);
+	}
+	return changed;
+}
+
+// drop directories that were removed, reset seen for the next scan
+static gboolean remove_unseen_dir(gpointer key, gpointer value, gpointer data)
+{
+	sound_dir *dir = (sound_dir*)value;
+
+	if (!dir->seen) {
+		*(gboolean*)data = TRUE;
+		return TRUE;
+	}
+	dir->seen = 0;
+	return FALSE;
+}
+
+static void put_dir_cb(gpointer key, gpointer value, gpointer data)
+{
+	sound_dir *dir = (sound_dir*)value;
+	GString *buf = (GString*)data;
+	guint i;
+
+	put_string(buf, (const char*)key);
+	put_i64(buf, dir->mtime);
+	put_u32(buf, dir->files->len);
+	for (i=0; i<dir->files->len; i++) {
+		put_string(buf, g_ptr_array_index(dir->files, i));
+	}
+	put_u32(buf, dir->subdirs->len);
+	for (i=0; i<dir->subdirs->len; i++) {
+		put_string(buf, g_ptr_array_index(dir->subdirs, i));
+	}
+}
+
+static void save_index(GHashTable *index)
+{
+	GString *buf;
+	char *path;
+
+	buf = g_string_sized_new(4096);
+	put_u32(buf, SOUNDS_MAGIC);
+	put_u32(buf, SOUNDS_VERSION);
+	put_u32(buf, g_hash_table_size(index));
+	g_hash_table_foreach(index, put_dir_cb, buf);
+
+	path = sounds_path();
+	save_file(path, buf->str, buf->len);
+
+	g_free(path);
+	g_string_free(buf, TRUE);
+}
+
+static int get_names(const gchar **p, const gchar *end, GPtrArray *names)
+{
+	guint32 n;
+	char *name;
+
+	if (get_u32(p, end, &n) != 0) return -1;
+	while (n-- > 0) {
+		if ((get_string(p, end, &name) != 0) || (name == NULL)) return -1;
+		g_ptr_array_add(names, name);
+	}
+	return 0;
+}
+
+static GHashTable *load_index(void)
+{
+	GHashTable *index;
+	char *path;
+	gchar *contents = NULL;
+	gsize len;
+	const gchar *p, *end;
+	guint32 magic, version, count;
+	char *dir_path;
+	gint64 mtime;
+	sound_dir *dir;
+
+	index = g_hash_table_new_full(g_str_hash, g_str_equal, 
+			g_free, (GDestroyNotify)sound_dir_free);
+
+	path = sounds_path();
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		// first scan
+		g_free(path);
+		return index;
+	}
+
+	p = contents;
+	end = contents + len;
+	if ((get_u32(&p, end, &magic) != 0) || (get_u32(&p, end, &version) != 0) ||
+			(get_u32(&p, end, &count) != 0) ||
+			(magic != SOUNDS_MAGIC) || (version != SOUNDS_VERSION)) {
+		malarm_print("error: %s is not a malarm sound index\n", path);
+		goto load_index_out;
+	}
+
+	while (count-- > 0) {
+		dir_path = NULL;
+		dir = NULL;
+		if ((get_string(&p, end, &dir_path) != 0) || (dir_path == NULL) ||
+				(get_bytes(&p, end, &mtime, sizeof(mtime)) != 0) ||
+				(get_names(&p, end, (dir = sound_dir_new(mtime))->files) != 0) ||
+				(get_names(&p, end, dir->subdirs) != 0)) {
+			malarm_print("error: %s is truncated\n", path);
+			g_free(dir_path);
+			if (dir) sound_dir_free(dir);
+			break;
+		}
+		g_hash_table_replace(index, dir_path, dir);
+	}
+	malarm_debug("loaded %u sound directories\n", g_hash_table_size(index));
+
+load_index_out:
+	g_free(contents);
+	g_free(path);
+	return index;
+}
+
+static void add_dir_paths(gpointer key, gpointer value, gpointer data)
+{
+	sound_dir *dir = (sound_dir*)value;
+	guint i;
+
+	for (i=0; i<dir->files->len; i++) {
+		g_ptr_array_add((GPtrArray*)data, 
+				g_build_filename(key, g_ptr_array_index(dir->files, i), NULL));
+	}
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// main loop: hand results to func, and end the scan after the last ones
+static gboolean done_sounds_result(gpointer data)
+{
+	sounds_result *result = (sounds_result*)data;
+	sounds_scan_data *scan = result->scan;
+	app_data *app = scan->app;
+
+	if (result->paths) {
+		scan->func(app, result->paths, scan->data);
+		free_names(result->paths);
+	}
+
+	if (result->last) {
+		// sounds_stop joined this scan already and a newer one may run
+		if (app->sound_thread && (app->sound_thread == scan->thread)) {
+			g_thread_join(app->sound_thread);
+			app->sound_thread = NULL;
+		}
+		g_free(scan);
+	}
+	g_free(result);
+	return FALSE;
+}
+
+// scan thread: post the paths of the index to the main loop
+static void post_sounds_result(sounds_scan_data *scan, int with_paths, int last)
+{
+	sounds_result *result;
+
+	result = g_new0(sounds_result, 1);
+	result->scan = scan;
+	result->last = last;
+	if (with_paths) {
+		result->paths = g_ptr_array_new();
+		g_hash_table_foreach(scan->app->sound_index, add_dir_paths, result->paths);
+		g_ptr_array_sort(result->paths, compare_paths);
+	}
+	g_idle_add(done_sounds_result, result);
+}
+
+static gpointer sounds_thread(gpointer data)
+{
+	sounds_scan_data *scan = (sounds_scan_data*)data;
+	app_data *app = scan->app;
+	gboolean changed = FALSE;
+	char *roots[4];
+	char *dir;
+	int i;
+
+	if (app->sound_index == NULL) {
+		// cached results first, the walk can take a while on a new card
+		app->sound_index = load_index();
+		if (g_hash_table_size(app->sound_index) > 0) {
+			post_sounds_result(scan, TRUE, FALSE);
+		}
+	}
+
+	roots[0] = g_build_filename(g_get_home_dir(), "MyDocs", NULL);
+	roots[1] = g_strdup("/media/mmc1");
+	roots[2] = g_strdup("/media/mmc2");
+	roots[3] = NULL;
+	for (i=0; roots[i]; i++) {
+		changed |= walk_sound_dir(app, roots[i], 0);
+		g_free(roots[i]);
+	}
+
+	if (app->sound_scan_cancel) {
+		// index is incomplete, unseen directories must not be dropped
+		post_sounds_result(scan, FALSE, TRUE);
+		return NULL;
+	}
+
+	g_hash_table_foreach_remove(app->sound_index, remove_unseen_dir, &changed);
+	if (changed) {
+		dir = get_data_path(NULL);
+		g_mkdir(dir, 0700);
+		g_free(dir);
+		save_index(app->sound_index);
+	}
+	malarm_debug("%u sound directories, changed %d\n", 
+			g_hash_table_size(app->sound_index), changed);
+
+	post_sounds_result(scan, changed, TRUE);
+	return NULL;
+}
+
+// main loop: start a scan, unless one is running
+void sounds_scan(app_data *app, sounds_func func, gpointer data)
+{
+	sounds_scan_data *scan;
+	GError *error = NULL;
+
+	if (app->sound_thread) return;
+
+	scan = g_new0(sounds_scan_data, 1);
+	scan->app = app;
+	scan->func = func;
+	scan->data = data;
+
+	app->sound_scan_cancel = 0;
+	app->sound_thread = g_thread_create(sounds_thread, scan, TRUE, &error);
+	// results are handled in the main loop, after this is set
+	scan->thread = app->sound_thread;
+	if (app->sound_thread == NULL) {
+		malarm_print("error: failed to create sound scan thread: %s\n", 
+				error->message);
+		g_error_free(error);
+		g_free(scan);
+	}
+}
+
+// main loop: stop a running scan, before exit
+void sounds_stop(app_data *app)
+{
+	if (app->sound_thread == NULL) return;
+
+	app->sound_scan_cancel = 1;
+	g_thread_join(app->sound_thread);
+	app->sound_thread = NULL;
+}
+
+// main loop: free the index, it is loaded again by the next scan
+void sounds_unload(app_data *app)
+{
+	if (app->sound_thread || (app->sound_index == NULL)) return;
+
+	g_hash_table_destroy(app->sound_index);
+	app->sound_index = NULL;
+}
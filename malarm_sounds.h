@@ -0,0 +1,41 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_SOUNDS_H_
+#define _MALARM_SOUNDS_H_
+
+#include "malarm_main.h"
+
+/* Index of the sound files in MyDocs and on the memory cards, for the
+ * sound picker. A scan runs in its own thread, so walking thousands of
+ * files never blocks the UI or the worker. The index is saved in
+ * MALARM_DATA_DIR with the mtime of each directory, and a scan only reads
+ * the directories whose mtime changed; the others cost one stat().
+ *
+ * func gets the full paths of all sound files, sorted, in the main loop:
+ * first the saved index if it was just loaded, then the scanned one if
+ * anything changed. The paths are freed after func returns.
+ */
+
+typedef void (*sounds_func)(app_data *app, GPtrArray *paths, gpointer data);
+
+void sounds_scan(app_data *app, sounds_func func, gpointer data);
+void sounds_stop(app_data *app);
+void sounds_unload(app_data *app);
+
+#endif /* #define _MALARM_SOUNDS_H_ */
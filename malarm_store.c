@@ -0,0 +1,235 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "malarm_store.h"
+#include "malarm_util.h"
+
+#define STORE_FILE  "disabled"
+#define STORE_MAGIC  0x534c414d  /* "MALS" */
+#define STORE_VERSION  1
+
+/* File layout, in host byte order:
+ *   u32 magic, u32 version, u32 count
+ *   count records of:
+ *     u32 id, event (see put_alarm_event())
+ */
+
+static char *store_path(void)
+{
+	return get_data_path(STORE_FILE);
+}
+
+static void put_record(GString *buf, guint id, const alarm_event_t *event)
+{
+	put_u32(buf, id);
+	put_alarm_event(buf, event);
+}
+
+// returns a new event, free with free_alarm_event_copy()
+static alarm_event_t *get_record(const gchar **p, const gchar *end, guint32 *id)
+{
+	if (get_u32(p, end, id) != 0) {
+		return NULL;
+	}
+	return get_alarm_event(p, end);
+}
+
+static void put_record_cb(gpointer key, gpointer value, gpointer data)
+{
+	put_record((GString*)data, GPOINTER_TO_UINT(key), (alarm_event_t*)value);
+}
+
+// write whole store, see save_file()
+static int store_save(app_data *app)
+{
+	GString *buf;
+	char *path;
+	int ret;
+
+	buf = g_string_sized_new(1024);
+	put_u32(buf, STORE_MAGIC);
+	put_u32(buf, STORE_VERSION);
+	put_u32(buf, g_hash_table_size(app->disabled_events));
+	g_hash_table_foreach(app->disabled_events, put_record_cb, buf);
+
+	path = store_path();
+	ret = save_file(path, buf->str, buf->len);
+
+	g_free(path);
+	g_string_free(buf, TRUE);
+	return ret;
+}
+
+void store_load(app_data *app)
+{
+	char *path;
+	gchar *contents = NULL;
+	gsize len;
+	const gchar *p, *end;
+	guint32 magic, version, count, id;
+	alarm_event_t *event;
+	char *dir;
+
+	if (app->disabled_events) return;
+
+	app->disabled_events = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_alarm_event_copy);
+
+	dir = get_data_path(NULL);
+	g_mkdir(dir, 0700);
+	g_free(dir);
+
+	path = store_path();
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		// no disabled alarms yet
+		g_free(path);
+		return;
+	}
+
+	p = contents;
+	end = contents + len;
+	if ((get_bytes(&p, end, &magic, sizeof(magic)) != 0) ||
+			(get_bytes(&p, end, &version, sizeof(version)) != 0) ||
+			(get_bytes(&p, end, &count, sizeof(count)) != 0) ||
+			(magic != STORE_MAGIC) || (version != STORE_VERSION)) {
+		malarm_print("error: %s is not a malarm store\n", path);
+		goto store_load_out;
+	}
+
+	while (count-- > 0) {
+		if ((event = get_record(&p, end, &id)) == NULL) {
+			malarm_print("error: %s is truncated\n", path);
+			break;
+		}
+		g_hash_table_replace(app->disabled_events, GUINT_TO_POINTER(id), event);
+	}
+	malarm_debug("loaded %u disabled alarms\n", 
+			g_hash_table_size(app->disabled_events));
+
+store_load_out:
+	g_free(contents);
+	g_free(path);
+}
+
+static void add_event_size(gpointer key, gpointer value, gpointer data)
+{
+	*(gsize*)data += alarm_event_copy_size((alarm_event_t*)value);
+}
+
+// free the events in memory, they are loaded again when needed
+void store_unload(app_data *app, guint *nevents, gsize *size)
+{
+	*nevents = 0;
+	*size = 0;
+	if (app->disabled_events == NULL) return;
+
+	*nevents = g_hash_table_size(app->disabled_events);
+	g_hash_table_foreach(app->disabled_events, add_event_size, size);
+
+	g_hash_table_destroy(app->disabled_events);
+	app->disabled_events = NULL;
+}
+
+// put n events at once, with a single write of the store
+int store_put_batch(app_data *app, guint n, const guint *ids, 
+		alarm_event_t * const *events)
+{
+	alarm_event_t **old_events;
+	guint i;
+
+	store_load(app);
+
+	old_events = g_new0(alarm_event_t*, n);
+	for (i=0; i<n; i++) {
+		old_events[i] = g_hash_table_lookup(app->disabled_events, 
+				GUINT_TO_POINTER(ids[i]));
+		if (old_events[i]) {
+			g_hash_table_steal(app->disabled_events, GUINT_TO_POINTER(ids[i]));
+		}
+		g_hash_table_insert(app->disabled_events, GUINT_TO_POINTER(ids[i]), 
+				copy_alarm_event(events[i]));
+	}
+
+	if (store_save(app) != 0) {
+		for (i=0; i<n; i++) {
+			if (old_events[i]) {
+				g_hash_table_replace(app->disabled_events, 
+						GUINT_TO_POINTER(ids[i]), old_events[i]);
+			} else {
+				g_hash_table_remove(app->disabled_events, GUINT_TO_POINTER(ids[i]));
+			}
+		}
+		g_free(old_events);
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		free_alarm_event_copy(old_events[i]);
+	}
+	g_free(old_events);
+	return 0;
+}
+
+int store_put(app_data *app, guint id, const alarm_event_t *event)
+{
+	return store_put_batch(app, 1, &id, (alarm_event_t * const *)&event);
+}
+
+// remove n events at once, with a single write of the store
+int store_remove_batch(app_data *app, guint n, const guint *ids)
+{
+	alarm_event_t **old_events;
+	guint i, nremoved = 0;
+
+	store_load(app);
+
+	old_events = g_new0(alarm_event_t*, n);
+	for (i=0; i<n; i++) {
+		old_events[i] = g_hash_table_lookup(app->disabled_events, 
+				GUINT_TO_POINTER(ids[i]));
+		if (old_events[i]) {
+			g_hash_table_steal(app->disabled_events, GUINT_TO_POINTER(ids[i]));
+			nremoved++;
+		}
+	}
+
+	if ((nremoved > 0) && (store_save(app) != 0)) {
+		for (i=0; i<n; i++) {
+			if (old_events[i]) {
+				g_hash_table_insert(app->disabled_events, 
+						GUINT_TO_POINTER(ids[i]), old_events[i]);
+			}
+		}
+		g_free(old_events);
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		free_alarm_event_copy(old_events[i]);
+	}
+	g_free(old_events);
+	return 0;
+}
+
+int store_remove(app_data *app, guint id)
+{
+	return store_remove_batch(app, 1, &id);
+}
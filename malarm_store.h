@@ -0,0 +1,39 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_STORE_H_
+#define _MALARM_STORE_H_
+
+#include "malarm_main.h"
+
+/* Disabled alarms are not registered with alarmd, they are kept in
+ * malarm's own store, a small binary file with all event fields.
+ * The event alarm_time is the actual time of the disabled alarm.
+ * Only the worker thread uses the store. The events are kept in memory
+ * once loaded, store_unload() drops them until they are needed again.
+ */
+
+void store_load(app_data *app);
+void store_unload(app_data *app, guint *nevents, gsize *size);
+int store_put(app_data *app, guint id, const alarm_event_t *event);
+int store_put_batch(app_data *app, guint n, const guint *ids, 
+		alarm_event_t * const *events);
+int store_remove(app_data *app, guint id);
+int store_remove_batch(app_data *app, guint n, const guint *ids);
+
+#endif /* #define _MALARM_STORE_H_ */
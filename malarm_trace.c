@@ -0,0 +1,123 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "malarm_trace.h"
+
+// records are written in blocks of about this size
+#define TRACE_BUF_SIZE  4096
+
+// tracing is process wide, like logging
+static int trace_fd = -1;
+static gint64 trace_t0;
+static GString *trace_buf;
+static GStaticMutex trace_mutex = G_STATIC_MUTEX_INIT;
+static volatile int trace_phase;
+
+static gint64 now_usec(void)
+{
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+	return (gint64)tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
+}
+
+// trace_mutex must be held
+static void trace_flush(void)
+{
+	if (trace_buf->len == 0) return;
+
+	if (write(trace_fd, trace_buf->str, trace_buf->len) != trace_buf->len) {
+		malarm_print("error: failed to write trace: %s\n", g_strerror(errno));
+	}
+	g_string_truncate(trace_buf, 0);
+}
+
+void trace_start(void)
+{
+	const char *path = g_getenv(MALARM_TRACE_ENV);
+	guint32 header[2] = { TRACE_MAGIC, TRACE_VERSION };
+
+	if ((path == NULL) || (path[0] == '\0')) return;
+
+	trace_fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (trace_fd < 0) {
+		malarm_print("error: failed to create trace %s: %s\n", path, 
+				g_strerror(errno));
+		return;
+	}
+
+	trace_buf = g_string_sized_new(TRACE_BUF_SIZE + 256);
+	g_string_append_len(trace_buf, (const gchar*)header, sizeof(header));
+	trace_t0 = now_usec();
+	malarm_print("tracing backend calls to %s\n", path);
+}
+
+void trace_stop(void)
+{
+	if (trace_fd < 0) return;
+
+	g_static_mutex_lock(&trace_mutex);
+	trace_flush();
+	close(trace_fd);
+	trace_fd = -1;
+	g_string_free(trace_buf, TRUE);
+	trace_buf = NULL;
+	g_static_mutex_unlock(&trace_mutex);
+}
+
+// phase of the calls made by the worker thread from now on
+void trace_set_phase(int phase)
+{
+	trace_phase = phase;
+}
+
+gint64 trace_begin(void)
+{
+	return (trace_fd < 0) ? 0 : now_usec();
+}
+
+// phase -1 is the worker's current phase
+void trace_end(int op, int phase, gint64 start, gint64 arg, gint64 result, 
+		const char *str)
+{
+	trace_record rec;
+	gsize len = str ? strlen(str) : 0;
+
+	if (trace_fd < 0) return;
+
+	rec.op = op;
+	rec.phase = (phase < 0) ? trace_phase : phase;
+	rec.len = MIN(len, G_MAXUINT16);
+	rec.duration = now_usec() - start;
+	rec.start = start - trace_t0;
+	rec.arg = arg;
+	rec.result = result;
+
+	g_static_mutex_lock(&trace_mutex);
+	if (trace_fd >= 0) {
+		g_string_append_len(trace_buf, (const gchar*)&rec, sizeof(rec));
+		g_string_append_len(trace_buf, str, rec.len);
+		if (trace_buf->len >= TRACE_BUF_SIZE) trace_flush();
+	}
+	g_static_mutex_unlock(&trace_mutex);
+}
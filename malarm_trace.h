@@ -0,0 +1,42 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_TRACE_H_
+#define _MALARM_TRACE_H_
+
+#include "malarm_main.h"
+#include "malarm_trace_format.h"
+
+/* If MALARM_TRACE is set to a file name, every backend call is recorded
+ * there, with its arguments, result and duration (see
+ * malarm_trace_format.h). The backend_* calls in malarm_backend.c do the
+ * recording, and cost one test when tracing is off.
+ * Calls may come from any thread.
+ */
+#define MALARM_TRACE_ENV  "MALARM_TRACE"
+
+void trace_start(void);
+void trace_stop(void);
+void trace_set_phase(int phase);
+
+// start = trace_begin(), call, trace_end()
+gint64 trace_begin(void);
+void trace_end(int op, int phase, gint64 start, gint64 arg, gint64 result, 
+		const char *str);
+
+#endif /* #define _MALARM_TRACE_H_ */
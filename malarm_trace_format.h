@@ -0,0 +1,78 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_TRACE_FORMAT_H_
+#define _MALARM_TRACE_FORMAT_H_
+
+/* Backend call trace file, written by malarm (see malarm_trace.h) and
+ * read by tools/malarm_replay. Only needs glib, so the replay tool
+ * builds on a plain Linux machine.
+ *
+ * The file is TRACE_MAGIC, TRACE_VERSION (u32 each), then records.
+ * Each record is a trace_record, followed by len bytes of string
+ * argument (gconf key, sound path or event dbus_name), not terminated.
+ * Values are in the byte order of the device.
+ */
+
+#include <glib.h>
+
+#define TRACE_MAGIC    0x544c414d  /* "MALT" */
+#define TRACE_VERSION  1
+
+enum {
+	TRACE_ALARM_QUERY = 1,    // arg: first time, result: number of cookies
+	TRACE_ALARM_GET,          // arg: cookie, result: 1 if event was found
+	TRACE_ALARM_ADD,          // arg: alarm time, result: cookie
+	TRACE_ALARM_DEL,          // arg: cookie, result: 1 on success
+	TRACE_GCONF_GET_INT,      // result: value
+	TRACE_GCONF_SET_INT,      // arg: value, result: 1 on success
+	TRACE_GCONF_UNSET,        // result: 1 on success
+	TRACE_GCONF_GET_BOOL,     // result: value
+	TRACE_GCONF_SET_BOOL,     // arg: value, result: 1 on success
+	TRACE_GCONF_ALL_ENTRIES,  // result: number of entries
+	TRACE_GCONF_RECURSIVE_UNSET,  // result: 1 on success
+	TRACE_SOUND_PLAY,         // result: osso return code
+	TRACE_SOUND_STOP,         // result: osso return code
+	TRACE_ALARM_GET_BATCH,    // arg: number of cookies
+	TRACE_ALARM_ADD_BATCH,    // arg: number of events
+	TRACE_KEY_SET_BATCH,      // arg: number of keys, result: 1 on success
+	TRACE_KEY_COMMIT,         // arg: number of changes, result: 1 on success
+	TRACE_N_OPS
+};
+
+// what malarm was doing when the call was made
+enum {
+	TRACE_PHASE_NONE,
+	TRACE_PHASE_REFRESH,
+	TRACE_PHASE_ROW_OP,
+	TRACE_PHASE_CLONE,
+	TRACE_PHASE_SOUND,
+	TRACE_N_PHASES
+};
+
+typedef struct {
+	guint8 op;          // gconf ops are the key ops of any backend
+	guint8 phase;
+	guint16 len;        // bytes of string argument after the record
+	guint32 duration;   // usec
+	guint64 start;      // usec since the trace was started
+	gint64 arg;
+	gint64 result;
+} trace_record;
+
+#endif /* #define _MALARM_TRACE_FORMAT_H_ */
@@ -22,25 +22,27 @@
 #include "malarm_main.h"
 #include "malarm_ui.h"
 #include "malarm_util.h"
+#include "malarm_worker.h"
+#include "malarm_store.h"
+#include "malarm_registry.h"
+#include "malarm_fetch.h"
+#include "malarm_sched.h"
+#include "malarm_trace.h"
+#include "malarm_backend.h"
+#include "malarm_calendar.h"
+#include "malarm_sounds.h"
+#include "malarm_scan.h"
+#include "malarm_client.h"
+#include "malarm_proto.h"
+#include "malarm_journal.h"
+#include "malarm_clock.h"
+#include "malarm_profiles.h"
+#include "malarm_conflicts.h"
 
 
-#define TIME_T_MAX  (LONG_MAX)
-
-// 0, TIME_T_MAX do not work!
-/* #define ALARM_DISABLED  (0) */
-/* #define ALARM_DISABLED  (TIME_T_MAX) // gives negative cookie */
-#define ALARM_DISABLED  (TIME_T_MAX - 200)
-
 // #sec to add to current time for a new alarm in "new alarm" dialog
 #define NEW_ALARM_TIME_INC   (60*60)
 
-// debounce delay when enabling/disabling an alarm
-#define KEY_DEBOUNCE_DELAY  200  /* msec */
-
-#define ALARM_EVENT_FLAGS  (ALARM_EVENT_BOOT | ALARM_EVENT_ACTDEAD | \
-		ALARM_EVENT_SHOW_ICON | ALARM_EVENT_RUN_DELAYED)
-		/* ALARM_EVENT_SHOW_ICON | ALARM_EVENT_POSTPONE_DELAYED) */
- 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof((a)[0]))
 
 #define SNOOZE_STRING(snoozed) ((snoozed) ? "S" : " ")
@@ -55,6 +57,10 @@ enum {
 	MESSAGE_COLUMN,
 	COOKIE_COLUMN,
 	ALARM_TIME_COLUMN,
+	ACTIVATABLE_COLUMN,
+	ID_COLUMN,
+	SNOOZED_COLUMN,
+	RECURRENCE_COLUMN,
 	N_COLUMNS
 };
 
@@ -62,6 +68,23 @@ enum {
 	REPEAT_ONCE,
 	REPEAT_DAILY,
 	REPEAT_WEEKLY,
+	REPEAT_WEEKDAYS,  // daily, on some days of the week only
+};
+
+// prebuilt "Add alarm" / "Edit alarm" dialog, reused between runs
+struct _alarm_dialog_data {
+	GtkWidget *dialog;
+	GtkWidget *time_now_label;
+	GtkWidget *time_editor;
+	GtkWidget *date_editor;
+	GtkWidget *repeat_combo_box;
+	GtkWidget *message_entry;
+	GtkWidget *weekday_box;
+	GtkWidget *weekday_buttons[7];  // Monday first
+	GtkWidget *skip_box;
+	GtkWidget *skip_holidays_check;
+	calendar *skip_days;       // being edited
+	alarm_calendar *calendar;  // result, taken by the caller
 };
 
 struct repeat_info {
@@ -71,6 +94,11 @@ struct repeat_info {
 	{ 0, "Once" },
 	{ 60*24, "Daily" },
 	{ 60*24*7, "Weekly" },
+	{ 60*24, "Days of week" },
+};
+
+static char *weekday_labels[] = {
+	"Mo", "Tu", "We", "Th", "Fr", "Sa", "Su",
 };
 
 static char *sounds_list[] = {
@@ -83,82 +111,33 @@ static char *sounds_list[] = {
 
 static void cb_row_activated(GtkTreeView *view, GtkTreePath *path,
 		GtkTreeViewColumn *column, app_data *app);
-static int alarm_dialog(app_data *app, cookie_t old_cookie, 
-		cookie_t *new_cookie, alarm_event_t *event);
-static int add_alarm_to_tree(app_data *app, cookie_t cookie, alarm_event_t *event);
-
-
-static void cb_action_add(GtkWidget *widget, app_data *app)
-{
-	int ret;
-	cookie_t cookie;
-	alarm_event_t event;
-
-	g_assert(app != NULL);
-
-	/* malarm_debug("add alarm event\n"); */
-	ret = alarm_dialog(app, 0, &cookie, &event);
-	if (ret == 0) {
-		add_alarm_to_tree(app, cookie, &event);
-		/* populate_tree(app); */
-		free(event.message);
-		show_banner(app, "Added alarm");
-	}
-}
-
-static void remove_item(app_data *app, GtkTreeIter *iter)
+static int alarm_dialog(app_data *app, GtkTreeIter *iter, alarm_event_t *event);
+static const char *repeat_text(app_data *app, guint id, guint32 recurrence, 
+		char *buf);
+static void set_alarm_row(app_data *app, GtkTreeIter *iter, guint id, 
+		cookie_t cookie, alarm_event_t *event, int enabled, int busy);
+static void add_alarm_to_tree(app_data *app, guint id, cookie_t cookie, 
+		alarm_event_t *event, int enabled, int busy, GtkTreeIter *new_iter);
+static void remove_item(app_data *app, GtkTreeIter *iter);
+static gboolean prebuild_alarm_dialog(gpointer data);
+
+void show_banner(app_data *app, const char *text)
 {
-	GtkTreePath *path;
-	GtkTreeIter next_iter;
-	int nitems;
-	int ret;
-
-	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), iter);
-	g_assert(path);
-
-	next_iter = *iter;
-	gtk_tree_store_remove(GTK_TREE_STORE(app->store), iter);
-
-	if (gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &next_iter) == FALSE) {
-		// no next item, so get prev iter
-		nitems = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL);
-		if (nitems == 0) {
-			// empty list, so just exit
-			return;
-		}
-		ret = gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(app->store), 
-				&next_iter, NULL, nitems-1);
-		g_assert(ret == TRUE);
-		path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &next_iter);
-		g_assert(path);
-	}
-
-	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+	hildon_banner_show_information(GTK_WIDGET(app->window), NULL, text);
 }
 
-static void cb_action_remove(GtkWidget *widget, app_data *app)
+// true if the user answers OK
+static int confirm_dialog(app_data *app, GtkWindow *parent, const char *text)
 {
-	GtkTreeSelection *selection;
-	GtkTreeIter iter;
 	GtkWidget *dialog;
-	GtkWidget *label;
-	cookie_t cookie;
-	gchar key[100];
 	gint ret;
+	int running;
 
-	g_assert(app != NULL);
-
-	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->view));
-	if (gtk_tree_selection_get_selected(selection, NULL, &iter)==FALSE) {
-		return;
-	}
-
-	dialog = gtk_message_dialog_new(
-		GTK_WINDOW(app->window),
+	dialog = gtk_message_dialog_new(parent, 
 		GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
 		GTK_MESSAGE_QUESTION,
 		GTK_BUTTONS_NONE,
-		"Remove alarm?");
+		"%s", text);
 
 	gtk_dialog_add_buttons(GTK_DIALOG(dialog), 
 		GTK_STOCK_OK, GTK_RESPONSE_OK,
@@ -167,655 +146,2534 @@ static void cb_action_remove(GtkWidget *widget, app_data *app)
 
 	gtk_widget_show_all(GTK_WIDGET(dialog));
 
+	// may be asked from the alarm dialog, which is still running
+	running = app->widget_running;
 	app->widget_running = 1;
 	ret = gtk_dialog_run(GTK_DIALOG(dialog));
 	gtk_widget_destroy(dialog);
-	app->widget_running = 0;
-	if (ret != GTK_RESPONSE_OK) {
-		return;
-	}
+	app->widget_running = running;
+	return (ret == GTK_RESPONSE_OK);
+}
 
-	gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
-				COOKIE_COLUMN, &cookie,
+
+/* An add, edit, enable/disable or remove of one alarm, done by the worker.
+ * The row shows the new state right away, and cannot be activated while
+ * the request is in flight. If the request fails, the row is rolled back.
+ */
+typedef struct {
+	GtkTreeRowReference *row;  // NULL if row is removed
+	guint id;
+	cookie_t old_cookie;       // 0 for a new or disabled alarm
+	cookie_t new_cookie;       // set by worker, 0 if disabled
+	alarm_event_t *old_event;  // NULL for a new alarm
+	alarm_event_t *event;      // NULL if alarm is removed
+	int old_enabled;
+	int enabled;
+	int failed;
+	int set_calendar;          // replace the exception days with calendar
+	alarm_calendar *calendar;  // NULL if none
+	int keep_old_cookie;       // old instance stays with alarmd
+	const char *done_text;     // NULL for no banner
+	const char *fail_text;
+} row_op;
+
+// true if a request for the row at iter is in flight
+static int is_row_busy(app_data *app, GtkTreeIter *iter)
+{
+	int activatable;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(app->store), iter, 
+				ACTIVATABLE_COLUMN, &activatable,
 				-1);
-	alarm_event_del(cookie);
-	cookie_to_gconf_key(cookie, key);
-	gconf_client_unset(app->gconf, key, NULL);
-	malarm_debug("removed alarm cookie %ld\n", cookie);
-	remove_item(app, &iter);
+	return !activatable;
 }
 
-static void cb_action_edit(GtkWidget *widget, app_data *app)
+// start an operation on the alarm at iter, taking its cached event
+static row_op *new_row_op(app_data *app, GtkTreeIter *iter)
 {
-	GtkTreeSelection *selection;
-	GtkTreeIter iter;
-	GtkTreePath *path;
+	row_op *op;
 
-	g_assert(app != NULL);
+	op = g_new0(row_op, 1);
+	gtk_tree_model_get(GTK_TREE_MODEL(app->store), iter, 
+				ID_COLUMN, &op->id,
+				COOKIE_COLUMN, &op->old_cookie,
+				ENABLED_COLUMN, &op->old_enabled,
+				-1);
 
-	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->view));
-	if (gtk_tree_selection_get_selected(selection, NULL, &iter)) {
-		path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &iter);
-		cb_row_activated(GTK_TREE_VIEW(app->view), path, NULL, app);
-		gtk_tree_path_free(path);
-	}
+	op->old_event = g_hash_table_lookup(app->events, GUINT_TO_POINTER(op->id));
+	g_assert(op->old_event != NULL);
+	g_hash_table_steal(app->events, GUINT_TO_POINTER(op->id));
+
+	return op;
 }
 
-static void cb_action_about(GtkWidget *widget, app_data *app)
+static void free_row_op(row_op *op)
 {
-	g_assert(app != NULL);
-
-	gtk_show_about_dialog(GTK_WINDOW(app->window),
-			"version", MALARM_VERSION,
-			"copyright", "(c) 2008 Ronald Taneza <ronald.taneza@gmail.com>",
-			NULL);
+	if (op->row) gtk_tree_row_reference_free(op->row);
+	free_alarm_event_copy(op->old_event);
+	free_alarm_event_copy(op->event);
+	alarm_calendar_free(op->calendar);
+	g_free(op);
 }
 
-static gboolean toggled_timeout(gpointer data)
+// worker thread: register op->event with alarmd
+static int register_row_op(app_data *app, row_op *op)
 {
-	GtkTreeIter iter;
-	cookie_t cookie;
-	cookie_t new_cookie;
-	alarm_event_t *event = NULL;
-	gchar key[100];
-	int new_state;
+	op->new_cookie = registry_add(app, op->id, op->event);
+	if (op->new_cookie == 0) {
+		op->failed = 1;
+		return -1;
+	}
+	return 0;
+}
 
-	app_data *app = (app_data*)data;
-	g_assert(app != NULL);
+// worker thread: ids below next_id are in use
+static void save_next_id(app_data *app, guint next_id)
+{
+	if (backend_key_set(app, MALARM_GCONF_NEXT_ID, next_id) != 0) {
+		malarm_print("error: failed to set gconf key %s to %u\n", 
+				MALARM_GCONF_NEXT_ID, next_id);
+	}
+}
 
-	iter = app->toggled_iter;
-	gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter,
-			ENABLED_COLUMN, &new_state,
-			-1);
-	new_state ^= 1;
-	malarm_debug("new toggle state %d\n", new_state);
+/* worker thread: register the new event, then delete the old one.
+ * Only enabled alarms are in alarmd, disabled ones are in the store.
+ */
+static void apply_row_op(app_data *app, row_op *op)
+{
+	int was_disabled = (op->old_event != NULL) && !op->old_enabled;
 
-	gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
-				COOKIE_COLUMN, &cookie,
-				-1);
-	event = alarm_event_get(cookie);
-	if (event == NULL) {
-		malarm_debug("error: unable to get alarm event of cookie %ld\n", cookie);
-		goto cb_toggled_out;
+	if (op->set_calendar && (calendar_put(app, op->id, op->calendar) != 0)) {
+		op->failed = 1;
+		return;
 	}
 
-	if (new_state == FALSE) {
-		time_t orig_time = event->alarm_time + event->snoozed*60;
-
-		event->alarm_time = ALARM_DISABLED;
-		event->flags = 0;
-		event->snoozed = 0;
-		new_cookie = alarm_event_add(event);
-		if (new_cookie <= 0) {
-			malarm_print("error setting alarm event, error code: '%d'\n", 
-					alarmd_get_error());
-			goto cb_toggled_out;
+	if (op->event && op->enabled) {
+		if (register_row_op(app, op) != 0) {
+			return;
 		}
-		/* malarm_debug("new cookie %ld\n", new_cookie); */
-		alarm_event_del(cookie);
-
-		cookie_to_gconf_key(new_cookie, key);
-		if (!gconf_client_set_int(app->gconf, key, orig_time, NULL)) {
-			malarm_print("error: failed to set gconf key %s to %ld\n", 
-					key, orig_time);
-			goto cb_toggled_out;
+		if (op->old_event == NULL) {
+			save_next_id(app, op->id + 1);
 		}
 
-		show_banner(app, "Disabled alarm");
-		malarm_debug("disabled cookie %ld, time %ld\n", cookie, orig_time);
-		malarm_debug("set gconf key %s to %ld\n", key, orig_time);
-		print_alarm_event(new_cookie, event);
-
-	} else {
-
-		cookie_to_gconf_key(cookie, key);
-		event->alarm_time = gconf_client_get_int(app->gconf, key, NULL);
-		if (event->alarm_time == 0) {
-			malarm_print("error: failed to get gconf key %s\n", key);
-			goto cb_toggled_out;
+	} else if (op->event) {
+		if (store_put(app, op->id, op->event) != 0) {
+			op->failed = 1;
+			return;
 		}
+	}
 
-		event->flags = ALARM_EVENT_FLAGS;
-		new_cookie = alarm_event_add(event);
-		if (new_cookie <= 0) {
-			malarm_print("error setting alarm event, error code: '%d'\n", 
-					alarmd_get_error());
-			goto cb_toggled_out;
+	// a triggered instance is dropped by alarmd itself
+	if ((op->old_cookie > 0) && !op->keep_old_cookie) {
+		if ((backend_event_del(app, op->old_cookie) != 0) && (op->event == NULL)) {
+			malarm_print("error: failed to remove alarm cookie %ld\n", 
+					op->old_cookie);
+			op->failed = 1;
+			return;
+		}
+		if (op->new_cookie == 0) {
+			registry_unset(app, op->id);
+		}
+	} else if (was_disabled && ((op->event == NULL) || op->enabled)) {
+		if ((store_remove(app, op->id) != 0) && (op->event == NULL)) {
+			op->failed = 1;
+			return;
 		}
-		alarm_event_del(cookie);
-		gconf_client_unset(app->gconf, key, NULL);
-
-		show_banner(app, "Enabled alarm");
-		malarm_debug("enabled cookie %ld, time %ld\n", cookie, event->alarm_time);
-		print_alarm_event(new_cookie, event);
 	}
 
-	gtk_tree_store_set(GTK_TREE_STORE(app->store), &iter, 
-			SNOOZE_COLUMN, SNOOZE_STRING(event->snoozed),
-			ENABLED_COLUMN, new_state,
-			COOKIE_COLUMN, new_cookie,
-			ALARM_TIME_COLUMN, event->alarm_time,
-			-1);
-
-cb_toggled_out:
-	if (event) alarm_event_free(event);
-	gtk_widget_set_sensitive(GTK_WIDGET(app->view), TRUE);
-	g_object_set(GTK_OBJECT(app->toggled_renderer), "activatable", TRUE, NULL);
-	app->toggled_processing = 0;
-	malarm_debug("toggled finished\n");
-
-	return FALSE;
+	malarm_debug("id %u: old cookie %ld, new cookie %ld\n", 
+			op->id, op->old_cookie, op->new_cookie);
 }
 
-static void cb_toggled(GtkCellRendererToggle *renderer, gchar *path, app_data *app)
+// worker thread: the steps of an operation are journaled, and its gconf
+// changes are made at once (see malarm_journal.h)
+static void run_row_op(app_data *app, gpointer data)
 {
-	g_assert(app != NULL);
+	row_op *op = (row_op*)data;
+	int flags = 0;
 
-	if (app->toggled_processing) return;
+	trace_set_phase(TRACE_PHASE_ROW_OP);
 
-	malarm_debug("item %s toggled\n", path);
+	if (op->event && op->enabled) {
+		flags = JOURNAL_ADD | (op->keep_old_cookie ? JOURNAL_KEEP_OLD : 0);
+	} else if (op->event) {
+		flags = JOURNAL_DISABLE;
+	}
 
-	g_object_set(GTK_OBJECT(app->toggled_renderer), "activatable", FALSE, NULL);
-	gtk_widget_set_sensitive(GTK_WIDGET(app->view), FALSE);
+	journal_begin(app, op->id, op->old_cookie, flags);
+	apply_row_op(app, op);
+	journal_commit(app);
+}
 
-	if (!gtk_tree_model_get_iter_from_string(
-				GTK_TREE_MODEL(app->store), &app->toggled_iter, path)) {
-		malarm_print("error: unable to get iter from path: %s\n", path);
-		return;
+// refresh tree if it was requested while row operations were in flight
+static void run_deferred_refresh(app_data *app)
+{
+	if (app->refresh_deferred && !app->refreshing && (app->ops_pending == 0)) {
+		app->refresh_deferred = 0;
+		populate_tree(app);
 	}
- 
-	// for "key debouncing"
-	app->toggled_processing = 1;
-	g_timeout_add(KEY_DEBOUNCE_DELAY, toggled_timeout, app);
 }
 
-static gboolean cb_visibility(GtkWidget *widget, GdkEventVisibility *visibility, 
-		app_data *app)
+// main loop: apply the result of the operation to the row
+static void done_row_op(app_data *app, gpointer data)
 {
-	g_assert(app != NULL);
+	row_op *op = (row_op*)data;
+	GtkTreeIter iter;
+	GtkTreePath *path = NULL;
+	int have_row = 0;
 
-	malarm_debug("visibility=%d, window is %s, %s\n", visibility->state,
-			gtk_window_is_active(GTK_WINDOW(app->window)) ? "active" : "not active",
-			hildon_window_get_is_topmost(HILDON_WINDOW(app->window)) ? 
-			"topmost" : "not topmost");
+	if (op->row && (path = gtk_tree_row_reference_get_path(op->row))) {
+		have_row = gtk_tree_model_get_iter(GTK_TREE_MODEL(app->store), &iter, path);
+		gtk_tree_path_free(path);
+	}
 
-	/* Repopulate only if:
-	 * - app was previously completely not visible, and is now fully visible
-	 * - some external widget (such as the alarm trigger dialog) obscured
-	 *   the app, and app is now fully visible
-	 */
-	if (!app->widget_running &&
+	if (op->failed) {
+		if (op->old_event == NULL) {
+			if (have_row) remove_item(app, &iter);
+		} else if (have_row) {
+			set_alarm_row(app, &iter, op->id, op->old_cookie, op->old_event, 
+					op->old_enabled, FALSE);
+		} else {
+			add_alarm_to_tree(app, op->id, op->old_cookie, op->old_event, 
+					op->old_enabled, FALSE, NULL);
+		}
+		show_banner(app, op->fail_text);
+	} else {
+		scan_item item = { op->id, op->new_cookie, op->event, op->enabled };
 
-		(((app->visibility == GDK_VISIBILITY_FULLY_OBSCURED) &&
-		(visibility->state == GDK_VISIBILITY_UNOBSCURED)) ||
+		if (op->set_calendar) calendar_cached_put(app, op->id, op->calendar);
+		if (have_row) {
+			set_alarm_row(app, &iter, op->id, op->new_cookie, op->event, 
+					op->enabled, FALSE);
+		}
+		client_changed(app, &item, 1);
+		if (op->done_text) show_banner(app, op->done_text);
+	}
 
-		// old
-		(((app->visibility == GDK_VISIBILITY_PARTIAL) &&
-			app->window_active && app->window_topmost) &&
-		// new
-		((visibility->state == GDK_VISIBILITY_UNOBSCURED) &&
-		 	!gtk_window_is_active(GTK_WINDOW(app->window)) &&
-			hildon_window_get_is_topmost(HILDON_WINDOW(app->window)))))) {
+	free_row_op(op);
 
-		populate_tree(app);
+	app->ops_pending--;
+	run_deferred_refresh(app);
+}
 
-	}
+// show new state of the row as busy, and keep a reference to it
+static void show_row_op(app_data *app, GtkTreeIter *iter, row_op *op)
+{
+	GtkTreePath *path;
 
-	app->visibility = visibility->state;
-	app->window_active = gtk_window_is_active(GTK_WINDOW(app->window));
-	app->window_topmost = hildon_window_get_is_topmost(HILDON_WINDOW(app->window));
+	set_alarm_row(app, iter, op->id, 0, op->event, op->enabled, TRUE);
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), iter);
+	op->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(app->store), path);
+	gtk_tree_path_free(path);
+}
 
-	return TRUE;
+// show new state of the row (if any), then hand the operation to the worker
+static void submit_row_op(app_data *app, GtkTreeIter *iter, row_op *op)
+{
+	if (iter) show_row_op(app, iter, op);
+
+	app->ops_pending++;
+	worker_submit(app, run_row_op, done_row_op, op);
 }
 
-static void cb_row_activated(GtkTreeView *view, GtkTreePath *path,
-		GtkTreeViewColumn *column, app_data *app)
+static void cb_action_add(GtkWidget *widget, app_data *app)
 {
-	GtkTreeIter iter;
-	cookie_t old_cookie, new_cookie;
 	alarm_event_t event;
-	int ret;
+	GtkTreeIter iter;
+	row_op *op;
 
 	g_assert(app != NULL);
 
-	/* malarm_debug("item %s activated\n", gtk_tree_path_to_string(path)); */
-	if (!gtk_tree_model_get_iter(
-				GTK_TREE_MODEL(app->store), &iter, path)) {
-		malarm_print("error: unable to get iter from path: %s\n", 
-				gtk_tree_path_to_string(path));
+	if (app->refreshing) return;
+
+	/* malarm_debug("add alarm event\n"); */
+	if (alarm_dialog(app, NULL, &event) != 0) {
 		return;
 	}
-	gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
-				COOKIE_COLUMN, &old_cookie,
-				-1);
-	ret = alarm_dialog(app, old_cookie, &new_cookie, &event);
-	if (ret == 0) {
-		gtk_tree_store_remove(app->store, &iter);
-		add_alarm_to_tree(app, new_cookie, &event);
-		free(event.message);
-		show_banner(app, "Updated alarm");
-		malarm_debug("item %s: updated alarm: old cookie %ld, new_cookie %ld\n", 
-				gtk_tree_path_to_string(path), old_cookie, new_cookie);
-	}
-}
 
-static void stop_preview_sound(app_data *app)
-{
-	stop_sound(app);
-	gtk_button_set_label(GTK_BUTTON(app->preview_button), GTK_STOCK_MEDIA_PLAY);
+	op = g_new0(row_op, 1);
+	op->id = app->next_id++;
+	op->event = copy_alarm_event(&event);
+	set_alarm_event_id(op->event, op->id);
+	op->enabled = TRUE;
+	op->set_calendar = TRUE;
+	op->calendar = app->dlg->calendar;
+	app->dlg->calendar = NULL;
+	op->done_text = "Added alarm";
+	op->fail_text = "Failed to add alarm";
+	free(event.message);
+
+	add_alarm_to_tree(app, op->id, 0, op->event, op->enabled, TRUE, &iter);
+	submit_row_op(app, &iter, op);
 }
 
-static void cb_sound_popup(GtkComboBox *combo_box, app_data *app)
-{
-	g_assert(app != NULL);
-	stop_preview_sound(app);
-}
+/* Cloning adds copies of one alarm, each clone_interval units after the
+ * previous one. All copies are added as one batch: one worker request,
+ * one store write for disabled copies, one next_id update, and one pass
+ * over the tree.
+ */
+enum {
+	CLONE_MINUTES,
+	CLONE_HOURS,
+	CLONE_DAYS,
+	CLONE_WEEKDAYS,
+};
 
-static void cb_preview_clicked(GtkButton *button, app_data *app)
-{
-	int idx;
+static char *clone_unit_list[] = {
+	"Minutes",
+	"Hours",
+	"Days",
+	"Weekdays",
+};
 
-	g_assert(app != NULL);
+#define CLONE_MAX_COUNT  50
 
-	idx = gtk_combo_box_get_active(GTK_COMBO_BOX(app->sound_combo_box));
-	g_assert((idx >=0) && (idx < ARRAY_SIZE(sounds_list)));
+// time of the nth copy of an alarm at itm
+static time_t get_clone_alarm_time(time_t itm, int n, int interval, int unit)
+{
+	struct tm stm;
+	int days;
 
-	if (!app->sound_playing) {
-		play_sound(app, sounds_list[idx]);
-		gtk_button_set_label(GTK_BUTTON(button), GTK_STOCK_MEDIA_STOP);
-	} else {
-		stop_preview_sound(app);
+	switch (unit) {
+	case CLONE_MINUTES:
+		return itm + (time_t)n*interval*60;
+	case CLONE_HOURS:
+		return itm + (time_t)n*interval*60*60;
 	}
-}
 
-static time_t get_new_alarm_time(void)
-{
-	time_t itm;
-	time(&itm);
-	if ((TIME_T_MAX - itm) < NEW_ALARM_TIME_INC) {
-		itm = TIME_T_MAX;
+	// days keep the time of day across DST changes
+	localtime_r(&itm, &stm);
+	if (unit == CLONE_DAYS) {
+		stm.tm_mday += n*interval;
 	} else {
-		itm += NEW_ALARM_TIME_INC;
+		// skip saturdays and sundays
+		for (days = n*interval; days > 0; ) {
+			stm.tm_mday++;
+			stm.tm_wday = (stm.tm_wday + 1) % 7;
+			if ((stm.tm_wday != 0) && (stm.tm_wday != 6)) days--;
+		}
 	}
-	return itm;
+	stm.tm_isdst = -1;
+	return mktime(&stm);
 }
 
-// if fcn returns 0, caller must free event->message after use
-static int alarm_dialog(app_data *app, cookie_t old_cookie, 
-		cookie_t *new_cookie, alarm_event_t *event)
+// ask for number of copies and interval between them, returns 0 if OK
+static int clone_dialog(app_data *app)
 {
-	int ret = 0;
 	GtkWidget *dialog;
+	GtkWidget *count_editor;
+	GtkWidget *interval_editor;
+	GtkWidget *unit_combo_box;
 	GtkWidget *caption;
-	GtkWidget *hbox;
-	GtkWidget *date_editor;
-	GtkWidget *time_editor;
-	GtkWidget *repeat_combo_box;
-	GtkWidget *sound_combo_box;
-	GtkWidget *preview_button;
-	GtkWidget *message_entry;
-	GtkSizeGroup *size_group;
 	GtkSizeGroup *caption_size_group;
 	gint result;
-	time_t now;
-	struct tm tnow;
-	int is_old_event_disabled = 0;
 	int i;
-	GtkWidget *time_now_label;
-	char time_now_buf[100];
-	gchar *time_now_string;
-
-	g_assert(app != NULL);
-	g_assert(old_cookie >= 0);
-	g_assert(new_cookie != NULL);
-	g_assert(event != NULL);
 
 	dialog = gtk_dialog_new_with_buttons(
-			(old_cookie == 0) ? "Add alarm" : "Edit alarm", 
+			"Clone alarm", 
 			GTK_WINDOW(app->window),
 			GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
 			GTK_STOCK_OK, GTK_RESPONSE_OK,
 			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
 			NULL);
 
-	// to align widgets
-	size_group = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
 	caption_size_group = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
 
-	// time now
-	now = time(NULL);
-	localtime_r(&now, &tnow);
-	date_to_string(&tnow, time_now_buf, 0);
-	time_now_string = g_strconcat(
-			"<span size='smaller' style='italic'>Time now: ", 
-			time_now_buf, "</span>", NULL);
-	time_now_label = gtk_label_new(NULL);
-	gtk_label_set_markup(GTK_LABEL(time_now_label), time_now_string);
-	/* gtk_size_group_add_widget(size_group, time_now_label); */
-	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), time_now_label, FALSE, FALSE, 2);
-	g_free(time_now_string);
-	
-	// time editor
-	hbox = gtk_hbox_new(FALSE, 0);
-	time_editor = hildon_time_editor_new();
-	now = get_new_alarm_time();
-	localtime_r(&now, &tnow);
-	hildon_time_editor_set_time(HILDON_TIME_EDITOR(time_editor), 
-			tnow.tm_hour, tnow.tm_min, tnow.tm_sec);
-	gtk_size_group_add_widget(size_group, time_editor);
-	caption = hildon_caption_new(caption_size_group, "Time", time_editor, 
+	count_editor = hildon_number_editor_new(1, CLONE_MAX_COUNT);
+	hildon_number_editor_set_value(HILDON_NUMBER_EDITOR(count_editor), 
+			app->clone_count);
+	caption = hildon_caption_new(caption_size_group, "Copies", count_editor, 
 			NULL, HILDON_CAPTION_MANDATORY);
 	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
 
-	// date editor
-	hbox = gtk_hbox_new(FALSE, 0);
-	date_editor = hildon_date_editor_new();
-	hildon_date_editor_set_date(HILDON_DATE_EDITOR(date_editor), 
-			tnow.tm_year+1900, tnow.tm_mon+1, tnow.tm_mday);
-	gtk_size_group_add_widget(size_group, date_editor);
-	caption = hildon_caption_new(caption_size_group, "Date", date_editor, 
+	interval_editor = hildon_number_editor_new(1, 999);
+	hildon_number_editor_set_value(HILDON_NUMBER_EDITOR(interval_editor), 
+			app->clone_interval);
+	caption = hildon_caption_new(caption_size_group, "Every", interval_editor, 
 			NULL, HILDON_CAPTION_MANDATORY);
 	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
 
-	// repeat
-	hbox = gtk_hbox_new(FALSE, 0);
-	repeat_combo_box = gtk_combo_box_new_text();
-	for (i=0; i<ARRAY_SIZE(repeat_list); i++) {
-		gtk_combo_box_append_text(GTK_COMBO_BOX(repeat_combo_box), repeat_list[i].text);
+	unit_combo_box = gtk_combo_box_new_text();
+	for (i=0; i<ARRAY_SIZE(clone_unit_list); i++) {
+		gtk_combo_box_append_text(GTK_COMBO_BOX(unit_combo_box), 
+				clone_unit_list[i]);
 	}
-	gtk_combo_box_set_active(GTK_COMBO_BOX(repeat_combo_box), 0);
-	gtk_size_group_add_widget(size_group, repeat_combo_box);
-	caption = hildon_caption_new(caption_size_group, "Repeat", repeat_combo_box, 
+	gtk_combo_box_set_active(GTK_COMBO_BOX(unit_combo_box), app->clone_unit);
+	caption = hildon_caption_new(caption_size_group, " ", unit_combo_box, 
 			NULL, HILDON_CAPTION_MANDATORY);
 	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
 
-	// sound
-	hbox = gtk_hbox_new(FALSE, 0);
-	sound_combo_box = gtk_combo_box_new_text();
-	app->sound_combo_box = sound_combo_box;
-	gtk_combo_box_append_text(GTK_COMBO_BOX(sound_combo_box), "Alarm 1");
-	gtk_combo_box_append_text(GTK_COMBO_BOX(sound_combo_box), "Alarm 2");
-	gtk_combo_box_append_text(GTK_COMBO_BOX(sound_combo_box), "Alarm 3");
-	gtk_combo_box_append_text(GTK_COMBO_BOX(sound_combo_box), "None");
-	gtk_combo_box_set_active(GTK_COMBO_BOX(sound_combo_box), app->sound_idx);
-	g_signal_connect(G_OBJECT(sound_combo_box), "popup", 
-			G_CALLBACK(cb_sound_popup), app);
+	g_object_unref(caption_size_group);
+	gtk_widget_show_all(GTK_WIDGET(dialog));
 
-	// todo: display icon instead of text?
-	// browse for other sound files
-	preview_button = gtk_button_new_from_stock(GTK_STOCK_MEDIA_PLAY);
-	app->preview_button = preview_button;
-	g_signal_connect(G_OBJECT(preview_button), "clicked", 
-			G_CALLBACK(cb_preview_clicked), app);
-	gtk_box_pack_start(GTK_BOX(hbox), sound_combo_box, FALSE, FALSE, 2);
-	gtk_box_pack_start(GTK_BOX(hbox), preview_button, FALSE, FALSE, 2);
-	gtk_size_group_add_widget(size_group, hbox);
-	caption = hildon_caption_new(caption_size_group, "Sound", hbox, NULL, 
-			HILDON_CAPTION_MANDATORY);
-	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
+	app->widget_running = 1;
+	result = gtk_dialog_run(GTK_DIALOG(dialog));
+	app->widget_running = 0;
 
-	// message
-	hbox = gtk_hbox_new(FALSE, 0);
-	message_entry = gtk_entry_new();
-	gtk_size_group_add_widget(size_group, message_entry);
-	caption = hildon_caption_new(caption_size_group, "Message", message_entry, 
-			NULL, HILDON_CAPTION_MANDATORY);
-	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
+	if (result == GTK_RESPONSE_OK) {
+		// remembered for the next clone
+		app->clone_count = hildon_number_editor_get_value(
+				HILDON_NUMBER_EDITOR(count_editor));
+		app->clone_interval = hildon_number_editor_get_value(
+				HILDON_NUMBER_EDITOR(interval_editor));
+		app->clone_unit = gtk_combo_box_get_active(GTK_COMBO_BOX(unit_combo_box));
+		g_assert((app->clone_unit >= 0) && 
+				(app->clone_unit < ARRAY_SIZE(clone_unit_list)));
+	}
+	gtk_widget_destroy(dialog);
+
+	return (result == GTK_RESPONSE_OK) ? 0 : -1;
+}
 
-	if (old_cookie > 0) {
-		int idx;
-		alarm_event_t *old_event;
+/* worker thread: add all copies, ops is an array of new row_op. Copies
+ * with exception days are armed one by one through the registry, see
+ * calendar_arm(); the others in one batch.
+ */
+static void run_clone_batch(app_data *app, gpointer data)
+{
+	GPtrArray *ops = (GPtrArray*)data;
+	row_op *op;
+	guint *ids;
+	alarm_event_t **events;
+	alarm_event_t *flagged;
+	cookie_t *cookies;
+	row_op **batch;
+	int i, n;
+
+	trace_set_phase(TRACE_PHASE_CLONE);
+
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		journal_begin(app, op->id, 0, op->enabled ? JOURNAL_ADD : 0);
+	}
 
-		old_event = alarm_event_get(old_cookie);
-		if (old_event == NULL) {
-			malarm_print("error: unable to get alarm event of cookie %ld\n", 
-					old_cookie);
-			return -1;
+	// the copies that are left for the batch
+	batch = g_new(row_op*, ops->len);
+	for (i=0, n=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		if (op->set_calendar && (calendar_put(app, op->id, op->calendar) != 0)) {
+			op->failed = 1;
+		} else if (op->enabled && (op->calendar != NULL)) {
+			register_row_op(app, op);
+		} else {
+			batch[n++] = op;
 		}
+	}
 
-		if (old_event->alarm_time == ALARM_DISABLED) {
-			old_event->alarm_time = get_actual_alarm_time(app, old_cookie);
-			if (old_event->alarm_time < 0) {
-				alarm_event_free(old_event);
-				return -1;
+	if ((n > 0) && batch[0]->enabled) {
+		// one batch call, for backends that have one
+		flagged = g_new(alarm_event_t, n);
+		events = g_new(alarm_event_t*, n);
+		cookies = g_new(cookie_t, n);
+		for (i=0; i<n; i++) {
+			flagged[i] = *batch[i]->event;
+			flagged[i].flags = ALARM_EVENT_FLAGS;
+			events[i] = &flagged[i];
+		}
+		backend_event_add_batch(app, events, n, cookies);
+		for (i=0; i<n; i++) {
+			op = batch[i];
+			op->new_cookie = MAX(cookies[i], 0);
+			if (op->new_cookie == 0) {
+				op->failed = 1;
+				continue;
 			}
-			is_old_event_disabled = 1;
+			print_alarm_event(op->new_cookie, &flagged[i]);
+			journal_added(app, op->id, op->new_cookie);
+			registry_set(app, op->id, op->new_cookie);
 		}
+		g_free(flagged);
+		g_free(events);
+		g_free(cookies);
+	} else if (n > 0) {
+		ids = g_new(guint, n);
+		events = g_new(alarm_event_t*, n);
+		for (i=0; i<n; i++) {
+			ids[i] = batch[i]->id;
+			events[i] = batch[i]->event;
+		}
+		if (store_put_batch(app, n, ids, events) != 0) {
+			for (i=0; i<n; i++) {
+				batch[i]->failed = 1;
+			}
+		}
+		g_free(ids);
+		g_free(events);
+	}
+	g_free(batch);
 
-		/* localtime_r(&old_event->alarm_time, &tnow); */
-		get_next_alarm_time(old_event, &tnow);
+	// ids are in increasing order
+	op = g_ptr_array_index(ops, ops->len - 1);
+	save_next_id(app, op->id + 1);
+	journal_commit(app);
+}
 
-		hildon_time_editor_set_time(HILDON_TIME_EDITOR(time_editor), 
-				tnow.tm_hour, tnow.tm_min, tnow.tm_sec);
-		hildon_date_editor_set_date(HILDON_DATE_EDITOR(date_editor), 
-				tnow.tm_year+1900, tnow.tm_mon+1, tnow.tm_mday);
+// main loop: show the added copies, remove the failed ones
+static void done_clone_batch(app_data *app, gpointer data)
+{
+	GPtrArray *ops = (GPtrArray*)data;
+	row_op *op;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	GArray *added;
+	scan_item item;
+	int nfailed = 0;
+	gchar *text;
+	int i;
 
-		for (idx=0; idx<ARRAY_SIZE(repeat_list); idx++) {
-			if (old_event->recurrence == repeat_list[idx].val) {
-				gtk_combo_box_set_active(GTK_COMBO_BOX(repeat_combo_box), idx);
-				break;
-			}
+	added = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		if (op->failed) {
+			nfailed++;
+		} else {
+			calendar_cached_put(app, op->id, op->calendar);
+			item.id = op->id;
+			item.cookie = op->new_cookie;
+			item.event = op->event;
+			item.enabled = op->enabled;
+			g_array_append_val(added, item);
 		}
 
-		for (idx=0; idx<ARRAY_SIZE(sounds_list); idx++) {
-			if (strcmp(old_event->sound, sounds_list[idx])==0) {
-				gtk_combo_box_set_active(GTK_COMBO_BOX(sound_combo_box), idx);
-				break;
+		path = gtk_tree_row_reference_get_path(op->row);
+		if (path == NULL) {
+			continue;
+		}
+		if (gtk_tree_model_get_iter(GTK_TREE_MODEL(app->store), &iter, path)) {
+			if (op->failed) {
+				gtk_tree_store_remove(GTK_TREE_STORE(app->store), &iter);
+			} else {
+				set_alarm_row(app, &iter, op->id, op->new_cookie, op->event, 
+						op->enabled, FALSE);
 			}
 		}
+		gtk_tree_path_free(path);
+	}
+	// the copies are added even if their rows are gone
+	client_changed(app, (scan_item*)added->data, added->len);
+	g_array_free(added, TRUE);
+
+	for (i=0; i<ops->len; i++) {
+		free_row_op(g_ptr_array_index(ops, i));
+	}
+
+	if (nfailed == 0) {
+		text = g_strdup_printf("Added %u alarms", ops->len);
+	} else {
+		text = g_strdup_printf("Failed to add %d of %u alarms", nfailed, ops->len);
+	}
+	show_banner(app, text);
+	g_free(text);
+
+	g_ptr_array_free(ops, TRUE);
+
+	app->ops_pending--;
+	run_deferred_refresh(app);
+}
 
-		if (old_event->message) {
-			gtk_entry_set_text(GTK_ENTRY(message_entry), old_event->message);
+static void cb_action_clone(GtkWidget *widget, app_data *app)
+{
+	GtkTreeSelection *selection;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	alarm_event_t *event;
+	alarm_calendar *entry;
+	GPtrArray *ops;
+	row_op *op;
+	guint id;
+	int enabled;
+	int i;
+
+	g_assert(app != NULL);
+
+	if (app->refreshing) return;
+
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->view));
+	if (gtk_tree_selection_get_selected(selection, NULL, &iter)==FALSE) {
+		return;
+	}
+
+	if (is_row_busy(app, &iter)) {
+		// request still in flight
+		return;
+	}
+
+	if (clone_dialog(app) != 0) {
+		return;
+	}
+
+	gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
+				ID_COLUMN, &id,
+				ENABLED_COLUMN, &enabled,
+				-1);
+	event = g_hash_table_lookup(app->events, GUINT_TO_POINTER(id));
+	g_assert(event != NULL);
+	// copies skip the same days
+	entry = calendar_cached_get(app, id);
+
+	ops = g_ptr_array_sized_new(app->clone_count);
+	for (i=1; i<=app->clone_count; i++) {
+		op = g_new0(row_op, 1);
+		op->id = app->next_id++;
+		op->event = copy_alarm_event(event);
+		op->event->alarm_time = get_clone_alarm_time(event->alarm_time, i, 
+				app->clone_interval, app->clone_unit);
+		op->event->snoozed = 0;
+		set_alarm_event_id(op->event, op->id);
+		op->enabled = enabled;
+		if (entry) {
+			op->set_calendar = TRUE;
+			op->calendar = alarm_calendar_copy(entry);
 		}
 
-		alarm_event_free(old_event);
+		// new ids are above all ids in the tree, so copies go at the end
+		gtk_tree_store_append(app->store, &iter, NULL);
+		show_row_op(app, &iter, op);
+		g_ptr_array_add(ops, op);
 	}
+	alarm_calendar_free(entry);
 
+	// cursor is set once, on the last copy
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &iter);
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+	gtk_tree_path_free(path);
 
-	app->widget_running = 1;
-	gtk_widget_show_all(GTK_WIDGET(GTK_DIALOG(dialog)->vbox));
+	app->ops_pending++;
+	worker_submit(app, run_clone_batch, done_clone_batch, ops);
+	malarm_debug("cloning alarm id %u, %d copies\n", id, app->clone_count);
+}
 
-wait_again:
-	result = gtk_dialog_run(GTK_DIALOG(dialog));
-	app->widget_running = 0;
-	stop_preview_sound(app);
-	if (result != GTK_RESPONSE_OK) {
-		ret = -1;
-		goto alarm_dialog_out;
+static void remove_item(app_data *app, GtkTreeIter *iter)
+{
+	GtkTreePath *path;
+	GtkTreeIter next_iter;
+	guint id;
+	int nitems;
+	int ret;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(app->store), iter, 
+				ID_COLUMN, &id,
+				-1);
+	conflicts_remove(app->conflicts, id);
+	gtk_widget_queue_draw(app->view);
+
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), iter);
+	g_assert(path);
+
+	next_iter = *iter;
+	gtk_tree_store_remove(GTK_TREE_STORE(app->store), iter);
+
+	if (gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &next_iter) == FALSE) {
+		// no next item, so get prev iter
+		nitems = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL);
+		if (nitems == 0) {
+			// empty list, so just exit
+			return;
+		}
+		ret = gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(app->store), 
+				&next_iter, NULL, nitems-1);
+		g_assert(ret == TRUE);
+		path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &next_iter);
+		g_assert(path);
 	}
 
-	{
-	guint year, month, day;
-	guint hours, minutes, seconds;
-	gint repeat_idx;
-	/* gint sound_idx; */
-	const gchar *message;
-	time_t itm;
-	struct tm stm;
-	time_t orig_time;
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+}
 
-	// get alarm info from widgets
-	hildon_date_editor_get_date(HILDON_DATE_EDITOR(date_editor), 
-			&year, &month, &day);
-	hildon_time_editor_get_time(HILDON_TIME_EDITOR(time_editor), 
-			&hours, &minutes, &seconds);
-	repeat_idx = gtk_combo_box_get_active(GTK_COMBO_BOX(repeat_combo_box));
-	app->sound_idx = gtk_combo_box_get_active(GTK_COMBO_BOX(sound_combo_box));
-	g_assert((app->sound_idx >= 0) && (app->sound_idx < ARRAY_SIZE(sounds_list)));
-	message = gtk_entry_get_text(GTK_ENTRY(message_entry));
+/* Removed rows go at once, and their removals wait REMOVE_UNDO_MS for an
+ * Undo. Removals that are not undone are flushed as one worker request:
+ * one journal and one gconf change set for all of them. They count as
+ * row operations in flight, a refresh waits for them.
+ */
+#define REMOVE_UNDO_MS  5000
 
-	// initialize the alarm event
-	memset(event, 0, sizeof(alarm_event_t));
-	time(&itm);
-	itm = (itm/60)*60; // ignore seconds
-	localtime_r(&itm, &stm); // just to properly init stm fields
-	stm.tm_year = year - 1900;
-	stm.tm_mon = month - 1;
-	stm.tm_mday = day;
-	stm.tm_hour = hours;
-	stm.tm_min = minutes;
-	/* stm.tm_sec = seconds; */
-	stm.tm_sec = 0;
-	event->alarm_time = mktime(&stm);
-	/* event->alarm_time = 0; // jan 1, 1970 07:30am */
-	/* print_stm(&stm); */
+static void show_undo(app_data *app, gboolean show)
+{
+	if (show) {
+		gtk_widget_show(app->undo_button);
+	} else {
+		gtk_widget_hide(app->undo_button);
+	}
+	gtk_widget_set_sensitive(app->undo_item, show);
+}
 
-	if (event->alarm_time < itm) {
-		show_banner(app, "Cannot set alarm for time in the past");
-		goto wait_again;
-	} else if (event->alarm_time == ALARM_DISABLED) {
-		show_banner(app, "Cannot set alarm at the end of time!");
-		goto wait_again;
+// true if the removal of id waits for the undo timeout
+static int is_removal_queued(app_data *app, guint id)
+{
+	int i;
+
+	if (app->removals == NULL) return 0;
+
+	for (i=0; i<app->removals->len; i++) {
+		if (((row_op*)g_ptr_array_index(app->removals, i))->id == id) return 1;
 	}
+	return 0;
+}
 
-	g_assert((repeat_idx >= 0) && (repeat_idx < ARRAY_SIZE(repeat_list)));
-	event->recurrence = repeat_list[repeat_idx].val;
-	event->recurrence_count = (repeat_idx == REPEAT_ONCE) ? 0 : -1;
+// worker thread: all removals, in one journal
+static void run_remove_batch(app_data *app, gpointer data)
+{
+	GPtrArray *ops = (GPtrArray*)data;
+	row_op *op;
+	int i;
 
-	event->title = MALARM_NAME;
-	event->message = alarm_escape_string(message);
-	event->sound = sounds_list[app->sound_idx];
-	event->icon = "qgn_list_hclk_alarm";
-	event->flags = ALARM_EVENT_FLAGS;
-	event->dbus_interface = MALARM_DBUS_NAME;
-	event->dbus_service = MALARM_DBUS_NAME;
-	event->dbus_path = MALARM_DBUS_PATH;
-	event->dbus_name = "alarm_triggered";
-	event->exec_name = NULL;
+	trace_set_phase(TRACE_PHASE_ROW_OP);
 
-	orig_time = event->alarm_time;
-	if (is_old_event_disabled) {
-		event->alarm_time = ALARM_DISABLED;
-		event->flags = 0;
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		journal_begin(app, op->id, op->old_cookie, 0);
+		apply_row_op(app, op);
 	}
+	journal_commit(app);
+}
 
-	/* malarm_debug("adding alarm event\n"); */
-	*new_cookie = alarm_event_add(event);
-	if (*new_cookie <= 0) {
-		malarm_debug("Error setting alarm event. Error code: '%d'\n", 
-				alarmd_get_error());
-		ret = -1;
-		goto alarm_dialog_out;
+// main loop: put back the rows that failed to be removed
+static void done_remove_batch(app_data *app, gpointer data)
+{
+	GPtrArray *ops = (GPtrArray*)data;
+	row_op *op;
+	GArray *removed;
+	scan_item item = { };
+	int nfailed = 0;
+	gchar *text;
+	int i;
+
+	removed = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		if (op->failed) {
+			nfailed++;
+			add_alarm_to_tree(app, op->id, op->old_cookie, op->old_event, 
+					op->old_enabled, FALSE, NULL);
+		} else {
+			item.id = op->id;
+			item.enabled = op->enabled;
+			g_array_append_val(removed, item);
+			calendar_cached_put(app, op->id, NULL);
+		}
+		free_row_op(op);
+	}
+	client_changed(app, (scan_item*)removed->data, removed->len);
+	g_array_free(removed, TRUE);
+
+	if (nfailed > 0) {
+		text = g_strdup_printf("Failed to remove %d of %u alarms", nfailed, ops->len);
+		show_banner(app, text);
+		g_free(text);
+	}
+
+	app->ops_pending -= ops->len;
+	g_ptr_array_free(ops, TRUE);
+	run_deferred_refresh(app);
+}
+
+// hand the removals to the worker, they cannot be undone any more
+void flush_removals(app_data *app)
+{
+	if (app->removal_timeout) {
+		g_source_remove(app->removal_timeout);
+		app->removal_timeout = 0;
+	}
+	if ((app->removals == NULL) || (app->removals->len == 0)) return;
+
+	malarm_debug("removing %u alarms\n", app->removals->len);
+	worker_submit(app, run_remove_batch, done_remove_batch, app->removals);
+	app->removals = NULL;
+	show_undo(app, FALSE);
+}
+
+static gboolean cb_removal_timeout(gpointer data)
+{
+	app_data *app = (app_data*)data;
+
+	app->removal_timeout = 0;
+	flush_removals(app);
+	return FALSE;
+}
+
+static void cb_action_undo(GtkWidget *widget, app_data *app)
+{
+	GPtrArray *ops = app->removals;
+	row_op *op;
+	int i;
+
+	if ((ops == NULL) || (ops->len == 0)) return;
+
+	g_source_remove(app->removal_timeout);
+	app->removal_timeout = 0;
+	app->removals = NULL;
+	show_undo(app, FALSE);
+
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		add_alarm_to_tree(app, op->id, op->old_cookie, op->old_event, 
+				op->old_enabled, FALSE, NULL);
+		free_row_op(op);
+	}
+	show_banner(app, (ops->len == 1) ? "Restored alarm" : "Restored alarms");
+
+	app->ops_pending -= ops->len;
+	g_ptr_array_free(ops, TRUE);
+	run_deferred_refresh(app);
+}
+
+// remove the row at iter, and queue the removal of its alarm
+static void queue_removal(app_data *app, GtkTreeIter *iter)
+{
+	row_op *op;
+
+	op = new_row_op(app, iter);
+	op->enabled = op->old_enabled;
+	op->set_calendar = TRUE;
+
+	remove_item(app, iter);
+	if (app->removals == NULL) {
+		app->removals = g_ptr_array_new();
+	}
+	g_ptr_array_add(app->removals, op);
+	app->ops_pending++;
+
+	// each removal gives the whole batch the full time for an undo
+	if (app->removal_timeout) {
+		g_source_remove(app->removal_timeout);
+	}
+	app->removal_timeout = g_timeout_add(REMOVE_UNDO_MS, cb_removal_timeout, app);
+	show_undo(app, TRUE);
+
+	malarm_debug("removing alarm id %u\n", op->id);
+}
+
+static void show_removal_banner(app_data *app)
+{
+	gchar *text;
+
+	if (app->removals->len == 1) {
+		show_banner(app, "Removed alarm, Undo restores it");
+	} else {
+		text = g_strdup_printf("Removed %u alarms, Undo restores them", 
+				app->removals->len);
+		show_banner(app, text);
+		g_free(text);
+	}
+}
+
+static void cb_action_remove(GtkWidget *widget, app_data *app)
+{
+	GtkTreeSelection *selection;
+	GtkTreeIter iter;
+
+	g_assert(app != NULL);
+
+	if (app->refreshing) return;
+
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->view));
+	if (gtk_tree_selection_get_selected(selection, NULL, &iter)==FALSE) {
+		return;
+	}
+
+	if (is_row_busy(app, &iter)) {
+		// request still in flight
+		return;
+	}
+
+	queue_removal(app, &iter);
+	show_removal_banner(app);
+}
+
+static void cb_action_edit(GtkWidget *widget, app_data *app)
+{
+	GtkTreeSelection *selection;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	g_assert(app != NULL);
+
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->view));
+	if (gtk_tree_selection_get_selected(selection, NULL, &iter)) {
+		path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &iter);
+		cb_row_activated(GTK_TREE_VIEW(app->view), path, NULL, app);
+		gtk_tree_path_free(path);
+	}
+}
+
+static void cb_action_about(GtkWidget *widget, app_data *app)
+{
+	g_assert(app != NULL);
+
+	gtk_show_about_dialog(GTK_WINDOW(app->window),
+			"version", MALARM_VERSION,
+			"copyright", "(c) 2008 Ronald Taneza <ronald.taneza@gmail.com>",
+			NULL);
+}
+
+// op enables the alarm, or disables it
+static void set_row_op_enabled(row_op *op, int enabled)
+{
+	op->enabled = enabled;
+	op->event = copy_alarm_event(op->old_event);
+
+	if (!enabled) {
+		// a disabled alarm keeps its snoozed time
+		op->event->alarm_time += op->event->snoozed*60;
+		op->event->snoozed = 0;
+	}
+}
+
+static void cb_toggled(GtkCellRendererToggle *renderer, gchar *path, app_data *app)
+{
+	GtkTreeIter iter;
+	row_op *op;
+
+	g_assert(app != NULL);
+
+	malarm_debug("item %s toggled\n", path);
+
+	if (!gtk_tree_model_get_iter_from_string(
+				GTK_TREE_MODEL(app->store), &iter, path)) {
+		malarm_print("error: unable to get iter from path: %s\n", path);
+		return;
+	}
+
+	if (is_row_busy(app, &iter)) {
+		// request still in flight
+		return;
+	}
+ 
+	op = new_row_op(app, &iter);
+	set_row_op_enabled(op, !op->old_enabled);
+
+	if (op->enabled) {
+		op->done_text = "Enabled alarm";
+		op->fail_text = "Failed to enable alarm";
+	} else {
+		op->done_text = "Disabled alarm";
+		op->fail_text = "Failed to disable alarm";
+	}
+
+	submit_row_op(app, &iter, op);
+}
+
+static gboolean cb_visibility(GtkWidget *widget, GdkEventVisibility *visibility, 
+		app_data *app)
+{
+	g_assert(app != NULL);
+
+	malarm_debug("visibility=%d, window is %s, %s\n", visibility->state,
+			gtk_window_is_active(GTK_WINDOW(app->window)) ? "active" : "not active",
+			hildon_window_get_is_topmost(HILDON_WINDOW(app->window)) ? 
+			"topmost" : "not topmost");
+
+	/* Repopulate only if:
+	 * - app was previously completely not visible, and is now fully visible
+	 * - some external widget (such as the alarm trigger dialog) obscured
+	 *   the app, and app is now fully visible
+	 */
+	if (!app->widget_running &&
+
+		// rows were released on low memory, and app is visible again
+		((app->caches_shed &&
+		 	(visibility->state != GDK_VISIBILITY_FULLY_OBSCURED)) ||
+
+		((app->visibility == GDK_VISIBILITY_FULLY_OBSCURED) &&
+		(visibility->state == GDK_VISIBILITY_UNOBSCURED)) ||
+
+		// old
+		(((app->visibility == GDK_VISIBILITY_PARTIAL) &&
+			app->window_active && app->window_topmost) &&
+		// new
+		((visibility->state == GDK_VISIBILITY_UNOBSCURED) &&
+		 	!gtk_window_is_active(GTK_WINDOW(app->window)) &&
+			hildon_window_get_is_topmost(HILDON_WINDOW(app->window)))))) {
+
+		populate_tree(app);
+
+	}
+
+	// alarm dialog was released on low memory
+	if ((app->dlg == NULL) && (visibility->state != GDK_VISIBILITY_FULLY_OBSCURED)) {
+		g_idle_add_full(G_PRIORITY_LOW, prebuild_alarm_dialog, app, NULL);
+	}
+
+	app->visibility = visibility->state;
+	app->window_active = gtk_window_is_active(GTK_WINDOW(app->window));
+	app->window_topmost = hildon_window_get_is_topmost(HILDON_WINDOW(app->window));
+
+	return TRUE;
+}
+
+static void cb_row_activated(GtkTreeView *view, GtkTreePath *path,
+		GtkTreeViewColumn *column, app_data *app)
+{
+	GtkTreeIter iter;
+	alarm_event_t event;
+	row_op *op;
+
+	g_assert(app != NULL);
+
+	if (app->refreshing) return;
+
+	/* malarm_debug("item %s activated\n", gtk_tree_path_to_string(path)); */
+	if (!gtk_tree_model_get_iter(
+				GTK_TREE_MODEL(app->store), &iter, path)) {
+		malarm_print("error: unable to get iter from path: %s\n", 
+				gtk_tree_path_to_string(path));
+		return;
+	}
+	if (is_row_busy(app, &iter)) {
+		// request still in flight
+		return;
+	}
+
+	if (alarm_dialog(app, &iter, &event) != 0) {
+		return;
+	}
+
+	op = new_row_op(app, &iter);
+	op->enabled = op->old_enabled;
+	op->event = copy_alarm_event(&event);
+	set_alarm_event_id(op->event, op->id);
+	op->set_calendar = TRUE;
+	op->calendar = app->dlg->calendar;
+	app->dlg->calendar = NULL;
+	op->done_text = "Updated alarm";
+	op->fail_text = "Failed to update alarm";
+	free(event.message);
+
+	malarm_debug("item %s: updating alarm id %u\n", 
+			gtk_tree_path_to_string(path), op->id);
+	submit_row_op(app, &iter, op);
+}
+
+static void stop_preview_sound(app_data *app)
+{
+	stop_sound(app);
+	gtk_button_set_label(GTK_BUTTON(app->preview_button), GTK_STOCK_MEDIA_PLAY);
+}
+
+// built-in sounds first, then the files found by the sound scan
+static const char *get_sound_uri(app_data *app, int idx)
+{
+	g_assert(idx >= 0);
+	if (idx < ARRAY_SIZE(sounds_list)) return sounds_list[idx];
+
+	idx -= ARRAY_SIZE(sounds_list);
+	g_assert(app->sound_files && (idx < app->sound_files->len));
+	return g_ptr_array_index(app->sound_files, idx);
+}
+
+static void append_sound_label(app_data *app, const char *uri)
+{
+	char *label, *dot;
+
+	label = g_path_get_basename(uri);
+	if ((dot = strrchr(label, '.')) != NULL) *dot = '\0';
+	gtk_combo_box_append_text(GTK_COMBO_BOX(app->sound_combo_box), label);
+	g_free(label);
+}
+
+/* Returns the combo box index of uri, adding it if it is new. Sounds are
+ * only added during a session, so the indexes stay valid; a file that was
+ * deleted stays listed until malarm is started again.
+ */
+static int add_sound(app_data *app, const char *uri)
+{
+	gpointer idx;
+	char *copy;
+	int i;
+
+	for (i=0; i<ARRAY_SIZE(sounds_list); i++) {
+		if (strcmp(uri, sounds_list[i]) == 0) return i;
+	}
+
+	if (app->sound_files == NULL) {
+		app->sound_files = g_ptr_array_new();
+		app->sound_uris = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+	if ((idx = g_hash_table_lookup(app->sound_uris, uri)) != NULL) {
+		return GPOINTER_TO_INT(idx) - 1;
+	}
+
+	// URIs are kept for the session, alarm events point at them
+	copy = g_strdup(uri);
+	g_ptr_array_add(app->sound_files, copy);
+	i = ARRAY_SIZE(sounds_list) + app->sound_files->len - 1;
+	g_hash_table_insert(app->sound_uris, copy, GINT_TO_POINTER(i + 1));
+	if (app->sound_combo_box) append_sound_label(app, copy);
+	return i;
+}
+
+static void add_sound_files(app_data *app, GPtrArray *paths, gpointer data)
+{
+	char *uri;
+	guint i;
+
+	for (i=0; i<paths->len; i++) {
+		// escapes spaces and non-ASCII names, which gnome-vfs needs
+		uri = g_filename_to_uri(g_ptr_array_index(paths, i), NULL, NULL);
+		if (uri == NULL) continue;
+		add_sound(app, uri);
+		g_free(uri);
+	}
+}
+
+static void cb_sound_popup(GtkComboBox *combo_box, app_data *app)
+{
+	g_assert(app != NULL);
+	stop_preview_sound(app);
+	// catch files copied since the dialog was opened
+	sounds_scan(app, add_sound_files, NULL);
+}
+
+static void cb_preview_clicked(GtkButton *button, app_data *app)
+{
+	int idx;
+
+	g_assert(app != NULL);
+
+	idx = gtk_combo_box_get_active(GTK_COMBO_BOX(app->sound_combo_box));
+
+	if (!app->sound_playing) {
+		play_sound(app, get_sound_uri(app, idx));
+		gtk_button_set_label(GTK_BUTTON(button), GTK_STOCK_MEDIA_STOP);
+	} else {
+		stop_preview_sound(app);
+	}
+}
+
+/* Exception days are edited in a calendar, excluded days are marked.
+ * A double tap on a day excludes it, or includes it again.
+ */
+static void mark_calendar_days(GtkCalendar *widget, calendar *days)
+{
+	guint year, month, mday;
+	guint32 first;
+	int n;
+
+	gtk_calendar_get_date(widget, &year, &month, &mday);
+	first = calendar_day(year, month + 1, 1);
+	n = g_date_get_days_in_month(month + 1, year);
+
+	gtk_calendar_clear_marks(widget);
+	for (mday = 1; mday <= n; mday++) {
+		if (calendar_is_set(days, first + mday - 1)) {
+			gtk_calendar_mark_day(widget, mday);
+		}
+	}
+}
+
+static void cb_calendar_day_toggled(GtkCalendar *widget, calendar *days)
+{
+	guint year, month, mday;
+	guint32 day;
+
+	gtk_calendar_get_date(widget, &year, &month, &mday);
+	day = calendar_day(year, month + 1, mday);
+	calendar_set(days, day, !calendar_is_set(days, day));
+	mark_calendar_days(widget, days);
+}
+
+// returns 0 if the changes to days are accepted
+static int calendar_dialog(GtkWidget *parent, const char *title, calendar *days)
+{
+	GtkWidget *dialog;
+	GtkWidget *label;
+	GtkWidget *widget;
+	gint ret;
+
+	dialog = gtk_dialog_new_with_buttons(
+			title, 
+			GTK_WINDOW(parent),
+			GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_STOCK_OK, GTK_RESPONSE_OK,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			NULL);
+
+	label = gtk_label_new(NULL);
+	gtk_label_set_markup(GTK_LABEL(label), "<span size='smaller' style='italic'>"
+			"Double-tap a day to skip it</span>");
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), label, FALSE, FALSE, 2);
+
+	widget = gtk_calendar_new();
+	mark_calendar_days(GTK_CALENDAR(widget), days);
+	g_signal_connect(G_OBJECT(widget), "month-changed", 
+			G_CALLBACK(mark_calendar_days), days);
+	g_signal_connect(G_OBJECT(widget), "day-selected-double-click", 
+			G_CALLBACK(cb_calendar_day_toggled), days);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), widget, FALSE, FALSE, 2);
+
+	gtk_widget_show_all(GTK_WIDGET(dialog));
+	ret = gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+
+	return (ret == GTK_RESPONSE_OK) ? 0 : -1;
+}
+
+/* main loop: move enabled alarms that skip days to their next instance
+ * that is not excluded. Called when an alarm triggers, as alarmd only had
+ * that instance, after a refresh, and when the holidays change.
+ */
+void arm_calendar_alarms(app_data *app)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(app->store);
+	GtkTreeIter iter;
+	alarm_event_t *event;
+	gboolean valid;
+	guint id;
+	int enabled;
+	time_t t, now;
+	row_op *op;
+
+	if (app->client_state != CLIENT_OFF) {
+		// the core arms them, and sends the new instances
+		client_rescan(app);
+		return;
+	}
+	// done_refresh() arms them
+	if (app->refreshing) return;
+
+	now = clock_now();
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	for (; valid; valid = gtk_tree_model_iter_next(model, &iter)) {
+		gtk_tree_model_get(model, &iter, 
+					ID_COLUMN, &id,
+					ENABLED_COLUMN, &enabled,
+					-1);
+		event = g_hash_table_lookup(app->events, GUINT_TO_POINTER(id));
+		if (!enabled || (event == NULL) || (event->snoozed > 0) || 
+				is_row_busy(app, &iter)) {
+			continue;
+		}
+		t = calendar_cached_next_alarm_time(app, id, event, now + 1);
+		if ((t < 0) || (t == event->alarm_time)) {
+			continue;
+		}
+
+		op = new_row_op(app, &iter);
+		op->enabled = TRUE;
+		op->event = copy_alarm_event(op->old_event);
+		op->event->alarm_time = t;
+		// the instance that triggered can still be snoozed
+		op->keep_old_cookie = (op->old_event->alarm_time <= now);
+		op->fail_text = "Failed to set next alarm";
+		submit_row_op(app, &iter, op);
+	}
+}
+
+typedef struct {
+	GHashTable *entries;
+	calendar *holidays;
+} calendar_copies;
+
+// worker thread: the copy of the calendars for the main loop
+static void run_load_calendars(app_data *app, gpointer data)
+{
+	calendar_copies *copies = (calendar_copies*)data;
+
+	journal_lock(app);
+	copies->entries = calendar_get_all(app, &copies->holidays);
+	journal_unlock(app);
+}
+
+static void done_load_calendars(app_data *app, gpointer data)
+{
+	calendar_copies *copies = (calendar_copies*)data;
+
+	GtkTreeModel *model = GTK_TREE_MODEL(app->store);
+	GtkTreeIter iter;
+	gboolean valid;
+	guint id, recurrence;
+	char buf[30];
+
+	app->ui_calendars = copies->entries;
+	app->ui_holidays = copies->holidays;
+	g_free(copies);
+
+	// rows of a core snapshot may be in before the copy, give them their
+	// days of the week
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	for (; valid; valid = gtk_tree_model_iter_next(model, &iter)) {
+		gtk_tree_model_get(model, &iter, 
+					ID_COLUMN, &id,
+					RECURRENCE_COLUMN, &recurrence,
+					-1);
+		if (calendar_cached_weekdays(app, id)) {
+			gtk_tree_store_set(app->store, &iter, 
+					REPEAT_COLUMN, repeat_text(app, id, recurrence, buf),
+					-1);
+		}
+	}
+	// and the conflicts their days off
+	conflicts_reset(app->conflicts);
+	gtk_widget_queue_draw(app->view);
+}
+
+static void run_put_holidays(app_data *app, gpointer data)
+{
+	journal_lock(app);
+	calendar_put_holidays(app, (calendar*)data);
+	journal_unlock(app);
+}
+
+static void done_put_holidays(app_data *app, gpointer data)
+{
+	calendar *holidays = (calendar*)data;
+
+	// the copy of the main loop takes it
+	if (calendar_is_empty(holidays)) {
+		calendar_free(holidays);
+		holidays = NULL;
+	}
+	calendar_free(app->ui_holidays);
+	app->ui_holidays = holidays;
+	conflicts_reset(app->conflicts);
+	gtk_widget_queue_draw(app->view);
+	arm_calendar_alarms(app);
+}
+
+static void cb_action_holidays(GtkWidget *widget, app_data *app)
+{
+	calendar *holidays;
+	int ret;
+
+	g_assert(app != NULL);
+
+	// the calendars are not loaded yet
+	if (app->ui_calendars == NULL) return;
+	holidays = app->ui_holidays ? calendar_copy(app->ui_holidays) : calendar_new();
+
+	app->widget_running = 1;
+	ret = calendar_dialog(GTK_WIDGET(app->window), "Holidays", holidays);
+	app->widget_running = 0;
+	if (ret != 0) {
+		calendar_free(holidays);
+		return;
+	}
+
+	worker_submit(app, run_put_holidays, done_put_holidays, holidays);
+}
+
+static void cb_skip_days_clicked(GtkButton *button, app_data *app)
+{
+	alarm_dialog_data *dlg = app->dlg;
+	calendar *days;
+
+	days = calendar_copy(dlg->skip_days);
+	if (calendar_dialog(dlg->dialog, "Days off", days) == 0) {
+		calendar_free(dlg->skip_days);
+		dlg->skip_days = days;
+	} else {
+		calendar_free(days);
+	}
+}
+
+// exception days only apply to recurring alarms
+static void cb_repeat_changed(GtkComboBox *combo_box, app_data *app)
+{
+	gint idx = gtk_combo_box_get_active(combo_box);
+
+	gtk_widget_set_sensitive(app->dlg->skip_box, idx != REPEAT_ONCE);
+	gtk_widget_set_sensitive(app->dlg->weekday_box, idx == REPEAT_WEEKDAYS);
+}
+
+static void set_dialog_weekdays(alarm_dialog_data *dlg, guint32 weekdays)
+{
+	int i;
+
+	for (i=0; i<7; i++) {
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dlg->weekday_buttons[i]), 
+				(weekdays & (1 << i)) != 0);
+	}
+}
+
+static guint32 get_dialog_weekdays(alarm_dialog_data *dlg)
+{
+	guint32 weekdays = 0;
+	int i;
+
+	for (i=0; i<7; i++) {
+		if (gtk_toggle_button_get_active(
+					GTK_TOGGLE_BUTTON(dlg->weekday_buttons[i]))) {
+			weekdays |= 1 << i;
+		}
+	}
+	return weekdays;
+}
+
+static time_t get_new_alarm_time(void)
+{
+	time_t itm;
+	itm = clock_now();
+	if ((TIME_T_MAX - itm) < NEW_ALARM_TIME_INC) {
+		itm = TIME_T_MAX;
+	} else {
+		itm += NEW_ALARM_TIME_INC;
+	}
+	return itm;
+}
+
+static void create_alarm_dialog(app_data *app)
+{
+	alarm_dialog_data *dlg;
+	GtkWidget *caption;
+	GtkWidget *hbox;
+	GtkWidget *button;
+	GtkSizeGroup *size_group;
+	GtkSizeGroup *caption_size_group;
+	int i;
+
+	g_assert(app != NULL);
+
+	if (app->dlg) return;
+
+	dlg = g_new0(alarm_dialog_data, 1);
+
+	dlg->dialog = gtk_dialog_new_with_buttons(
+			"Add alarm", 
+			GTK_WINDOW(app->window),
+			GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_STOCK_OK, GTK_RESPONSE_OK,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			NULL);
+	// dialog is reused, so only hide it when closed
+	g_signal_connect(G_OBJECT(dlg->dialog), "delete-event", 
+			G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+	// to align widgets
+	size_group = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
+	caption_size_group = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
+
+	// time now, text is set every time the dialog is shown
+	dlg->time_now_label = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), dlg->time_now_label, 
+			FALSE, FALSE, 2);
+	
+	// time editor
+	dlg->time_editor = hildon_time_editor_new();
+	gtk_size_group_add_widget(size_group, dlg->time_editor);
+	caption = hildon_caption_new(caption_size_group, "Time", dlg->time_editor, 
+			NULL, HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// date editor
+	dlg->date_editor = hildon_date_editor_new();
+	gtk_size_group_add_widget(size_group, dlg->date_editor);
+	caption = hildon_caption_new(caption_size_group, "Date", dlg->date_editor, 
+			NULL, HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// repeat
+	dlg->repeat_combo_box = gtk_combo_box_new_text();
+	for (i=0; i<ARRAY_SIZE(repeat_list); i++) {
+		gtk_combo_box_append_text(GTK_COMBO_BOX(dlg->repeat_combo_box), 
+				repeat_list[i].text);
+	}
+	gtk_size_group_add_widget(size_group, dlg->repeat_combo_box);
+	caption = hildon_caption_new(caption_size_group, "Repeat", dlg->repeat_combo_box, 
+			NULL, HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+	g_signal_connect(G_OBJECT(dlg->repeat_combo_box), "changed", 
+			G_CALLBACK(cb_repeat_changed), app);
+
+	// days of week
+	dlg->weekday_box = gtk_hbox_new(TRUE, 0);
+	for (i=0; i<7; i++) {
+		dlg->weekday_buttons[i] = gtk_toggle_button_new_with_label(weekday_labels[i]);
+		gtk_box_pack_start(GTK_BOX(dlg->weekday_box), dlg->weekday_buttons[i], 
+				TRUE, TRUE, 0);
+	}
+	gtk_size_group_add_widget(size_group, dlg->weekday_box);
+	caption = hildon_caption_new(caption_size_group, "Days", dlg->weekday_box, 
+			NULL, HILDON_CAPTION_OPTIONAL);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// exception days
+	dlg->skip_box = gtk_hbox_new(FALSE, 0);
+	dlg->skip_holidays_check = gtk_check_button_new_with_label("Holidays");
+	button = gtk_button_new_with_label("Days off...");
+	g_signal_connect(G_OBJECT(button), "clicked", 
+			G_CALLBACK(cb_skip_days_clicked), app);
+	gtk_box_pack_start(GTK_BOX(dlg->skip_box), dlg->skip_holidays_check, 
+			FALSE, FALSE, 2);
+	gtk_box_pack_start(GTK_BOX(dlg->skip_box), button, FALSE, FALSE, 2);
+	gtk_size_group_add_widget(size_group, dlg->skip_box);
+	caption = hildon_caption_new(caption_size_group, "Skip", dlg->skip_box, 
+			NULL, HILDON_CAPTION_OPTIONAL);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// sound
+	hbox = gtk_hbox_new(FALSE, 0);
+	app->sound_combo_box = gtk_combo_box_new_text();
+	gtk_combo_box_append_text(GTK_COMBO_BOX(app->sound_combo_box), "Alarm 1");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(app->sound_combo_box), "Alarm 2");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(app->sound_combo_box), "Alarm 3");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(app->sound_combo_box), "None");
+	if (app->sound_files) {
+		// dialog was rebuilt after shed_caches()
+		for (i=0; i<app->sound_files->len; i++) {
+			append_sound_label(app, g_ptr_array_index(app->sound_files, i));
+		}
+	}
+	g_signal_connect(G_OBJECT(app->sound_combo_box), "popup", 
+			G_CALLBACK(cb_sound_popup), app);
+
+	// todo: display icon instead of text?
+	app->preview_button = gtk_button_new_from_stock(GTK_STOCK_MEDIA_PLAY);
+	g_signal_connect(G_OBJECT(app->preview_button), "clicked", 
+			G_CALLBACK(cb_preview_clicked), app);
+	gtk_box_pack_start(GTK_BOX(hbox), app->sound_combo_box, FALSE, FALSE, 2);
+	gtk_box_pack_start(GTK_BOX(hbox), app->preview_button, FALSE, FALSE, 2);
+	gtk_size_group_add_widget(size_group, hbox);
+	caption = hildon_caption_new(caption_size_group, "Sound", hbox, NULL, 
+			HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// message
+	dlg->message_entry = gtk_entry_new();
+	gtk_size_group_add_widget(size_group, dlg->message_entry);
+	caption = hildon_caption_new(caption_size_group, "Message", dlg->message_entry, 
+			NULL, HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dlg->dialog)->vbox), caption, FALSE, FALSE, 2);
+
+	// the dialog keeps references to the size groups
+	g_object_unref(size_group);
+	g_object_unref(caption_size_group);
+
+	gtk_widget_show_all(GTK_WIDGET(GTK_DIALOG(dlg->dialog)->vbox));
+
+	app->dlg = dlg;
+}
+
+// build the alarm dialog while the app is idle, so the first Add/Edit is fast
+static gboolean prebuild_alarm_dialog(gpointer data)
+{
+	app_data *app = (app_data*)data;
+	g_assert(app != NULL);
+
+	create_alarm_dialog(app);
+	// sound files are listed by the time the sound combo box is opened
+	sounds_scan(app, add_sound_files, NULL);
+	return FALSE;
+}
+
+// set dialog widgets from old_event, or to defaults for a new alarm
+static void reset_alarm_dialog(app_data *app, alarm_event_t *old_event)
+{
+	alarm_dialog_data *dlg = app->dlg;
+	time_t now;
+	struct tm tnow;
+	char time_now_buf[100];
+	gchar *time_now_string;
+	alarm_calendar *entry;
+	char *message;
+	int idx;
+
+	gtk_window_set_title(GTK_WINDOW(dlg->dialog), 
+			(old_event == NULL) ? "Add alarm" : "Edit alarm");
+
+	// time now
+	now = clock_now();
+	localtime_r(&now, &tnow);
+	date_to_string(&tnow, time_now_buf, 0);
+	time_now_string = g_strconcat(
+			"<span size='smaller' style='italic'>Time now: ", 
+			time_now_buf, "</span>", NULL);
+	gtk_label_set_markup(GTK_LABEL(dlg->time_now_label), time_now_string);
+	g_free(time_now_string);
+
+	if (old_event == NULL) {
+		now = get_new_alarm_time();
+		localtime_r(&now, &tnow);
+	} else {
+		get_next_alarm_time(old_event, &tnow);
+	}
+
+	hildon_time_editor_set_time(HILDON_TIME_EDITOR(dlg->time_editor), 
+			tnow.tm_hour, tnow.tm_min, tnow.tm_sec);
+	hildon_date_editor_set_date(HILDON_DATE_EDITOR(dlg->date_editor), 
+			tnow.tm_year+1900, tnow.tm_mon+1, tnow.tm_mday);
+
+	gtk_combo_box_set_active(GTK_COMBO_BOX(dlg->repeat_combo_box), 0);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(app->sound_combo_box), app->sound_idx);
+	gtk_entry_set_text(GTK_ENTRY(dlg->message_entry), "");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dlg->skip_holidays_check), FALSE);
+	calendar_free(dlg->skip_days);
+	dlg->skip_days = calendar_new();
+	set_dialog_weekdays(dlg, CALENDAR_WORKDAYS);
+
+	if (old_event == NULL) return;
+
+	for (idx=0; idx<ARRAY_SIZE(repeat_list); idx++) {
+		if (old_event->recurrence == repeat_list[idx].val) {
+			gtk_combo_box_set_active(GTK_COMBO_BOX(dlg->repeat_combo_box), idx);
+			break;
+		}
+	}
+
+	entry = calendar_cached_get(app, get_alarm_event_id(old_event));
+	if (entry) {
+		if (entry->weekdays) {
+			gtk_combo_box_set_active(GTK_COMBO_BOX(dlg->repeat_combo_box), 
+					REPEAT_WEEKDAYS);
+			set_dialog_weekdays(dlg, entry->weekdays);
+		}
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dlg->skip_holidays_check), 
+				entry->skip_holidays);
+		if (entry->days) {
+			calendar_free(dlg->skip_days);
+			dlg->skip_days = entry->days;
+			entry->days = NULL;
+		}
+		alarm_calendar_free(entry);
+	}
+
+	if (old_event->sound) {
+		// the sound may be on a card that is not scanned yet, or removed
+		gtk_combo_box_set_active(GTK_COMBO_BOX(app->sound_combo_box), 
+				add_sound(app, old_event->sound));
+	}
+
+	if (old_event->message) {
+		// old_event is the cached one, it keeps its escapes
+		message = unescape_message(old_event->message);
+		gtk_entry_set_text(GTK_ENTRY(dlg->message_entry), message);
+		g_free(message);
+	}
+}
+
+// true if event fires close to no other alarm, or the user sets it anyway
+static int confirm_conflicts(app_data *app, const alarm_event_t *event, 
+		guint32 weekdays, guint skip_id)
+{
+	alarm_event_t *other;
+	struct tm stm;
+	char buf[100];
+	char *message;
+	gchar *text;
+	guint id;
+	int ret;
+
+	id = conflicts_check(app->conflicts, event, weekdays, skip_id);
+	if (id == 0) return 1;
+
+	other = g_hash_table_lookup(app->events, GUINT_TO_POINTER(id));
+	if (other == NULL) return 1;
+
+	get_next_alarm_time(other, &stm);
+	date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+	message = unescape_message(other->message);
+	text = g_strdup_printf("Alarm \"%s\" at %s fires within %d minutes "
+			"of this one. Set it anyway?", message, buf, 
+			conflicts_get_minutes(app->conflicts));
+	g_free(message);
+	ret = confirm_dialog(app, GTK_WINDOW(app->dlg->dialog), text);
+	g_free(text);
+	return ret;
+}
+
+// if iter is NULL, a new alarm is added, else the alarm at iter is edited
+// event gets the actual alarm time, the caller registers it with alarmd
+// if fcn returns 0, caller must free event->message after use
+static int alarm_dialog(app_data *app, GtkTreeIter *iter, alarm_event_t *event)
+{
+	int ret = 0;
+	alarm_dialog_data *dlg;
+	alarm_event_t *old_event = NULL;
+	guint id = 0;
+	int enabled = TRUE;
+	gint result;
+
+	g_assert(app != NULL);
+	g_assert(event != NULL);
+
+	create_alarm_dialog(app);
+	dlg = app->dlg;
+
+	if (iter) {
+		gtk_tree_model_get(GTK_TREE_MODEL(app->store), iter, 
+					ID_COLUMN, &id,
+					ENABLED_COLUMN, &enabled,
+					-1);
+
+		// cached copy has the actual alarm time, even if alarm is disabled
+		old_event = g_hash_table_lookup(app->events, GUINT_TO_POINTER(id));
+		if (old_event == NULL) {
+			malarm_print("error: no cached alarm event of id %u\n", id);
+			return -1;
+		}
+	}
+
+	reset_alarm_dialog(app, old_event);
+
+	// set until the dialog is hidden, shed_caches() must not destroy it
+	// between the runs
+	app->widget_running = 1;
+	gtk_widget_show(dlg->dialog);
+
+wait_again:
+	result = gtk_dialog_run(GTK_DIALOG(dlg->dialog));
+	stop_preview_sound(app);
+	if (result != GTK_RESPONSE_OK) {
+		ret = -1;
+		goto alarm_dialog_out;
+	}
+
+	{
+	guint year, month, day;
+	guint hours, minutes, seconds;
+	gint repeat_idx;
+	gboolean skip_holidays;
+	guint32 weekdays = 0;
+	/* gint sound_idx; */
+	const gchar *message;
+	time_t itm;
+	struct tm stm;
+
+	// get alarm info from widgets
+	hildon_date_editor_get_date(HILDON_DATE_EDITOR(dlg->date_editor), 
+			&year, &month, &day);
+	hildon_time_editor_get_time(HILDON_TIME_EDITOR(dlg->time_editor), 
+			&hours, &minutes, &seconds);
+	repeat_idx = gtk_combo_box_get_active(GTK_COMBO_BOX(dlg->repeat_combo_box));
+	app->sound_idx = gtk_combo_box_get_active(GTK_COMBO_BOX(app->sound_combo_box));
+	message = gtk_entry_get_text(GTK_ENTRY(dlg->message_entry));
+
+	// initialize the alarm event
+	memset(event, 0, sizeof(alarm_event_t));
+	itm = clock_now();
+	itm = (itm/60)*60; // ignore seconds
+	localtime_r(&itm, &stm); // just to properly init stm fields
+	stm.tm_year = year - 1900;
+	stm.tm_mon = month - 1;
+	stm.tm_mday = day;
+	stm.tm_hour = hours;
+	stm.tm_min = minutes;
+	/* stm.tm_sec = seconds; */
+	stm.tm_sec = 0;
+	event->alarm_time = mktime(&stm);
+	/* event->alarm_time = 0; // jan 1, 1970 07:30am */
+	/* print_stm(&stm); */
+
+	if (event->alarm_time < itm) {
+		show_banner(app, "Cannot set alarm for time in the past");
+		goto wait_again;
+	} else if (event->alarm_time == ALARM_DISABLED) {
+		show_banner(app, "Cannot set alarm at the end of time!");
+		goto wait_again;
+	}
+
+	if (repeat_idx == REPEAT_WEEKDAYS) {
+		weekdays = get_dialog_weekdays(dlg);
+		if (weekdays == 0) {
+			show_banner(app, "Select the days of the week");
+			goto wait_again;
+		}
+		// every day is just daily
+		if (weekdays == CALENDAR_ALL_WEEK) weekdays = 0;
+	}
+
+	g_assert((repeat_idx >= 0) && (repeat_idx < ARRAY_SIZE(repeat_list)));
+	event->recurrence = repeat_list[repeat_idx].val;
+	event->recurrence_count = (repeat_idx == REPEAT_ONCE) ? 0 : -1;
+
+	event->title = MALARM_NAME;
+	event->message = alarm_escape_string(message);
+	event->sound = (char*)get_sound_uri(app, app->sound_idx);
+	event->icon = "qgn_list_hclk_alarm";
+	event->flags = ALARM_EVENT_FLAGS;
+	// triggers go to the core service, it runs without the UI
+	event->dbus_interface = MALARM_CORE_DBUS_NAME;
+	event->dbus_service = MALARM_CORE_DBUS_NAME;
+	event->dbus_path = MALARM_CORE_DBUS_PATH;
+	event->dbus_name = MALARM_DBUS_METHOD;
+	event->exec_name = NULL;
+
+	alarm_calendar_free(dlg->calendar);
+	dlg->calendar = NULL;
+	skip_holidays = gtk_toggle_button_get_active(
+			GTK_TOGGLE_BUTTON(dlg->skip_holidays_check));
+	if ((repeat_idx != REPEAT_ONCE) && (skip_holidays || weekdays || 
+				!calendar_is_empty(dlg->skip_days))) {
+		dlg->calendar = alarm_calendar_new();
+		dlg->calendar->recurrence = event->recurrence;
+		dlg->calendar->skip_holidays = skip_holidays;
+		dlg->calendar->weekdays = weekdays;
+		if (!calendar_is_empty(dlg->skip_days)) {
+			dlg->calendar->days = calendar_copy(dlg->skip_days);
+		}
+	}
+
+	// a disabled alarm does not fire, it cannot conflict
+	if (enabled && !confirm_conflicts(app, event, weekdays, id)) {
+		free(event->message);
+		goto wait_again;
+	}
+	}
+
+alarm_dialog_out:
+	gtk_widget_hide(dlg->dialog);
+	app->widget_running = 0;
+	return ret;
+}
+
+// text of the repeat column, buf holds the days of the week if it has some
+static const char *repeat_text(app_data *app, guint id, guint32 recurrence, 
+		char *buf)
+{
+	guint32 weekdays;
+	int i;
+
+	// the main loop copy of the calendars, no lock is taken
+	if ((recurrence == repeat_list[REPEAT_WEEKDAYS].val) && 
+			(weekdays = calendar_cached_weekdays(app, id))) {
+		return weekdays_to_string(weekdays, buf);
+	}
+	for (i=0; i<ARRAY_SIZE(repeat_list); i++) {
+		if (recurrence == repeat_list[i].val) {
+			return repeat_list[i].text;
+		}
+	}
+	return "Other";
+}
+
+// show event in the row at iter, busy if a request for it is in flight
+static void set_alarm_row(app_data *app, GtkTreeIter *iter, guint id, 
+		cookie_t cookie, alarm_event_t *event, int enabled, int busy)
+{
+	struct tm stm;
+	const char *repeat;
+	char buf[100];
+	char weekdays_buf[30];
+	char *message;
+
+	get_next_alarm_time(event, &stm);
+	date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+	repeat = repeat_text(app, id, event->recurrence, weekdays_buf);
+
+	message = unescape_message(event->message);
+	gtk_tree_store_set(app->store, iter,
+			SNOOZE_COLUMN, SNOOZE_STRING(event->snoozed),
+			ENABLED_COLUMN, enabled,
+			TIME_STRING_COLUMN, buf,
+			REPEAT_COLUMN, repeat,
+			MESSAGE_COLUMN, message,
+			COOKIE_COLUMN, cookie,
+			ALARM_TIME_COLUMN, event->alarm_time,
+			ACTIVATABLE_COLUMN, !busy,
+			ID_COLUMN, id,
+			SNOOZED_COLUMN, event->snoozed,
+			RECURRENCE_COLUMN, event->recurrence,
+			-1);
+	g_free(message);
+
+	if (!busy) {
+		g_hash_table_replace(app->events, GUINT_TO_POINTER(id), 
+				copy_alarm_event(event));
+		// other rows may conflict with it, or not any more
+		conflicts_put(app->conflicts, id, event, enabled);
+		gtk_widget_queue_draw(app->view);
+	}
+}
+
+// event must have the actual alarm time, even if alarm is disabled
+static void add_alarm_to_tree(app_data *app, guint id, cookie_t cookie, 
+		alarm_event_t *event, int enabled, int busy, GtkTreeIter *new_iter)
+{
+	GtkTreeIter *piter, iter, tmp_iter;
+	guint tid;
+	GtkTreePath *path;
+
+	if (new_iter == NULL) new_iter = &tmp_iter;
+
+	// insert at correct position based on sorted ids
+	piter = NULL;
+	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(app->store), &iter)) {
+		do {
+			gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
+					ID_COLUMN, &tid,
+					-1);
+			if (id < tid) {
+				piter = &iter;
+				break;
+			}
+		} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &iter));
+	}
+
+	gtk_tree_store_insert_before(app->store, new_iter, NULL, piter);
+	set_alarm_row(app, new_iter, id, cookie, event, enabled, busy);
+
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), new_iter);
+	g_assert(path);
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+	gtk_tree_path_free(path);
+}
+
+/* Events are fetched by the worker thread (with FETCH_THREADS requests in
+ * flight), and handed to the main loop in chunks of REFRESH_CHUNK_SIZE rows.
+ * If the registry turns out to be inconsistent, the worker starts over
+ * with a new generation, and the main loop clears the rows it has shown.
+ */
+#define REFRESH_CHUNK_SIZE  64
+
+typedef struct {
+	app_data *app;
+	GArray *items;       // rows not yet handed to the main loop
+	int generation;      // worker thread
+	int shown_generation;  // main loop
+	guint next_id;
+} refresh_data;
+
+typedef struct {
+	refresh_data *refresh;
+	GArray *items;
+	int generation;
+} refresh_chunk;
+
+static gint compare_refresh_items(gconstpointer a, gconstpointer b)
+{
+	guint ida = ((const scan_item*)a)->id;
+	guint idb = ((const scan_item*)b)->id;
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+/* Large updates are made with the model detached from the view: rows
+ * inserted or removed then cost no view work, and the view lays them
+ * out once when the model is attached again. The caller sets the cursor.
+ */
+#define TREE_BULK_ROWS  128
+
+static int begin_bulk_update(app_data *app, int nrows)
+{
+	if (nrows < TREE_BULK_ROWS) {
+		return 0;
+	}
+	g_object_ref(app->store);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(app->view), NULL);
+	return 1;
+}
+
+static void end_bulk_update(app_data *app, int bulk)
+{
+	if (!bulk) return;
+
+	gtk_tree_view_set_model(GTK_TREE_VIEW(app->view), GTK_TREE_MODEL(app->store));
+	g_object_unref(app->store);
+}
+
+// main loop: insert rows in a single pass over the tree, which is sorted by id
+static void insert_alarm_rows(app_data *app, GArray *items)
+{
+	GtkTreeIter iter, prev, new_iter;
+	scan_item *item;
+	guint tid = 0;
+	int have_row, have_prev = FALSE;
+	int i;
+
+	g_array_sort(items, compare_refresh_items);
+
+	have_row = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(app->store), &iter);
+	for (i=0; i<items->len; i++) {
+		item = &g_array_index(items, scan_item, i);
+
+		while (have_row) {
+			gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
+					ID_COLUMN, &tid,
+					-1);
+			if (item->id < tid) break;
+			prev = iter;
+			have_prev = TRUE;
+			have_row = gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &iter);
+		}
+
+		// an append with no sibling walks all rows, inserting after the
+		// previous row does not
+		if (have_row) {
+			gtk_tree_store_insert_before(app->store, &new_iter, NULL, &iter);
+		} else if (have_prev) {
+			gtk_tree_store_insert_after(app->store, &new_iter, NULL, &prev);
+		} else {
+			gtk_tree_store_append(app->store, &new_iter, NULL);
+		}
+		prev = new_iter;
+		have_prev = TRUE;
+		set_alarm_row(app, &new_iter, item->id, item->cookie, item->event, 
+				item->enabled, FALSE);
+		free_alarm_event_copy(item->event);
+	}
+	g_array_set_size(items, 0);
+}
+
+// main loop: start over if the rows shown are from an older generation
+static void reset_refresh_rows(app_data *app, refresh_data *refresh, int generation)
+{
+	int bulk;
+
+	if (refresh->shown_generation != generation) {
+		bulk = begin_bulk_update(app, 
+				gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL));
+		gtk_tree_store_clear(GTK_TREE_STORE(app->store));
+		end_bulk_update(app, bulk);
+		g_hash_table_remove_all(app->events);
+		conflicts_clear(app->conflicts);
+		refresh->shown_generation = generation;
+	}
+}
+
+static gboolean done_refresh_chunk(gpointer data)
+{
+	refresh_chunk *chunk = (refresh_chunk*)data;
+	app_data *app = chunk->refresh->app;
+
+	reset_refresh_rows(app, chunk->refresh, chunk->generation);
+	insert_alarm_rows(app, chunk->items);
+
+	g_array_free(chunk->items, TRUE);
+	g_free(chunk);
+	return FALSE;
+}
+
+// worker thread: queue a row for the main loop
+static void add_refresh_item(scan_item *item, gpointer data)
+{
+	refresh_data *refresh = (refresh_data*)data;
+	refresh_chunk *chunk;
+
+	g_array_append_val(refresh->items, *item);
+
+	if (refresh->items->len < REFRESH_CHUNK_SIZE) return;
+
+	// same priority as worker_job_done(), so chunks are shown in order
+	// and before done_refresh()
+	chunk = g_new0(refresh_chunk, 1);
+	chunk->refresh = refresh;
+	chunk->items = refresh->items;
+	chunk->generation = refresh->generation;
+	g_idle_add(done_refresh_chunk, chunk);
+
+	refresh->items = g_array_sized_new(FALSE, FALSE, sizeof(scan_item), 
+			REFRESH_CHUNK_SIZE);
+}
+
+// worker thread: drop queued rows, rows already shown are cleared later
+static void restart_refresh(gpointer data)
+{
+	refresh_data *refresh = (refresh_data*)data;
+	int i;
+
+	for (i=0; i<refresh->items->len; i++) {
+		free_alarm_event_copy(g_array_index(refresh->items, scan_item, i).event);
+	}
+	g_array_set_size(refresh->items, 0);
+	refresh->generation++;
+}
+
+// worker thread: get all alarms, see malarm_scan.h
+static void run_refresh(app_data *app, gpointer data)
+{
+	refresh_data *refresh = (refresh_data*)data;
+
+	trace_set_phase(TRACE_PHASE_REFRESH);
+	refresh->next_id = scan_alarms(app, add_refresh_item, restart_refresh, 
+			refresh);
+}
+
+// main loop: end of a refresh, the rows are all in
+static void finish_refresh(app_data *app)
+{
+	GtkTreePath *path;
+	int nitems;
+
+	// cursor is set once, on the last row
+	nitems = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL);
+	if (nitems > 0) {
+		path = gtk_tree_path_new_from_indices(nitems - 1, -1);
+		gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+		gtk_tree_path_free(path);
+	}
+
+	app->refreshing = 0;
+	gtk_widget_set_sensitive(GTK_WIDGET(app->view), TRUE);
+	malarm_debug("done\n");
+}
+
+// main loop: show the last rows read by the worker
+static void done_refresh(app_data *app, gpointer data)
+{
+	refresh_data *refresh = (refresh_data*)data;
+
+	reset_refresh_rows(app, refresh, refresh->generation);
+	insert_alarm_rows(app, refresh->items);
+	g_array_free(refresh->items, TRUE);
+
+	app->next_id = MAX(app->next_id, refresh->next_id);
+	g_free(refresh);
+	finish_refresh(app);
+
+	arm_calendar_alarms(app);
+	run_deferred_refresh(app);
+}
+
+/* main loop: show the alarms of a snapshot of the core service, see
+ * malarm_client.h. items is NULL if the core did not answer, then the
+ * worker reads alarmd.
+ */
+void done_core_snapshot(app_data *app, GArray *items)
+{
+	int bulk;
+
+	if (items == NULL) {
+		app->refreshing = 0;
+		populate_tree(app);
+		return;
+	}
+
+	bulk = begin_bulk_update(app, items->len + 
+			gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL));
+	gtk_tree_store_clear(GTK_TREE_STORE(app->store));
+	g_hash_table_remove_all(app->events);
+	conflicts_clear(app->conflicts);
+	insert_alarm_rows(app, items);
+	g_array_free(items, TRUE);
+	end_bulk_update(app, bulk);
+	finish_refresh(app);
+
+	run_deferred_refresh(app);
+}
+
+// true if the tree has a row for alarm id
+static int find_alarm_row(app_data *app, guint id, GtkTreeIter *iter)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(app->store);
+	gboolean valid;
+	guint tid;
+
+	valid = gtk_tree_model_get_iter_first(model, iter);
+	for (; valid; valid = gtk_tree_model_iter_next(model, iter)) {
+		gtk_tree_model_get(model, iter, 
+					ID_COLUMN, &tid,
+					-1);
+		if (tid == id) return 1;
+	}
+	return 0;
+}
+
+// id of the row at the cursor, 0 if none
+static guint get_cursor_id(app_data *app)
+{
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	guint id = 0;
+
+	gtk_tree_view_get_cursor(GTK_TREE_VIEW(app->view), &path, NULL);
+	if (path == NULL) return 0;
+
+	if (gtk_tree_model_get_iter(GTK_TREE_MODEL(app->store), &iter, path)) {
+		gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
+					ID_COLUMN, &id,
+					-1);
+	}
+	gtk_tree_path_free(path);
+	return id;
+}
+
+static void set_cursor_id(app_data *app, guint id)
+{
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	if ((id == 0) || !find_alarm_row(app, id, &iter)) return;
+
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &iter);
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
+	gtk_tree_path_free(path);
+}
+
+/* main loop: apply a delta of the core service, taking items. Rows with
+ * a request in flight are skipped, the request reports their new state.
+ */
+void apply_core_delta(app_data *app, GArray *items)
+{
+	GArray *new_items;
+	scan_item *item;
+	GtkTreeIter iter;
+	guint cursor_id;
+	int i, bulk;
+
+	cursor_id = get_cursor_id(app);
+	bulk = begin_bulk_update(app, items->len);
+
+	new_items = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	for (i=0; i<items->len; i++) {
+		item = &g_array_index(items, scan_item, i);
+		if (!find_alarm_row(app, item->id, &iter)) {
+			// a removed row stays removed until its removal is undone
+			if (item->event && !is_removal_queued(app, item->id)) {
+				g_array_append_val(new_items, *item);
+			} else {
+				free_alarm_event_copy(item->event);
+			}
+			continue;
+		}
+		if (!is_row_busy(app, &iter)) {
+			if (item->event) {
+				set_alarm_row(app, &iter, item->id, item->cookie, item->event, 
+						item->enabled, FALSE);
+			} else {
+				g_hash_table_remove(app->events, GUINT_TO_POINTER(item->id));
+				if (bulk) {
+					conflicts_remove(app->conflicts, item->id);
+					// the cursor is set at the end
+					gtk_tree_store_remove(GTK_TREE_STORE(app->store), &iter);
+				} else {
+					remove_item(app, &iter);
+				}
+			}
+		}
+		free_alarm_event_copy(item->event);
+	}
+	g_array_free(items, TRUE);
+
+	insert_alarm_rows(app, new_items);
+	g_array_free(new_items, TRUE);
+
+	if (bulk) {
+		end_bulk_update(app, bulk);
+		set_cursor_id(app, cursor_id);
+	}
+}
+
+void populate_tree(app_data *app)
+{
+	refresh_data *refresh;
+
+	malarm_debug("start\n");
+
+	// wait for row operations in flight, else their rows are lost
+	if (app->refreshing || (app->ops_pending > 0)) {
+		app->refresh_deferred = 1;
+		return;
+	}
+
+	app->refreshing = 1;
+	app->caches_shed = 0;
+	gtk_widget_set_sensitive(GTK_WIDGET(app->view), FALSE);
+
+	if (app->client_state != CLIENT_OFF) {
+		// the core has all alarms in memory
+		client_snapshot(app);
+		return;
+	}
+
+	refresh = g_new0(refresh_data, 1);
+	refresh->app = app;
+	refresh->items = g_array_sized_new(FALSE, FALSE, sizeof(scan_item), 
+			REFRESH_CHUNK_SIZE);
+	refresh->generation = 1;
+	worker_submit(app, run_refresh, done_refresh, refresh);
+}
+
+/* Low memory: release what can be rebuilt. The alarm dialog is built
+ * again on the next Add/Edit, the rows and cached events are read again
+ * when the window is shown, and the worker loads the store when needed.
+ */
+typedef struct {
+	guint store_events;
+	gsize store_size;
+	int fetch_pool;
+} shed_data;
+
+static gboolean add_row_size(GtkTreeModel *model, GtkTreePath *path, 
+		GtkTreeIter *iter, gpointer data)
+{
+	gchar *snooze, *time_string, *repeat, *message;
+
+	gtk_tree_model_get(model, iter, 
+			SNOOZE_COLUMN, &snooze,
+			TIME_STRING_COLUMN, &time_string,
+			REPEAT_COLUMN, &repeat,
+			MESSAGE_COLUMN, &message,
+			-1);
+	*(gsize*)data += strlen(snooze) + strlen(time_string) + strlen(repeat) + 
+		(message ? strlen(message) : 0) + 4;
+
+	g_free(snooze);
+	g_free(time_string);
+	g_free(repeat);
+	g_free(message);
+	return FALSE;
+}
+
+static void add_cached_event_size(gpointer key, gpointer value, gpointer data)
+{
+	*(gsize*)data += alarm_event_copy_size((alarm_event_t*)value);
+}
+
+// memory used by the main loop caches
+static void print_ui_memory(app_data *app, const char *when)
+{
+	gsize row_size = 0;
+	gsize event_size = 0;
+
+	gtk_tree_model_foreach(GTK_TREE_MODEL(app->store), add_row_size, &row_size);
+	g_hash_table_foreach(app->events, add_cached_event_size, &event_size);
+
+	malarm_print("memory %s: rows %d (%u bytes of strings), "
+			"cached events %u (%u bytes), alarm dialog %s\n", when,
+			gtk_tree_model_iter_n_children(GTK_TREE_MODEL(app->store), NULL), 
+			(guint)row_size, g_hash_table_size(app->events), (guint)event_size,
+			app->dlg ? "built" : "not built");
+}
+
+// worker thread: release the store and the fetch threads
+static void run_shed(app_data *app, gpointer data)
+{
+	shed_data *shed = (shed_data*)data;
+
+	store_unload(app, &shed->store_events, &shed->store_size);
+	shed->fetch_pool = (app->fetch_pool != NULL);
+	fetch_stop(app);
+}
+
+static void done_shed(app_data *app, gpointer data)
+{
+	shed_data *shed = (shed_data*)data;
+
+	malarm_print("memory released by worker: store events %u (%u bytes), "
+			"fetch threads %d\n", shed->store_events, (guint)shed->store_size, 
+			shed->fetch_pool ? FETCH_THREADS : 0);
+	g_free(shed);
+}
+
+void shed_caches(app_data *app)
+{
+	alarm_dialog_data *dlg = app->dlg;
+
+	print_ui_memory(app, "before release");
+
+	if (dlg && !app->widget_running) {
+		gtk_widget_destroy(dlg->dialog);
+		calendar_free(dlg->skip_days);
+		alarm_calendar_free(dlg->calendar);
+		g_free(dlg);
+		app->dlg = NULL;
+		app->sound_combo_box = NULL;
+		app->preview_button = NULL;
+	}
+	sounds_unload(app);
+
+	// rows are kept while shown, or while a request for them is in flight
+	if ((app->visibility == GDK_VISIBILITY_FULLY_OBSCURED) && 
+			!app->widget_running && !app->refreshing && 
+			(app->ops_pending == 0)) {
+		gtk_tree_store_clear(GTK_TREE_STORE(app->store));
+		g_hash_table_remove_all(app->events);
+		conflicts_clear(app->conflicts);
+		app->caches_shed = 1;
+	}
+
+	print_ui_memory(app, "after release");
+
+	worker_submit(app, run_shed, done_shed, g_new0(shed_data, 1));
+}
+
+/* The "fires in" column is not in the store. It is computed when a row
+ * is drawn, from the alarm time and the current minute. Each minute only
+ * the visible rows are redrawn, so the cost does not grow with the
+ * number of alarms.
+ */
+static void fires_in_data_func(GtkTreeViewColumn *column, GtkCellRenderer *renderer, 
+		GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	app_data *app = (app_data*)data;
+	time_t alarm_time;
+	time_t now = app->fires_in_now;
+	guint snoozed, recurrence;
+	int enabled;
+	long mins;
+	char buf[50];
+
+	gtk_tree_model_get(model, iter, 
+			ENABLED_COLUMN, &enabled,
+			ALARM_TIME_COLUMN, &alarm_time,
+			SNOOZED_COLUMN, &snoozed,
+			RECURRENCE_COLUMN, &recurrence,
+			-1);
+
+	buf[0] = '\0';
+	alarm_time += snoozed*60;
+	if (enabled && (alarm_time < now) && (recurrence > 0) && (snoozed == 0)) {
+		// next occurrence of a recurring alarm
+		alarm_time += ((now - alarm_time)/(recurrence*60) + 1)*recurrence*60;
+	}
+
+	if (enabled && (alarm_time >= now)) {
+		mins = (alarm_time - now + 59)/60;
+		if (snoozed) {
+			g_snprintf(buf, sizeof(buf), "snoozed, %ld min", mins);
+		} else if (mins < 60) {
+			g_snprintf(buf, sizeof(buf), "in %ld min", mins);
+		} else if (mins < 24*60) {
+			g_snprintf(buf, sizeof(buf), "in %ldh %02ldmin", mins/60, mins%60);
+		} else {
+			g_snprintf(buf, sizeof(buf), "in %ld days", mins/(24*60));
+		}
+	}
+
+	g_object_set(G_OBJECT(renderer), "text", buf, NULL);
+}
+
+/* Conflicts (see malarm_conflicts.h) are looked up when a row is drawn,
+ * like the "fires in" column: a flag of the alarm, set when the index
+ * changed.
+ */
+static void conflict_data_func(GtkTreeViewColumn *column, GtkCellRenderer *renderer, 
+		GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	app_data *app = (app_data*)data;
+	guint id;
+
+	gtk_tree_model_get(model, iter, 
+			ID_COLUMN, &id,
+			-1);
+	g_object_set(G_OBJECT(renderer), 
+			"foreground-set", conflicts_has(app->conflicts, id), NULL);
+}
+
+typedef struct {
+	int minutes;
+	int days;
+} conflict_settings;
+
+// worker thread: unset keys are 0, for the defaults
+static void run_get_conflict_settings(app_data *app, gpointer data)
+{
+	conflict_settings *settings = (conflict_settings*)data;
+
+	settings->minutes = backend_key_get(app, MALARM_GCONF_CONFLICT_MINUTES);
+	settings->days = backend_key_get(app, MALARM_GCONF_CONFLICT_DAYS);
+}
+
+static void done_get_conflict_settings(app_data *app, gpointer data)
+{
+	conflict_settings *settings = (conflict_settings*)data;
+
+	conflicts_configure(app->conflicts, settings->minutes, settings->days);
+	gtk_widget_queue_draw(app->view);
+	g_free(settings);
+}
+
+// minute timer: redraw the visible rows only
+static gboolean update_fires_in(app_data *app, gpointer data)
+{
+	GtkTreePath *start, *end;
+	GtkTreeIter iter;
+
+	app->fires_in_now = clock_now()/60*60;
+
+	if (!gtk_tree_view_get_visible_range(GTK_TREE_VIEW(app->view), &start, &end)) {
+		return TRUE;
+	}
+
+	if (gtk_tree_model_get_iter(GTK_TREE_MODEL(app->store), &iter, start)) {
+		do {
+			gtk_tree_model_row_changed(GTK_TREE_MODEL(app->store), start, &iter);
+			if (gtk_tree_path_compare(start, end) >= 0) break;
+			gtk_tree_path_next(start);
+		} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &iter));
 	}
 
-	if (old_cookie > 0) {
-		char key[50];
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+	return TRUE;
+}
 
-		alarm_event_del(old_cookie);
+/* Rows have a fixed height, and columns the width of the widest text
+ * they can show, measured once: inserting a row does not measure its
+ * cells (see gtk_tree_view_set_fixed_height_mode()). Takes texts, NULL
+ * for a renderer without text.
+ */
+static void set_fixed_width(GtkWidget *view, GtkTreeViewColumn *column, 
+		GtkCellRenderer *renderer, GPtrArray *texts)
+{
+	gint width, max = 0, sep = 0;
+	int i;
 
-		// update gconf key
-		cookie_to_gconf_key(old_cookie, key);
-		gconf_client_unset(app->gconf, key, NULL);
-		cookie_to_gconf_key(*new_cookie, key);
-		if (!gconf_client_set_int(app->gconf, key, orig_time, NULL)) {
-			malarm_print("error: failed to set gconf key %s to %ld\n", 
-					key, orig_time);
-			ret = -1;
-			goto alarm_dialog_out;
+	if (texts == NULL) {
+		gtk_cell_renderer_get_size(renderer, view, NULL, NULL, NULL, &max, NULL);
+	} else {
+		for (i=0; i<texts->len; i++) {
+			g_object_set(G_OBJECT(renderer), "text", g_ptr_array_index(texts, i), NULL);
+			gtk_cell_renderer_get_size(renderer, view, NULL, NULL, NULL, &width, NULL);
+			max = MAX(max, width);
+			g_free(g_ptr_array_index(texts, i));
 		}
+		g_object_set(G_OBJECT(renderer), "text", NULL, NULL);
+		g_ptr_array_free(texts, TRUE);
 	}
 
-	print_alarm_event(*new_cookie, event);
-	}
+	gtk_widget_style_get(view, "horizontal-separator", &sep, NULL);
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(column, max + sep);
+}
 
-alarm_dialog_out:
-	// todo: do I need to free something???
-	gtk_widget_destroy(dialog);
-	return ret;
+static GPtrArray *new_texts(const char *title)
+{
+	GPtrArray *texts = g_ptr_array_new();
+
+	g_ptr_array_add(texts, g_strdup(title));
+	return texts;
 }
 
-static int add_alarm_to_tree(app_data *app, cookie_t cookie, alarm_event_t *event)
+// every month and weekday, at the widest time of day
+static GPtrArray *time_texts(void)
 {
-	char *newline;
-	struct tm stm;
-	int enabled = TRUE;
-	char *repeat = "Other";
-	GtkTreeIter *piter, iter, new_iter;
-	cookie_t tcookie;
-	GtkTreePath *path;
-	int i;
+	GPtrArray *texts = new_texts("Time");
+	struct tm stm = { };
 	char buf[100];
 
-
-	if (event->alarm_time == ALARM_DISABLED) {
-		event->alarm_time = get_actual_alarm_time(app, cookie);
-		if (event->alarm_time < 0) {
-			return -1;
+	stm.tm_year = 2008 - 1900;
+	for (stm.tm_mon=0; stm.tm_mon<12; stm.tm_mon++) {
+		for (stm.tm_wday=0; stm.tm_wday<7; stm.tm_wday++) {
+			stm.tm_hour = 20;
+			stm.tm_min = 58;
+			stm.tm_mday = 28;
+			date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+			g_ptr_array_add(texts, g_strdup(buf));
 		}
-		enabled = FALSE;
 	}
+	return texts;
+}
 
-	get_next_alarm_time(event, &stm);
-	date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+static GPtrArray *repeat_texts(void)
+{
+	GPtrArray *texts = new_texts("Repeat");
+	char buf[30];
+	guint32 weekdays;
+	int i;
 
+	g_ptr_array_add(texts, g_strdup("Other"));
 	for (i=0; i<ARRAY_SIZE(repeat_list); i++) {
-		if (event->recurrence == repeat_list[i].val) {
-			repeat = repeat_list[i].text;
-			break;
-		}
+		g_ptr_array_add(texts, g_strdup(repeat_list[i].text));
 	}
-
-	// insert at correct position based on sorted cookies
-	piter = NULL;
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(app->store), &iter)) {
-		do {
-			gtk_tree_model_get(GTK_TREE_MODEL(app->store), &iter, 
-					COOKIE_COLUMN, &tcookie,
-					-1);
-			if (cookie < tcookie) {
-				piter = &iter;
-				break;
-			}
-		} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(app->store), &iter));
+	for (weekdays=1; weekdays<(1 << 7); weekdays++) {
+		weekdays_to_string(weekdays, buf);
+		// the longest lists of days only, "Mon, Wed, Fri, Sun" etc.
+		if (strlen(buf) >= 18) {
+			g_ptr_array_add(texts, g_strdup(buf));
+		}
 	}
-
-	gtk_tree_store_insert_before(app->store, &new_iter, NULL, piter);
-	gtk_tree_store_set(app->store, &new_iter,
-			SNOOZE_COLUMN, SNOOZE_STRING(event->snoozed),
-			ENABLED_COLUMN, enabled,
-			TIME_STRING_COLUMN, buf,
-			REPEAT_COLUMN, repeat,
-			MESSAGE_COLUMN, alarm_unescape_string_noalloc(event->message),
-			COOKIE_COLUMN, cookie,
-			ALARM_TIME_COLUMN, event->alarm_time,
-			-1);
-
-	path = gtk_tree_model_get_path(GTK_TREE_MODEL(app->store), &new_iter);
-	g_assert(path);
-	gtk_tree_view_set_cursor(GTK_TREE_VIEW(app->view), path, NULL, FALSE);
-
-	return 0;
+	return texts;
 }
 
-void populate_tree(app_data *app)
+static GPtrArray *fires_in_texts(void)
 {
-	cookie_t *cookie;
-	alarm_event_t *event = NULL;
-	/* time_t itm; */
-
-	malarm_debug("start\n");
-
-	gtk_tree_store_clear(GTK_TREE_STORE(app->store));
+	GPtrArray *texts = new_texts("Fires in");
 
-	/* time(&itm); */
-
-	// also need to show snoozed alarms, which have alarm_time in the past
-	/* cookie = alarm_event_query(itm, TIME_T_MAX, 0, 0); */
-	cookie = alarm_event_query(0, TIME_T_MAX, 0, 0);
-	while (cookie && *cookie) {
-		if (event = alarm_event_get(*cookie)) {
-			if (strcmp(event->title, MALARM_NAME) == 0) {
-				print_alarm_event(*cookie, event);
-				if (add_alarm_to_tree(app, *cookie, event) != 0) {
-					// cannot find actual time of disabled alarm
-					alarm_event_del(*cookie);
-					malarm_debug("removed alarm cookie %d\n", *cookie);
-				}
-			}
-			alarm_event_free(event);
-		}
-		cookie++;
-	}
+	g_ptr_array_add(texts, g_strdup("snoozed, 99 min"));
+	g_ptr_array_add(texts, g_strdup("in 59 min"));
+	g_ptr_array_add(texts, g_strdup("in 23h 59min"));
+	g_ptr_array_add(texts, g_strdup("in 9999 days"));
+	return texts;
 }
 
 static void create_tree(app_data *app)
@@ -833,92 +2691,694 @@ static void create_tree(app_data *app)
 			G_TYPE_STRING, 
 			G_TYPE_STRING,
 			G_TYPE_LONG,
-			G_TYPE_LONG);
+			G_TYPE_LONG,
+			G_TYPE_BOOLEAN,
+			G_TYPE_UINT,
+			G_TYPE_UINT,
+			G_TYPE_UINT);
 	app->store = store;
+	app->events = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, (GDestroyNotify)free_alarm_event_copy);
+	app->conflicts = conflicts_new(app);
 
 	view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
 	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(view), TRUE);
 	gtk_tree_view_set_headers_clickable(GTK_TREE_VIEW(view), TRUE);
 	app->view = view;
 
+	// scrolled window
+	swindow = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(swindow),
+			GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(swindow), GTK_WIDGET(view));
+
+	gtk_container_add(GTK_CONTAINER(app->window), GTK_WIDGET(swindow));
+
+	// column widths are measured with the theme font
+	gtk_widget_ensure_style(view);
+
 	/* snooze */
 	renderer = gtk_cell_renderer_text_new();
 	column = gtk_tree_view_column_new_with_attributes(
 			" ", renderer, "text", SNOOZE_COLUMN, NULL);
+	set_fixed_width(view, column, renderer, new_texts(SNOOZE_STRING(1)));
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
 
 	/* enable checkbox */
 	renderer = gtk_cell_renderer_toggle_new();
 	column = gtk_tree_view_column_new_with_attributes(
-			" ", renderer, "active", ENABLED_COLUMN, NULL);
+			" ", renderer, "active", ENABLED_COLUMN, 
+			"activatable", ACTIVATABLE_COLUMN, NULL);
+	set_fixed_width(view, column, renderer, NULL);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
 
 	app->cb_toggled_handler_id = 
 		g_signal_connect(G_OBJECT(renderer), "toggled", G_CALLBACK(cb_toggled), app);
 	app->toggled_renderer = renderer;
 
-	/* time string */
+	/* time string, in red if it conflicts */
 	renderer = gtk_cell_renderer_text_new();
+	g_object_set(G_OBJECT(renderer), "foreground", "red", NULL);
 	column = gtk_tree_view_column_new_with_attributes(
 			"Time", renderer, "text", TIME_STRING_COLUMN, NULL);
+	gtk_tree_view_column_set_cell_data_func(column, renderer, 
+			conflict_data_func, app, NULL);
+	set_fixed_width(view, column, renderer, time_texts());
+	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
+
+	/* time remaining, text is set when the row is drawn */
+	renderer = gtk_cell_renderer_text_new();
+	column = gtk_tree_view_column_new_with_attributes(
+			"Fires in", renderer, NULL);
+	gtk_tree_view_column_set_cell_data_func(column, renderer, 
+			fires_in_data_func, app, NULL);
+	set_fixed_width(view, column, renderer, fires_in_texts());
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
 
 	/* recurrence */
 	renderer = gtk_cell_renderer_text_new();
 	column = gtk_tree_view_column_new_with_attributes(
 			"Repeat", renderer, "text", REPEAT_COLUMN, NULL);
+	set_fixed_width(view, column, renderer, repeat_texts());
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
 
 	/* alarm message */
 	renderer = gtk_cell_renderer_text_new();
 	column = gtk_tree_view_column_new_with_attributes(
 			"Message", renderer, "text", MESSAGE_COLUMN, NULL);
+	set_fixed_width(view, column, renderer, new_texts("Message"));
+	gtk_tree_view_column_set_expand(column, TRUE);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
 
+	// all columns are fixed, the row height is taken from the first row
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(view), TRUE);
+
 	g_signal_connect(G_OBJECT(view), "row-activated", G_CALLBACK(cb_row_activated), app);
  
 	g_signal_connect(G_OBJECT(app->view), "visibility-notify-event",
 					 G_CALLBACK(cb_visibility), app);
 
-	// scrolled window
-	swindow = gtk_scrolled_window_new(NULL, NULL);
-	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(swindow),
-			GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
-	gtk_container_add(GTK_CONTAINER(swindow), GTK_WIDGET(view));
-
-	gtk_container_add(GTK_CONTAINER(app->window), GTK_WIDGET(swindow));
+	app->fires_in_now = clock_now()/60*60;
+	sched_add_aligned(app, "fires in", 60*1000, update_fires_in, NULL);
 
+	worker_submit(app, run_get_conflict_settings, done_get_conflict_settings, 
+			g_new0(conflict_settings, 1));
+	// before the refresh, which arms the alarms from it
+	worker_submit(app, run_load_calendars, done_load_calendars, 
+			g_new0(calendar_copies, 1));
 	populate_tree(app);
 }
 
+/* Profiles (see malarm_profiles.h). A switch changes the alarms whose
+ * state differs from the profile as one worker request: the enabled ones
+ * get their alarmd events and the disabled ones go to the store in one
+ * write, and only then the old state is dropped. If any step fails, the
+ * steps done are undone and no alarm changes. The rows show the result
+ * in one model update.
+ */
+enum {
+	PROFILE_RESPONSE_SAVE = 1,
+	PROFILE_RESPONSE_DELETE,
+};
+
+typedef struct {
+	char *name;
+	GArray *states;  // of profile_state, NULL to delete the profile
+	int failed;
+} profile_put_data;
+
+typedef struct {
+	char *name;
+	GPtrArray *ops;  // row_op that enable or disable an alarm
+	int nbusy;       // rows skipped, a request for them was in flight
+	int failed;
+} profile_switch;
+
+// the profiles, read by the worker for the dialog
+typedef struct {
+	GPtrArray *names;   // sorted
+	GPtrArray *states;  // GArray of profile_state of each name
+} profile_list;
+
+// ask for a profile and what to do with it; name is NULL if cancelled
+static int profile_dialog(app_data *app, const GPtrArray *names, char **name)
+{
+	GtkWidget *dialog;
+	GtkWidget *combo_box;
+	GtkWidget *caption;
+	gint result;
+	int i;
+
+	dialog = gtk_dialog_new_with_buttons(
+			"Profiles", 
+			GTK_WINDOW(app->window),
+			GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+			"Switch", GTK_RESPONSE_OK,
+			"Save", PROFILE_RESPONSE_SAVE,
+			GTK_STOCK_DELETE, PROFILE_RESPONSE_DELETE,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			NULL);
+
+	combo_box = gtk_combo_box_entry_new_text();
+	for (i=0; i<names->len; i++) {
+		gtk_combo_box_append_text(GTK_COMBO_BOX(combo_box), 
+				g_ptr_array_index(names, i));
+	}
+	if (names->len > 0) {
+		gtk_combo_box_set_active(GTK_COMBO_BOX(combo_box), 0);
+	}
+
+	caption = hildon_caption_new(NULL, "Profile", combo_box, 
+			NULL, HILDON_CAPTION_MANDATORY);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(dialog)->vbox), caption, FALSE, FALSE, 2);
+	gtk_widget_show_all(GTK_WIDGET(dialog));
+
+	app->widget_running = 1;
+	result = gtk_dialog_run(GTK_DIALOG(dialog));
+	app->widget_running = 0;
+
+	*name = NULL;
+	if ((result == GTK_RESPONSE_OK) || (result == PROFILE_RESPONSE_SAVE) || 
+			(result == PROFILE_RESPONSE_DELETE)) {
+		// the text of the entry
+		*name = gtk_combo_box_get_active_text(GTK_COMBO_BOX(combo_box));
+		if (*name) g_strstrip(*name);
+	}
+	gtk_widget_destroy(dialog);
+
+	return result;
+}
+
+static void run_put_profile(app_data *app, gpointer data)
+{
+	profile_put_data *put = (profile_put_data*)data;
+
+	put->failed = (profile_put(app, put->name, put->states) != 0);
+}
+
+static void done_put_profile(app_data *app, gpointer data)
+{
+	profile_put_data *put = (profile_put_data*)data;
+	gchar *text;
+
+	if (put->failed) {
+		text = g_strdup_printf("Failed to save profile %s", put->name);
+	} else if (put->states) {
+		text = g_strdup_printf("Saved profile %s, %u alarms", 
+				put->name, put->states->len);
+	} else {
+		text = g_strdup_printf("Deleted profile %s", put->name);
+	}
+	show_banner(app, text);
+	g_free(text);
+
+	if (put->states) g_array_free(put->states, TRUE);
+	g_free(put->name);
+	g_free(put);
+}
+
+// the state of all rows, as profile_state
+static GArray *get_row_states(app_data *app)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(app->store);
+	GtkTreeIter iter;
+	GArray *states;
+	profile_state st;
+	gboolean valid;
+	int enabled;
+
+	states = g_array_new(FALSE, FALSE, sizeof(profile_state));
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	for (; valid; valid = gtk_tree_model_iter_next(model, &iter)) {
+		gtk_tree_model_get(model, &iter, 
+					ID_COLUMN, &st.id,
+					ENABLED_COLUMN, &enabled,
+					-1);
+		st.enabled = (enabled != 0);
+		g_array_append_val(states, st);
+	}
+	return states;
+}
+
+// worker thread: undo the alarmd events added for the enabled alarms
+static void undo_switch_batch(app_data *app, GPtrArray *ops)
+{
+	row_op *op;
+	int i;
+
+	for (i=0; i<ops->len; i++) {
+		op = g_ptr_array_index(ops, i);
+		if (op->new_cookie > 0) {
+			backend_event_del(app, op->new_cookie);
+			registry_unset(app, op->id);
+			op->new_cookie = 0;
+		}
+		op->failed = 1;
+	}
+}
+
+// worker thread: all changes of the switch, in one journal
+static void run_switch_batch(app_data *app, gpointer data)
+{
+	profile_switch *sw = (profile_switch*)data;
+	row_op *op;
+	guint *ids;
+	alarm_event_t **events;
+	int i, n;
+
+	trace_set_phase(TRACE_PHASE_ROW_OP);
+
+	for (i=0; i<sw->ops->len; i++) {
+		op = g_ptr_array_index(sw->ops, i);
+		journal_begin(app, op->id, op->old_cookie, 
+				op->enabled ? JOURNAL_ADD : JOURNAL_DISABLE);
+	}
+
+	ids = g_new(guint, sw->ops->len);
+	events = g_new(alarm_event_t*, sw->ops->len);
+
+	// the new state of all alarms, next to the old one
+	for (i=0; i<sw->ops->len; i++) {
+		op = g_ptr_array_index(sw->ops, i);
+		if (op->enabled && (register_row_op(app, op) != 0)) {
+			sw->failed = 1;
+			break;
+		}
+	}
+	for (i=0, n=0; !sw->failed && (i<sw->ops->len); i++) {
+		op = g_ptr_array_index(sw->ops, i);
+		if (!op->enabled) {
+			ids[n] = op->id;
+			events[n++] = op->event;
+		}
+	}
+	if (!sw->failed && (n > 0) && (store_put_batch(app, n, ids, events) != 0)) {
+		sw->failed = 1;
+	}
+	if (sw->failed) {
+		undo_switch_batch(app, sw->ops);
+		goto run_switch_batch_out;
+	}
+
+	// then drop the old state
+	for (i=0, n=0; i<sw->ops->len; i++) {
+		op = g_ptr_array_index(sw->ops, i);
+		if (op->enabled) {
+			ids[n++] = op->id;
+		} else if (op->old_cookie > 0) {
+			backend_event_del(app, op->old_cookie);
+			registry_unset(app, op->id);
+		}
+	}
+	if ((n > 0) && (store_remove_batch(app, n, ids) != 0)) {
+		// the enabled alarms are in alarmd, the next refresh shows them so
+		malarm_print("error: failed to remove %d enabled alarms from the store\n", n);
+	}
+
+run_switch_batch_out:
+	g_free(ids);
+	g_free(events);
+	journal_commit(app);
+}
+
+// main loop: show the new state of all rows at once, or the old one
+static void done_switch_batch(app_data *app, gpointer data)
+{
+	profile_switch *sw = (profile_switch*)data;
+	row_op *op;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	GArray *changed;
+	scan_item item;
+	guint cursor_id;
+	gchar *text;
+	int i, bulk;
+
+	cursor_id = get_cursor_id(app);
+	bulk = begin_bulk_update(app, sw->ops->len);
+
+	changed = g_array_new(FALSE, FALSE, sizeof(scan_item));
+	for (i=0; i<sw->ops->len; i++) {
+		op = g_ptr_array_index(sw->ops, i);
+		if (!sw->failed) {
+			item.id = op->id;
+			item.cookie = op->new_cookie;
+			item.event = op->event;
+			item.enabled = op->enabled;
+			g_array_append_val(changed, item);
+		}
+
+		path = gtk_tree_row_reference_get_path(op->row);
+		if (path == NULL) {
+			continue;
+		}
+		if (gtk_tree_model_get_iter(GTK_TREE_MODEL(app->store), &iter, path)) {
+			if (sw->failed) {
+				set_alarm_row(app, &iter, op->id, op->old_cookie, op->old_event, 
+						op->old_enabled, FALSE);
+			} else {
+				set_alarm_row(app, &iter, op->id, op->new_cookie, op->event, 
+						op->enabled, FALSE);
+			}
+		}
+		gtk_tree_path_free(path);
+	}
+
+	if (bulk) {
+		end_bulk_update(app, bulk);
+		set_cursor_id(app, cursor_id);
+	}
+
+	client_changed(app, (scan_item*)changed->data, changed->len);
+	g_array_free(changed, TRUE);
+
+	if (sw->failed) {
+		text = g_strdup_printf("Failed to switch to profile %s, "
+				"no alarm was changed", sw->name);
+	} else if (sw->nbusy > 0) {
+		text = g_strdup_printf("Switched to profile %s, %u alarms changed, "
+				"%d busy alarms skipped", sw->name, sw->ops->len, sw->nbusy);
+	} else {
+		text = g_strdup_printf("Switched to profile %s, %u alarms changed", 
+				sw->name, sw->ops->len);
+	}
+	show_banner(app, text);
+	g_free(text);
+
+	for (i=0; i<sw->ops->len; i++) {
+		free_row_op(g_ptr_array_index(sw->ops, i));
+	}
+	g_ptr_array_free(sw->ops, TRUE);
+	g_free(sw->name);
+	g_free(sw);
+
+	app->ops_pending--;
+	run_deferred_refresh(app);
+}
+
+// main loop: start a switch to states, the ones of profile name
+static void switch_profile(app_data *app, char *name, const GArray *states)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(app->store);
+	GtkTreeIter iter;
+	const profile_state *st;
+	profile_switch *sw;
+	row_op *op;
+	gboolean valid;
+	guint id, cursor_id;
+	int enabled, bulk;
+	gchar *text;
+
+	if (states == NULL) {
+		text = g_strdup_printf("No profile %s", name);
+		show_banner(app, text);
+		g_free(text);
+		g_free(name);
+		return;
+	}
+
+	// removed rows are gone for good, before the switch
+	flush_removals(app);
+
+	sw = g_new0(profile_switch, 1);
+	sw->name = name;
+	sw->ops = g_ptr_array_new();
+
+	cursor_id = get_cursor_id(app);
+	bulk = begin_bulk_update(app, 
+			gtk_tree_model_iter_n_children(model, NULL));
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	for (; valid; valid = gtk_tree_model_iter_next(model, &iter)) {
+		gtk_tree_model_get(model, &iter, 
+					ID_COLUMN, &id,
+					ENABLED_COLUMN, &enabled,
+					-1);
+		st = profile_find(states, id);
+		if ((st == NULL) || ((enabled != 0) == (st->enabled != 0))) {
+			continue;
+		}
+		if (is_row_busy(app, &iter)) {
+			sw->nbusy++;
+			continue;
+		}
+
+		op = new_row_op(app, &iter);
+		set_row_op_enabled(op, st->enabled);
+		show_row_op(app, &iter, op);
+		g_ptr_array_add(sw->ops, op);
+	}
+	if (bulk) {
+		end_bulk_update(app, bulk);
+		set_cursor_id(app, cursor_id);
+	}
+
+	if (sw->ops->len == 0) {
+		text = g_strdup_printf("Profile %s is already set", name);
+		show_banner(app, text);
+		g_free(text);
+		g_ptr_array_free(sw->ops, TRUE);
+		g_free(sw->name);
+		g_free(sw);
+		return;
+	}
+
+	malarm_debug("switching to profile %s, %u alarms\n", name, sw->ops->len);
+	app->ops_pending++;
+	worker_submit(app, run_switch_batch, done_switch_batch, sw);
+}
+
+// worker thread: all profiles, the file is read on first use
+static void run_get_profiles(app_data *app, gpointer data)
+{
+	profile_list *list = (profile_list*)data;
+	int i;
+
+	list->names = profile_get_names(app);
+	list->states = g_ptr_array_sized_new(list->names->len);
+	for (i=0; i<list->names->len; i++) {
+		g_ptr_array_add(list->states, 
+				profile_get(app, g_ptr_array_index(list->names, i)));
+	}
+}
+
+static void free_profile_list(profile_list *list)
+{
+	GArray *states;
+	int i;
+
+	for (i=0; i<list->names->len; i++) {
+		g_free(g_ptr_array_index(list->names, i));
+		states = g_ptr_array_index(list->states, i);
+		if (states) g_array_free(states, TRUE);
+	}
+	g_ptr_array_free(list->names, TRUE);
+	g_ptr_array_free(list->states, TRUE);
+	g_free(list);
+}
+
+// main loop: the profiles are in, ask what to do with one
+static void done_get_profiles(app_data *app, gpointer data)
+{
+	profile_list *list = (profile_list*)data;
+	profile_put_data *put;
+	GArray *states = NULL;
+	char *name;
+	int i, result;
+
+	app->profiles_pending = 0;
+	if (app->refreshing) {
+		free_profile_list(list);
+		return;
+	}
+
+	result = profile_dialog(app, list->names, &name);
+	if (name == NULL) {
+		free_profile_list(list);
+		return;
+	}
+
+	if (name[0] == '\0') {
+		show_banner(app, "Enter a profile name");
+		g_free(name);
+
+	} else if (result == GTK_RESPONSE_OK) {
+		for (i=0; i<list->names->len; i++) {
+			if (strcmp(g_ptr_array_index(list->names, i), name) == 0) {
+				states = g_ptr_array_index(list->states, i);
+				break;
+			}
+		}
+		// a refresh may have started while the dialog was up
+		if (app->refreshing) {
+			g_free(name);
+		} else {
+			switch_profile(app, name, states);
+		}
+
+	} else {
+		put = g_new0(profile_put_data, 1);
+		put->name = name;
+		if (result == PROFILE_RESPONSE_SAVE) {
+			put->states = get_row_states(app);
+		}
+		worker_submit(app, run_put_profile, done_put_profile, put);
+	}
+	free_profile_list(list);
+}
+
+static void cb_action_profiles(GtkWidget *widget, app_data *app)
+{
+	g_assert(app != NULL);
+
+	if (app->refreshing || app->profiles_pending) return;
+
+	// the dialog shows when the worker has read them
+	app->profiles_pending = 1;
+	worker_submit(app, run_get_profiles, done_get_profiles, 
+			g_new0(profile_list, 1));
+}
+
+/* Merging keeps the alarm at the cursor, or else the first one of the
+ * first conflict; a recurring alarm close to a one-time one is kept
+ * instead. Only its duplicates, the alarms that repeat alike and fire
+ * at the same times, are removed, and the removals can be undone like
+ * any other. Alarms that merely fire close to it are left alone.
+ */
+static void cb_action_conflicts(GtkWidget *widget, app_data *app)
+{
+	alarm_event_t *event, *other;
+	GtkTreeIter iter;
+	GArray *ids, *dups;
+	GString *list;
+	struct tm stm;
+	char buf[100];
+	char *message;
+	gchar *text;
+	guint id, other_id;
+	int i, ok, n = 0;
+
+	g_assert(app != NULL);
+
+	if (app->refreshing) return;
+
+	id = get_cursor_id(app);
+	if ((id == 0) || !conflicts_has(app->conflicts, id)) {
+		id = conflicts_first(app->conflicts);
+	}
+	event = g_hash_table_lookup(app->events, GUINT_TO_POINTER(id));
+	if ((id == 0) || (event == NULL)) {
+		show_banner(app, "No alarms fire close to each other");
+		return;
+	}
+
+	ids = conflicts_get_cluster(app->conflicts, id);
+	for (i=1; (event->recurrence == 0) && (i<ids->len); i++) {
+		other_id = g_array_index(ids, guint, i);
+		other = g_hash_table_lookup(app->events, GUINT_TO_POINTER(other_id));
+		if ((other != NULL) && (other->recurrence != 0)) {
+			id = other_id;
+			event = other;
+		}
+	}
+	g_array_free(ids, TRUE);
+	set_cursor_id(app, id);
+
+	// rows with a request in flight are left alone
+	dups = g_array_new(FALSE, FALSE, sizeof(guint));
+	list = g_string_new(NULL);
+	ids = conflicts_get_cluster(app->conflicts, id);
+	for (i=1; i<ids->len; i++) {
+		other_id = g_array_index(ids, guint, i);
+		other = g_hash_table_lookup(app->events, GUINT_TO_POINTER(other_id));
+		if ((other == NULL) || 
+				!conflicts_is_duplicate(app->conflicts, id, other_id) || 
+				!find_alarm_row(app, other_id, &iter) || 
+				is_row_busy(app, &iter)) {
+			continue;
+		}
+		g_array_append_val(dups, other_id);
+
+		get_next_alarm_time(other, &stm);
+		date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+		message = unescape_message(other->message);
+		g_string_append_printf(list, "\n%s \"%s\"", buf, message);
+		g_free(message);
+	}
+	g_array_free(ids, TRUE);
+
+	message = unescape_message(event->message);
+	if (dups->len == 0) {
+		text = g_strdup_printf("No duplicates of \"%s\" to merge", message);
+		show_banner(app, text);
+		ok = 0;
+	} else {
+		get_next_alarm_time(event, &stm);
+		date_to_string(&stm, buf, DATE_TO_STRING_WDAY);
+		text = g_strdup_printf("Merge into \"%s\" at %s and remove its "
+				"%u duplicates?%s", message, buf, dups->len, list->str);
+		ok = confirm_dialog(app, GTK_WINDOW(app->window), text);
+	}
+	g_free(text);
+	g_free(message);
+	g_string_free(list, TRUE);
+
+	// the dialog ran the main loop, so the rows are looked up again
+	for (i=0; ok && (i<dups->len); i++) {
+		if (find_alarm_row(app, g_array_index(dups, guint, i), &iter) && 
+				!is_row_busy(app, &iter)) {
+			queue_removal(app, &iter);
+			n++;
+		}
+	}
+	if (n > 0) {
+		set_cursor_id(app, id);
+		show_removal_banner(app);
+	}
+	g_array_free(dups, TRUE);
+}
+
 static void create_toolbar(app_data *app) 
 {
 	GtkToolbar* toolbar;
 	GtkToolItem* tb_add;
 	GtkToolItem* tb_remove;
 	GtkToolItem* tb_edit;
+	GtkToolItem* tb_clone;
+	GtkToolItem* tb_undo;
 
 	g_assert(app != NULL);
 
 	tb_add = gtk_tool_button_new_from_stock(GTK_STOCK_ADD);
 	tb_remove = gtk_tool_button_new_from_stock(GTK_STOCK_REMOVE);
 	tb_edit = gtk_tool_button_new_from_stock(GTK_STOCK_EDIT);
+	tb_clone = gtk_tool_button_new_from_stock(GTK_STOCK_COPY);
+	gtk_tool_button_set_label(GTK_TOOL_BUTTON(tb_clone), "Clone");
+	tb_undo = gtk_tool_button_new_from_stock(GTK_STOCK_UNDO);
 
 	// required for BOTH_HORIZ style to work!
 	gtk_tool_item_set_is_important(GTK_TOOL_ITEM(tb_add), TRUE);
 	gtk_tool_item_set_is_important(GTK_TOOL_ITEM(tb_remove), TRUE);
 	gtk_tool_item_set_is_important(GTK_TOOL_ITEM(tb_edit), TRUE);
+	gtk_tool_item_set_is_important(GTK_TOOL_ITEM(tb_clone), TRUE);
+	gtk_tool_item_set_is_important(GTK_TOOL_ITEM(tb_undo), TRUE);
 
 	toolbar = GTK_TOOLBAR(gtk_toolbar_new());
 	gtk_toolbar_set_style(GTK_TOOLBAR(toolbar), GTK_TOOLBAR_BOTH_HORIZ);
 	gtk_toolbar_insert(toolbar, tb_add, -1);
 	gtk_toolbar_insert(toolbar, tb_remove, -1);
 	gtk_toolbar_insert(toolbar, tb_edit, -1);
+	gtk_toolbar_insert(toolbar, tb_clone, -1);
+	gtk_toolbar_insert(toolbar, tb_undo, -1);
 
 	gtk_widget_show_all(GTK_WIDGET(toolbar));
+	// only while removals can be undone
+	gtk_widget_hide(GTK_WIDGET(tb_undo));
+	app->undo_button = GTK_WIDGET(tb_undo);
 	g_signal_connect(G_OBJECT(tb_add), "clicked", G_CALLBACK(cb_action_add), app);
 	g_signal_connect(G_OBJECT(tb_remove), "clicked", G_CALLBACK(cb_action_remove), app);
 	g_signal_connect(G_OBJECT(tb_edit), "clicked", G_CALLBACK(cb_action_edit), app);
+	g_signal_connect(G_OBJECT(tb_clone), "clicked", G_CALLBACK(cb_action_clone), app);
+	g_signal_connect(G_OBJECT(tb_undo), "clicked", G_CALLBACK(cb_action_undo), app);
 
 	hildon_window_add_toolbar(HILDON_WINDOW(app->window), GTK_TOOLBAR(toolbar));
 }
@@ -928,39 +3388,72 @@ static void create_menu(app_data *app)
 	GtkWidget *main_menu;
 	GtkWidget *add_item;
 	GtkWidget *remove_item;
+	GtkWidget *undo_item;
 	GtkWidget *edit_item;
+	GtkWidget *clone_item;
+	GtkWidget *holidays_item;
+	GtkWidget *profiles_item;
+	GtkWidget *conflicts_item;
 	GtkWidget *about_item;
 
 	main_menu = gtk_menu_new();
 
 	add_item = gtk_image_menu_item_new_with_label("Add alarm");
 	remove_item = gtk_image_menu_item_new_with_label("Remove alarm");
+	undo_item = gtk_image_menu_item_new_with_label("Undo remove");
 	edit_item = gtk_image_menu_item_new_with_label("Edit alarm");
+	clone_item = gtk_image_menu_item_new_with_label("Clone alarm");
+	holidays_item = gtk_image_menu_item_new_with_label("Holidays");
+	profiles_item = gtk_image_menu_item_new_with_label("Profiles");
+	conflicts_item = gtk_image_menu_item_new_with_label("Merge close alarms");
 	about_item = gtk_image_menu_item_new_with_label("About");
 
 	gtk_menu_append(main_menu, add_item);
 	gtk_menu_append(main_menu, remove_item);
+	gtk_menu_append(main_menu, undo_item);
 	gtk_menu_append(main_menu, edit_item);
+	gtk_menu_append(main_menu, clone_item);
+	gtk_menu_append(main_menu, holidays_item);
+	gtk_menu_append(main_menu, profiles_item);
+	gtk_menu_append(main_menu, conflicts_item);
 	gtk_menu_append(main_menu, about_item);
 
 	g_signal_connect(G_OBJECT(add_item), "activate",
 			G_CALLBACK(cb_action_add), app);
 	g_signal_connect(G_OBJECT(remove_item), "activate",
 			G_CALLBACK(cb_action_remove), app);
+	g_signal_connect(G_OBJECT(undo_item), "activate",
+			G_CALLBACK(cb_action_undo), app);
 	g_signal_connect(G_OBJECT(edit_item), "activate",
 			G_CALLBACK(cb_action_edit), app);
+	g_signal_connect(G_OBJECT(clone_item), "activate",
+			G_CALLBACK(cb_action_clone), app);
+	g_signal_connect(G_OBJECT(holidays_item), "activate",
+			G_CALLBACK(cb_action_holidays), app);
+	g_signal_connect(G_OBJECT(profiles_item), "activate",
+			G_CALLBACK(cb_action_profiles), app);
+	g_signal_connect(G_OBJECT(conflicts_item), "activate",
+			G_CALLBACK(cb_action_conflicts), app);
 	g_signal_connect(G_OBJECT(about_item), "activate",
 			G_CALLBACK(cb_action_about), app);
 
 	hildon_window_set_menu(app->window, GTK_MENU(main_menu));
 
 	gtk_widget_show_all(GTK_WIDGET(main_menu));
+	gtk_widget_set_sensitive(undo_item, FALSE);
+	app->undo_item = undo_item;
 }
 
 void create_ui(app_data *app)
 {
+	app->clone_count = 5;
+	app->clone_interval = 10;
+	app->clone_unit = CLONE_MINUTES;
+
 	create_toolbar(app);
 	create_menu(app);
 	create_tree(app);
+
+	g_idle_add_full(G_PRIORITY_LOW, prebuild_alarm_dialog, app, NULL);
 }
 
@@ -19,10 +19,18 @@
 #ifndef _MALARM_UI_H_
 #define _MALARM_UI_H_
 
+#include <hildon/hildon.h>
+
 #include "malarm_main.h"
 
 void create_ui(app_data *app);
 void populate_tree(app_data *app);
+void shed_caches(app_data *app);
+void arm_calendar_alarms(app_data *app);
+void show_banner(app_data *app, const char *text);
+void flush_removals(app_data *app);
+void done_core_snapshot(app_data *app, GArray *items);
+void apply_core_delta(app_data *app, GArray *items);
 
 #endif /* #define _MALARM_UI_H_ */
 
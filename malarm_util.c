@@ -16,9 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <osso-multimedia-interface.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
 
 #include "malarm_util.h"
+#include "malarm_backend.h"
 
 void print_alarm_event(cookie_t cookie, alarm_event_t *event)
 {
@@ -80,19 +84,8 @@ void print_itm(time_t itm)
 
 int play_sound(app_data *app, const char *path)
 {
-	osso_return_t ret;
-	osso_rpc_t retval;
-
 	/* malarm_debug("playing %s\n", path); */
-	ret = osso_rpc_run(app->ctx, OSSO_MULTIMEDIA_SERVICE, 
-			OSSO_MULTIMEDIA_OBJECT_PATH, OSSO_MULTIMEDIA_SOUND_INTERFACE, 
-			OSSO_MULTIMEDIA_PLAY_SOUND_REQ, &retval,
-			DBUS_TYPE_STRING, path,
-			DBUS_TYPE_INT32, 1, // what are possible priority values?
-			DBUS_TYPE_INVALID);
-	if (ret != OSSO_OK) {
-		malarm_print("error sending play rpc to osso-multimedia-service: %d\n", ret);
-		malarm_print("osso retval: type %d, val %d\n", retval.type, retval.value.i);
+	if (backend_sound_play(app, path) != 0) {
 		return -1;
 	}
 	
@@ -102,20 +95,11 @@ int play_sound(app_data *app, const char *path)
 
 int stop_sound(app_data *app)
 {
-	osso_return_t ret;
-	osso_rpc_t retval;
-
 	if (!app->sound_playing) {
 		return 0;
 	}
 
-	ret = osso_rpc_run(app->ctx, OSSO_MULTIMEDIA_SERVICE, 
-			OSSO_MULTIMEDIA_OBJECT_PATH, OSSO_MULTIMEDIA_SOUND_INTERFACE, 
-			OSSO_MULTIMEDIA_STOP_SOUND_REQ, &retval,
-			DBUS_TYPE_INVALID);
-	if (ret != OSSO_OK) {
-		malarm_print("error sending stop rpc to osso-multimedia-service: %d\n", ret);
-		malarm_print("osso retval: type %d, val %d\n", retval.type, retval.value.i);
+	if (backend_sound_stop(app) != 0) {
 		return -1;
 	}
 
@@ -124,13 +108,29 @@ int stop_sound(app_data *app)
 }
 
 // get actual time of disabled alarm
-time_t get_actual_alarm_time(app_data *app, cookie_t cookie)
+time_t get_actual_alarm_time(app_data *app, guint id)
+{
+	time_t actual_time;
+	gchar key[100];
+
+	id_to_gconf_key(id, key);
+	actual_time = backend_key_get(app, key);
+	if (actual_time == 0) {
+		malarm_print("error: failed to get gconf key %s\n", key);
+		return -1;
+	}
+
+	return actual_time;
+}
+
+// same, for a disabled alarm created by an older malarm
+time_t get_actual_alarm_time_old(app_data *app, cookie_t cookie)
 {
 	time_t actual_time;
 	gchar key[100];
 
 	cookie_to_gconf_key(cookie, key);
-	actual_time = gconf_client_get_int(app->gconf, key, NULL);
+	actual_time = backend_key_get(app, key);
 	if (actual_time == 0) {
 		malarm_print("error: failed to get gconf key %s\n", key);
 		return -1;
@@ -179,14 +179,270 @@ void date_to_string(struct tm *stm, char *buf, int flags)
 			stm->tm_year+1900);
 }
 
+// deep copy of an alarm event, free with free_alarm_event_copy()
+alarm_event_t *copy_alarm_event(const alarm_event_t *event)
+{
+	alarm_event_t *copy;
+
+	copy = g_new(alarm_event_t, 1);
+	*copy = *event;
+	copy->title = g_strdup(event->title);
+	copy->message = g_strdup(event->message);
+	copy->sound = g_strdup(event->sound);
+	copy->icon = g_strdup(event->icon);
+	copy->dbus_interface = g_strdup(event->dbus_interface);
+	copy->dbus_service = g_strdup(event->dbus_service);
+	copy->dbus_path = g_strdup(event->dbus_path);
+	copy->dbus_name = g_strdup(event->dbus_name);
+	copy->exec_name = g_strdup(event->exec_name);
+	return copy;
+}
+
+void free_alarm_event_copy(alarm_event_t *event)
+{
+	if (event == NULL) return;
+
+	g_free(event->title);
+	g_free(event->message);
+	g_free(event->sound);
+	g_free(event->icon);
+	g_free(event->dbus_interface);
+	g_free(event->dbus_service);
+	g_free(event->dbus_path);
+	g_free(event->dbus_name);
+	g_free(event->exec_name);
+	g_free(event);
+}
+
+/* Unescaped copy of an event message, free with g_free(). 
+ * alarm_unescape_string_noalloc() unescapes in place, so it is only ever
+ * given a copy: events are cached and registered with their escapes.
+ */
+char *unescape_message(const char *message)
+{
+	char *text;
+
+	if (message == NULL) return g_strdup("");
+
+	text = g_strdup(message);
+	alarm_unescape_string_noalloc(text);
+	return text;
+}
+
+// bytes used by a copy from copy_alarm_event()
+gsize alarm_event_copy_size(const alarm_event_t *event)
+{
+	const char *strings[] = {
+		event->title, event->message, event->sound, event->icon, 
+		event->dbus_interface, event->dbus_service, event->dbus_path, 
+		event->dbus_name, event->exec_name,
+	};
+	gsize size = sizeof(alarm_event_t);
+	int i;
+
+	for (i=0; i<sizeof(strings)/sizeof(strings[0]); i++) {
+		if (strings[i]) size += strlen(strings[i]) + 1;
+	}
+	return size;
+}
+
+// malarm id in a method name MALARM_DBUS_METHOD "_<id>", 0 if none
+guint method_to_id(const char *method)
+{
+	const char *prefix = MALARM_DBUS_METHOD "_";
+	unsigned long id;
+	char *end;
+
+	if ((method == NULL) || strncmp(method, prefix, strlen(prefix)) != 0) {
+		return 0;
+	}
+
+	id = strtoul(method + strlen(prefix), &end, 10);
+	if ((*end != '\0') || (id > G_MAXUINT)) {
+		return 0;
+	}
+	return id;
+}
+
+// malarm id of event, 0 if event was created by an older malarm
+guint get_alarm_event_id(const alarm_event_t *event)
+{
+	return method_to_id(event->dbus_name);
+}
+
+// event must be a copy from copy_alarm_event()
+void set_alarm_event_id(alarm_event_t *event, guint id)
+{
+	g_free(event->dbus_name);
+	event->dbus_name = g_strdup_printf("%s_%u", MALARM_DBUS_METHOD, id);
+}
+
+// gconf key with actual time of a disabled alarm
+char *id_to_gconf_key(guint id, char *key)
+{
+	sprintf(key, "%stime/%u", MALARM_GCONF_DIR, id);
+	return key;
+}
+
+// gconf key used by older malarm versions, before alarms had ids
 char *cookie_to_gconf_key(cookie_t cookie, char *key)
 {
 	sprintf(key, "%s%d", MALARM_GCONF_DIR, cookie);
 	return key;
 }
 
-void show_banner(app_data *app, const char *text)
+/* path of a file in MALARM_DATA_DIR, or of the dir itself if name is
+ * NULL. MALARM_DATA_ENV names another dir, e.g. for a simulation.
+ */
+char *get_data_path(const char *name)
 {
-	hildon_banner_show_information(GTK_WIDGET(app->window), NULL, text);
+	const char *dir = g_getenv(MALARM_DATA_ENV);
+
+	if (dir) {
+		return g_build_filename(dir, name, NULL);
+	}
+	return g_build_filename(g_get_home_dir(), MALARM_DATA_DIR, name, NULL);
 }
 
+// write data to a temp file, then rename it over path, so a crash leaves
+// either the old or the new contents
+int save_file(const char *path, const gchar *data, gsize len)
+{
+	char *tmp_path;
+	int fd;
+	int ret = -1;
+
+	tmp_path = g_strconcat(path, ".tmp", NULL);
+
+	fd = g_open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		malarm_print("error: failed to create %s: %s\n", tmp_path, 
+				g_strerror(errno));
+		goto save_file_out;
+	}
+	if ((write(fd, data, len) != len) || (fsync(fd) != 0)) {
+		malarm_print("error: failed to write %s: %s\n", tmp_path, 
+				g_strerror(errno));
+		close(fd);
+		g_unlink(tmp_path);
+		goto save_file_out;
+	}
+	close(fd);
+
+	if (g_rename(tmp_path, path) != 0) {
+		malarm_print("error: failed to rename %s: %s\n", tmp_path, 
+				g_strerror(errno));
+		g_unlink(tmp_path);
+		goto save_file_out;
+	}
+	ret = 0;
+
+save_file_out:
+	g_free(tmp_path);
+	return ret;
+}
+
+/* Records of malarm's binary files, in host byte order. A string is a
+ * u32 length and its chars, or BUF_NULL_STRING for NULL.
+ */
+void put_u32(GString *buf, guint32 val)
+{
+	g_string_append_len(buf, (gchar*)&val, sizeof(val));
+}
+
+void put_i64(GString *buf, gint64 val)
+{
+	g_string_append_len(buf, (gchar*)&val, sizeof(val));
+}
+
+void put_string(GString *buf, const char *str)
+{
+	if (str == NULL) {
+		put_u32(buf, BUF_NULL_STRING);
+		return;
+	}
+	put_u32(buf, strlen(str));
+	g_string_append(buf, str);
+}
+
+int get_bytes(const gchar **p, const gchar *end, void *val, gsize len)
+{
+	if (end - *p < len) return -1;
+	memcpy(val, *p, len);
+	*p += len;
+	return 0;
+}
+
+int get_u32(const gchar **p, const gchar *end, guint32 *val)
+{
+	return get_bytes(p, end, val, sizeof(*val));
+}
+
+int get_string(const gchar **p, const gchar *end, char **str)
+{
+	guint32 len;
+
+	*str = NULL;
+	if (get_bytes(p, end, &len, sizeof(len)) != 0) return -1;
+	if (len == BUF_NULL_STRING) return 0;
+	if (end - *p < len) return -1;
+	*str = g_strndup(*p, len);
+	*p += len;
+	return 0;
+}
+
+/* Event fields in host byte order:
+ *   i64 alarm_time, u32 recurrence, i32 recurrence_count,
+ *   u32 snooze, i32 flags, u32 snoozed,
+ *   9 strings (title ... exec_name), each u32 length + chars
+ */
+void put_alarm_event(GString *buf, const alarm_event_t *event)
+{
+	put_i64(buf, event->alarm_time);
+	put_u32(buf, event->recurrence);
+	put_u32(buf, event->recurrence_count);
+	put_u32(buf, event->snooze);
+	put_u32(buf, event->flags);
+	put_u32(buf, event->snoozed);
+	put_string(buf, event->title);
+	put_string(buf, event->message);
+	put_string(buf, event->sound);
+	put_string(buf, event->icon);
+	put_string(buf, event->dbus_interface);
+	put_string(buf, event->dbus_service);
+	put_string(buf, event->dbus_path);
+	put_string(buf, event->dbus_name);
+	put_string(buf, event->exec_name);
+}
+
+// returns a new event, free with free_alarm_event_copy(), or NULL
+alarm_event_t *get_alarm_event(const gchar **p, const gchar *end)
+{
+	alarm_event_t *event;
+	gint64 alarm_time;
+	int err = 0;
+
+	event = g_new0(alarm_event_t, 1);
+	err |= get_bytes(p, end, &alarm_time, sizeof(alarm_time));
+	err |= get_bytes(p, end, &event->recurrence, sizeof(event->recurrence));
+	err |= get_bytes(p, end, &event->recurrence_count, sizeof(event->recurrence_count));
+	err |= get_bytes(p, end, &event->snooze, sizeof(event->snooze));
+	err |= get_bytes(p, end, &event->flags, sizeof(event->flags));
+	err |= get_bytes(p, end, &event->snoozed, sizeof(event->snoozed));
+	err |= get_string(p, end, &event->title);
+	err |= get_string(p, end, &event->message);
+	err |= get_string(p, end, &event->sound);
+	err |= get_string(p, end, &event->icon);
+	err |= get_string(p, end, &event->dbus_interface);
+	err |= get_string(p, end, &event->dbus_service);
+	err |= get_string(p, end, &event->dbus_path);
+	err |= get_string(p, end, &event->dbus_name);
+	err |= get_string(p, end, &event->exec_name);
+	event->alarm_time = alarm_time;
+
+	if (err) {
+		free_alarm_event_copy(event);
+		return NULL;
+	}
+	return event;
+}
@@ -23,6 +23,8 @@
 
 #define DATE_TO_STRING_WDAY  (1 << 0)
 
+#define BUF_NULL_STRING  0xffffffff
+
 void print_alarm_event(cookie_t cookie, alarm_event_t *event);
 void print_stm(struct tm *ptm);
 void print_itm(time_t itm);
@@ -30,12 +32,33 @@ void print_itm(time_t itm);
 int play_sound(app_data *app, const char *path);
 int stop_sound(app_data *app);
 
-time_t get_actual_alarm_time(app_data *app, cookie_t cookie);
+time_t get_actual_alarm_time(app_data *app, guint id);
+time_t get_actual_alarm_time_old(app_data *app, cookie_t cookie);
 void get_next_alarm_time(alarm_event_t *event, struct tm *stm);
 void date_to_string(struct tm *stm, char *buf, int flags);
 
+alarm_event_t *copy_alarm_event(const alarm_event_t *event);
+void free_alarm_event_copy(alarm_event_t *event);
+gsize alarm_event_copy_size(const alarm_event_t *event);
+char *unescape_message(const char *message);
+
+guint method_to_id(const char *method);
+guint get_alarm_event_id(const alarm_event_t *event);
+void set_alarm_event_id(alarm_event_t *event, guint id);
+
+char *id_to_gconf_key(guint id, char *key);
 char *cookie_to_gconf_key(cookie_t cookie, char *key);
-void show_banner(app_data *app, const char *text);
+char *get_data_path(const char *name);
+int save_file(const char *path, const gchar *data, gsize len);
+
+void put_u32(GString *buf, guint32 val);
+void put_i64(GString *buf, gint64 val);
+void put_string(GString *buf, const char *str);
+int get_bytes(const gchar **p, const gchar *end, void *val, gsize len);
+int get_u32(const gchar **p, const gchar *end, guint32 *val);
+int get_string(const gchar **p, const gchar *end, char **str);
+void put_alarm_event(GString *buf, const alarm_event_t *event);
+alarm_event_t *get_alarm_event(const gchar **p, const gchar *end);
 
 #endif /* #define _MALARM_UTIL_H_ */
 
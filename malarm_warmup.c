@@ -0,0 +1,283 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "malarm_warmup.h"
+#include "malarm_scan.h"
+#include "malarm_worker.h"
+#include "malarm_history.h"
+#include "malarm_clock.h"
+
+#define WARMUP_MAX_DELAY  (24*60*60)
+
+typedef struct {
+	GPtrArray *uris;  // sounds to read
+} warmup_data;
+
+typedef struct {
+	app_data *app;
+	time_t now;
+	time_t next;       // of the next alarm to warm up, -1 if none
+	GPtrArray *uris;   // NULL, or the sounds due to be warmed up now
+} warmup_scan;
+
+// the time the list shows, see get_next_alarm_time()
+static time_t next_alarm_time(const alarm_event_t *event)
+{
+	return event->alarm_time + (time_t)event->snoozed*60;
+}
+
+static char *sound_path(const char *uri)
+{
+	if (g_str_has_prefix(uri, "file://")) {
+		return g_filename_from_uri(uri, NULL, NULL);
+	}
+	return g_strdup(uri);
+}
+
+// worker thread: read uri through the page cache
+static void read_sound(const char *uri)
+{
+	char *path;
+	char buf[16*1024];
+	GTimer *timer;
+	gsize total = 0;
+	gssize n;
+	int fd;
+
+	if ((path = sound_path(uri)) == NULL) return;
+
+	timer = g_timer_new();
+	fd = g_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		malarm_debug("no sound file %s\n", path);
+		g_timer_destroy(timer);
+		g_free(path);
+		return;
+	}
+	while ((total < WARMUP_MAX_BYTES) && ((n = read(fd, buf, sizeof(buf))) > 0)) {
+		total += n;
+	}
+	close(fd);
+
+	malarm_debug("read %u bytes of %s in %d ms\n", (guint)total, path, 
+			(int)(g_timer_elapsed(timer, NULL)*1000));
+	g_timer_destroy(timer);
+	g_free(path);
+}
+
+/* Percent of the first WARMUP_MAX_BYTES of the sound of uri that are in
+ * the page cache, -1 if it cannot be told. mincore() reads nothing, the
+ * check does not warm the file up itself.
+ */
+static gint32 sound_resident(const char *uri)
+{
+	char *path;
+	struct stat st;
+	unsigned char *vec;
+	void *addr;
+	size_t len, page, npages, i, resident = 0;
+	gint32 percent = -1;
+	int fd;
+
+	if ((path = sound_path(uri)) == NULL) return -1;
+	fd = g_open(path, O_RDONLY, 0);
+	g_free(path);
+	if (fd < 0) return -1;
+
+	if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+		close(fd);
+		return -1;
+	}
+	len = MIN((size_t)st.st_size, WARMUP_MAX_BYTES);
+	addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) return -1;
+
+	page = sysconf(_SC_PAGESIZE);
+	npages = (len + page - 1)/page;
+	vec = g_malloc(npages);
+	if (mincore(addr, len, vec) == 0) {
+		for (i=0; i<npages; i++) {
+			resident += vec[i] & 1;
+		}
+		percent = (gint32)(resident*100/npages);
+	}
+	g_free(vec);
+	munmap(addr, len);
+	return percent;
+}
+
+// worker thread
+static void run_warmup(app_data *app, gpointer data)
+{
+	warmup_data *wu = (warmup_data*)data;
+	int i;
+
+	for (i=0; i<wu->uris->len; i++) {
+		read_sound(g_ptr_array_index(wu->uris, i));
+	}
+}
+
+static void done_warmup(app_data *app, gpointer data)
+{
+	warmup_data *wu = (warmup_data*)data;
+	int i;
+
+	for (i=0; i<wu->uris->len; i++) {
+		g_free(g_ptr_array_index(wu->uris, i));
+	}
+	g_ptr_array_free(wu->uris, TRUE);
+	g_free(wu);
+}
+
+static void add_uri(GPtrArray *uris, const char *uri)
+{
+	int i;
+
+	for (i=0; i<uris->len; i++) {
+		if (strcmp(g_ptr_array_index(uris, i), uri) == 0) return;
+	}
+	g_ptr_array_add(uris, g_strdup(uri));
+}
+
+/* Alarms with a sound that fire after now and were not warmed up for
+ * that time: the ones due within the lead time are taken, if scan->uris
+ * is set, and scan->next is the earliest of the others.
+ */
+static void scan_alarm(gpointer key, gpointer value, gpointer data)
+{
+	warmup_scan *scan = (warmup_scan*)data;
+	app_data *app = scan->app;
+	scan_item *item = (scan_item*)value;
+	gpointer warmed;
+	time_t t;
+
+	if (!item->enabled || (item->event->sound == NULL)) return;
+
+	t = next_alarm_time(item->event);
+	if (t <= scan->now) return;
+	if (g_hash_table_lookup_extended(app->warmup_done, key, NULL, &warmed) && 
+			((time_t)GPOINTER_TO_INT(warmed) == t)) {
+		return;
+	}
+
+	if (scan->uris && (t <= scan->now + WARMUP_LEAD_SECS)) {
+		add_uri(scan->uris, item->event->sound);
+		g_hash_table_replace(app->warmup_done, key, GINT_TO_POINTER((gint)t));
+	} else if ((scan->next < 0) || (t < scan->next)) {
+		scan->next = t;
+	}
+}
+
+static gboolean cb_warmup(gpointer data)
+{
+	app_data *app = (app_data*)data;
+	warmup_data *wu;
+	warmup_scan scan = { app, clock_now(), -1, NULL };
+
+	app->warmup_timeout = 0;
+
+	scan.uris = g_ptr_array_new();
+	g_hash_table_foreach(app->core_alarms, scan_alarm, &scan);
+	if (scan.uris->len > 0) {
+		wu = g_new0(warmup_data, 1);
+		wu->uris = scan.uris;
+		worker_submit(app, run_warmup, done_warmup, wu);
+	} else {
+		g_ptr_array_free(scan.uris, TRUE);
+	}
+
+	warmup_schedule(app);
+	return FALSE;
+}
+
+// main loop: set the timer for the next warm-up, after the alarms changed
+void warmup_schedule(app_data *app)
+{
+	warmup_scan scan = { app, clock_now(), -1, NULL };
+	time_t delay;
+
+	if (app->warmup_done == NULL) {
+		app->warmup_done = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+	if (app->warmup_timeout) {
+		g_source_remove(app->warmup_timeout);
+		app->warmup_timeout = 0;
+	}
+
+	g_hash_table_foreach(app->core_alarms, scan_alarm, &scan);
+	if (scan.next < 0) return;
+
+	// a timer of days would overflow, look again then
+	delay = MAX(scan.next - WARMUP_LEAD_SECS - scan.now, 0);
+	delay = MIN(delay, WARMUP_MAX_DELAY);
+	app->warmup_timeout = g_timeout_add(delay*1000, cb_warmup, app);
+}
+
+/* main loop: alarm id fired, log how much of its sound was in the page
+ * cache. The player starts at the same time, so this is checked here
+ * and not queued to the worker; it takes no disk reads.
+ */
+void warmup_fired(app_data *app, guint id)
+{
+	scan_item *item;
+	gpointer warmed;
+	time_t now = clock_now(), t;
+	gint32 percent;
+	int warm = 0;
+
+	item = g_hash_table_lookup(app->core_alarms, GUINT_TO_POINTER(id));
+	if ((item == NULL) || (item->event->sound == NULL)) return;
+
+	// warm only if the time warmed up for is this fire, not a later
+	// instance or one missed long ago
+	if (app->warmup_done && g_hash_table_lookup_extended(app->warmup_done, 
+				GUINT_TO_POINTER(id), NULL, &warmed)) {
+		t = (time_t)GPOINTER_TO_INT(warmed);
+		if (t <= now + WARMUP_LEAD_SECS) {
+			warm = (now - t <= WARMUP_LEAD_SECS);
+			g_hash_table_remove(app->warmup_done, GUINT_TO_POINTER(id));
+		}
+	}
+
+	percent = sound_resident(item->event->sound);
+	malarm_debug("sound of alarm %u fired %d%% cached, warm %d\n", 
+			id, percent, warm);
+	if ((percent >= 0) && app->history) {
+		history_add(app->history, id, HISTORY_SOUND, 
+				warm ? HISTORY_WARM : 0, percent);
+	}
+}
+
+void warmup_stop(app_data *app)
+{
+	if (app->warmup_timeout) {
+		g_source_remove(app->warmup_timeout);
+		app->warmup_timeout = 0;
+	}
+	if (app->warmup_done) {
+		g_hash_table_destroy(app->warmup_done);
+		app->warmup_done = NULL;
+	}
+}
@@ -0,0 +1,45 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_WARMUP_H_
+#define _MALARM_WARMUP_H_
+
+#include "malarm_main.h"
+
+/* Sound warm-up of the core service (see malarm_core.h). alarmd starts
+ * the sound of an alarm when it fires, and the file may have to come
+ * from flash right then. WARMUP_LEAD_SECS before the next time of each
+ * enabled alarm (the time the list shows), the core reads its sound
+ * file through the page cache, so the player finds it there.
+ *
+ * When an alarm fires, the part of its sound that is in the page cache
+ * (mincore(), nothing is read) is logged as HISTORY_SOUND, with
+ * HISTORY_WARM if that fire was warmed up. The files are read by the
+ * worker thread.
+ */
+
+#define WARMUP_LEAD_SECS  60
+
+// of one sound file; the start is what the player needs first
+#define WARMUP_MAX_BYTES  (4*1024*1024)
+
+void warmup_schedule(app_data *app);
+void warmup_fired(app_data *app, guint id);
+void warmup_stop(app_data *app);
+
+#endif /* #define _MALARM_WARMUP_H_ */
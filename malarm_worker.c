@@ -0,0 +1,113 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malarm_worker.h"
+
+typedef struct {
+	app_data *app;
+	worker_run_func run;  // NULL: stop the worker thread
+	worker_done_func done;
+	gpointer data;
+} worker_job;
+
+static gboolean worker_job_done(gpointer data)
+{
+	worker_job *job = (worker_job*)data;
+
+	job->done(job->app, job->data);
+	g_free(job);
+
+	return FALSE;
+}
+
+static gpointer worker_thread(gpointer data)
+{
+	app_data *app = (app_data*)data;
+	worker_job *job;
+
+	g_assert(app != NULL);
+
+	malarm_debug("worker started\n");
+
+	while ((job = g_async_queue_pop(app->worker_queue)) != NULL) {
+		if (job->run == NULL) {
+			g_free(job);
+			break;
+		}
+
+		job->run(job->app, job->data);
+
+		// idle callbacks of same priority run in FIFO order,
+		// so done fcns are called in the order jobs were submitted
+		g_idle_add(worker_job_done, job);
+	}
+
+	malarm_debug("worker stopped\n");
+	return NULL;
+}
+
+void worker_start(app_data *app)
+{
+	GError *error = NULL;
+
+	g_assert(app != NULL);
+	g_assert(app->worker_thread == NULL);
+
+	app->worker_queue = g_async_queue_new();
+	app->worker_thread = g_thread_create(worker_thread, app, TRUE, &error);
+	if (app->worker_thread == NULL) {
+		malarm_print("error: failed to create worker thread: %s\n", 
+				error->message);
+		g_error_free(error);
+		g_assert_not_reached();
+	}
+}
+
+void worker_stop(app_data *app)
+{
+	g_assert(app != NULL);
+
+	if (app->worker_thread == NULL) return;
+
+	// jobs already queued are still run, but their done fcns are not
+	// called anymore since the main loop has exited
+	g_async_queue_push(app->worker_queue, g_new0(worker_job, 1));
+	g_thread_join(app->worker_thread);
+	app->worker_thread = NULL;
+
+	g_async_queue_unref(app->worker_queue);
+	app->worker_queue = NULL;
+}
+
+void worker_submit(app_data *app, worker_run_func run, 
+		worker_done_func done, gpointer data)
+{
+	worker_job *job;
+
+	g_assert(app != NULL);
+	g_assert(run != NULL);
+	g_assert(done != NULL);
+
+	job = g_new0(worker_job, 1);
+	job->app = app;
+	job->run = run;
+	job->done = done;
+	job->data = data;
+
+	g_async_queue_push(app->worker_queue, job);
+}
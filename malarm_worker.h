@@ -0,0 +1,37 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MALARM_WORKER_H_
+#define _MALARM_WORKER_H_
+
+#include "malarm_main.h"
+
+/* All alarmd and gconf calls are done in the worker thread.
+ * A job's run fcn is called in the worker thread, then its done fcn
+ * is called in the gtk main loop. Jobs are run in the order they
+ * were submitted. The done fcn must not be NULL, it owns data.
+ */
+typedef void (*worker_run_func)(app_data *app, gpointer data);
+typedef void (*worker_done_func)(app_data *app, gpointer data);
+
+void worker_start(app_data *app);
+void worker_stop(app_data *app);
+void worker_submit(app_data *app, worker_run_func run, 
+		worker_done_func done, gpointer data);
+
+#endif /* #define _MALARM_WORKER_H_ */
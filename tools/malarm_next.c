@@ -0,0 +1,124 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Prints the next alarms malarmd publishes (see malarm_next_format.h),
+ * the way a status bar or home applet would read them. With -w it waits
+ * for changes with inotify and prints them again. Only needs glib:
+ *
+ *   gcc -O2 -I.. -o malarm_next malarm_next.c \
+ *       `pkg-config --cflags --libs glib-2.0`
+ *   malarm_next [-w]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <glib.h>
+
+#include "malarm_next_format.h"
+
+// copy the alarms without blocking the writer, retry while it changes them
+static guint read_alarms(const next_segment *seg, next_alarm *alarms)
+{
+	gint32 seq;
+	guint count;
+
+	do {
+		while ((seq = g_atomic_int_get((gint*)&seg->seq)) & 1) {
+			g_usleep(1000);
+		}
+		count = MIN(seg->count, NEXT_ALARMS);
+		memcpy(alarms, seg->alarms, count*sizeof(next_alarm));
+	} while (seq != g_atomic_int_get((gint*)&seg->seq));
+	return count;
+}
+
+static void print_alarms(const next_segment *seg)
+{
+	next_alarm alarms[NEXT_ALARMS];
+	char buf[64];
+	time_t t;
+	guint count, i;
+
+	count = read_alarms(seg, alarms);
+	if (count == 0) {
+		printf("no alarms\n");
+	}
+	for (i=0; i<count; i++) {
+		t = (time_t)alarms[i].time;
+		strftime(buf, sizeof(buf), "%a %Y-%m-%d %H:%M", localtime(&t));
+		alarms[i].message[NEXT_MESSAGE_LEN - 1] = '\0';
+		printf("%u\t%s%s\t%s\n", alarms[i].id, buf, 
+				alarms[i].snoozed ? " (snoozed)" : "", alarms[i].message);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	const next_segment *seg;
+	struct inotify_event ev[8];
+	struct pollfd pfd;
+	struct stat st;
+	int watch = 0;
+	int fd;
+
+	if ((argc == 2) && (strcmp(argv[1], "-w") == 0)) {
+		watch = 1;
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-w]\n", argv[0]);
+		return 2;
+	}
+
+	fd = open(NEXT_PATH, O_RDONLY);
+	if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size < sizeof(next_segment))) {
+		fprintf(stderr, "error: %s is missing, is malarmd running?\n", NEXT_PATH);
+		return 1;
+	}
+	seg = mmap(NULL, sizeof(next_segment), PROT_READ, MAP_SHARED, fd, 0);
+	if (seg == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map %s\n", NEXT_PATH);
+		return 1;
+	}
+	if ((g_atomic_int_get((gint*)&seg->magic) != NEXT_MAGIC) || 
+			(seg->version != NEXT_VERSION) || (seg->size < sizeof(next_segment))) {
+		fprintf(stderr, "error: %s is not a malarm segment\n", NEXT_PATH);
+		return 1;
+	}
+	print_alarms(seg);
+	if (!watch) return 0;
+
+	pfd.fd = inotify_init();
+	pfd.events = POLLIN;
+	if ((pfd.fd < 0) || (inotify_add_watch(pfd.fd, NEXT_PATH, IN_MODIFY) < 0)) {
+		fprintf(stderr, "error: cannot watch %s\n", NEXT_PATH);
+		return 1;
+	}
+	while (poll(&pfd, 1, -1) > 0) {
+		if (read(pfd.fd, ev, sizeof(ev)) <= 0) break;
+		printf("--\n");
+		print_alarms(seg);
+	}
+	return 0;
+}
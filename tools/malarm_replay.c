@@ -0,0 +1,324 @@
+/**
+ * malarm: simple maemo alarm app for Nokia N8xx devices
+ * Copyright (C) 2008  Ronald Taneza
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Replays a malarm backend call trace (see malarm_trace_format.h) against
+ * an in-memory stand-in for alarmd and gconf, and reports the recorded
+ * and replayed latency of each phase and call. Runs on a plain Linux
+ * machine, it only needs glib:
+ *
+ *   gcc -O2 -I.. -o malarm_replay malarm_replay.c \
+ *       `pkg-config --cflags --libs glib-2.0`
+ *   malarm_replay trace-file
+ *
+ * Sound calls and batch calls are reported, but not replayed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "malarm_trace_format.h"
+
+static const char *op_names[TRACE_N_OPS] = {
+	NULL,
+	"alarm_event_query",
+	"alarm_event_get",
+	"alarm_event_add",
+	"alarm_event_del",
+	"gconf get_int",
+	"gconf set_int",
+	"gconf unset",
+	"gconf get_bool",
+	"gconf set_bool",
+	"gconf all_entries",
+	"gconf recursive_unset",
+	"sound play",
+	"sound stop",
+	"alarm_event_get batch",
+	"alarm_event_add batch",
+	"key set batch",
+	"key commit",
+};
+
+static const char *phase_names[TRACE_N_PHASES] = {
+	"other",
+	"refresh",
+	"row op",
+	"clone",
+	"sound",
+};
+
+typedef struct {
+	guint calls;
+	guint64 recorded;       // usec
+	guint64 recorded_max;
+	double replayed;        // usec
+	double replayed_max;
+} latency;
+
+// stand-in backend
+typedef struct {
+	gint64 alarm_time;
+	char *dbus_name;
+} stand_event;
+
+typedef struct {
+	GHashTable *events;   // cookie -> stand_event
+	GHashTable *cookies;  // recorded cookie -> stand-in cookie
+	GHashTable *gconf;    // key -> int
+	gint next_cookie;
+	const char *prefix;   // for gconf dir ops
+	GSList *list;
+} stand_in;
+
+static void free_stand_event(gpointer data)
+{
+	stand_event *event = (stand_event*)data;
+
+	g_free(event->dbus_name);
+	g_free(event);
+}
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec/1e3;
+}
+
+static gint map_cookie(stand_in *be, gint64 cookie)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(be->cookies, 
+				GINT_TO_POINTER((gint)cookie)));
+}
+
+// events that existed before the trace started appear on their first get
+static void prepare(stand_in *be, const trace_record *rec, const char *str)
+{
+	stand_event *event;
+	gint cookie;
+
+	if ((rec->op != TRACE_ALARM_GET) || !rec->result) return;
+	if (map_cookie(be, rec->arg)) return;
+
+	cookie = ++be->next_cookie;
+	event = g_new0(stand_event, 1);
+	event->dbus_name = g_strdup(str);
+	g_hash_table_insert(be->events, GINT_TO_POINTER(cookie), event);
+	g_hash_table_insert(be->cookies, GINT_TO_POINTER((gint)rec->arg), 
+			GINT_TO_POINTER(cookie));
+}
+
+static void collect_cookie(gpointer key, gpointer value, gpointer data)
+{
+	g_array_append_val((GArray*)data, key);
+}
+
+static void collect_dir_key(gpointer key, gpointer value, gpointer data)
+{
+	stand_in *be = (stand_in*)data;
+
+	if (g_str_has_prefix(key, be->prefix)) {
+		be->list = g_slist_prepend(be->list, key);
+	}
+}
+
+// run one call against the stand-in backend, returns FALSE if not replayed
+static gboolean replay(stand_in *be, const trace_record *rec, const char *str)
+{
+	stand_event *event, *copy;
+	GArray *cookies;
+	GSList *l;
+	gint cookie;
+
+	switch (rec->op) {
+	case TRACE_ALARM_QUERY:
+		cookies = g_array_new(TRUE, FALSE, sizeof(gpointer));
+		g_hash_table_foreach(be->events, collect_cookie, cookies);
+		g_array_free(cookies, TRUE);
+		break;
+	case TRACE_ALARM_GET:
+		event = g_hash_table_lookup(be->events, 
+				GINT_TO_POINTER(map_cookie(be, rec->arg)));
+		if (event) {
+			copy = g_new0(stand_event, 1);
+			copy->alarm_time = event->alarm_time;
+			copy->dbus_name = g_strdup(event->dbus_name);
+			free_stand_event(copy);
+		}
+		break;
+	case TRACE_ALARM_ADD:
+		if (rec->result <= 0) break;
+		cookie = ++be->next_cookie;
+		event = g_new0(stand_event, 1);
+		event->alarm_time = rec->arg;
+		event->dbus_name = g_strdup(str);
+		g_hash_table_insert(be->events, GINT_TO_POINTER(cookie), event);
+		g_hash_table_insert(be->cookies, GINT_TO_POINTER((gint)rec->result), 
+				GINT_TO_POINTER(cookie));
+		break;
+	case TRACE_ALARM_DEL:
+		g_hash_table_remove(be->events, GINT_TO_POINTER(map_cookie(be, rec->arg)));
+		break;
+	case TRACE_GCONF_GET_INT:
+	case TRACE_GCONF_GET_BOOL:
+		g_hash_table_lookup(be->gconf, str);
+		break;
+	case TRACE_GCONF_SET_INT:
+	case TRACE_GCONF_SET_BOOL:
+		g_hash_table_replace(be->gconf, g_strdup(str), 
+				GINT_TO_POINTER((gint)rec->arg));
+		break;
+	case TRACE_GCONF_UNSET:
+		g_hash_table_remove(be->gconf, str);
+		break;
+	case TRACE_GCONF_ALL_ENTRIES:
+	case TRACE_GCONF_RECURSIVE_UNSET:
+		be->prefix = str;
+		be->list = NULL;
+		g_hash_table_foreach(be->gconf, collect_dir_key, be);
+		if (rec->op == TRACE_GCONF_RECURSIVE_UNSET) {
+			for (l = be->list; l; l = l->next) {
+				g_hash_table_remove(be->gconf, l->data);
+			}
+		}
+		g_slist_free(be->list);
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void add_latency(latency *lat, guint64 recorded, double replayed)
+{
+	lat->calls++;
+	lat->recorded += recorded;
+	lat->recorded_max = MAX(lat->recorded_max, recorded);
+	lat->replayed += replayed;
+	lat->replayed_max = MAX(lat->replayed_max, replayed);
+}
+
+static void print_latency(const char *name, const latency *lat)
+{
+	if (lat->calls == 0) return;
+
+	printf("%-22s %7u %12.1f %10.1f %9" G_GUINT64_FORMAT " %12.1f %10.2f %9.2f\n", 
+			name, lat->calls, lat->recorded/1000.0, 
+			(double)lat->recorded/lat->calls, lat->recorded_max, 
+			lat->replayed/1000.0, lat->replayed/lat->calls, lat->replayed_max);
+}
+
+static void print_header(const char *title)
+{
+	printf("\n%-22s %7s %12s %10s %9s %12s %10s %9s\n", title, "calls", 
+			"rec ms", "rec avg us", "rec max", "replay ms", "avg us", "max");
+}
+
+int main(int argc, char **argv)
+{
+	gchar *contents;
+	gsize len;
+	const gchar *p, *end;
+	guint32 header[2];
+	trace_record rec;
+	char *str;
+	stand_in be;
+	latency phases[TRACE_N_PHASES];
+	latency ops[TRACE_N_OPS];
+	latency total;
+	guint64 span = 0;
+	double start;
+	int i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace-file\n", argv[0]);
+		return 2;
+	}
+
+	if (!g_file_get_contents(argv[1], &contents, &len, NULL)) {
+		fprintf(stderr, "error: cannot read %s\n", argv[1]);
+		return 1;
+	}
+
+	p = contents;
+	end = contents + len;
+	if ((len < sizeof(header)) || 
+			(memcpy(header, p, sizeof(header)), header[0] != TRACE_MAGIC) || 
+			(header[1] != TRACE_VERSION)) {
+		fprintf(stderr, "error: %s is not a malarm trace\n", argv[1]);
+		return 1;
+	}
+	p += sizeof(header);
+
+	memset(phases, 0, sizeof(phases));
+	memset(ops, 0, sizeof(ops));
+	memset(&total, 0, sizeof(total));
+
+	be.events = g_hash_table_new_full(g_direct_hash, g_direct_equal, 
+			NULL, free_stand_event);
+	be.cookies = g_hash_table_new(g_direct_hash, g_direct_equal);
+	be.gconf = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	be.next_cookie = 0;
+
+	while (p + sizeof(rec) <= end) {
+		double replayed = 0;
+
+		memcpy(&rec, p, sizeof(rec));
+		p += sizeof(rec);
+		if ((p + rec.len > end) || (rec.op == 0) || (rec.op >= TRACE_N_OPS) || 
+				(rec.phase >= TRACE_N_PHASES)) {
+			fprintf(stderr, "error: %s is corrupt\n", argv[1]);
+			break;
+		}
+		str = g_strndup(p, rec.len);
+		p += rec.len;
+
+		prepare(&be, &rec, str);
+		start = now_usec();
+		if (replay(&be, &rec, str)) {
+			replayed = now_usec() - start;
+		}
+		g_free(str);
+
+		add_latency(&phases[rec.phase], rec.duration, replayed);
+		add_latency(&ops[rec.op], rec.duration, replayed);
+		add_latency(&total, rec.duration, replayed);
+		span = rec.start + rec.duration;
+	}
+
+	printf("%u calls in %.1f s of recorded time\n", total.calls, span/1e6);
+
+	print_header("phase");
+	for (i=0; i<TRACE_N_PHASES; i++) {
+		print_latency(phase_names[i], &phases[i]);
+	}
+	print_header("call");
+	for (i=1; i<TRACE_N_OPS; i++) {
+		print_latency(op_names[i], &ops[i]);
+	}
+	print_latency("total", &total);
+
+	g_hash_table_destroy(be.events);
+	g_hash_table_destroy(be.cookies);
+	g_hash_table_destroy(be.gconf);
+	g_free(contents);
+	return 0;
+}